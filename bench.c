@@ -0,0 +1,384 @@
+#ifdef MPZ_DISK_BENCHMARK
+// Throughput benchmark of the streaming operations. It sweeps the operand
+// size (from a few KB up to max_bytes, twice the RAM by default), the
+// block size, the number of threads and aliasing (the same integer as both
+// operands) of each operation, and prints one CSV line per run, with the
+// throughput of the same operation on mpz_t's in memory next to it (for
+// operands that fit in memory). Given a latency and a bandwidth, the files
+// are on a simulated disk that slow (see mpz_disk_throttled_backend_init()).
+//
+// Usage: mpz_disk [max_bytes[K|M|G]] [add|sub|cmpabs|get_mpz|set_mpz|all] [latency_us MB_per_s]
+#include "mpz_disk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#elif defined(__unix__)
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define BENCH_ADD 0
+#define BENCH_SUB 1
+#define BENCH_CMPABS 2
+#define BENCH_GET_MPZ 3
+#define BENCH_SET_MPZ 4
+#define BENCH_OPS 5
+
+static const char* bench_op_names[BENCH_OPS] = { "add", "sub", "cmpabs", "get_mpz", "set_mpz" };
+
+// Block sizes per thread, 0 = whatever the available memory gives
+static const size_t bench_block_sizes[] = { 64 << 10, 1 << 20, 16 << 20, 0 };
+
+// Runs shorter than this are repeated, for a stable timing
+#define BENCH_MIN_SECONDS 0.2
+// Limbs the operands are filled with at a time
+#define BENCH_FILL_LIMBS (1 << 20)
+
+static size_t bench_block_bytes = 0;
+static int bench_threads = 1;
+
+size_t _mpz_disk_bench_available_mem()
+{
+	// The operations take a third of the memory for their blocks, split
+	// between the threads
+	if (bench_block_bytes == 0)
+		return _mpz_disk_get_available_mem();
+
+	return 3 * bench_block_bytes * bench_threads;
+}
+
+static double bench_seconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart / (double)frequency.QuadPart;
+#elif defined(__unix__)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+static uint64_t bench_ram_bytes()
+{
+#ifdef _WIN32
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	GlobalMemoryStatusEx(&status);
+	return status.ullTotalPhys;
+#elif defined(__unix__)
+	return (uint64_t)sysconf(_SC_PHYS_PAGES) * (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// I/O system calls of the process so far, -1 if the OS doesn't tell
+static int64_t bench_syscalls()
+{
+#ifdef _WIN32
+	IO_COUNTERS counters;
+	if (!GetProcessIoCounters(GetCurrentProcess(), &counters))
+		return -1;
+
+	return (int64_t)(counters.ReadOperationCount + counters.WriteOperationCount + counters.OtherOperationCount);
+#elif defined(__unix__)
+	FILE* io = fopen("/proc/self/io", "r");
+	if (!io)
+		return -1;
+
+	int64_t count = 0;
+	char line[128];
+	long long n;
+	while (fgets(line, sizeof(line), io))
+		if (sscanf(line, "syscr: %lld", &n) == 1 || sscanf(line, "syscw: %lld", &n) == 1)
+			count += n;
+
+	fclose(io);
+
+	return count;
+#endif
+}
+
+// Start measuring the peak RSS anew, where the OS allows it (on Windows
+// the peak is that of the whole process)
+static void bench_reset_peak_rss()
+{
+#ifdef __unix__
+	FILE* clear_refs = fopen("/proc/self/clear_refs", "w");
+	if (clear_refs) {
+		fputs("5", clear_refs);
+		fclose(clear_refs);
+	}
+#endif
+}
+
+// Peak resident set size in KB, -1 if the OS doesn't tell
+static int64_t bench_peak_rss_kb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return -1;
+
+	return (int64_t)(counters.PeakWorkingSetSize >> 10);
+#elif defined(__unix__)
+	FILE* status = fopen("/proc/self/status", "r");
+	if (!status)
+		return -1;
+
+	int64_t peak = -1;
+	char line[128];
+	long long kb;
+	while (fgets(line, sizeof(line), status))
+		if (sscanf(line, "VmHWM: %lld kB", &kb) == 1)
+			peak = kb;
+
+	fclose(status);
+
+	return peak;
+#endif
+}
+
+// Parse a number of bytes with an optional K, M or G suffix
+static uint64_t bench_parse_bytes(const char* str)
+{
+	char* end;
+	uint64_t bytes = strtoull(str, &end, 10);
+
+	switch (*end)
+	{
+	case 'G': case 'g': bytes <<= 10;
+	case 'M': case 'm': bytes <<= 10;
+	case 'K': case 'k': bytes <<= 10;
+	}
+
+	return bytes;
+}
+
+// Fill op with 'limbs' random limbs with 'top' as the top limb and the
+// lowest one xor'ed with 'low', a block at a time so that operands can be
+// larger than the memory
+static int bench_fill(mpz_disk_ptr op, size_t limbs, mp_limb_t top, mp_limb_t low, uint64_t* seed)
+{
+	_mpz_disk_handle* fp = _mpz_disk_open(op, _MPZ_DISK_OPEN_CREATE);
+	mp_limb_t* buf = malloc(BENCH_FILL_LIMBS * sizeof(mp_limb_t));
+
+	int ret = fp && buf ? 0 : -1;
+	for (size_t offset = 0; offset < limbs && ret == 0; offset += BENCH_FILL_LIMBS)
+	{
+		size_t n = limbs - offset < BENCH_FILL_LIMBS ? limbs - offset : BENCH_FILL_LIMBS;
+
+		// xorshift64
+		for (size_t i = 0; i < n; i++)
+		{
+			*seed ^= *seed << 13;
+			*seed ^= *seed >> 7;
+			*seed ^= *seed << 17;
+			buf[i] = (mp_limb_t)*seed;
+		}
+
+		if (offset + n == limbs)
+			buf[n - 1] = top;
+		if (offset == 0)
+			buf[0] ^= low;
+
+		ret = _mpz_disk_write_limbs(fp, buf, n, offset);
+	}
+
+	free(buf);
+	_mpz_disk_close(fp);
+
+	return ret;
+}
+
+static void bench_run(int op, mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2, mpz_ptr mpz)
+{
+	switch (op)
+	{
+	case BENCH_ADD: mpz_disk_add(rop, op1, op2); break;
+	case BENCH_SUB: mpz_disk_sub(rop, op1, op2); break;
+	case BENCH_CMPABS: mpz_disk_cmpabs(op1, op2); break;
+	case BENCH_GET_MPZ: mpz_disk_get_mpz(mpz, op1); break;
+	case BENCH_SET_MPZ: mpz_disk_set_mpz(rop, mpz); break;
+	}
+}
+
+// The same operation on mpz_t's in memory, in seconds per run
+static double bench_baseline(int op, mpz_ptr rop, mpz_ptr op1, mpz_ptr op2)
+{
+	int runs = 0;
+	double start = bench_seconds(), seconds;
+
+	do {
+		switch (op)
+		{
+		case BENCH_ADD: mpz_add(rop, op1, op2); break;
+		case BENCH_SUB: mpz_sub(rop, op1, op2); break;
+		case BENCH_CMPABS: mpz_cmpabs(op1, op2); break;
+		case BENCH_GET_MPZ:
+		case BENCH_SET_MPZ: mpz_set(rop, op1); break;
+		}
+
+		runs++;
+		seconds = bench_seconds() - start;
+	} while (seconds < BENCH_MIN_SECONDS);
+
+	return seconds / runs;
+}
+
+// Run op with the given block size and threads until it took long enough,
+// and print its CSV line
+static void bench_report(int op, uint64_t bytes, size_t block_bytes, int threads, int aliased,
+	mpz_disk_ptr disk_rop, mpz_disk_ptr disk_op1, mpz_disk_ptr disk_op2, mpz_ptr op1, mpz_ptr rop, double baseline)
+{
+	bench_block_bytes = block_bytes;
+	bench_threads = threads;
+	mpz_disk_set_num_threads(threads);
+
+	bench_reset_peak_rss();
+	int64_t syscalls = bench_syscalls();
+
+	int runs = 0;
+	double start = bench_seconds(), seconds;
+	do {
+		bench_run(op, disk_rop, disk_op1, disk_op2, op == BENCH_GET_MPZ ? rop : op1);
+
+		runs++;
+		seconds = bench_seconds() - start;
+	} while (seconds < BENCH_MIN_SECONDS);
+
+	seconds /= runs;
+	if (syscalls >= 0)
+		syscalls = (bench_syscalls() - syscalls) / runs;
+
+	printf("%s,%llu,%llu,%d,%d,%.6f,%.1f,%lld,%lld,", bench_op_names[op], (unsigned long long)bytes,
+		(unsigned long long)block_bytes, threads, aliased, seconds, bytes / seconds / 1e6,
+		(long long)syscalls, (long long)bench_peak_rss_kb());
+
+	// No baseline for operands that don't fit in memory
+	if (baseline >= 0)
+		printf("%.1f", baseline);
+	printf("\n");
+	fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t ram = bench_ram_bytes();
+	uint64_t max_bytes = argc > 1 ? bench_parse_bytes(argv[1]) : 2 * ram;
+	const char* only = argc > 2 && strcmp(argv[2], "all") != 0 ? argv[2] : NULL;
+
+	mpz_disk_backend_t slow_disk;
+	if (argc > 4) {
+		mpz_disk_throttled_backend_init(&slow_disk, NULL, atoll(argv[3]) * 1000, atoll(argv[4]) * 1000000);
+		mpz_disk_set_backend(&slow_disk);
+	}
+
+	// Every operand on disk, read from the files every time
+	mpz_disk_set_memory_threshold(0);
+	mpz_disk_set_cache_size(0);
+
+	int max_threads = mpz_disk_get_num_threads();
+	uint64_t seed = 88172645463325252ull;
+
+	printf("op,bytes,block_bytes,threads,aliased,seconds,mb_per_s,syscalls,peak_rss_kb,mpz_mb_per_s\n");
+
+	for (uint64_t bytes = 4 << 10; bytes <= max_bytes; bytes *= 16)
+	{
+		size_t limbs = (size_t)(bytes / sizeof(mp_limb_t));
+
+		mpz_disk_t disk_op1, disk_op2, disk_near, disk_rop;
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_near);
+		mpz_disk_init(disk_rop);
+
+		// op1 > op2, so that op1 - op2 is positive. cmpabs compares op1
+		// with 'near', which is op1 but for the lowest bit, so that it has
+		// to read both all the way down.
+		uint64_t op1_seed = seed;
+		int cmpabs = !only || strcmp(only, "cmpabs") == 0;
+		if (bench_fill(disk_op1, limbs, (mp_limb_t)1 << (GMP_NUMB_BITS - 2), 0, &seed) != 0 ||
+			bench_fill(disk_op2, limbs, 1, 0, &seed) != 0 ||
+			(cmpabs && bench_fill(disk_near, limbs, (mp_limb_t)1 << (GMP_NUMB_BITS - 2), 1, &op1_seed) != 0)) {
+			fprintf(stderr, "Can't write operands of %llu bytes\n", (unsigned long long)bytes);
+			break;
+		}
+
+		// Copies in memory for mpz_disk_set_mpz() and the baseline, if
+		// three of them fit comfortably
+		int in_memory = bytes * 3 <= ram / 2;
+		mpz_t op1, op2, near, rop;
+		mpz_init(op1);
+		mpz_init(op2);
+		mpz_init(near);
+		mpz_init(rop);
+		if (in_memory) {
+			mpz_disk_get_mpz(op1, disk_op1);
+			mpz_disk_get_mpz(op2, disk_op2);
+			mpz_set(near, op1);
+			mpz_combit(near, 0);
+			mpz_realloc2(rop, (mp_bitcnt_t)(limbs + 1) * GMP_NUMB_BITS);
+		}
+
+		for (int op = 0; op < BENCH_OPS; op++)
+		{
+			if (only && strcmp(only, bench_op_names[op]) != 0)
+				continue;
+
+			// mpz_t's of the operands are needed
+			if ((op == BENCH_GET_MPZ || op == BENCH_SET_MPZ) && !in_memory)
+				continue;
+
+			mpz_disk_ptr disk_second = op == BENCH_CMPABS ? disk_near : disk_op2;
+			mpz_ptr second = op == BENCH_CMPABS ? near : op2;
+
+			double baseline = in_memory ? bytes / bench_baseline(op, rop, op1, second) / 1e6 : -1;
+
+			for (int b = 0; b < (int)(sizeof(bench_block_sizes) / sizeof(bench_block_sizes[0])); b++)
+			{
+				// Powers of two up to all the threads
+				for (int threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+				{
+					bench_report(op, bytes, bench_block_sizes[b], threads, 0, disk_rop, disk_op1, disk_second, op1, rop, baseline);
+
+					// The same integer as both operands
+					if (op == BENCH_ADD || op == BENCH_SUB || op == BENCH_CMPABS)
+						bench_report(op, bytes, bench_block_sizes[b], threads, 1, disk_rop, disk_op1, disk_op1, op1, rop, baseline);
+
+					if (threads == max_threads)
+						break;
+				}
+			}
+		}
+
+		mpz_clear(op1);
+		mpz_clear(op2);
+		mpz_clear(near);
+		mpz_clear(rop);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+		mpz_disk_clear(disk_near);
+		mpz_disk_clear(disk_rop);
+	}
+
+	mpz_disk_set_num_threads(0);
+
+	if (argc > 4) {
+		mpz_disk_set_backend(NULL);
+		mpz_disk_throttled_backend_clear(&slow_disk);
+	}
+
+#ifdef MPZ_DISK_STATS
+	// Where the time of the whole sweep went, away from the CSV
+	mpz_disk_dump_stats(stderr);
+#endif
+
+	return 0;
+}
+#endif
@@ -1,3 +1,7 @@
+#if defined(__unix__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	// SEEK_DATA
+#endif
+
 #include "mpz_disk.h"
 #include <stdlib.h>
 #include <string.h>
@@ -6,420 +10,7716 @@
 
 #ifdef _WIN32	/* Windows */
 #include <Windows.h>
+#include <intrin.h>
+
+#elif defined(__unix__)	/* *nix */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <errno.h>
+#include <semaphore.h>
+
+// The stdlib.h of MSVC has these for C
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <nmmintrin.h>	// SSE4.2 crc32 instruction
+#endif
+
+// Directories integers are striped across (see mpz_disk_set_stripe_dirs())
+static char _mpz_disk_stripe_dirs[MPZ_DISK_MAX_STRIPE_DIRS][MPZ_DISK_MAX_PATH];
+static int _mpz_disk_n_stripe_dirs = 0;
+static size_t _mpz_disk_stripe_limbs = 0;
+
+// Chunk size of compressed integers (see mpz_disk_set_compression()), 0 = off
+static size_t _mpz_disk_chunk_limbs = 0;
+
+// Limbs integers may hold in memory (see mpz_disk_set_memory_threshold())
+static size_t _mpz_disk_max_memory_limbs = MPZ_DISK_DEFAULT_MEMORY_THRESHOLD / sizeof(mp_limb_t);
+
+// Whether mpz_disk_set_mpz() leaves zero ranges as holes (see mpz_disk_set_sparse())
+static int _mpz_disk_sparse = 0;
+
+// Whether integers keep checksums of their limbs (see mpz_disk_set_checksums())
+static int _mpz_disk_checksums = 0;
+
+// Storage the files of integers are in (see mpz_disk_set_backend()), NULL = plain files
+static const mpz_disk_backend_t* _mpz_disk_backend = NULL;
+
+// An open file of a storage backend
+typedef struct
+{
+	const mpz_disk_backend_t* backend;
+	void* file;
+} _mpz_disk_file;
+
+typedef _mpz_disk_file* _mpz_disk_fd;
+#define _MPZ_DISK_INVALID_FD NULL
+
+static _mpz_disk_fd _mpz_disk_io_open(const mpz_disk_backend_t* backend, const char* filename, int mode);
+static void _mpz_disk_io_close(_mpz_disk_fd fd);
+static size_t _mpz_disk_io_pread(_mpz_disk_fd fd, void* buf, size_t bytes, int64_t offset);
+static int _mpz_disk_io_pwrite(_mpz_disk_fd fd, const void* buf, size_t bytes, int64_t offset);
+static int _mpz_disk_io_remove(const mpz_disk_backend_t* backend, const char* filename);
+
+// Monotonic clock in nanoseconds
+static int64_t _mpz_disk_now_ns()
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+
+	return (int64_t)((double)count.QuadPart * 1e9 / frequency.QuadPart);
+#elif defined(__unix__)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+// Statistics (see mpz_disk_get_stats()). Each thread charges what it does
+// to the operation it currently works for, or to MPZ_DISK_STATS_OTHER.
+// The busy time of a thread is the time it spent working for an operation
+// minus the time it waited for its worker threads; what of it isn't I/O
+// is compute. Without MPZ_DISK_STATS all of the hooks below are empty.
+#define _MPZ_DISK_STAT_CALLS 0
+#define _MPZ_DISK_STAT_NS 1
+#define _MPZ_DISK_STAT_BYTES_READ 2
+#define _MPZ_DISK_STAT_BYTES_WRITTEN 3
+#define _MPZ_DISK_STAT_SYSCALLS 4
+#define _MPZ_DISK_STAT_IO_NS 5
+#define _MPZ_DISK_STAT_BUSY_NS 6
+#define _MPZ_DISK_STAT_NORMALIZE_NS 7
+#define _MPZ_DISK_STAT_BUFFER_BYTES 8
+#define _MPZ_DISK_STAT_PEAK_BUFFER_BYTES 9
+#define _MPZ_DISK_STAT_FIELDS 10
+
+#ifdef MPZ_DISK_STATS
+static volatile int64_t _mpz_disk_stats[MPZ_DISK_STATS_ALL + 1][_MPZ_DISK_STAT_FIELDS];
+static volatile int64_t _mpz_disk_stats_buffers_in_use = 0;
+#ifdef _WIN32
+static __declspec(thread) int _mpz_disk_stats_op = -1;
+static __declspec(thread) int64_t _mpz_disk_stats_wait_ns = 0;
+#elif defined(__unix__)
+static __thread int _mpz_disk_stats_op = -1;
+static __thread int64_t _mpz_disk_stats_wait_ns = 0;
+#endif
+#endif
+
+typedef struct
+{
+	int op;	// -1 if the thread already worked for an operation
+	int calls;
+	int64_t start, wait_ns;
+} _mpz_disk_stats_scope;
+
+static int64_t _mpz_disk_stats_now()
+{
+#ifdef MPZ_DISK_STATS
+	return _mpz_disk_now_ns();
+#else
+	return 0;
+#endif
+}
+
+// Add value to a statistic of the current operation and to the totals
+static void _mpz_disk_stats_add(int stat, int64_t value)
+{
+#ifdef MPZ_DISK_STATS
+	int op = _mpz_disk_stats_op >= 0 ? _mpz_disk_stats_op : MPZ_DISK_STATS_OTHER;
+
+	_mpz_disk_atomic_add(&_mpz_disk_stats[op][stat], value);
+	_mpz_disk_atomic_add(&_mpz_disk_stats[MPZ_DISK_STATS_ALL][stat], value);
+#endif
+}
+
+// Add the time since start (from _mpz_disk_stats_now()) to a statistic
+static void _mpz_disk_stats_time(int stat, int64_t start)
+{
+#ifdef MPZ_DISK_STATS
+	_mpz_disk_stats_add(stat, _mpz_disk_stats_now() - start);
+#endif
+}
+
+// Account for 'syscalls' I/O system calls made since start, which moved
+// 'bytes' bytes (counted as bytes_stat)
+static void _mpz_disk_stats_io(int64_t start, int syscalls, int bytes_stat, int64_t bytes)
+{
+#ifdef MPZ_DISK_STATS
+	_mpz_disk_stats_time(_MPZ_DISK_STAT_IO_NS, start);
+	_mpz_disk_stats_add(_MPZ_DISK_STAT_SYSCALLS, syscalls);
+	if (bytes > 0)
+		_mpz_disk_stats_add(bytes_stat, bytes);
+#endif
+}
+
+// Account for 'bytes' bytes of block buffers taken from the pool (or
+// given back to it if negative)
+static void _mpz_disk_stats_buffers(int64_t bytes)
+{
+#ifdef MPZ_DISK_STATS
+	int64_t in_use = _mpz_disk_atomic_add(&_mpz_disk_stats_buffers_in_use, bytes) + bytes;
+	if (bytes < 0)
+		return;
+
+	int op = _mpz_disk_stats_op >= 0 ? _mpz_disk_stats_op : MPZ_DISK_STATS_OTHER;
+
+	_mpz_disk_stats_add(_MPZ_DISK_STAT_BUFFER_BYTES, bytes);
+	_mpz_disk_atomic_max(&_mpz_disk_stats[op][_MPZ_DISK_STAT_PEAK_BUFFER_BYTES], in_use);
+	_mpz_disk_atomic_max(&_mpz_disk_stats[MPZ_DISK_STATS_ALL][_MPZ_DISK_STAT_PEAK_BUFFER_BYTES], in_use);
+#endif
+}
+
+static _mpz_disk_stats_scope _mpz_disk_stats_enter(int op, int calls)
+{
+	_mpz_disk_stats_scope scope = { -1, calls, 0, 0 };
+
+#ifdef MPZ_DISK_STATS
+	if (_mpz_disk_stats_op < 0) {
+		scope.op = op;
+		scope.start = _mpz_disk_stats_now();
+		scope.wait_ns = _mpz_disk_stats_wait_ns;
+
+		_mpz_disk_stats_op = op;
+	}
+#endif
+
+	return scope;
+}
+
+// Charge what the calling thread does until _mpz_disk_stats_end() to a call
+// of op, unless it is already working for an operation
+static _mpz_disk_stats_scope _mpz_disk_stats_begin(int op)
+{
+	return _mpz_disk_stats_enter(op, 1);
+}
+
+// Same for a worker thread of op (-1 if none), which isn't a call of its own
+static _mpz_disk_stats_scope _mpz_disk_stats_begin_thread(int op)
+{
+	return _mpz_disk_stats_enter(op >= 0 ? op : MPZ_DISK_STATS_OTHER, 0);
+}
+
+static void _mpz_disk_stats_end(_mpz_disk_stats_scope scope)
+{
+#ifdef MPZ_DISK_STATS
+	if (scope.op < 0)
+		return;
+
+	int64_t ns = _mpz_disk_stats_now() - scope.start;
+
+	if (scope.calls) {
+		_mpz_disk_stats_add(_MPZ_DISK_STAT_CALLS, 1);
+		_mpz_disk_stats_add(_MPZ_DISK_STAT_NS, ns);
+	}
+	_mpz_disk_stats_add(_MPZ_DISK_STAT_BUSY_NS, ns - (_mpz_disk_stats_wait_ns - scope.wait_ns));
+
+	_mpz_disk_stats_op = -1;
+#endif
+}
+
+// Operation the calling thread works for, -1 if none
+static int _mpz_disk_stats_current()
+{
+#ifdef MPZ_DISK_STATS
+	return _mpz_disk_stats_op;
+#else
+	return -1;
+#endif
+}
+
+// The calling thread waited for other threads since start
+static void _mpz_disk_stats_wait(int64_t start)
+{
+#ifdef MPZ_DISK_STATS
+	_mpz_disk_stats_wait_ns += _mpz_disk_stats_now() - start;
+#endif
+}
+
+int mpz_disk_get_stats(mpz_disk_stats_t* stats, int op)
+{
+	memset(stats, 0, sizeof(mpz_disk_stats_t));
+
+#ifdef MPZ_DISK_STATS
+	if (op < 0 || op > MPZ_DISK_STATS_ALL)
+		return -1;
+
+	volatile int64_t* s = _mpz_disk_stats[op];
+
+	stats->calls = s[_MPZ_DISK_STAT_CALLS];
+	stats->ns = s[_MPZ_DISK_STAT_NS];
+	stats->bytes_read = s[_MPZ_DISK_STAT_BYTES_READ];
+	stats->bytes_written = s[_MPZ_DISK_STAT_BYTES_WRITTEN];
+	stats->syscalls = s[_MPZ_DISK_STAT_SYSCALLS];
+	stats->io_ns = s[_MPZ_DISK_STAT_IO_NS];
+	// I/O outside of operations isn't part of any busy time
+	stats->compute_ns = max(s[_MPZ_DISK_STAT_BUSY_NS] - s[_MPZ_DISK_STAT_IO_NS], 0);
+	stats->normalize_ns = s[_MPZ_DISK_STAT_NORMALIZE_NS];
+	stats->buffer_bytes = s[_MPZ_DISK_STAT_BUFFER_BYTES];
+	stats->peak_buffer_bytes = s[_MPZ_DISK_STAT_PEAK_BUFFER_BYTES];
+
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+void mpz_disk_reset_stats()
+{
+#ifdef MPZ_DISK_STATS
+	for (int op = 0; op <= MPZ_DISK_STATS_ALL; op++)
+		for (int stat = 0; stat < _MPZ_DISK_STAT_FIELDS; stat++)
+			_mpz_disk_stats[op][stat] = 0;
+#endif
+}
+
+int mpz_disk_dump_stats(FILE* stream)
+{
+	static const char* names[MPZ_DISK_STATS_ALL + 1] =
+		{ "add", "sub", "cmpabs", "logic", "count", "set_mpz", "get_mpz", "raw", "verify", "other", "all" };
+	mpz_disk_stats_t stats;
+
+	if (mpz_disk_get_stats(&stats, MPZ_DISK_STATS_ALL) != 0)
+		return -1;
+
+	fprintf(stream, "{");
+
+	for (int op = 0; op <= MPZ_DISK_STATS_ALL; op++)
+	{
+		mpz_disk_get_stats(&stats, op);
+
+		fprintf(stream, "%s\n\t\"%s\": { \"calls\": %lld, \"ns\": %lld, \"bytes_read\": %lld, \"bytes_written\": %lld, "
+			"\"syscalls\": %lld, \"io_ns\": %lld, \"compute_ns\": %lld, \"normalize_ns\": %lld, "
+			"\"buffer_bytes\": %lld, \"peak_buffer_bytes\": %lld }",
+			op ? "," : "", names[op], (long long)stats.calls, (long long)stats.ns,
+			(long long)stats.bytes_read, (long long)stats.bytes_written, (long long)stats.syscalls,
+			(long long)stats.io_ns, (long long)stats.compute_ns, (long long)stats.normalize_ns,
+			(long long)stats.buffer_bytes, (long long)stats.peak_buffer_bytes);
+	}
+
+	fprintf(stream, "\n}\n");
+
+	return ferror(stream) ? -1 : 0;
+}
+
+int mpz_disk_init(mpz_disk_ptr disk_integer) {
+	// Generate a random filename (from https://codereview.stackexchange.com/questions/29198/random-string-generator-in-c)
+    const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+	int n = 0;
+    for (n = 0; n < MPZ_DISK_FILENAME_LEN - 5; n++) {
+		int key = rand() % (int)(sizeof charset - 1);
+		disk_integer->filename[n] = charset[key];
+	}
+
+	// End with .tmp extension
+	strcpy(&disk_integer->filename[n], ".tmp");
+
+	// Stripe the limbs if mpz_disk_set_stripe_dirs() was called
+	disk_integer->stripe_dirs = _mpz_disk_n_stripe_dirs;
+	disk_integer->stripe_limbs = _mpz_disk_stripe_limbs;
+
+	disk_integer->keep_summary = 1;
+	disk_integer->keep_checksums = _mpz_disk_checksums;
+	disk_integer->backend = _mpz_disk_backend;
+
+	disk_integer->handle = NULL;
+	disk_integer->sign = MPZ_DISK_SIGN_POSITIVE;
+
+	// Compressed integers aren't striped
+	disk_integer->chunk_limbs = _mpz_disk_chunk_limbs;
+	if (disk_integer->chunk_limbs)
+		disk_integer->stripe_dirs = 0;
+
+	// Small values don't get files until they grow
+	disk_integer->max_memory_limbs = _mpz_disk_max_memory_limbs;
+
+	mp_limb_t zero = 0;
+
+	_mpz_disk_handle* mp_file = _mpz_disk_open(disk_integer,
+		disk_integer->max_memory_limbs ? _MPZ_DISK_OPEN_MEMORY : _MPZ_DISK_OPEN_CREATE);
+	if (!mp_file)
+		return -1;
+
+	// Kept open until mpz_disk_clear()
+	_mpz_disk_keep_open(disk_integer, mp_file);
+
+	_mpz_disk_write_limbs(mp_file, &zero, 1, 0);
+	
+	_mpz_disk_close(mp_file);
+
+	return 0;
+}
+
+int mpz_disk_clear(mpz_disk_ptr disk_integer)
+{
+	// Integers still held in memory have no files to remove
+	int in_memory = _mpz_disk_in_memory(disk_integer);
+
+	_mpz_disk_release(disk_integer);
+
+	// Negative integers also own a sign file
+	char sign_filename[MPZ_DISK_FILENAME_LEN];
+	_mpz_disk_get_sign_filename(sign_filename, disk_integer);
+	_mpz_disk_io_remove(disk_integer->backend, sign_filename);
+	disk_integer->sign = MPZ_DISK_SIGN_POSITIVE;
+
+	int ret = 0;
+	for (int i = 0; i < max(disk_integer->stripe_dirs, 1); i++)
+	{
+		char filename[MPZ_DISK_MAX_PATH + MPZ_DISK_FILENAME_LEN];
+		_mpz_disk_get_stripe_filename(filename, disk_integer, i);
+
+		if (_mpz_disk_io_remove(disk_integer->backend, filename) != 0 && !in_memory)
+			ret = -1;
+	}
+
+	char summary_filename[MPZ_DISK_FILENAME_LEN];
+	_mpz_disk_get_summary_filename(summary_filename, disk_integer);
+	_mpz_disk_io_remove(disk_integer->backend, summary_filename);
+
+	char checksum_filename[MPZ_DISK_FILENAME_LEN];
+	_mpz_disk_get_checksum_filename(checksum_filename, disk_integer);
+	_mpz_disk_io_remove(disk_integer->backend, checksum_filename);
+
+	// Checkpoints of an operation on it that never finished
+	char journal_filename[MPZ_DISK_FILENAME_LEN];
+	_mpz_disk_get_journal_filename(journal_filename, disk_integer);
+	_mpz_disk_io_remove(disk_integer->backend, journal_filename);
+
+	if (disk_integer->chunk_limbs) {
+		char index_filename[MPZ_DISK_FILENAME_LEN];
+		_mpz_disk_get_index_filename(index_filename, disk_integer);
+
+		_mpz_disk_io_remove(disk_integer->backend, index_filename);
+	}
+
+	return ret;
+}
+
+// Round a block size down to whole summary entries, so that every block
+// can be looked up in the summaries
+static size_t _mpz_disk_summary_align(size_t limbs)
+{
+	return limbs >= MPZ_DISK_SUMMARY_LIMBS ? limbs - limbs % MPZ_DISK_SUMMARY_LIMBS : limbs;
+}
+
+// Integers are split between threads in pieces of whole cache blocks and
+// summary entries, so that the threads' reads can be cached and checked
+// against the checksums, and their writes make whole checksums
+static size_t _mpz_disk_piece_limbs()
+{
+	return max(MPZ_DISK_CACHE_BLOCK_LIMBS, MPZ_DISK_SUMMARY_LIMBS);
+}
+
+// Progress callback (see mpz_disk_set_progress())
+static mpz_disk_progress_func _mpz_disk_progress_func = NULL;
+static void* _mpz_disk_progress_arg = NULL;
+static size_t _mpz_disk_progress_bytes = 0;
+
+// Progress of a running operation, shared by its threads
+typedef struct
+{
+	int64_t bytes_total;
+	volatile int64_t bytes_done, next_report;
+	// Number of threads trying to report at the moment
+	volatile int64_t reporting;
+	volatile int cancelled;
+} _mpz_disk_progress;
+
+int mpz_disk_set_progress(mpz_disk_progress_func func, void* arg, size_t bytes)
+{
+	_mpz_disk_progress_func = func;
+	_mpz_disk_progress_arg = arg;
+	_mpz_disk_progress_bytes = bytes;
+
+	return 0;
+}
+
+static void _mpz_disk_progress_start(_mpz_disk_progress* progress, int64_t bytes_done, int64_t bytes_total)
+{
+	progress->bytes_total = bytes_total;
+	progress->bytes_done = bytes_done;
+	progress->next_report = bytes_done + _mpz_disk_progress_bytes;
+	progress->reporting = 0;
+	progress->cancelled = 0;
+}
+
+// Count another 'bytes' bytes of the operation as done, and report them if
+// it is time to. Returns non-zero once the operation is cancelled.
+static int _mpz_disk_progress_add(_mpz_disk_progress* progress, int64_t bytes)
+{
+	if (!_mpz_disk_progress_func)
+		return 0;
+
+	int64_t done = _mpz_disk_atomic_add(&progress->bytes_done, bytes) + bytes;
+
+	// The end is reported by _mpz_disk_progress_end()
+	if (progress->cancelled || done < progress->next_report || done >= progress->bytes_total)
+		return progress->cancelled;
+
+	// One thread reports at a time, the others carry on
+	if (_mpz_disk_atomic_add(&progress->reporting, 1) == 0) {
+		done = progress->bytes_done;
+
+		if (done >= progress->next_report && done < progress->bytes_total) {
+			progress->next_report = done + _mpz_disk_progress_bytes;
+
+			if (_mpz_disk_progress_func(done, progress->bytes_total, _mpz_disk_progress_arg) != 0)
+				progress->cancelled = 1;
+		}
+	}
+
+	_mpz_disk_atomic_add(&progress->reporting, -1);
+
+	return progress->cancelled;
+}
+
+// Report a finished operation as all done
+static void _mpz_disk_progress_end(_mpz_disk_progress* progress)
+{
+	if (_mpz_disk_progress_func)
+		_mpz_disk_progress_func(progress->bytes_total, progress->bytes_total, _mpz_disk_progress_arg);
+}
+
+// Number of tasks the pool is running at once (see mpz_disk_pool_start())
+static volatile int64_t _mpz_disk_pool_running = 0;
+
+// Memory an operation may use for its blocks: what is available, shared
+// equally by the tasks of the pool that are running
+static size_t _mpz_disk_op_mem()
+{
+	int64_t running = _mpz_disk_pool_running;
+
+	return MPZ_DISK_AVAILABLE_MEM_FUNCTION() / (size_t)max(running, 1);
+}
+
+// Number of threads of an operation, shared the same way
+static int _mpz_disk_op_threads()
+{
+	int64_t running = _mpz_disk_pool_running;
+
+	return max(mpz_disk_get_num_threads() / (int)max(running, 1), 1);
+}
+
+// Add (or subtract) two uniform blocks with summaries s1 and s2 and an
+// incoming carry (or borrow). Returns the summary of the result and sets
+// *carry_out, or returns _MPZ_DISK_SUMMARY_MIXED if the blocks have to be
+// read after all.
+static int _mpz_disk_addsub_uniform(int s1, int s2, mp_limb_t carry, int subtract, mp_limb_t* carry_out)
+{
+	if (s1 == _MPZ_DISK_SUMMARY_MIXED || s2 == _MPZ_DISK_SUMMARY_MIXED)
+		return _MPZ_DISK_SUMMARY_MIXED;
+
+	mp_limb_t op1_limb = s1 == _MPZ_DISK_SUMMARY_ONES ? ~(mp_limb_t)0 : 0;
+	mp_limb_t op2_limb = s2 == _MPZ_DISK_SUMMARY_ONES ? ~(mp_limb_t)0 : 0;
+	mp_limb_t rop_limb;
+
+	if (subtract) {
+		*carry_out = MPZ_DISK_SUB_FUNCTION(&rop_limb, &op1_limb, &op2_limb, 1);
+		*carry_out += MPZ_DISK_SUB_CARRY_FUNCTION(&rop_limb, &rop_limb, 1, carry);
+	}
+	else {
+		*carry_out = MPZ_DISK_ADD_FUNCTION(&rop_limb, &op1_limb, &op2_limb, 1);
+		*carry_out += MPZ_DISK_ADD_CARRY_FUNCTION(&rop_limb, &rop_limb, 1, carry);
+	}
+
+	// All limbs of the result are the same only if the carry out of
+	// each limb is the carry into the next
+	if (*carry_out != carry)
+		return _MPZ_DISK_SUMMARY_MIXED;
+
+	if (rop_limb == 0)
+		return _MPZ_DISK_SUMMARY_ZERO;
+
+	return rop_limb == ~(mp_limb_t)0 ? _MPZ_DISK_SUMMARY_ONES : _MPZ_DISK_SUMMARY_MIXED;
+}
+
+// Carry-select addition/subtraction. Every thread adds (or subtracts) its
+// own segment of the operands as if there was no carry into it, and notes
+// whether an incoming carry would ripple all the way through the segment.
+// The carries are then resolved in a short fix-up pass that only touches
+// the segments a carry actually reaches.
+typedef struct
+{
+	// The handles are shared by all threads
+	_mpz_disk_handle* rop_file, * op1_file, * op2_file;
+	size_t op1_limbs, op2_limbs, limbs;
+	size_t limbs_per_thread, limbs_in_buffer;
+	int subtract;
+	// Carry (or borrow) out of each segment with no carry into it
+	mp_limb_t carry[MPZ_DISK_MAX_THREADS];
+	// Segment is all ones (or all zeroes when subtracting), so an incoming
+	// carry (or borrow) would propagate through it
+	int ripple[MPZ_DISK_MAX_THREADS];
+	int error;
+	_mpz_disk_progress progress;
+} _mpz_disk_addsub_job;
+
+static void _mpz_disk_addsub_thread(void* arg, int thread_idx)
+{
+	_mpz_disk_addsub_job* job = arg;
+
+	size_t begin = thread_idx * job->limbs_per_thread;
+	size_t end = min(begin + job->limbs_per_thread, job->limbs);
+
+	job->carry[thread_idx] = 0;
+	job->ripple[thread_idx] = 1;
+
+	if (begin >= end)
+		return;
+
+	mp_limb_t* rop_block = _mpz_disk_buffer_alloc(job->limbs_in_buffer * sizeof(mp_limb_t));
+	mp_limb_t* op1_block = _mpz_disk_buffer_alloc(job->limbs_in_buffer * sizeof(mp_limb_t));
+	mp_limb_t* op2_block = _mpz_disk_buffer_alloc(job->limbs_in_buffer * sizeof(mp_limb_t));
+
+	if (!rop_block || !op1_block || !op2_block)
+		job->error = MPZ_DISK_ADD_ERROR_MEM_ALLOC_FAIL;
+	else {
+		// The limb an incoming carry (or borrow) leaves unchanged
+		mp_limb_t ripple_limb = job->subtract ? 0 : ~(mp_limb_t)0;
+
+		mp_limb_t carry = 0;
+		for (size_t offset = begin; offset < end; offset += job->limbs_in_buffer)
+		{
+			size_t limbs = min(job->limbs_in_buffer, end - offset);
+			mp_limb_t carry_now;
+
+			// Uniform blocks are done from the summaries alone, a zero
+			// result isn't even written as rop reads as zero there already
+			int uniform = _mpz_disk_addsub_uniform(
+				_mpz_disk_get_summary(job->op1_file, offset, limbs),
+				_mpz_disk_get_summary(job->op2_file, offset, limbs), carry, job->subtract, &carry_now);
+
+			if (uniform != _MPZ_DISK_SUMMARY_MIXED) {
+				if (uniform != (job->subtract ? _MPZ_DISK_SUMMARY_ZERO : _MPZ_DISK_SUMMARY_ONES))
+					job->ripple[thread_idx] = 0;
+
+				if (uniform == _MPZ_DISK_SUMMARY_ONES) {
+					memset(rop_block, 0xff, limbs * sizeof(mp_limb_t));
+					if (_mpz_disk_write_limbs(job->rop_file, rop_block, limbs, offset) != 0)
+						job->error = MPZ_DISK_ERROR_UNKNOWN;
+				}
+
+				carry = carry_now;
+
+				if (_mpz_disk_progress_add(&job->progress, limbs * sizeof(mp_limb_t)))
+					break;
+				continue;
+			}
+
+			int ret = _mpz_disk_read_limbs(job->op1_file, op1_block, limbs, offset, job->op1_limbs);
+			if (!ret)
+				ret = _mpz_disk_read_limbs(job->op2_file, op2_block, limbs, offset, job->op2_limbs);
+			if (ret) {
+				job->error = ret;
+				break;
+			}
+
+			if (job->subtract) {
+				carry_now = MPZ_DISK_SUB_FUNCTION(rop_block, op1_block, op2_block, limbs);
+				if (carry)
+					carry_now += MPZ_DISK_SUB_CARRY_FUNCTION(rop_block, rop_block, limbs, carry);
+			}
+			else {
+				carry_now = MPZ_DISK_ADD_FUNCTION(rop_block, op1_block, op2_block, limbs);
+				if (carry)
+					carry_now += MPZ_DISK_ADD_CARRY_FUNCTION(rop_block, rop_block, limbs, carry);
+			}
+
+			for (size_t i = 0; i < limbs && job->ripple[thread_idx]; i++)
+				if (rop_block[i] != ripple_limb)
+					job->ripple[thread_idx] = 0;
+
+			if (_mpz_disk_write_limbs(job->rop_file, rop_block, limbs, offset) != 0)
+				job->error = MPZ_DISK_ERROR_UNKNOWN;
+
+			carry = carry_now;
+
+			if (_mpz_disk_progress_add(&job->progress, limbs * sizeof(mp_limb_t)))
+				break;
+		}
+
+		job->carry[thread_idx] = carry;
+	}
+
+	_mpz_disk_buffer_free(rop_block);
+	_mpz_disk_buffer_free(op1_block);
+	_mpz_disk_buffer_free(op2_block);
+}
+
+static int _mpz_disk_addsub_parallel(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2, int subtract)
+{
+	_mpz_disk_addsub_job job;
+
+	job.op1_limbs = mpz_disk_size(op1);
+	job.op2_limbs = mpz_disk_size(op2);
+	job.limbs = max(job.op1_limbs, job.op2_limbs);
+	job.subtract = subtract;
+	job.error = 0;
+
+	job.rop_file = _mpz_disk_open(rop, _MPZ_DISK_OPEN_CREATE);
+	job.op1_file = _mpz_disk_open(op1, _MPZ_DISK_OPEN_READ);
+	job.op2_file = _mpz_disk_open(op2, _MPZ_DISK_OPEN_READ);
+
+	if (!job.rop_file || !job.op1_file || !job.op2_file)
+	{
+		_mpz_disk_close(job.rop_file);
+		_mpz_disk_close(job.op1_file);
+		_mpz_disk_close(job.op2_file);
+
+		return MPZ_DISK_ADD_ERROR_FILE_OPEN_FAIL;
+	}
+
+	// Only the absolute values are used, so rop is never negative
+	_mpz_disk_set_sign(rop, MPZ_DISK_SIGN_POSITIVE);
+
+	// Every thread needs three buffers, which share the memory that
+	// mpz_disk_add() would have used
+	int n_threads = _mpz_disk_op_threads();
+	job.limbs_in_buffer = _mpz_disk_summary_align(max(_mpz_disk_op_mem() / 3 / sizeof(mp_limb_t) / n_threads, 1));
+	job.limbs_per_thread = (job.limbs + n_threads - 1) / n_threads;
+	job.limbs_per_thread += (job.limbs_in_buffer - job.limbs_per_thread % job.limbs_in_buffer) % job.limbs_in_buffer;
+	n_threads = (int)((job.limbs + job.limbs_per_thread - 1) / job.limbs_per_thread);
+
+	_mpz_disk_progress_start(&job.progress, 0, (int64_t)job.limbs * sizeof(mp_limb_t));
+	_mpz_disk_run_threads(n_threads, _mpz_disk_addsub_thread, &job);
+
+	_mpz_disk_close(job.op1_file);
+	_mpz_disk_close(job.op2_file);
+
+	// Don't leave a half-done rop behind
+	if (job.progress.cancelled) {
+		_mpz_disk_resize(job.rop_file, 0);
+		_mpz_disk_close(job.rop_file);
+		return MPZ_DISK_ERROR_CANCELLED;
+	}
+
+	mp_limb_t* rop_block = _mpz_disk_buffer_alloc(job.limbs_in_buffer * sizeof(mp_limb_t));
+
+	if (job.error || !rop_block) {
+		_mpz_disk_close(job.rop_file);
+		_mpz_disk_buffer_free(rop_block);
+		return job.error ? job.error : MPZ_DISK_ADD_ERROR_MEM_ALLOC_FAIL;
+	}
+
+	// Fix-up pass: apply the carry into each segment. In a segment that
+	// doesn't ripple, the carry dies out after the first few limbs. Skipped
+	// zero blocks at the top aren't in the files yet, and read as zero.
+	int64_t rop_size = _mpz_disk_handle_size(job.rop_file);
+	size_t rop_file_limbs = rop_size > 0 ? (size_t)rop_size / sizeof(mp_limb_t) : 0;
+	mp_limb_t carry = 0;
+	for (int t = 0; t < n_threads; t++)
+	{
+		size_t begin = t * job.limbs_per_thread;
+		size_t end = min(begin + job.limbs_per_thread, job.limbs);
+
+		mp_limb_t carry_now = carry;
+		for (size_t offset = begin; offset < end && carry_now; offset += job.limbs_in_buffer)
+		{
+			size_t limbs = min(job.limbs_in_buffer, end - offset);
+
+			// A carry goes right through an all ones block (and a borrow
+			// through an all zero one), so it needn't be read
+			if (_mpz_disk_get_summary(job.rop_file, offset, limbs) == (subtract ? _MPZ_DISK_SUMMARY_ZERO : _MPZ_DISK_SUMMARY_ONES)) {
+				memset(rop_block, subtract ? 0xff : 0, limbs * sizeof(mp_limb_t));
+				_mpz_disk_write_limbs(job.rop_file, rop_block, limbs, offset);
+				continue;
+			}
+
+			int ret = _mpz_disk_read_limbs(job.rop_file, rop_block, limbs, offset, rop_file_limbs);
+			if (ret) {
+				_mpz_disk_close(job.rop_file);
+				_mpz_disk_buffer_free(rop_block);
+				return ret;
+			}
+
+			if (subtract)
+				carry_now = MPZ_DISK_SUB_CARRY_FUNCTION(rop_block, rop_block, limbs, carry_now);
+			else
+				carry_now = MPZ_DISK_ADD_CARRY_FUNCTION(rop_block, rop_block, limbs, carry_now);
+
+			_mpz_disk_write_limbs(job.rop_file, rop_block, limbs, offset);
+		}
+
+		carry = job.carry[t] | (carry & job.ripple[t]);
+	}
+
+	_mpz_disk_buffer_free(rop_block);
+
+	// Skipped zero blocks may have left rop short
+	if (_mpz_disk_resize(job.rop_file, job.limbs) != 0) {
+		_mpz_disk_close(job.rop_file);
+		return MPZ_DISK_ERROR_UNKNOWN;
+	}
+
+	// Finally, write out the carry
+	if (carry != 0) {
+		assert(!subtract);
+
+		_mpz_disk_write_limbs(job.rop_file, &carry, 1, job.limbs);
+		_mpz_disk_close(job.rop_file);
+	}
+	else {
+		_mpz_disk_close(job.rop_file);
+
+		if (_mpz_disk_normalize(rop) != 0)
+			return MPZ_DISK_ERROR_UNKNOWN;
+	}
+
+	_mpz_disk_progress_end(&job.progress);
+
+	return 0;
+}
+
+// Progress of a mpz_disk_add()/mpz_disk_sub() that checkpoints (see
+// mpz_disk_set_checkpoint()), kept in the journal file of rop
+typedef struct
+{
+	char magic[4];
+	int32_t subtract;
+	char op1_filename[MPZ_DISK_FILENAME_LEN], op2_filename[MPZ_DISK_FILENAME_LEN];
+	uint64_t op1_limbs, op2_limbs;
+	uint64_t limbs_in_block;
+	// The first blocks_done blocks (rop_limbs limbs) of rop are on disk for
+	// good, and carry goes into the next block
+	uint64_t blocks_done, rop_limbs;
+	uint64_t carry;
+} _mpz_disk_journal;
+
+// Bytes of rop written between checkpoints, 0 = no checkpoints
+static size_t _mpz_disk_checkpoint_bytes = 0;
+
+// Block by block addition/subtraction of |op1| and |op2| on a single
+// thread. Continues an interrupted one if 'resume' is given.
+static int _mpz_disk_addsub_serial(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2, int subtract, const _mpz_disk_journal* resume)
+{
+	_mpz_disk_handle* rop_file = _mpz_disk_open(rop, resume ? _MPZ_DISK_OPEN_WRITE : _MPZ_DISK_OPEN_CREATE);
+	_mpz_disk_handle* op1_file = _mpz_disk_open(op1, _MPZ_DISK_OPEN_READ);
+	_mpz_disk_handle* op2_file = _mpz_disk_open(op2, _MPZ_DISK_OPEN_READ);
+
+	if (!rop_file || !op1_file || !op2_file)
+	{
+		_mpz_disk_close(rop_file);
+		_mpz_disk_close(op1_file);
+		_mpz_disk_close(op2_file);
+
+		return MPZ_DISK_ADD_ERROR_FILE_OPEN_FAIL;
+	}
+
+	// Only the absolute values are added/subtracted, so rop is never negative
+	_mpz_disk_set_sign(rop, MPZ_DISK_SIGN_POSITIVE);
+
+	// Addition roughly works in the following way:
+	// 1. Read blocks of size "block_size" bytes from op1
+	//    and op2
+	// 2. Add the two blocks (and the carry from previous
+	//    additions) and record the result and carry
+	// 3. Write the result to rop and record the carry
+
+	size_t available_mem = _mpz_disk_op_mem();
+
+	// We need memory for three blocks and then some
+	size_t block_size = available_mem / 3;
+	size_t limbs_in_block = _mpz_disk_summary_align(block_size / sizeof(mp_limb_t));
+	block_size = limbs_in_block * sizeof(mp_limb_t);
+
+	// Total number of blocks in op1 and op2
+	// number of blocks = ceil( bytes in op1 / block size )
+
+	size_t op1_filesize = mpz_disk_size(op1) * sizeof(mp_limb_t),
+		   op2_filesize = mpz_disk_size(op2) * sizeof(mp_limb_t);
+	size_t n_op1_blocks = op1_filesize / block_size;
+	size_t n_op2_blocks = op2_filesize / block_size;
+	// Round up
+	if (op1_filesize > n_op1_blocks * block_size) n_op1_blocks++;
+	if (op2_filesize > n_op2_blocks * block_size) n_op2_blocks++;
+
+	// Minimum number of blocks in output (rop)
+	size_t n_blocks = max(n_op1_blocks, n_op2_blocks);
+
+	// If both the numbers fit inside a single block,
+	// reduce block size to save memory
+	if (n_blocks == 1) {
+		block_size = max(op1_filesize, op2_filesize);
+		limbs_in_block = block_size / sizeof(mp_limb_t);
+	}
+
+	// The blocks already done were cut with the memory available back then
+	if (resume && resume->limbs_in_block != limbs_in_block) {
+		limbs_in_block = (size_t)resume->limbs_in_block;
+		block_size = limbs_in_block * sizeof(mp_limb_t);
+		n_op1_blocks = (op1_filesize + block_size - 1) / block_size;
+		n_op2_blocks = (op2_filesize + block_size - 1) / block_size;
+		n_blocks = max(n_op1_blocks, n_op2_blocks);
+	}
+	
+	// Try to allocate memory for the blocks
+	mp_limb_t* rop_block, * op1_block, * op2_block;
+
+	rop_block = _mpz_disk_buffer_alloc(limbs_in_block * sizeof(mp_limb_t));
+	op1_block = _mpz_disk_buffer_alloc(limbs_in_block * sizeof(mp_limb_t));
+	op2_block = _mpz_disk_buffer_alloc(limbs_in_block * sizeof(mp_limb_t));
+
+	// TODO Decrease blocks size progressively if any of the
+	// memory allocation fails
+	if (!rop_block || !op1_block || !op2_block) {
+		_mpz_disk_close(rop_file);
+		_mpz_disk_close(op1_file);
+		_mpz_disk_close(op2_file);
+
+		_mpz_disk_buffer_free(rop_block);
+		_mpz_disk_buffer_free(op1_block);
+		_mpz_disk_buffer_free(op2_block);
+
+		return MPZ_DISK_ADD_ERROR_MEM_ALLOC_FAIL;
+	}
+
+	_mpz_disk_journal journal;
+	memset(&journal, 0, sizeof(journal));
+	memcpy(journal.magic, "MPZJ", 4);
+	journal.subtract = subtract;
+	strcpy(journal.op1_filename, op1->filename);
+	strcpy(journal.op2_filename, op2->filename);
+	journal.op1_limbs = op1_filesize / sizeof(mp_limb_t);
+	journal.op2_limbs = op2_filesize / sizeof(mp_limb_t);
+	journal.limbs_in_block = limbs_in_block;
+
+	size_t checkpoint_blocks = _mpz_disk_checkpoint_bytes ? max(_mpz_disk_checkpoint_bytes / max(block_size, 1), 1) : 0;
+
+	mp_limb_t carry = 0;
+	size_t first_block = 1;
+	int failed = 0, read_error = 0;
+
+	// Whatever was written past the last checkpoint is done again. The
+	// uniform zero blocks rely on rop reading as zero, so it is cut first.
+	if (resume) {
+		carry = (mp_limb_t)resume->carry;
+		first_block = (size_t)resume->blocks_done + 1;
+		failed = _mpz_disk_resize(rop_file, (size_t)resume->rop_limbs) != 0;
+	}
+
+	size_t rop_limbs = max(op1_filesize, op2_filesize) / sizeof(mp_limb_t);
+	_mpz_disk_progress progress;
+	_mpz_disk_progress_start(&progress, (int64_t)min((first_block - 1) * limbs_in_block, rop_limbs) * sizeof(mp_limb_t),
+		(int64_t)rop_limbs * sizeof(mp_limb_t));
+
+	for (size_t n = first_block; n <= n_blocks && !failed; n++)
+	{
+		mp_limb_t carry_now = 0;
+
+		// Uniform blocks are done from the summaries alone, a zero result
+		// isn't even written as rop reads as zero there already
+		mp_limb_t uniform_carry;
+		int uniform = _mpz_disk_addsub_uniform(
+			_mpz_disk_get_summary(op1_file, (n - 1) * limbs_in_block, limbs_in_block),
+			_mpz_disk_get_summary(op2_file, (n - 1) * limbs_in_block, limbs_in_block), carry, subtract, &uniform_carry);
+
+		if (uniform != _MPZ_DISK_SUMMARY_MIXED) {
+			if (uniform == _MPZ_DISK_SUMMARY_ONES) {
+				memset(rop_block, 0xff, limbs_in_block * sizeof(mp_limb_t));
+				_mpz_disk_write_limbs(rop_file, rop_block, limbs_in_block, (n - 1) * limbs_in_block);
+			}
+
+			carry_now = uniform_carry;
+		}
+		else {
+			// The input blocks are padded with zero past the end
+			// of op1 and op2
+			read_error = _mpz_disk_read_limbs(op1_file, op1_block, limbs_in_block, (n - 1) * limbs_in_block, op1_filesize / sizeof(mp_limb_t));
+			if (!read_error)
+				read_error = _mpz_disk_read_limbs(op2_file, op2_block, limbs_in_block, (n - 1) * limbs_in_block, op2_filesize / sizeof(mp_limb_t));
+			if (read_error) {
+				failed = 1;
+				break;
+			}
+
+			// Directly copy the block if the other block is zero
+			if (n > n_op1_blocks)
+				memcpy(rop_block, op2_block, limbs_in_block * sizeof(mp_limb_t));
+			else if (n > n_op2_blocks)
+				memcpy(rop_block, op1_block, limbs_in_block * sizeof(mp_limb_t));
+			else if (subtract)
+				carry_now = MPZ_DISK_SUB_FUNCTION(rop_block, op1_block, op2_block, limbs_in_block);
+			else // Add the blocks
+				carry_now = MPZ_DISK_ADD_FUNCTION(rop_block, op1_block, op2_block, limbs_in_block);
+
+			// Process carry as well
+			if (carry && subtract)
+				carry_now += MPZ_DISK_SUB_CARRY_FUNCTION(rop_block, rop_block, limbs_in_block, carry);
+			else if (carry)
+				carry_now += MPZ_DISK_ADD_CARRY_FUNCTION(rop_block, rop_block, limbs_in_block, carry);
+
+			// Write rop_block to rop
+			_mpz_disk_write_limbs(rop_file, rop_block, limbs_in_block, (n - 1) * limbs_in_block);
+
+			assert(carry_now <= 1);	// Carry can either by 0 or 1
+		}
+
+		carry = carry_now;
+
+		// Make the blocks so far durable, then note that they are
+		if (checkpoint_blocks && n % checkpoint_blocks == 0 && n < n_blocks) {
+			journal.blocks_done = n;
+			journal.rop_limbs = n * limbs_in_block;
+			journal.carry = carry;
+
+			failed = _mpz_disk_write_journal(rop, rop_file, &journal, sizeof(journal)) != 0;
+		}
+
+		size_t block_limbs = min(limbs_in_block, rop_limbs - min((n - 1) * limbs_in_block, rop_limbs));
+		failed = failed || _mpz_disk_progress_add(&progress, (int64_t)block_limbs * sizeof(mp_limb_t));
+
+#ifdef MPZ_DISK_TESTING
+		// Lets the tests stop half way, as a crash would
+		failed = failed || _mpz_disk_simulate_crash(n);
+#endif
+	}
+
+	_mpz_disk_close(op1_file);
+	_mpz_disk_close(op2_file);
+	// Don't close rop_file just yet
+	_mpz_disk_buffer_free(op1_block);
+	_mpz_disk_buffer_free(op2_block);
+	_mpz_disk_buffer_free(rop_block);
+
+	// Skipped zero blocks may have left rop short
+	if (failed || _mpz_disk_resize(rop_file, n_blocks * limbs_in_block) != 0) {
+		// Don't leave a half-done rop behind, unless it can be resumed
+		if (progress.cancelled && !resume && !journal.blocks_done)
+			_mpz_disk_resize(rop_file, 0);
+
+		_mpz_disk_close(rop_file);
+		return progress.cancelled ? MPZ_DISK_ERROR_CANCELLED : read_error ? read_error : MPZ_DISK_ERROR_UNKNOWN;
+	}
+	
+	// Finally, write out the carry
+	if (carry != 0) {
+		assert(!subtract);
+
+		_mpz_disk_write_limbs(rop_file, &carry, 1, n_blocks * limbs_in_block);
+		_mpz_disk_close(rop_file);
+	}
+	else {
+		_mpz_disk_close(rop_file);
+
+		// Truncate unneccassary zereos in the output file
+		if (_mpz_disk_normalize(rop) != 0)
+			return MPZ_DISK_ERROR_UNKNOWN;
+	}
+
+	// Nothing left to resume
+	if (checkpoint_blocks || resume) {
+		char journal_filename[MPZ_DISK_FILENAME_LEN];
+		_mpz_disk_get_journal_filename(journal_filename, rop);
+		_mpz_disk_io_remove(rop->backend, journal_filename);
+	}
+
+	_mpz_disk_progress_end(&progress);
+
+	return 0;
+}
+
+int mpz_disk_add(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_t op2)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_ADD);
+	int ret;
+
+	// Operands of more than one block are split over the threads, unless
+	// the progress is checkpointed, which needs a single carry
+	if (_mpz_disk_op_threads() > 1 && !_mpz_disk_checkpoint_bytes &&
+		max(mpz_disk_size(op1), mpz_disk_size(op2)) * sizeof(mp_limb_t) > _mpz_disk_op_mem() / 3)
+		ret = _mpz_disk_addsub_parallel(rop, op1, op2, 0);
+	else
+		ret = _mpz_disk_addsub_serial(rop, op1, op2, 0, NULL);
+
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+int mpz_disk_sub(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_t op2)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_SUB);
+	int ret;
+
+	// Operands of more than one block are split over the threads, unless
+	// the progress is checkpointed, which needs a single carry
+	if (_mpz_disk_op_threads() > 1 && !_mpz_disk_checkpoint_bytes &&
+		max(mpz_disk_size(op1), mpz_disk_size(op2)) * sizeof(mp_limb_t) > _mpz_disk_op_mem() / 3)
+		ret = _mpz_disk_addsub_parallel(rop, op1, op2, 1);
+	else
+		ret = _mpz_disk_addsub_serial(rop, op1, op2, 1, NULL);
+
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+// Fused sum of n terms: every block of rop starts out as the block of the
+// first term, and the others are added (or subtracted) into it in memory,
+// each with a carry (or borrow) of its own. rop is written once per block
+// however many terms there are.
+static int _mpz_disk_addsub_n(mpz_disk_ptr rop, mpz_disk_ptr const* ops, const int* subtract, int n)
+{
+	if (n < 1 || subtract[0])
+		return MPZ_DISK_ERROR_UNKNOWN;
+
+	_mpz_disk_handle** op_files = calloc(n, sizeof(_mpz_disk_handle*));
+	size_t* op_limbs = malloc(n * sizeof(size_t));
+	mp_limb_t* carry = calloc(n, sizeof(mp_limb_t));
+
+	if (!op_files || !op_limbs || !carry) {
+		free(op_files);
+		free(op_limbs);
+		free(carry);
+
+		return MPZ_DISK_ADD_ERROR_MEM_ALLOC_FAIL;
+	}
+
+	size_t limbs = 0;
+	for (int i = 0; i < n; i++)
+	{
+		op_limbs[i] = mpz_disk_size(ops[i]);
+		limbs = max(limbs, op_limbs[i]);
+	}
+
+	// One block of rop and one that the terms are read into in turn
+	size_t limbs_in_block = _mpz_disk_summary_align(max(_mpz_disk_op_mem() / 2 / sizeof(mp_limb_t), 1));
+	limbs_in_block = min(limbs_in_block, max(limbs, 1));
+
+	_mpz_disk_handle* rop_file = _mpz_disk_open(rop, _MPZ_DISK_OPEN_CREATE);
+	int failed = !rop_file;
+	for (int i = 0; i < n; i++)
+	{
+		op_files[i] = _mpz_disk_open(ops[i], _MPZ_DISK_OPEN_READ);
+		failed = failed || !op_files[i];
+	}
+
+	mp_limb_t* rop_block = _mpz_disk_buffer_alloc(limbs_in_block * sizeof(mp_limb_t));
+	mp_limb_t* op_block = _mpz_disk_buffer_alloc(limbs_in_block * sizeof(mp_limb_t));
+
+	int ret = failed ? MPZ_DISK_ADD_ERROR_FILE_OPEN_FAIL : (!rop_block || !op_block) ? MPZ_DISK_ADD_ERROR_MEM_ALLOC_FAIL : 0;
+
+	// Only the absolute values are used, so rop is never negative
+	if (!ret)
+		_mpz_disk_set_sign(rop, MPZ_DISK_SIGN_POSITIVE);
+
+	_mpz_disk_progress progress;
+	_mpz_disk_progress_start(&progress, 0, (int64_t)limbs * sizeof(mp_limb_t));
+
+	for (size_t offset = 0; offset < limbs && !ret; offset += limbs_in_block)
+	{
+		size_t block_limbs = min(limbs_in_block, limbs - offset);
+
+		ret = _mpz_disk_read_limbs(op_files[0], rop_block, block_limbs, offset, op_limbs[0]);
+
+		for (int i = 1; i < n && !ret; i++)
+		{
+			mp_limb_t carry_now = 0;
+
+			// Past the end of a term only its carry is left
+			if (offset < op_limbs[i]) {
+				ret = _mpz_disk_read_limbs(op_files[i], op_block, block_limbs, offset, op_limbs[i]);
+
+				if (subtract[i])
+					carry_now = MPZ_DISK_SUB_FUNCTION(rop_block, rop_block, op_block, block_limbs);
+				else
+					carry_now = MPZ_DISK_ADD_FUNCTION(rop_block, rop_block, op_block, block_limbs);
+			}
+
+			if (carry[i] && subtract[i])
+				carry_now += MPZ_DISK_SUB_CARRY_FUNCTION(rop_block, rop_block, block_limbs, carry[i]);
+			else if (carry[i])
+				carry_now += MPZ_DISK_ADD_CARRY_FUNCTION(rop_block, rop_block, block_limbs, carry[i]);
+
+			carry[i] = carry_now;
+		}
+
+		if (ret)
+			break;
+
+		if (_mpz_disk_write_limbs(rop_file, rop_block, block_limbs, offset) != 0)
+			ret = MPZ_DISK_ERROR_UNKNOWN;
+		else if (_mpz_disk_progress_add(&progress, (int64_t)block_limbs * sizeof(mp_limb_t)))
+			ret = MPZ_DISK_ERROR_CANCELLED;
+	}
+
+	// The carries and borrows that are left all go into the limb above
+	int64_t top = 0;
+	for (int i = 1; i < n; i++)
+		top += subtract[i] ? -(int64_t)carry[i] : (int64_t)carry[i];
+
+	if (!ret && top < 0)
+		ret = MPZ_DISK_ERROR_NEGATIVE;
+
+	for (int i = 0; i < n; i++)
+		_mpz_disk_close(op_files[i]);
+	_mpz_disk_buffer_free(rop_block);
+	_mpz_disk_buffer_free(op_block);
+	free(op_files);
+	free(op_limbs);
+	free(carry);
+
+	if (ret) {
+		// Don't leave a half-done rop behind
+		if (rop_file) {
+			_mpz_disk_resize(rop_file, 0);
+			_mpz_disk_close(rop_file);
+		}
+
+		return ret;
+	}
+
+	if (top > 0) {
+		mp_limb_t top_limb = (mp_limb_t)top;
+
+		ret = _mpz_disk_write_limbs(rop_file, &top_limb, 1, limbs) != 0 ? MPZ_DISK_ERROR_UNKNOWN : 0;
+		_mpz_disk_close(rop_file);
+	}
+	else {
+		_mpz_disk_close(rop_file);
+
+		if (_mpz_disk_normalize(rop) != 0)
+			ret = MPZ_DISK_ERROR_UNKNOWN;
+	}
+
+	_mpz_disk_progress_end(&progress);
+
+	return ret;
+}
+
+int mpz_disk_addsub_n(mpz_disk_ptr rop, mpz_disk_ptr const* ops, const int* subtract, int n)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_ADD);
+
+	int ret = _mpz_disk_addsub_n(rop, ops, subtract, n);
+
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+int mpz_disk_set(mpz_disk_ptr rop, mpz_disk_ptr op)
+{
+	if (rop == op)
+		return 0;
+
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_OTHER);
+
+	// A sum of one term copies the limbs, but leaves rop positive
+	int subtract = 0;
+	int ret = _mpz_disk_addsub_n(rop, &op, &subtract, 1);
+
+	if (!ret && _mpz_disk_set_sign(rop, _mpz_disk_get_sign(op)) != 0)
+		ret = MPZ_DISK_ADD_ERROR_FILE_OPEN_FAIL;
+
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+int mpz_disk_set_checkpoint(size_t bytes)
+{
+	_mpz_disk_checkpoint_bytes = bytes;
+
+	return 0;
+}
+
+int mpz_disk_resume(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2)
+{
+	_mpz_disk_journal journal;
+
+	if (_mpz_disk_read_journal(rop, &journal, sizeof(journal)) != 0 || memcmp(journal.magic, "MPZJ", 4) != 0)
+		return MPZ_DISK_ERROR_NO_CHECKPOINT;
+
+	// Only the very same operands can be carried on with
+	if (strcmp(journal.op1_filename, op1->filename) != 0 || strcmp(journal.op2_filename, op2->filename) != 0 ||
+		journal.op1_limbs != mpz_disk_size(op1) || journal.op2_limbs != mpz_disk_size(op2))
+		return MPZ_DISK_ERROR_NO_CHECKPOINT;
+
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(journal.subtract ? MPZ_DISK_STATS_SUB : MPZ_DISK_STATS_ADD);
+	int ret = _mpz_disk_addsub_serial(rop, op1, op2, journal.subtract, &journal);
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+// Top-down comparison of equal-length operands. Chunks are numbered from
+// the most significant end and handed out to the threads interleaved, so
+// the threads always work on consecutive high-to-low regions and the reads
+// of the lower chunks are already in flight while the top one is compared.
+// Chunk boundaries are whole pieces from the bottom, so that the reads are
+// checked against the checksums; the top chunk may be short.
+typedef struct
+{
+	mpz_disk_ptr op1, op2;
+	size_t limbs, limbs_in_chunk, n_chunks;
+	int n_threads;
+	// 2 * (most significant differing chunk found so far) + (op1 > op2)
+	volatile int64_t found;
+	int error;
+	_mpz_disk_progress progress;
+} _mpz_disk_cmpabs_job;
+
+static void _mpz_disk_cmpabs_thread(void* arg, int thread_idx)
+{
+	_mpz_disk_cmpabs_job* job = arg;
+
+	_mpz_disk_handle* op1_file = _mpz_disk_open(job->op1, _MPZ_DISK_OPEN_READ);
+	_mpz_disk_handle* op2_file = _mpz_disk_open(job->op2, _MPZ_DISK_OPEN_READ);
+	mp_limb_t* op1_buf = _mpz_disk_buffer_alloc(job->limbs_in_chunk * sizeof(mp_limb_t));
+	mp_limb_t* op2_buf = _mpz_disk_buffer_alloc(job->limbs_in_chunk * sizeof(mp_limb_t));
+
+	if (!op1_file || !op2_file)
+		job->error = MPZ_DISK_ADD_ERROR_FILE_OPEN_FAIL;
+	else if (!op1_buf || !op2_buf)
+		job->error = MPZ_DISK_ADD_ERROR_MEM_ALLOC_FAIL;
+	else {
+		for (size_t chunk = thread_idx; chunk < job->n_chunks; chunk += job->n_threads)
+		{
+			// A more significant chunk already decided the comparison
+			if ((int64_t)chunk > job->found / 2)
+				break;
+
+			size_t start = (job->n_chunks - 1 - chunk) * job->limbs_in_chunk;
+			size_t limbs = min(job->limbs_in_chunk, job->limbs - start);
+
+			// Ask for this thread's next chunk while this one is compared
+			size_t next = chunk + job->n_threads;
+			if (next < job->n_chunks) {
+				size_t next_start = (job->n_chunks - 1 - next) * job->limbs_in_chunk;
+				_mpz_disk_prefetch_limbs(op1_file, next_start, job->limbs_in_chunk);
+				_mpz_disk_prefetch_limbs(op2_file, next_start, job->limbs_in_chunk);
+			}
+
+			int ret = _mpz_disk_read_limbs(op1_file, op1_buf, limbs, start, job->limbs);
+			if (!ret)
+				ret = _mpz_disk_read_limbs(op2_file, op2_buf, limbs, start, job->limbs);
+			if (ret) {
+				job->error = ret;
+				break;
+			}
+
+			int cmp = mpn_cmp(op1_buf, op2_buf, limbs);
+			if (cmp != 0) {
+				_mpz_disk_atomic_min(&job->found, 2 * (int64_t)chunk + (cmp > 0));
+				break;
+			}
+
+			if (_mpz_disk_progress_add(&job->progress, limbs * sizeof(mp_limb_t)))
+				break;
+		}
+	}
+
+	_mpz_disk_close(op1_file);
+	_mpz_disk_close(op2_file);
+	_mpz_disk_buffer_free(op1_buf);
+	_mpz_disk_buffer_free(op2_buf);
+}
+
+static int _mpz_disk_cmpabs(mpz_disk_ptr op1, mpz_disk_ptr op2, int* result)
+{
+	*result = 0;
+
+	// If sizes are unequal, directly compare the sizes
+	if (mpz_disk_size(op1) != mpz_disk_size(op2)) {
+		*result = mpz_disk_size(op1) > mpz_disk_size(op2) ? 1 : -1;
+		return 0;
+	}
+
+	_mpz_disk_cmpabs_job job;
+
+	job.op1 = op1;
+	job.op2 = op2;
+	// Number of limbs in both op1 and op2 are equal
+	job.limbs = mpz_disk_size(op1);
+	job.found = INT64_MAX;
+	job.error = 0;
+
+	// Two buffers per thread, sharing the memory of a mpz_disk_add() block
+	job.n_threads = _mpz_disk_op_threads();
+	job.limbs_in_chunk = max(_mpz_disk_op_mem() / 3 / sizeof(mp_limb_t) / (2 * job.n_threads), 1);
+	job.limbs_in_chunk += (_mpz_disk_piece_limbs() - job.limbs_in_chunk % _mpz_disk_piece_limbs()) % _mpz_disk_piece_limbs();
+	job.n_chunks = (job.limbs + job.limbs_in_chunk - 1) / job.limbs_in_chunk;
+	job.n_threads = (int)min((size_t)job.n_threads, job.n_chunks);
+
+	_mpz_disk_progress_start(&job.progress, 0, (int64_t)job.limbs * sizeof(mp_limb_t));
+
+	if (job.n_chunks > 0)
+		_mpz_disk_run_threads(job.n_threads, _mpz_disk_cmpabs_thread, &job);
+
+	if (job.error)
+		return job.error;
+
+	// Not all of the chunks above the difference found may have been compared
+	if (job.progress.cancelled)
+		return MPZ_DISK_ERROR_CANCELLED;
+
+	_mpz_disk_progress_end(&job.progress);
+
+	// Unless equal
+	if (job.found != INT64_MAX)
+		*result = (job.found & 1) ? 1 : -1;
+
+	return 0;
+}
+
+int mpz_disk_cmpabs_ex(mpz_disk_ptr op1, mpz_disk_ptr op2, int* result)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_CMPABS);
+	int ret = _mpz_disk_cmpabs(op1, op2, result);
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+int mpz_disk_cmpabs(mpz_disk_ptr op1, mpz_disk_ptr op2)
+{
+	int result;
+	mpz_disk_cmpabs_ex(op1, op2, &result);
+
+	return result;
+}
+
+// Operations understood by _mpz_disk_logic()
+#define _MPZ_DISK_LOGIC_AND 0
+#define _MPZ_DISK_LOGIC_IOR 1
+#define _MPZ_DISK_LOGIC_XOR 2
+#define _MPZ_DISK_LOGIC_COM 3
+
+// Read limbs [offset, offset + limbs) of the two's complement form of an
+// operand. Limbs past the end of the file read as zero (or all ones if
+// negative). The blocks have to be read in order: 'borrow' carries the -1
+// of ~(|op| - 1) across blocks and must start at 1.
+static int _mpz_disk_read_twos_block(mp_limb_t* block, size_t limbs, size_t offset,
+	_mpz_disk_handle* fp, size_t file_limbs, int sign, mp_limb_t* borrow)
+{
+	int ret = _mpz_disk_read_limbs(fp, block, limbs, offset, file_limbs);
+
+	if (sign == MPZ_DISK_SIGN_NEGATIVE) {
+		if (*borrow)
+			*borrow = MPZ_DISK_SUB_CARRY_FUNCTION(block, block, limbs, *borrow);
+		mpn_com(block, block, limbs);
+	}
+
+	return ret;
+}
+
+static int _mpz_disk_same_file(mpz_disk_ptr op1, mpz_disk_ptr op2)
+{
+	return op2 != NULL && strcmp(op1->filename, op2->filename) == 0;
+}
+
+// Bitwise logic in a single streaming pass over op1 and op2 (op2 is
+// unused for _MPZ_DISK_LOGIC_COM), with the semantics of mpz_and & co.
+static int _mpz_disk_logic_pass(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2, int logic_op)
+{
+	int op1_sign = _mpz_disk_get_sign(op1);
+	int op2_sign = op2 ? _mpz_disk_get_sign(op2) : MPZ_DISK_SIGN_POSITIVE;
+	size_t op1_limbs = mpz_disk_size(op1);
+	size_t op2_limbs = op2 ? mpz_disk_size(op2) : 0;
+
+	// Work out the sign of rop and how many limbs of the two's complement
+	// result can be non-trivial. Past that point the result is all zeros
+	// (or all ones when negative), so the inputs don't need to be read any
+	// further. This is what lets an AND stop early.
+	int rop_sign;
+	size_t rop_limbs;
+	switch (logic_op)
+	{
+	case _MPZ_DISK_LOGIC_AND:
+		rop_sign = op1_sign & op2_sign;
+		if (op1_sign == MPZ_DISK_SIGN_NEGATIVE && op2_sign == MPZ_DISK_SIGN_NEGATIVE)
+			rop_limbs = max(op1_limbs, op2_limbs);
+		else if (op1_sign == MPZ_DISK_SIGN_NEGATIVE)
+			rop_limbs = op2_limbs;
+		else if (op2_sign == MPZ_DISK_SIGN_NEGATIVE)
+			rop_limbs = op1_limbs;
+		else
+			rop_limbs = min(op1_limbs, op2_limbs);
+		break;
+	case _MPZ_DISK_LOGIC_IOR:
+		rop_sign = op1_sign | op2_sign;
+		if (op1_sign == MPZ_DISK_SIGN_NEGATIVE && op2_sign == MPZ_DISK_SIGN_NEGATIVE)
+			rop_limbs = min(op1_limbs, op2_limbs);
+		else if (op1_sign == MPZ_DISK_SIGN_NEGATIVE)
+			rop_limbs = op1_limbs;
+		else if (op2_sign == MPZ_DISK_SIGN_NEGATIVE)
+			rop_limbs = op2_limbs;
+		else
+			rop_limbs = max(op1_limbs, op2_limbs);
+		break;
+	case _MPZ_DISK_LOGIC_XOR:
+		rop_sign = op1_sign ^ op2_sign;
+		rop_limbs = max(op1_limbs, op2_limbs);
+		break;
+	case _MPZ_DISK_LOGIC_COM:
+		rop_sign = !op1_sign;
+		rop_limbs = op1_limbs;
+		break;
+	default:
+		return MPZ_DISK_ERROR_UNKNOWN;
+	}
+
+	// If rop is also an operand, overwrite it in place instead of
+	// truncating it before it has been read
+	int rop_aliased = _mpz_disk_same_file(rop, op1) || _mpz_disk_same_file(rop, op2);
+
+	_mpz_disk_handle* rop_file = _mpz_disk_open(rop, rop_aliased ? _MPZ_DISK_OPEN_WRITE : _MPZ_DISK_OPEN_CREATE);
+	_mpz_disk_handle* op1_file = _mpz_disk_open(op1, _MPZ_DISK_OPEN_READ);
+	_mpz_disk_handle* op2_file = op2 ? _mpz_disk_open(op2, _MPZ_DISK_OPEN_READ) : NULL;
+
+	if (!rop_file || !op1_file || (op2 && !op2_file))
+	{
+		_mpz_disk_close(rop_file);
+		_mpz_disk_close(op1_file);
+		_mpz_disk_close(op2_file);
+
+		return MPZ_DISK_ADD_ERROR_FILE_OPEN_FAIL;
+	}
+
+	// We need memory for three blocks, same as mpz_disk_add()
+	size_t limbs_in_block = _mpz_disk_summary_align(_mpz_disk_op_mem() / 3 / sizeof(mp_limb_t));
+	limbs_in_block = max(min(limbs_in_block, rop_limbs), 1);
+
+	mp_limb_t* rop_block, * op1_block, * op2_block;
+
+	rop_block = _mpz_disk_buffer_alloc(limbs_in_block * sizeof(mp_limb_t));
+	op1_block = _mpz_disk_buffer_alloc(limbs_in_block * sizeof(mp_limb_t));
+	op2_block = _mpz_disk_buffer_alloc(limbs_in_block * sizeof(mp_limb_t));
+
+	if (!rop_block || !op1_block || !op2_block) {
+		_mpz_disk_close(rop_file);
+		_mpz_disk_close(op1_file);
+		_mpz_disk_close(op2_file);
+
+		_mpz_disk_buffer_free(rop_block);
+		_mpz_disk_buffer_free(op1_block);
+		_mpz_disk_buffer_free(op2_block);
+
+		return MPZ_DISK_ADD_ERROR_MEM_ALLOC_FAIL;
+	}
+
+	// Borrows of the on-the-fly two's complement conversion of the
+	// operands, and carry of the conversion of rop back to sign-magnitude
+	mp_limb_t op1_borrow = 1, op2_borrow = 1, rop_carry = 1;
+
+	// Number of limbs in rop without the leading zeroes
+	size_t rop_top = 0;
+	int read_error = 0;
+
+	for (size_t limbs_done = 0; limbs_done < rop_limbs; limbs_done += limbs_in_block)
+	{
+		size_t limbs = min(limbs_in_block, rop_limbs - limbs_done);
+
+		read_error = _mpz_disk_read_twos_block(op1_block, limbs, limbs_done, op1_file, op1_limbs, op1_sign, &op1_borrow);
+		if (op2 && !read_error)
+			read_error = _mpz_disk_read_twos_block(op2_block, limbs, limbs_done, op2_file, op2_limbs, op2_sign, &op2_borrow);
+		if (read_error)
+			break;
+
+		switch (logic_op)
+		{
+		case _MPZ_DISK_LOGIC_AND: mpn_and_n(rop_block, op1_block, op2_block, limbs); break;
+		case _MPZ_DISK_LOGIC_IOR: mpn_ior_n(rop_block, op1_block, op2_block, limbs); break;
+		case _MPZ_DISK_LOGIC_XOR: mpn_xor_n(rop_block, op1_block, op2_block, limbs); break;
+		case _MPZ_DISK_LOGIC_COM: mpn_com(rop_block, op1_block, limbs); break;
+		}
+
+		// |rop| = ~rop + 1 if rop is negative
+		if (rop_sign == MPZ_DISK_SIGN_NEGATIVE) {
+			mpn_com(rop_block, rop_block, limbs);
+			if (rop_carry)
+				rop_carry = MPZ_DISK_ADD_CARRY_FUNCTION(rop_block, rop_block, limbs, rop_carry);
+		}
+
+		// Keep track of the leading zeroes so that the result never has
+		// to be rescanned by _mpz_disk_truncate_leading_zeroes()
+		size_t top = limbs;
+		while (top > 0 && rop_block[top - 1] == 0)
+			top--;
+		if (top > 0)
+			rop_top = limbs_done + top;
+
+		_mpz_disk_write_limbs(rop_file, rop_block, limbs, limbs_done);
+	}
+
+	// -(2^k) needs one more limb than its two's complement
+	if (rop_sign == MPZ_DISK_SIGN_NEGATIVE && rop_carry && !read_error) {
+		_mpz_disk_write_limbs(rop_file, &rop_carry, 1, rop_limbs);
+		rop_top = rop_limbs + 1;
+	}
+
+	// Cut rop down to its significant limbs. If rop was an operand the
+	// file may still have some of its old limbs past that point.
+	int ret = _mpz_disk_resize(rop_file, rop_top);
+
+	_mpz_disk_close(rop_file);
+	_mpz_disk_close(op1_file);
+	_mpz_disk_close(op2_file);
+	_mpz_disk_buffer_free(rop_block);
+	_mpz_disk_buffer_free(op1_block);
+	_mpz_disk_buffer_free(op2_block);
+
+	if (read_error)
+		return read_error;
+
+	if (ret != 0)
+		return MPZ_DISK_ERROR_UNKNOWN;
+
+	if (_mpz_disk_set_sign(rop, rop_top > 0 ? rop_sign : MPZ_DISK_SIGN_POSITIVE) != 0)
+		return MPZ_DISK_ERROR_UNKNOWN;
+
+	return 0;
+}
+
+static int _mpz_disk_logic(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2, int logic_op)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_LOGIC);
+	int ret = _mpz_disk_logic_pass(rop, op1, op2, logic_op);
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+int mpz_disk_and(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2)
+{
+	return _mpz_disk_logic(rop, op1, op2, _MPZ_DISK_LOGIC_AND);
+}
+
+int mpz_disk_ior(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2)
+{
+	return _mpz_disk_logic(rop, op1, op2, _MPZ_DISK_LOGIC_IOR);
+}
+
+int mpz_disk_xor(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2)
+{
+	return _mpz_disk_logic(rop, op1, op2, _MPZ_DISK_LOGIC_XOR);
+}
+
+int mpz_disk_com(mpz_disk_ptr rop, mpz_disk_ptr op)
+{
+	return _mpz_disk_logic(rop, op, NULL, _MPZ_DISK_LOGIC_COM);
+}
+
+// Splits a popcount/hamdist over the threads, one contiguous range of
+// limbs per thread
+typedef struct
+{
+	mpz_disk_ptr op1, op2;	// op2 is NULL for a popcount
+	size_t op1_limbs, op2_limbs;
+	// Lowest non-zero limb of a negative operand. The operand is then
+	// counted as |op| - 1, which has the same bits as its two's complement
+	// except for the infinite string of ones (SIZE_MAX if not negative)
+	size_t op1_low, op2_low;
+	size_t limbs, limbs_per_thread, limbs_in_buffer;
+	mp_bitcnt_t count[MPZ_DISK_MAX_THREADS];
+	int error;
+} _mpz_disk_count_job;
+
+// Turn limbs [offset, offset + limbs) of |op| into the same limbs of |op| - 1
+static void _mpz_disk_decrement_limbs(mp_limb_t* buf, size_t limbs, size_t offset, size_t low)
+{
+	if (low == SIZE_MAX)
+		return;
+
+	for (size_t i = 0; i < limbs && offset + i <= low; i++)
+		buf[i] = offset + i < low ? ~(mp_limb_t)0 : buf[i] - 1;
+}
+
+static void _mpz_disk_count_thread(void* arg, int thread_idx)
+{
+	_mpz_disk_count_job* job = arg;
+
+	size_t begin = thread_idx * job->limbs_per_thread;
+	size_t end = min(begin + job->limbs_per_thread, job->limbs);
+	job->count[thread_idx] = 0;
+
+	if (begin >= end)
+		return;
+
+	_mpz_disk_handle* op1_file = _mpz_disk_open(job->op1, _MPZ_DISK_OPEN_READ);
+	_mpz_disk_handle* op2_file = job->op2 ? _mpz_disk_open(job->op2, _MPZ_DISK_OPEN_READ) : NULL;
+
+	mp_limb_t* op1_buf = _mpz_disk_buffer_alloc(job->limbs_in_buffer * sizeof(mp_limb_t));
+	mp_limb_t* op2_buf = job->op2 ? _mpz_disk_buffer_alloc(job->limbs_in_buffer * sizeof(mp_limb_t)) : NULL;
+
+	if (!op1_file || (job->op2 && !op2_file) || !op1_buf || (job->op2 && !op2_buf)) {
+		job->error = 1;
+	}
+	else {
+		for (size_t offset = begin; offset < end; offset += job->limbs_in_buffer)
+		{
+			size_t limbs = min(job->limbs_in_buffer, end - offset);
+
+			if (_mpz_disk_read_limbs(op1_file, op1_buf, limbs, offset, job->op1_limbs) != 0) {
+				job->error = 1;
+				break;
+			}
+			_mpz_disk_decrement_limbs(op1_buf, limbs, offset, job->op1_low);
+
+			if (job->op2) {
+				if (_mpz_disk_read_limbs(op2_file, op2_buf, limbs, offset, job->op2_limbs) != 0) {
+					job->error = 1;
+					break;
+				}
+				_mpz_disk_decrement_limbs(op2_buf, limbs, offset, job->op2_low);
+
+				job->count[thread_idx] += mpn_hamdist(op1_buf, op2_buf, limbs);
+			}
+			else
+				job->count[thread_idx] += mpn_popcount(op1_buf, limbs);
+		}
+	}
+
+	_mpz_disk_close(op1_file);
+	_mpz_disk_close(op2_file);
+	_mpz_disk_buffer_free(op1_buf);
+	_mpz_disk_buffer_free(op2_buf);
+}
+
+static mp_bitcnt_t _mpz_disk_count(mpz_disk_ptr op1, mpz_disk_ptr op2, size_t op1_low, size_t op2_low)
+{
+	_mpz_disk_count_job job;
+
+	job.op1 = op1;
+	job.op2 = op2;
+	job.op1_limbs = mpz_disk_size(op1);
+	job.op2_limbs = op2 ? mpz_disk_size(op2) : 0;
+	job.op1_low = op1_low;
+	job.op2_low = op2_low;
+	job.limbs = max(job.op1_limbs, job.op2_limbs);
+	job.error = 0;
+
+	// The threads share the memory of a single mpz_disk_add() block
+	int n_threads = _mpz_disk_op_threads();
+	size_t buffers = n_threads * (op2 ? 2 : 1);
+	job.limbs_in_buffer = max(_mpz_disk_op_mem() / 3 / sizeof(mp_limb_t) / buffers, 1);
+
+	// Don't start threads that would have less than a buffer to count
+	job.limbs_per_thread = max((job.limbs + n_threads - 1) / n_threads, job.limbs_in_buffer);
+	n_threads = (int)((job.limbs + job.limbs_per_thread - 1) / job.limbs_per_thread);
+
+	_mpz_disk_run_threads(n_threads, _mpz_disk_count_thread, &job);
+
+	if (job.error)
+		return ~(mp_bitcnt_t)0;
+
+	mp_bitcnt_t count = 0;
+	for (int i = 0; i < n_threads; i++)
+		count += job.count[i];
+
+	return count;
+}
+
+// The threads scan interleaved chunks from the bottom up, so the chunks in
+// flight are always close to the lowest unscanned one
+typedef struct
+{
+	mpz_disk_ptr op;
+	size_t op_limbs;
+	mp_bitcnt_t starting_bit;
+	int bit;
+	size_t n_chunks, limbs_in_chunk;
+	int n_threads;
+	// Lowest matching bit found so far by any thread
+	volatile int64_t found;
+	int error;
+} _mpz_disk_scan_job;
+
+static void _mpz_disk_scan_thread(void* arg, int thread_idx)
+{
+	_mpz_disk_scan_job* job = arg;
+
+	size_t start_limb = job->starting_bit / GMP_NUMB_BITS;
+
+	_mpz_disk_handle* fp = _mpz_disk_open(job->op, _MPZ_DISK_OPEN_READ);
+	mp_limb_t* buf = _mpz_disk_buffer_alloc(job->limbs_in_chunk * sizeof(mp_limb_t));
+
+	if (!fp || !buf) {
+		job->error = 1;
+		_mpz_disk_close(fp);
+		_mpz_disk_buffer_free(buf);
+		return;
+	}
+
+	for (size_t chunk = thread_idx; chunk < job->n_chunks; chunk += job->n_threads)
+	{
+		size_t offset = start_limb + chunk * job->limbs_in_chunk;
+
+		// Stop as soon as a lower chunk has a match
+		if ((int64_t)offset * GMP_NUMB_BITS > job->found)
+			break;
+
+		size_t limbs = min(job->limbs_in_chunk, job->op_limbs - offset);
+		if (_mpz_disk_read_limbs(fp, buf, limbs, offset, job->op_limbs) != 0) {
+			job->error = 1;
+			break;
+		}
+
+		for (size_t i = 0; i < limbs; i++)
+		{
+			mp_limb_t limb = job->bit ? buf[i] : ~buf[i];
+
+			// Ignore the bits below the starting bit
+			if (offset + i == start_limb)
+				limb &= ~(mp_limb_t)0 << (job->starting_bit % GMP_NUMB_BITS);
+
+			if (limb != 0) {
+				_mpz_disk_atomic_min(&job->found, (int64_t)(offset + i) * GMP_NUMB_BITS + mpn_scan1(&limb, 0));
+				break;
+			}
+		}
+	}
+
+	_mpz_disk_close(fp);
+	_mpz_disk_buffer_free(buf);
+}
+
+// Index of the first 'bit' (0 or 1) at or after starting_bit in |op|
+static mp_bitcnt_t _mpz_disk_scan(mpz_disk_ptr op, mp_bitcnt_t starting_bit, int bit)
+{
+	_mpz_disk_scan_job job;
+
+	job.op = op;
+	job.op_limbs = mpz_disk_size(op);
+	job.starting_bit = starting_bit;
+	job.bit = bit;
+	job.found = INT64_MAX;
+	job.error = 0;
+
+	size_t start_limb = starting_bit / GMP_NUMB_BITS;
+	size_t limbs = job.op_limbs > start_limb ? job.op_limbs - start_limb : 0;
+
+	job.n_threads = _mpz_disk_op_threads();
+	job.limbs_in_chunk = max(_mpz_disk_op_mem() / 3 / sizeof(mp_limb_t) / job.n_threads, 1);
+	job.n_chunks = (limbs + job.limbs_in_chunk - 1) / job.limbs_in_chunk;
+	job.n_threads = (int)min((size_t)job.n_threads, job.n_chunks);
+
+	if (job.n_chunks > 0)
+		_mpz_disk_run_threads(job.n_threads, _mpz_disk_scan_thread, &job);
+
+	if (job.error)
+		return ~(mp_bitcnt_t)0;
+
+	if (job.found != INT64_MAX)
+		return job.found;
+
+	// |op| is followed by infinitely many zeroes
+	if (bit == 0)
+		return max(starting_bit, (mp_bitcnt_t)job.op_limbs * GMP_NUMB_BITS);
+	return ~(mp_bitcnt_t)0;
+}
+
+mp_bitcnt_t mpz_disk_popcount(mpz_disk_ptr op)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_COUNT);
+	mp_bitcnt_t ret = ~(mp_bitcnt_t)0;
+
+	if (_mpz_disk_get_sign(op) == MPZ_DISK_SIGN_POSITIVE)
+		ret = _mpz_disk_count(op, NULL, SIZE_MAX, SIZE_MAX);
+
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+mp_bitcnt_t mpz_disk_hamdist(mpz_disk_ptr op1, mpz_disk_ptr op2)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_COUNT);
+	int op1_sign = _mpz_disk_get_sign(op1), op2_sign = _mpz_disk_get_sign(op2);
+	mp_bitcnt_t ret = ~(mp_bitcnt_t)0;
+
+	if (op1_sign == op2_sign && op1_sign == MPZ_DISK_SIGN_NEGATIVE)
+		ret = _mpz_disk_count(op1, op2,
+			_mpz_disk_scan(op1, 0, 1) / GMP_NUMB_BITS,
+			_mpz_disk_scan(op2, 0, 1) / GMP_NUMB_BITS);
+	else if (op1_sign == op2_sign)
+		ret = _mpz_disk_count(op1, op2, SIZE_MAX, SIZE_MAX);
+
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+// The two's complement of a negative op has zeroes below the lowest one
+// bit of |op|, then that bit, then the complement of |op|. So scans on
+// negative numbers turn into scans of |op| for the opposite bit.
+
+mp_bitcnt_t mpz_disk_scan0(mpz_disk_ptr op, mp_bitcnt_t starting_bit)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_COUNT);
+	mp_bitcnt_t ret;
+
+	if (_mpz_disk_get_sign(op) == MPZ_DISK_SIGN_POSITIVE)
+		ret = _mpz_disk_scan(op, starting_bit, 0);
+	else {
+		mp_bitcnt_t lowest_one = _mpz_disk_scan(op, 0, 1);
+		ret = starting_bit < lowest_one ? starting_bit : _mpz_disk_scan(op, max(starting_bit, lowest_one + 1), 1);
+	}
+
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+mp_bitcnt_t mpz_disk_scan1(mpz_disk_ptr op, mp_bitcnt_t starting_bit)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_COUNT);
+	mp_bitcnt_t ret;
+
+	if (_mpz_disk_get_sign(op) == MPZ_DISK_SIGN_POSITIVE)
+		ret = _mpz_disk_scan(op, starting_bit, 1);
+	else {
+		mp_bitcnt_t lowest_one = _mpz_disk_scan(op, 0, 1);
+		ret = starting_bit <= lowest_one ? lowest_one : _mpz_disk_scan(op, starting_bit, 0);
+	}
+
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+// Splits the write of mpz_disk_set_mpz() over the threads, one contiguous
+// range of limbs per thread, written straight from the limbs of the mpz_t
+typedef struct
+{
+	mpz_disk_ptr rop;
+	const mp_limb_t* limbs_in;
+	size_t limbs, limbs_per_thread;
+	int sparse;
+	int error;
+} _mpz_disk_set_job;
+
+// Zero ranges are left out in pieces of _mpz_disk_piece_limbs() limbs.
+// Returns the end of the piece offset is in.
+static size_t _mpz_disk_set_piece_end(size_t offset, size_t end)
+{
+	return min((offset / _mpz_disk_piece_limbs() + 1) * _mpz_disk_piece_limbs(), end);
+}
+
+// mpn_zero_p() is only inlined by gmp.h, MPIR doesn't export it
+static int _mpz_disk_zero_p(const mp_limb_t* limbs, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		if (limbs[i] != 0)
+			return 0;
+
+	return 1;
+}
+
+static int _mpz_disk_set_hole(_mpz_disk_set_job* job, size_t offset, size_t end)
+{
+	return job->sparse && _mpz_disk_zero_p(job->limbs_in + offset, _mpz_disk_set_piece_end(offset, end) - offset);
+}
+
+static void _mpz_disk_set_thread(void* arg, int thread_idx)
+{
+	_mpz_disk_set_job* job = arg;
+
+	size_t begin = thread_idx * job->limbs_per_thread;
+	size_t end = min(begin + job->limbs_per_thread, job->limbs);
+
+	_mpz_disk_handle* fp = _mpz_disk_open(job->rop, _MPZ_DISK_OPEN_WRITE);
+	if (!fp) {
+		job->error = 1;
+		return;
+	}
+
+	// One write per run of pieces that aren't left out
+	size_t offset = begin;
+	while (offset < end)
+	{
+		while (offset < end && _mpz_disk_set_hole(job, offset, end))
+			offset = _mpz_disk_set_piece_end(offset, end);
+
+		size_t run_end = offset;
+		while (run_end < end && !_mpz_disk_set_hole(job, run_end, end))
+			run_end = _mpz_disk_set_piece_end(run_end, end);
+
+		if (run_end > offset && _mpz_disk_write_limbs(fp, job->limbs_in + offset, run_end - offset, offset) != 0) {
+			job->error = 1;
+			break;
+		}
+
+		offset = run_end;
+	}
+
+	_mpz_disk_close(fp);
+}
+
+static int _mpz_disk_set_mpz(mpz_disk_ptr rop, mpz_srcptr op)
+{
+	_mpz_disk_set_job job;
+
+	job.rop = rop;
+	job.limbs_in = op->_mp_d;
+	job.limbs = abs(op->_mp_size);
+	job.sparse = _mpz_disk_sparse;
+	job.error = 0;
+
+	_mpz_disk_handle* mp_file = _mpz_disk_open(rop, _MPZ_DISK_OPEN_CREATE);
+	if (!mp_file)
+		return -1;
+
+	if (_mpz_disk_set_sign(rop, op->_mp_size < 0 ? MPZ_DISK_SIGN_NEGATIVE : MPZ_DISK_SIGN_POSITIVE) != 0) {
+		_mpz_disk_close(mp_file);
+		return -1;
+	}
+
+	// Sized up front, so that the threads write into place and the ranges
+	// that are left out read as zero
+	if (_mpz_disk_prepare_files(mp_file, job.limbs, job.sparse) != 0) {
+		_mpz_disk_close(mp_file);
+		return -1;
+	}
+
+	// Don't start threads that would have less than a mpz_disk_add() block
+	// to write, and give them whole pieces
+	int n_threads = _mpz_disk_op_threads();
+	size_t limbs_in_block = max(_mpz_disk_op_mem() / 3 / sizeof(mp_limb_t), 1);
+	job.limbs_per_thread = max((job.limbs + n_threads - 1) / n_threads, limbs_in_block);
+	job.limbs_per_thread += (_mpz_disk_piece_limbs() - job.limbs_per_thread % _mpz_disk_piece_limbs()) % _mpz_disk_piece_limbs();
+	n_threads = (int)((job.limbs + job.limbs_per_thread - 1) / job.limbs_per_thread);
+
+	if (n_threads > 0)
+		_mpz_disk_run_threads(n_threads, _mpz_disk_set_thread, &job);
+
+	_mpz_disk_close(mp_file);
+
+	return job.error ? -1 : 0;
+}
+
+int mpz_disk_set_mpz(mpz_disk_ptr rop, mpz_srcptr op)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_SET_MPZ);
+	int ret = _mpz_disk_set_mpz(rop, op);
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+// Splits the read of mpz_disk_get_mpz() over the threads, one contiguous
+// range of limbs per thread, read straight into the limbs of the mpz_t
+typedef struct
+{
+	mpz_disk_ptr op;
+	mp_limb_t* limbs_out;
+	size_t limbs, limbs_per_thread;
+	int error;
+} _mpz_disk_get_job;
+
+static void _mpz_disk_get_thread(void* arg, int thread_idx)
+{
+	_mpz_disk_get_job* job = arg;
+
+	size_t begin = thread_idx * job->limbs_per_thread;
+	size_t end = min(begin + job->limbs_per_thread, job->limbs);
+
+	_mpz_disk_handle* fp = _mpz_disk_open(job->op, _MPZ_DISK_OPEN_READ);
+	if (!fp) {
+		job->error = -1;
+		return;
+	}
+
+	int ret = _mpz_disk_read_limbs(fp, job->limbs_out + begin, end - begin, begin, job->limbs);
+	if (ret)
+		job->error = ret;
+	_mpz_disk_close(fp);
+}
+
+static int _mpz_disk_get_mpz(mpz_ptr mpz, mpz_disk_ptr op)
+{
+	_mpz_disk_get_job job;
+
+	job.op = op;
+	job.limbs = mpz_disk_size(op);
+	job.error = 0;
+
+	if (job.limbs == 0) {
+		mpz_set_ui(mpz, 0);
+		return 0;
+	}
+
+	// Reuses the allocation of mpz if it is large enough
+	job.limbs_out = mpz_limbs_write(mpz, (mp_size_t)job.limbs);
+
+	// Don't start threads that would have less than a mpz_disk_add() block to read
+	int n_threads = _mpz_disk_op_threads();
+	size_t limbs_in_block = max(_mpz_disk_op_mem() / 3 / sizeof(mp_limb_t), 1);
+	job.limbs_per_thread = max((job.limbs + n_threads - 1) / n_threads, limbs_in_block);
+	// Whole pieces per thread
+	job.limbs_per_thread += (_mpz_disk_piece_limbs() - job.limbs_per_thread % _mpz_disk_piece_limbs()) % _mpz_disk_piece_limbs();
+	n_threads = (int)((job.limbs + job.limbs_per_thread - 1) / job.limbs_per_thread);
+
+	_mpz_disk_run_threads(n_threads, _mpz_disk_get_thread, &job);
+
+	if (job.error) {
+		mpz_limbs_finish(mpz, 0);
+		return job.error;
+	}
+
+	// mpz_limbs_finish() drops the leading zero limbs (e.g. a zero is
+	// stored as a single zero limb)
+	mp_size_t size = (mp_size_t)job.limbs;
+	mpz_limbs_finish(mpz, _mpz_disk_get_sign(op) == MPZ_DISK_SIGN_NEGATIVE ? -size : size);
+
+	return 0;
+}
+
+int mpz_disk_get_mpz(mpz_ptr mpz, mpz_disk_ptr op)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_GET_MPZ);
+	int ret = _mpz_disk_get_mpz(mpz, op);
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+int mpz_disk_map_ro(mpz_ptr view, mpz_disk_ptr op)
+{
+	size_t limbs = mpz_disk_size(op);
+
+	// The handle stays referenced until mpz_disk_unmap()
+	_mpz_disk_handle* fp = _mpz_disk_open(op, _MPZ_DISK_OPEN_READ);
+	if (!fp)
+		return -1;
+
+	const mp_limb_t* map = _mpz_disk_map(fp, limbs);
+	if (!map) {
+		_mpz_disk_close(fp);
+		return -1;
+	}
+
+	// mpz_roinit_n() drops the leading zero limbs
+	mp_size_t size = (mp_size_t)limbs;
+	mpz_roinit_n(view, map, _mpz_disk_get_sign(op) == MPZ_DISK_SIGN_NEGATIVE ? -size : size);
+
+	return 0;
+}
+
+int mpz_disk_unmap(mpz_ptr view, mpz_disk_ptr op)
+{
+	_mpz_disk_handle* fp = op->handle;
+	if (!fp)
+		return -1;
+
+	_mpz_disk_unmap(fp, view->_mp_d);
+	_mpz_disk_close(fp);
+
+	return 0;
+}
+
+static mp_limb_t _mpz_disk_byteswap_limb(mp_limb_t limb)
+{
+#if GMP_LIMB_BITS == 64
+#ifdef _WIN32
+	return _byteswap_uint64(limb);
+#elif defined(__unix__)
+	return __builtin_bswap64(limb);
+#endif
+#elif GMP_LIMB_BITS == 32
+#ifdef _WIN32
+	return _byteswap_ulong(limb);
+#elif defined(__unix__)
+	return __builtin_bswap32(limb);
+#endif
+#else
+#error "Limbs of other than 32 or 64 bits aren't supported"
+#endif
+}
+
+// Reverse the order of the bytes of limbs [0, n), which turns limbs into
+// the big-endian bytes of the mpz_out_raw() format and back. The swaps are
+// done in a separate pass that compilers vectorize into byte shuffles.
+static void _mpz_disk_reverse_bytes(mp_limb_t* limbs, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		limbs[i] = _mpz_disk_byteswap_limb(limbs[i]);
+
+	for (size_t i = 0; i < n / 2; i++)
+	{
+		mp_limb_t limb = limbs[i];
+		limbs[i] = limbs[n - 1 - i];
+		limbs[n - 1 - i] = limb;
+	}
+}
+
+// Number of leading zero bytes of a limb
+static size_t _mpz_disk_leading_zero_bytes(mp_limb_t limb)
+{
+	size_t n = 0;
+	while (n < sizeof(mp_limb_t) && (limb >> (8 * (sizeof(mp_limb_t) - 1 - n))) == 0)
+		n++;
+
+	return n;
+}
+
+static size_t _mpz_disk_out_raw(FILE* stream, mpz_disk_ptr op)
+{
+	if (_mpz_disk_normalize(op) != 0)
+		return 0;
+
+	size_t limbs = mpz_disk_size(op);
+
+	_mpz_disk_handle* fp = _mpz_disk_open(op, _MPZ_DISK_OPEN_READ);
+	if (!fp)
+		return 0;
+
+	// Blocks from the most significant end down, the first one takes the
+	// odd limbs so that the others are aligned
+	size_t limbs_in_block = max(_mpz_disk_op_mem() / 3 / sizeof(mp_limb_t), 1);
+	limbs_in_block = max(min(limbs_in_block, limbs), 1);
+	mp_limb_t* block = _mpz_disk_buffer_alloc(limbs_in_block * sizeof(mp_limb_t));
+
+	mp_limb_t top_limb = 0;
+	int failed = limbs > 0 && _mpz_disk_read_limbs(fp, &top_limb, 1, limbs - 1, limbs) != 0;
+
+	size_t leading_zeros = limbs > 0 ? _mpz_disk_leading_zero_bytes(top_limb) : 0;
+	size_t bytes = limbs * sizeof(mp_limb_t) - leading_zeros;
+
+	// The size prefix is 32 bits, negated for negative integers
+	if (failed || !block || bytes > INT32_MAX) {
+		_mpz_disk_close(fp);
+		_mpz_disk_buffer_free(block);
+		return 0;
+	}
+
+	int32_t size = _mpz_disk_get_sign(op) == MPZ_DISK_SIGN_NEGATIVE ? -(int32_t)bytes : (int32_t)bytes;
+	unsigned char header[4] = { (unsigned char)(size >> 24), (unsigned char)(size >> 16), (unsigned char)(size >> 8), (unsigned char)size };
+
+	failed = fwrite(header, 1, 4, stream) != 4;
+
+	size_t end = limbs;
+	size_t n = limbs % limbs_in_block ? limbs % limbs_in_block : limbs_in_block;
+	while (end > 0 && !failed)
+	{
+		if (_mpz_disk_read_limbs(fp, block, n, end - n, limbs) != 0) {
+			failed = 1;
+			break;
+		}
+		if (end > n)
+			_mpz_disk_prefetch_limbs(fp, end - n - limbs_in_block, limbs_in_block);
+
+		_mpz_disk_reverse_bytes(block, n);
+
+		// The leading zeros of the top limb aren't written
+		size_t skip = end == limbs ? leading_zeros : 0;
+		failed = fwrite((char*)block + skip, 1, n * sizeof(mp_limb_t) - skip, stream) != n * sizeof(mp_limb_t) - skip;
+
+		end -= n;
+		n = limbs_in_block;
+	}
+
+	_mpz_disk_close(fp);
+	_mpz_disk_buffer_free(block);
+
+	return failed ? 0 : 4 + bytes;
+}
+
+size_t mpz_disk_out_raw(FILE* stream, mpz_disk_ptr op)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_RAW);
+	size_t ret = _mpz_disk_out_raw(stream, op);
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+static size_t _mpz_disk_inp_raw(mpz_disk_ptr rop, FILE* stream)
+{
+	unsigned char header[4];
+	if (fread(header, 1, 4, stream) != 4)
+		return 0;
+
+	int32_t size = (int32_t)((uint32_t)header[0] << 24 | (uint32_t)header[1] << 16 | (uint32_t)header[2] << 8 | header[3]);
+	size_t bytes = size < 0 ? (size_t)-(int64_t)size : (size_t)size;
+	size_t limbs = (bytes + sizeof(mp_limb_t) - 1) / sizeof(mp_limb_t);
+
+	// Bytes the top limb is short of a full limb
+	size_t pad = limbs * sizeof(mp_limb_t) - bytes;
+
+	_mpz_disk_handle* fp = _mpz_disk_open(rop, _MPZ_DISK_OPEN_CREATE);
+	if (!fp)
+		return 0;
+
+	size_t limbs_in_block = _mpz_disk_summary_align(max(_mpz_disk_op_mem() / 3 / sizeof(mp_limb_t), 1));
+	limbs_in_block = max(min(limbs_in_block, limbs), 1);
+	mp_limb_t* block = _mpz_disk_buffer_alloc(limbs_in_block * sizeof(mp_limb_t));
+
+	int failed = !block || _mpz_disk_prepare_files(fp, limbs, 0) != 0;
+
+	// The stream starts with the most significant bytes, so the blocks are
+	// written from the top down, same as mpz_disk_out_raw() reads them
+	size_t end = limbs;
+	size_t n = limbs % limbs_in_block ? limbs % limbs_in_block : limbs_in_block;
+	while (end > 0 && !failed)
+	{
+		size_t skip = end == limbs ? pad : 0;
+		memset(block, 0, skip);
+		failed = fread((char*)block + skip, 1, n * sizeof(mp_limb_t) - skip, stream) != n * sizeof(mp_limb_t) - skip;
+
+		_mpz_disk_reverse_bytes(block, n);
+
+		failed = failed || _mpz_disk_write_limbs(fp, block, n, end - n) != 0;
+
+		end -= n;
+		n = limbs_in_block;
+	}
+
+	_mpz_disk_close(fp);
+	_mpz_disk_buffer_free(block);
+
+	if (failed)
+		return 0;
+
+	// Other writers may leave leading zero bytes
+	if (_mpz_disk_set_sign(rop, size < 0 && bytes > 0 ? MPZ_DISK_SIGN_NEGATIVE : MPZ_DISK_SIGN_POSITIVE) != 0 ||
+		_mpz_disk_normalize(rop) != 0)
+		return 0;
+
+	return 4 + bytes;
+}
+
+size_t mpz_disk_inp_raw(mpz_disk_ptr rop, FILE* stream)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_RAW);
+	size_t ret = _mpz_disk_inp_raw(rop, stream);
+	_mpz_disk_stats_end(stats);
+
+	return ret;
+}
+
+size_t mpz_disk_size(mpz_disk_ptr mpd)
+{
+	_mpz_disk_handle* fp = _mpz_disk_open(mpd, _MPZ_DISK_OPEN_READ);
+	if (!fp)
+		return 0;
+
+	int64_t size = _mpz_disk_handle_size(fp);
+	_mpz_disk_close(fp);
+
+	if (size < 0)
+		return 0;
+
+	size_t nlimbs = size / sizeof(mp_limb_t);
+	if (nlimbs * sizeof(mp_limb_t) < (size_t)size)
+		nlimbs += 1;
+
+	return nlimbs;
+}
+
+void _mpz_disk_get_sign_filename(char* dest, mpz_disk_ptr rop)
+{
+	// Same name as the limb file, with the .tmp extension replaced by .sgn
+	size_t name_len = strlen(rop->filename) - 4;
+
+	memcpy(dest, rop->filename, name_len);
+	strcpy(&dest[name_len], ".sgn");
+}
+
+void _mpz_disk_get_journal_filename(char* dest, mpz_disk_ptr op)
+{
+	// Same name as the limb file, with the .tmp extension replaced by .jnl
+	size_t name_len = strlen(op->filename) - 4;
+
+	memcpy(dest, op->filename, name_len);
+	strcpy(&dest[name_len], ".jnl");
+}
+
+void _mpz_disk_get_index_filename(char* dest, mpz_disk_ptr op)
+{
+	// Same name as the limb file, with the .tmp extension replaced by .idx
+	size_t name_len = strlen(op->filename) - 4;
+
+	memcpy(dest, op->filename, name_len);
+	strcpy(&dest[name_len], ".idx");
+}
+
+void _mpz_disk_get_summary_filename(char* dest, mpz_disk_ptr op)
+{
+	// Same name as the limb file, with the .tmp extension replaced by .sum
+	size_t name_len = strlen(op->filename) - 4;
+
+	memcpy(dest, op->filename, name_len);
+	strcpy(&dest[name_len], ".sum");
+}
+
+void _mpz_disk_get_checksum_filename(char* dest, mpz_disk_ptr op)
+{
+	// Same name as the limb file, with the .tmp extension replaced by .crc
+	size_t name_len = strlen(op->filename) - 4;
+
+	memcpy(dest, op->filename, name_len);
+	strcpy(&dest[name_len], ".crc");
+}
+
+int _mpz_disk_get_sign(mpz_disk_ptr op)
+{
+	if (op->sign >= 0)
+		return op->sign;
+
+	char sign_filename[MPZ_DISK_FILENAME_LEN];
+	_mpz_disk_get_sign_filename(sign_filename, op);
+
+	// Only negative integers have a sign file
+	_mpz_disk_fd sign_file = _mpz_disk_io_open(op->backend, sign_filename, _MPZ_DISK_OPEN_READ);
+	if (sign_file == _MPZ_DISK_INVALID_FD)
+		return op->sign = MPZ_DISK_SIGN_POSITIVE;
+
+	char sign = MPZ_DISK_SIGN_POSITIVE;
+	_mpz_disk_io_pread(sign_file, &sign, 1, 0);
+	_mpz_disk_io_close(sign_file);
+
+	return op->sign = sign;
+}
+
+int _mpz_disk_write_sign_file(mpz_disk_ptr rop, int sign)
+{
+	char sign_filename[MPZ_DISK_FILENAME_LEN];
+	_mpz_disk_get_sign_filename(sign_filename, rop);
+
+	if (sign == MPZ_DISK_SIGN_POSITIVE) {
+		_mpz_disk_io_remove(rop->backend, sign_filename);
+		return 0;
+	}
+
+	_mpz_disk_fd sign_file = _mpz_disk_io_open(rop->backend, sign_filename, _MPZ_DISK_OPEN_CREATE);
+	if (sign_file == _MPZ_DISK_INVALID_FD)
+		return -1;
+
+	char mp_sign = MPZ_DISK_SIGN_NEGATIVE;
+	int ret = _mpz_disk_io_pwrite(sign_file, &mp_sign, 1, 0);
+	_mpz_disk_io_close(sign_file);
+
+	return ret;
+}
+
+int _mpz_disk_set_sign(mpz_disk_ptr rop, int sign)
+{
+	// The sign file is only touched when the sign changes, and not at all
+	// while the limbs are in memory
+	if (rop->sign == sign)
+		return 0;
+
+	if (_mpz_disk_in_memory(rop)) {
+		rop->sign = sign;
+		return 0;
+	}
+
+	rop->sign = -1;
+
+	if (_mpz_disk_write_sign_file(rop, sign) != 0)
+		return -1;
+
+	rop->sign = sign;
+
+	return 0;
+}
+
+// Number of threads used by the parallel routines, 0 = one per CPU
+static int _mpz_disk_num_threads = 0;
+
+void mpz_disk_set_num_threads(int num_threads)
+{
+	_mpz_disk_num_threads = num_threads;
+}
+
+static int _mpz_disk_cpu_count()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#elif defined(__unix__)
+	return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+int mpz_disk_get_num_threads()
+{
+	int num_threads = _mpz_disk_num_threads;
+
+	if (num_threads <= 0)
+		num_threads = _mpz_disk_cpu_count();
+
+	return max(min(num_threads, MPZ_DISK_MAX_THREADS), 1);
+}
+
+typedef struct
+{
+	_mpz_disk_thread_func func;
+	void* arg;
+	int thread_idx;
+	int stats_op;	// Operation of the thread that started it
+} _mpz_disk_thread_task;
+
+#ifdef _WIN32
+static DWORD WINAPI _mpz_disk_thread_entry(LPVOID param)
+#elif defined(__unix__)
+static void* _mpz_disk_thread_entry(void* param)
+#endif
+{
+	_mpz_disk_thread_task* task = param;
+
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin_thread(task->stats_op);
+	task->func(task->arg, task->thread_idx);
+	_mpz_disk_stats_end(stats);
+
+	return 0;
+}
+
+int _mpz_disk_run_threads(int n_threads, _mpz_disk_thread_func func, void* arg)
+{
+	_mpz_disk_thread_task tasks[MPZ_DISK_MAX_THREADS];
+	int started[MPZ_DISK_MAX_THREADS] = { 0 };
+#ifdef _WIN32
+	HANDLE threads[MPZ_DISK_MAX_THREADS];
+#elif defined(__unix__)
+	pthread_t threads[MPZ_DISK_MAX_THREADS];
+#endif
+
+	n_threads = max(min(n_threads, MPZ_DISK_MAX_THREADS), 1);
+
+	// Thread #0 is the calling thread
+	for (int i = 1; i < n_threads; i++)
+	{
+		tasks[i].func = func;
+		tasks[i].arg = arg;
+		tasks[i].thread_idx = i;
+		tasks[i].stats_op = _mpz_disk_stats_current();
+
+#ifdef _WIN32
+		threads[i] = CreateThread(NULL, 0, _mpz_disk_thread_entry, &tasks[i], 0, NULL);
+		started[i] = threads[i] != NULL;
+#elif defined(__unix__)
+		started[i] = pthread_create(&threads[i], NULL, _mpz_disk_thread_entry, &tasks[i]) == 0;
+#endif
+	}
+
+	func(arg, 0);
+
+	int64_t wait_start = _mpz_disk_stats_now();
+
+	for (int i = 1; i < n_threads; i++)
+	{
+		// Do the work here if the thread couldn't be created
+		if (!started[i]) {
+			int64_t start = _mpz_disk_stats_now();
+			func(arg, i);
+			wait_start += _mpz_disk_stats_now() - start;
+			continue;
+		}
+
+#ifdef _WIN32
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#elif defined(__unix__)
+		pthread_join(threads[i], NULL);
+#endif
+	}
+
+	_mpz_disk_stats_wait(wait_start);
+
+	return 0;
+}
+
+void _mpz_disk_atomic_min(volatile int64_t* target, int64_t value)
+{
+	int64_t current;
+
+	while ((current = *target) > value)
+	{
+#ifdef _WIN32
+		if (InterlockedCompareExchange64((volatile LONG64*)target, value, current) == current)
+			break;
+#elif defined(__unix__)
+		if (__sync_bool_compare_and_swap(target, current, value))
+			break;
+#endif
+	}
+}
+
+void _mpz_disk_atomic_max(volatile int64_t* target, int64_t value)
+{
+	int64_t current;
+
+	while ((current = *target) < value)
+	{
+#ifdef _WIN32
+		if (InterlockedCompareExchange64((volatile LONG64*)target, value, current) == current)
+			break;
+#elif defined(__unix__)
+		if (__sync_bool_compare_and_swap(target, current, value))
+			break;
+#endif
+	}
+}
+
+int64_t _mpz_disk_atomic_add(volatile int64_t* target, int64_t value)
+{
+#ifdef _WIN32
+	return InterlockedExchangeAdd64((volatile LONG64*)target, value);
+#elif defined(__unix__)
+	return __sync_fetch_and_add(target, value);
+#endif
+}
+
+int _mpz_disk_atomic_cas(volatile int64_t* target, int64_t expected, int64_t value)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchange64((volatile LONG64*)target, value, expected) == expected;
+#elif defined(__unix__)
+	return __sync_bool_compare_and_swap(target, expected, value);
+#endif
+}
+
+// Lock for short critical sections of process-wide state, needs no initialization
+static void _mpz_disk_spin_lock(volatile long* lock)
+{
+#ifdef _WIN32
+	while (InterlockedCompareExchange(lock, 1, 0) != 0)
+		SwitchToThread();
+#elif defined(__unix__)
+	while (__sync_lock_test_and_set(lock, 1))
+		sched_yield();
+#endif
+}
+
+static void _mpz_disk_spin_unlock(volatile long* lock)
+{
+#ifdef _WIN32
+	InterlockedExchange(lock, 0);
+#elif defined(__unix__)
+	__sync_lock_release(lock);
+#endif
+}
+
+// Pool of workers that run submitted tasks (see mpz_disk_pool_start()).
+// Tasks are queued in a bounded lock-free queue, where the sequence number
+// of each cell says whether it is free for the enqueue position that maps
+// to it or holds the task for the dequeue position, and a semaphore counts
+// them for the idle workers to sleep on.
+#define _MPZ_DISK_QUEUE_SIZE 1024
+
+#ifdef _WIN32
+typedef HANDLE _mpz_disk_sem;
+#elif defined(__unix__)
+typedef sem_t _mpz_disk_sem;
+#endif
+
+// What to do once a task has finished: call func(result, arg), or with no
+// func count off one of the dependencies of task
+typedef struct _mpz_disk_task_link_struct
+{
+	mpz_disk_done_func func;
+	void* arg;
+	mpz_disk_task task;
+	struct _mpz_disk_task_link_struct* next;
+} _mpz_disk_task_link;
+
+struct _mpz_disk_task_struct
+{
+	mpz_disk_task_func func;
+	void* arg;
+	// Freed along with the task (the arguments of the _async operations)
+	void* owned;
+	// Set before done, both through the atomic helpers, so whoever sees
+	// done sees the result
+	volatile int64_t result;
+	volatile int64_t done;
+	// One for the handle and one for the pool until the task has run, the
+	// last one to let go frees it
+	volatile int64_t refs;
+	// Unfinished dependencies, plus one while they are being linked, and
+	// the result of the first one that failed
+	volatile int64_t pending;
+	volatile int64_t dep_result;
+	// Guards done and links
+	volatile long lock;
+	_mpz_disk_task_link* links;
+	_mpz_disk_sem finished;
+};
+
+typedef struct
+{
+	volatile int64_t seq;
+	mpz_disk_task task;
+} _mpz_disk_queue_cell;
+
+static _mpz_disk_queue_cell _mpz_disk_queue[_MPZ_DISK_QUEUE_SIZE];
+static volatile int64_t _mpz_disk_queue_head = 0, _mpz_disk_queue_tail = 0;
+
+static int _mpz_disk_pool_workers = 0;
+static volatile int _mpz_disk_pool_stopping = 0;
+static _mpz_disk_sem _mpz_disk_pool_queued;
+#ifdef _WIN32
+static HANDLE _mpz_disk_pool_threads[MPZ_DISK_MAX_THREADS];
+static __declspec(thread) int _mpz_disk_pool_worker = 0;
+#elif defined(__unix__)
+static pthread_t _mpz_disk_pool_threads[MPZ_DISK_MAX_THREADS];
+static __thread int _mpz_disk_pool_worker = 0;
+#endif
+
+static int _mpz_disk_sem_init(_mpz_disk_sem* sem)
+{
+#ifdef _WIN32
+	*sem = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+	return *sem ? 0 : -1;
+#elif defined(__unix__)
+	return sem_init(sem, 0, 0);
+#endif
+}
+
+static void _mpz_disk_sem_destroy(_mpz_disk_sem* sem)
+{
+#ifdef _WIN32
+	CloseHandle(*sem);
+#elif defined(__unix__)
+	sem_destroy(sem);
+#endif
+}
+
+static void _mpz_disk_sem_post(_mpz_disk_sem* sem)
+{
+#ifdef _WIN32
+	ReleaseSemaphore(*sem, 1, NULL);
+#elif defined(__unix__)
+	sem_post(sem);
+#endif
+}
+
+static void _mpz_disk_sem_wait(_mpz_disk_sem* sem)
+{
+#ifdef _WIN32
+	WaitForSingleObject(*sem, INFINITE);
+#elif defined(__unix__)
+	while (sem_wait(sem) != 0 && errno == EINTR)
+		;
+#endif
+}
+
+// Returns -1 if the queue is full
+static int _mpz_disk_queue_push(mpz_disk_task task)
+{
+	for (;;)
+	{
+		int64_t pos = _mpz_disk_queue_tail;
+		_mpz_disk_queue_cell* cell = &_mpz_disk_queue[pos % _MPZ_DISK_QUEUE_SIZE];
+		int64_t seq = _mpz_disk_atomic_add(&cell->seq, 0);
+
+		if (seq == pos) {
+			if (_mpz_disk_atomic_cas(&_mpz_disk_queue_tail, pos, pos + 1)) {
+				cell->task = task;
+				_mpz_disk_atomic_add(&cell->seq, 1);
+
+				return 0;
+			}
+		}
+		else if (seq < pos)
+			return -1;
+	}
+}
+
+// Returns NULL if the queue is empty
+static mpz_disk_task _mpz_disk_queue_pop()
+{
+	for (;;)
+	{
+		int64_t pos = _mpz_disk_queue_head;
+		_mpz_disk_queue_cell* cell = &_mpz_disk_queue[pos % _MPZ_DISK_QUEUE_SIZE];
+		int64_t seq = _mpz_disk_atomic_add(&cell->seq, 0);
+
+		if (seq == pos + 1) {
+			if (_mpz_disk_atomic_cas(&_mpz_disk_queue_head, pos, pos + 1)) {
+				mpz_disk_task task = cell->task;
+				_mpz_disk_atomic_add(&cell->seq, _MPZ_DISK_QUEUE_SIZE - 1);
+
+				return task;
+			}
+		}
+		else if (seq < pos + 1)
+			return NULL;
+	}
+}
+
+static int _mpz_disk_queue_empty()
+{
+	return _mpz_disk_atomic_add(&_mpz_disk_queue_head, 0) == _mpz_disk_atomic_add(&_mpz_disk_queue_tail, 0);
+}
+
+// A worker waiting for a task sleeps until a task finishes or another one
+// is queued, as the task it waits for may need one that is queued later
+#ifdef _WIN32
+static SRWLOCK _mpz_disk_pool_wait_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE _mpz_disk_pool_changed = CONDITION_VARIABLE_INIT;
+#elif defined(__unix__)
+static pthread_mutex_t _mpz_disk_pool_wait_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _mpz_disk_pool_changed = PTHREAD_COND_INITIALIZER;
+#endif
+static volatile int64_t _mpz_disk_pool_sleeping = 0;
+
+static void _mpz_disk_pool_notify()
+{
+	if (!_mpz_disk_atomic_add(&_mpz_disk_pool_sleeping, 0))
+		return;
+
+#ifdef _WIN32
+	AcquireSRWLockExclusive(&_mpz_disk_pool_wait_lock);
+	WakeAllConditionVariable(&_mpz_disk_pool_changed);
+	ReleaseSRWLockExclusive(&_mpz_disk_pool_wait_lock);
+#elif defined(__unix__)
+	pthread_mutex_lock(&_mpz_disk_pool_wait_lock);
+	pthread_cond_broadcast(&_mpz_disk_pool_changed);
+	pthread_mutex_unlock(&_mpz_disk_pool_wait_lock);
+#endif
+}
+
+// Sleep until task is done or the queue isn't empty. Notifiers change
+// either before they look for sleepers, so none is missed.
+static void _mpz_disk_pool_sleep(mpz_disk_task task)
+{
+#ifdef _WIN32
+	AcquireSRWLockExclusive(&_mpz_disk_pool_wait_lock);
+#elif defined(__unix__)
+	pthread_mutex_lock(&_mpz_disk_pool_wait_lock);
+#endif
+
+	_mpz_disk_atomic_add(&_mpz_disk_pool_sleeping, 1);
+
+	while (!_mpz_disk_atomic_add(&task->done, 0) && _mpz_disk_queue_empty())
+	{
+#ifdef _WIN32
+		SleepConditionVariableSRW(&_mpz_disk_pool_changed, &_mpz_disk_pool_wait_lock, INFINITE, 0);
+#elif defined(__unix__)
+		pthread_cond_wait(&_mpz_disk_pool_changed, &_mpz_disk_pool_wait_lock);
+#endif
+	}
+
+	_mpz_disk_atomic_add(&_mpz_disk_pool_sleeping, -1);
+
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(&_mpz_disk_pool_wait_lock);
+#elif defined(__unix__)
+	pthread_mutex_unlock(&_mpz_disk_pool_wait_lock);
+#endif
+}
+
+static void _mpz_disk_task_release(mpz_disk_task task)
+{
+	if (_mpz_disk_atomic_add(&task->refs, -1) == 1) {
+		_mpz_disk_sem_destroy(&task->finished);
+		free(task->owned);
+		free(task);
+	}
+}
+
+// Add link to the ones run when task finishes, 1 if it has finished already
+static int _mpz_disk_task_link_to(mpz_disk_task task, _mpz_disk_task_link* link)
+{
+	_mpz_disk_spin_lock(&task->lock);
+
+	int done = task->done != 0;
+	if (!done) {
+		link->next = task->links;
+		task->links = link;
+	}
+
+	_mpz_disk_spin_unlock(&task->lock);
+
+	return done;
+}
+
+// Only read once done has been seen set
+static int _mpz_disk_task_result(mpz_disk_task task)
+{
+	return (int)_mpz_disk_atomic_add(&task->result, 0);
+}
+
+static void _mpz_disk_pool_enqueue(mpz_disk_task task);
+
+// Count off a dependency of task that finished with dep_result, and queue
+// the task once none are left
+static void _mpz_disk_task_ready(mpz_disk_task task, int dep_result)
+{
+	if (dep_result)
+		_mpz_disk_atomic_cas(&task->dep_result, 0, dep_result);
+
+	if (_mpz_disk_atomic_add(&task->pending, -1) == 1)
+		_mpz_disk_pool_enqueue(task);
+}
+
+// Tasks running at once share the memory and the threads of the operations
+static void _mpz_disk_pool_run(mpz_disk_task task)
+{
+	// A task whose dependency failed fails the same way without running
+	int result = (int)_mpz_disk_atomic_add(&task->dep_result, 0);
+	if (!result) {
+		_mpz_disk_atomic_add(&_mpz_disk_pool_running, 1);
+		result = task->func(task->arg);
+		_mpz_disk_atomic_add(&_mpz_disk_pool_running, -1);
+	}
+
+	_mpz_disk_atomic_add(&task->result, result);
+
+	_mpz_disk_spin_lock(&task->lock);
+	_mpz_disk_atomic_add(&task->done, 1);
+	_mpz_disk_task_link* links = task->links;
+	task->links = NULL;
+	_mpz_disk_spin_unlock(&task->lock);
+
+	while (links)
+	{
+		_mpz_disk_task_link* link = links;
+		links = link->next;
+
+		if (link->func)
+			link->func(result, link->arg);
+		else
+			_mpz_disk_task_ready(link->task, result);
+
+		free(link);
+	}
+
+	_mpz_disk_sem_post(&task->finished);
+	_mpz_disk_pool_notify();
+	_mpz_disk_task_release(task);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI _mpz_disk_pool_entry(LPVOID param)
+#elif defined(__unix__)
+static void* _mpz_disk_pool_entry(void* param)
+#endif
+{
+	_mpz_disk_pool_worker = 1;
+
+	for (;;)
+	{
+		_mpz_disk_sem_wait(&_mpz_disk_pool_queued);
+
+		// Tasks run by waiting workers leave wake-ups with nothing to do
+		mpz_disk_task task = _mpz_disk_queue_pop();
+		if (task)
+			_mpz_disk_pool_run(task);
+		else if (_mpz_disk_pool_stopping)
+			break;
+	}
+
+	return 0;
+}
+
+int mpz_disk_pool_start(int n_workers)
+{
+	if (_mpz_disk_pool_workers)
+		return -1;
+
+	n_workers = min(n_workers > 0 ? n_workers : _mpz_disk_cpu_count(), MPZ_DISK_MAX_THREADS);
+
+	for (int i = 0; i < _MPZ_DISK_QUEUE_SIZE; i++)
+		_mpz_disk_queue[i].seq = i;
+	_mpz_disk_queue_head = _mpz_disk_queue_tail = 0;
+	_mpz_disk_pool_stopping = 0;
+
+	if (_mpz_disk_sem_init(&_mpz_disk_pool_queued) != 0)
+		return -1;
+
+	for (int i = 0; i < n_workers; i++)
+	{
+#ifdef _WIN32
+		_mpz_disk_pool_threads[i] = CreateThread(NULL, 0, _mpz_disk_pool_entry, NULL, 0, NULL);
+		int started = _mpz_disk_pool_threads[i] != NULL;
+#elif defined(__unix__)
+		int started = pthread_create(&_mpz_disk_pool_threads[i], NULL, _mpz_disk_pool_entry, NULL) == 0;
+#endif
+		if (!started)
+			break;
+
+		_mpz_disk_pool_workers++;
+	}
+
+	if (!_mpz_disk_pool_workers) {
+		_mpz_disk_sem_destroy(&_mpz_disk_pool_queued);
+		return -1;
+	}
+
+	return 0;
+}
+
+void mpz_disk_pool_stop()
+{
+	if (!_mpz_disk_pool_workers)
+		return;
+
+	// Each worker leaves once it finds the queue empty
+	_mpz_disk_pool_stopping = 1;
+	for (int i = 0; i < _mpz_disk_pool_workers; i++)
+		_mpz_disk_sem_post(&_mpz_disk_pool_queued);
+
+	for (int i = 0; i < _mpz_disk_pool_workers; i++)
+	{
+#ifdef _WIN32
+		WaitForSingleObject(_mpz_disk_pool_threads[i], INFINITE);
+		CloseHandle(_mpz_disk_pool_threads[i]);
+#elif defined(__unix__)
+		pthread_join(_mpz_disk_pool_threads[i], NULL);
+#endif
+	}
+
+	_mpz_disk_sem_destroy(&_mpz_disk_pool_queued);
+	_mpz_disk_pool_workers = 0;
+}
+
+static void _mpz_disk_pool_enqueue(mpz_disk_task task)
+{
+	// Without a pool it runs right away
+	if (!_mpz_disk_pool_workers) {
+		_mpz_disk_pool_run(task);
+		return;
+	}
+
+	// While the queue is full, take tasks off it and run them here
+	while (_mpz_disk_queue_push(task) != 0)
+	{
+		mpz_disk_task queued = _mpz_disk_queue_pop();
+		if (queued)
+			_mpz_disk_pool_run(queued);
+	}
+
+	_mpz_disk_sem_post(&_mpz_disk_pool_queued);
+	_mpz_disk_pool_notify();
+}
+
+static mpz_disk_task _mpz_disk_submit_owned(mpz_disk_task_func func, void* arg, void* owned, int n_deps, const mpz_disk_task* deps)
+{
+	mpz_disk_task task = malloc(sizeof(struct _mpz_disk_task_struct));
+	if (!task) {
+		free(owned);
+		return NULL;
+	}
+
+	if (_mpz_disk_sem_init(&task->finished) != 0) {
+		free(owned);
+		free(task);
+		return NULL;
+	}
+
+	task->func = func;
+	task->arg = arg;
+	task->owned = owned;
+	task->result = 0;
+	task->done = 0;
+	task->refs = 2;
+	task->pending = 1;
+	task->dep_result = 0;
+	task->lock = 0;
+	task->links = NULL;
+
+	// The links are all allocated before any is made, so that a task that
+	// can't be made never runs
+	_mpz_disk_task_link* links = NULL;
+	for (int i = 0; i < n_deps; i++)
+	{
+		if (!deps[i])
+			continue;
+
+		_mpz_disk_task_link* link = malloc(sizeof(_mpz_disk_task_link));
+		if (!link) {
+			while (links) {
+				link = links;
+				links = link->next;
+				free(link);
+			}
+
+			_mpz_disk_sem_destroy(&task->finished);
+			free(owned);
+			free(task);
+			return NULL;
+		}
+
+		link->func = NULL;
+		link->arg = NULL;
+		link->task = task;
+		link->next = links;
+		links = link;
+	}
+
+	for (int i = 0; i < n_deps; i++)
+	{
+		if (!deps[i])
+			continue;
+
+		_mpz_disk_task_link* link = links;
+		links = link->next;
+
+		_mpz_disk_atomic_add(&task->pending, 1);
+		if (_mpz_disk_task_link_to(deps[i], link)) {
+			free(link);
+			_mpz_disk_task_ready(task, _mpz_disk_task_result(deps[i]));
+		}
+	}
+
+	// Queued here unless a dependency is still to finish
+	_mpz_disk_task_ready(task, 0);
+
+	return task;
+}
+
+mpz_disk_task mpz_disk_submit(mpz_disk_task_func func, void* arg)
+{
+	return _mpz_disk_submit_owned(func, arg, NULL, 0, NULL);
+}
+
+mpz_disk_task mpz_disk_submit_after(mpz_disk_task_func func, void* arg, int n_deps, const mpz_disk_task* deps)
+{
+	return _mpz_disk_submit_owned(func, arg, NULL, n_deps, deps);
+}
+
+int mpz_disk_wait(mpz_disk_task task)
+{
+	// A worker would wait for tasks that may be queued behind the one it
+	// runs, or be queued later, so it runs queued tasks until it is done
+	while (!_mpz_disk_atomic_add(&task->done, 0))
+	{
+		if (!_mpz_disk_pool_worker) {
+			_mpz_disk_sem_wait(&task->finished);
+			continue;
+		}
+
+		mpz_disk_task queued = _mpz_disk_queue_pop();
+
+		if (queued)
+			_mpz_disk_pool_run(queued);
+		else
+			_mpz_disk_pool_sleep(task);
+	}
+
+	int result = _mpz_disk_task_result(task);
+	_mpz_disk_task_release(task);
+
+	return result;
+}
+
+int mpz_disk_poll(mpz_disk_task task)
+{
+	return _mpz_disk_atomic_add(&task->done, 0) != 0;
+}
+
+int mpz_disk_on_complete(mpz_disk_task task, mpz_disk_done_func func, void* arg)
+{
+	_mpz_disk_task_link* link = malloc(sizeof(_mpz_disk_task_link));
+	if (!link)
+		return -1;
+
+	link->func = func;
+	link->arg = arg;
+	link->task = NULL;
+
+	if (_mpz_disk_task_link_to(task, link)) {
+		free(link);
+		func(_mpz_disk_task_result(task), arg);
+	}
+
+	return 0;
+}
+
+void mpz_disk_detach(mpz_disk_task task)
+{
+	_mpz_disk_task_release(task);
+}
+
+// The _async operations start the pool themselves, so that they never run
+// on the thread of the caller
+static volatile long _mpz_disk_pool_start_lock = 0;
+
+static void _mpz_disk_pool_ensure()
+{
+	if (_mpz_disk_pool_workers)
+		return;
+
+	_mpz_disk_spin_lock(&_mpz_disk_pool_start_lock);
+	if (!_mpz_disk_pool_workers)
+		mpz_disk_pool_start(0);
+	_mpz_disk_spin_unlock(&_mpz_disk_pool_start_lock);
+}
+
+typedef struct
+{
+	mpz_disk_ptr rop;
+	mpz_disk_ptr op1;
+	mpz_disk_ptr op2;
+	int subtract;
+} _mpz_disk_addsub_args;
+
+static int _mpz_disk_addsub_task(void* arg)
+{
+	_mpz_disk_addsub_args* args = arg;
+
+	if (args->subtract)
+		return mpz_disk_sub(args->rop, args->op1, args->op2);
+	else
+		return mpz_disk_add(args->rop, args->op1, args->op2);
+}
+
+static mpz_disk_task _mpz_disk_addsub_async(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2, int subtract, int n_deps, const mpz_disk_task* deps)
+{
+	_mpz_disk_addsub_args* args = malloc(sizeof(_mpz_disk_addsub_args));
+	if (!args)
+		return NULL;
+
+	args->rop = rop;
+	args->op1 = op1;
+	args->op2 = op2;
+	args->subtract = subtract;
+
+	_mpz_disk_pool_ensure();
+
+	return _mpz_disk_submit_owned(_mpz_disk_addsub_task, args, args, n_deps, deps);
+}
+
+mpz_disk_task mpz_disk_add_async(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_t op2, int n_deps, const mpz_disk_task* deps)
+{
+	return _mpz_disk_addsub_async(rop, op1, op2, 0, n_deps, deps);
+}
+
+mpz_disk_task mpz_disk_sub_async(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_t op2, int n_deps, const mpz_disk_task* deps)
+{
+	return _mpz_disk_addsub_async(rop, op1, op2, 1, n_deps, deps);
+}
+
+// Pool of page-aligned block buffers shared by all streaming routines, so
+// that back-to-back operations reuse the memory instead of page-faulting
+// in fresh allocations every time. Buffers that are given back are kept
+// for reuse while the idle ones add up to no more than the cap.
+typedef struct _mpz_disk_buffer_struct
+{
+	void* ptr;
+	size_t bytes;
+	int in_use;
+	struct _mpz_disk_buffer_struct* next;
+} _mpz_disk_buffer;
+
+static _mpz_disk_buffer* _mpz_disk_buffers = NULL;
+static size_t _mpz_disk_idle_bytes = 0;
+static size_t _mpz_disk_pool_max_bytes = MPZ_DISK_POOL_AUTO;
+static int _mpz_disk_pool_huge_pages = 0;
+
+// The pool is only locked for a few list operations
+static volatile long _mpz_disk_pool_lock = 0;
+
+static void _mpz_disk_pool_acquire()
+{
+	_mpz_disk_spin_lock(&_mpz_disk_pool_lock);
+}
+
+static void _mpz_disk_pool_release()
+{
+	_mpz_disk_spin_unlock(&_mpz_disk_pool_lock);
+}
+
+// By default the idle buffers are kept up to half of the memory an
+// operation may use, which leaves the rest to the block cache and to the
+// buffers the operations have in use
+static size_t _mpz_disk_pool_cap()
+{
+	return _mpz_disk_pool_max_bytes == MPZ_DISK_POOL_AUTO ? _mpz_disk_op_mem() / 2 : _mpz_disk_pool_max_bytes;
+}
+
+// Map at least *bytes bytes of fresh pages, *bytes is set to the size mapped
+static void* _mpz_disk_pages_alloc(size_t* bytes, int huge_pages)
+{
+#ifdef _WIN32
+	// Large pages need the "Lock pages in memory" privilege, without it
+	// this fails and normal pages are used
+	SIZE_T large_page = GetLargePageMinimum();
+	if (huge_pages && large_page) {
+		size_t size = (*bytes + large_page - 1) / large_page * large_page;
+
+		void* p = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (p) {
+			*bytes = size;
+			return p;
+		}
+	}
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	*bytes = (*bytes + info.dwPageSize - 1) / info.dwPageSize * info.dwPageSize;
+
+	return VirtualAlloc(NULL, *bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__unix__)
+	void* p;
+
+#ifdef MAP_HUGETLB
+	// Only works if huge pages have been reserved, otherwise fall back to
+	// transparent huge pages
+	if (huge_pages) {
+		size_t size = (*bytes + _MPZ_DISK_HUGE_PAGE_BYTES - 1) / _MPZ_DISK_HUGE_PAGE_BYTES * _MPZ_DISK_HUGE_PAGE_BYTES;
+
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			*bytes = size;
+			return p;
+		}
+	}
+#endif
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	*bytes = (*bytes + page - 1) / page * page;
+
+	p = mmap(NULL, *bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+#ifdef MADV_HUGEPAGE
+	if (huge_pages)
+		madvise(p, *bytes, MADV_HUGEPAGE);
+#endif
+
+	return p;
+#endif
+}
+
+static void _mpz_disk_pages_free(void* p, size_t bytes)
+{
+#ifdef _WIN32
+	VirtualFree(p, 0, MEM_RELEASE);
+#elif defined(__unix__)
+	munmap(p, bytes);
+#endif
+}
+
+// Unmap idle buffers until they take up no more than max_idle_bytes
+static void _mpz_disk_pool_trim(size_t max_idle_bytes)
+{
+	_mpz_disk_buffer* released = NULL;
+
+	_mpz_disk_pool_acquire();
+
+	for (_mpz_disk_buffer** b = &_mpz_disk_buffers; *b && _mpz_disk_idle_bytes > max_idle_bytes; )
+	{
+		if ((*b)->in_use) {
+			b = &(*b)->next;
+			continue;
+		}
+
+		_mpz_disk_buffer* buffer = *b;
+		*b = buffer->next;
+		_mpz_disk_idle_bytes -= buffer->bytes;
+
+		buffer->next = released;
+		released = buffer;
+	}
+
+	_mpz_disk_pool_release();
+
+	while (released)
+	{
+		_mpz_disk_buffer* next = released->next;
+
+		_mpz_disk_pages_free(released->ptr, released->bytes);
+		free(released);
+
+		released = next;
+	}
+}
+
+void* _mpz_disk_buffer_alloc(size_t bytes)
+{
+	bytes = max(bytes, 1);
+
+	// Smallest idle buffer that is large enough
+	_mpz_disk_pool_acquire();
+
+	_mpz_disk_buffer* best = NULL;
+	for (_mpz_disk_buffer* b = _mpz_disk_buffers; b; b = b->next)
+		if (!b->in_use && b->bytes >= bytes && (!best || b->bytes < best->bytes))
+			best = b;
+
+	if (best) {
+		best->in_use = 1;
+		_mpz_disk_idle_bytes -= best->bytes;
+	}
+
+	_mpz_disk_pool_release();
+
+	if (best) {
+		_mpz_disk_stats_buffers(best->bytes);
+		return best->ptr;
+	}
+
+	_mpz_disk_buffer* buffer = malloc(sizeof(_mpz_disk_buffer));
+	if (!buffer)
+		return NULL;
+
+	buffer->bytes = bytes;
+	buffer->ptr = _mpz_disk_pages_alloc(&buffer->bytes, _mpz_disk_pool_huge_pages);
+
+	// The idle buffers are too small, make room for a new one
+	if (!buffer->ptr) {
+		_mpz_disk_pool_trim(0);
+
+		buffer->bytes = bytes;
+		buffer->ptr = _mpz_disk_pages_alloc(&buffer->bytes, _mpz_disk_pool_huge_pages);
+	}
+
+	if (!buffer->ptr) {
+		free(buffer);
+		return NULL;
+	}
+
+	buffer->in_use = 1;
+
+	_mpz_disk_pool_acquire();
+	buffer->next = _mpz_disk_buffers;
+	_mpz_disk_buffers = buffer;
+	_mpz_disk_pool_release();
+
+	_mpz_disk_stats_buffers(buffer->bytes);
+
+	return buffer->ptr;
+}
+
+void _mpz_disk_buffer_free(void* ptr)
+{
+	if (!ptr)
+		return;
+
+	_mpz_disk_pool_acquire();
+
+	_mpz_disk_buffer* buffer;
+	for (buffer = _mpz_disk_buffers; buffer; buffer = buffer->next)
+		if (buffer->ptr == ptr)
+			break;
+
+	assert(buffer && buffer->in_use);
+
+	buffer->in_use = 0;
+	_mpz_disk_idle_bytes += buffer->bytes;
+	size_t bytes = buffer->bytes;
+
+	_mpz_disk_pool_release();
+
+	_mpz_disk_stats_buffers(-(int64_t)bytes);
+
+	_mpz_disk_pool_trim(_mpz_disk_pool_cap());
+}
+
+int mpz_disk_set_buffer_pool(size_t max_bytes, int huge_pages)
+{
+	_mpz_disk_pool_max_bytes = max_bytes;
+	_mpz_disk_pool_huge_pages = huge_pages;
+
+	_mpz_disk_pool_trim(_mpz_disk_pool_cap());
+
+	return 0;
+}
+
+void mpz_disk_release_buffers()
+{
+	_mpz_disk_pool_trim(0);
+}
+
+int mpz_disk_set_memory_threshold(size_t bytes)
+{
+	_mpz_disk_max_memory_limbs = bytes / sizeof(mp_limb_t);
+
+	return 0;
+}
+
+int mpz_disk_set_sparse(int enabled)
+{
+	_mpz_disk_sparse = enabled != 0;
+
+	return 0;
+}
+
+int mpz_disk_set_compression(int enabled, size_t chunk_bytes)
+{
+	if (chunk_bytes == 0)
+		chunk_bytes = MPZ_DISK_DEFAULT_CHUNK_BYTES;
+
+	// The index stores chunk sizes in 32 bits
+	if (chunk_bytes > ((size_t)1 << 30))
+		return -1;
+
+	_mpz_disk_chunk_limbs = enabled ? max(chunk_bytes / sizeof(mp_limb_t), 1) : 0;
+
+	return 0;
+}
+
+int mpz_disk_set_stripe_dirs(const char** dirs, int n_dirs, size_t stripe_bytes)
+{
+	if (n_dirs < 0 || n_dirs > MPZ_DISK_MAX_STRIPE_DIRS)
+		return -1;
+
+	for (int i = 0; i < n_dirs; i++)
+		if (strlen(dirs[i]) >= MPZ_DISK_MAX_PATH)
+			return -1;
+
+	for (int i = 0; i < n_dirs; i++)
+		strcpy(_mpz_disk_stripe_dirs[i], dirs[i]);
+
+	_mpz_disk_n_stripe_dirs = n_dirs;
+	_mpz_disk_stripe_limbs = max(stripe_bytes / sizeof(mp_limb_t), 1);
+
+	return 0;
+}
+
+void _mpz_disk_get_stripe_filename(char* dest, mpz_disk_ptr op, int stripe_dir)
+{
+	if (op->stripe_dirs == 0)
+		strcpy(dest, op->filename);
+	else
+		sprintf(dest, "%s/%s", _mpz_disk_stripe_dirs[stripe_dir], op->filename);
+}
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION _mpz_disk_mutex;
+#elif defined(__unix__)
+typedef pthread_mutex_t _mpz_disk_mutex;
+#endif
+
+static void _mpz_disk_mutex_init(_mpz_disk_mutex* mutex)
+{
+#ifdef _WIN32
+	InitializeCriticalSection(mutex);
+#elif defined(__unix__)
+	pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static void _mpz_disk_mutex_destroy(_mpz_disk_mutex* mutex)
+{
+#ifdef _WIN32
+	DeleteCriticalSection(mutex);
+#elif defined(__unix__)
+	pthread_mutex_destroy(mutex);
+#endif
+}
+
+static void _mpz_disk_mutex_lock(_mpz_disk_mutex* mutex)
+{
+#ifdef _WIN32
+	EnterCriticalSection(mutex);
+#elif defined(__unix__)
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+static void _mpz_disk_mutex_unlock(_mpz_disk_mutex* mutex)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(mutex);
+#elif defined(__unix__)
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+// Persistent worker threads for work that is handed out on every block,
+// where starting threads each time (see _mpz_disk_run_threads()) would cost
+// more than the work. Each worker takes its requests in order from a list
+// of its own. They are started on first use and run until the process ends.
+typedef struct _mpz_disk_worker_request_struct
+{
+	_mpz_disk_thread_func func;
+	void* arg;
+	int thread_idx;
+	int stats_op;
+	// Requests of the same call still running, plus one until the caller
+	// has queued them all; whoever brings it to zero posts done
+	volatile int64_t* pending;
+	_mpz_disk_sem* done;
+	struct _mpz_disk_worker_request_struct* next;
+} _mpz_disk_worker_request;
+
+typedef struct
+{
+	// 1 = running, -1 = couldn't be started, set through the atomic helpers
+	// once the rest is
+	volatile int64_t started;
+	_mpz_disk_mutex lock;
+	_mpz_disk_sem queued;
+	_mpz_disk_worker_request* head;
+	_mpz_disk_worker_request* tail;
+} _mpz_disk_worker;
+
+static volatile long _mpz_disk_workers_start_lock = 0;
+
+#ifdef _WIN32
+static DWORD WINAPI _mpz_disk_worker_entry(LPVOID param)
+#elif defined(__unix__)
+static void* _mpz_disk_worker_entry(void* param)
+#endif
+{
+	_mpz_disk_worker* worker = param;
+
+	for (;;)
+	{
+		_mpz_disk_sem_wait(&worker->queued);
+
+		_mpz_disk_mutex_lock(&worker->lock);
+		_mpz_disk_worker_request* request = worker->head;
+		worker->head = request->next;
+		if (!worker->head)
+			worker->tail = NULL;
+		_mpz_disk_mutex_unlock(&worker->lock);
+
+		_mpz_disk_stats_scope stats = _mpz_disk_stats_begin_thread(request->stats_op);
+		request->func(request->arg, request->thread_idx);
+		_mpz_disk_stats_end(stats);
+
+		// The request is gone once the caller is woken up
+		_mpz_disk_sem* done = request->done;
+		if (_mpz_disk_atomic_add(request->pending, -1) == 1)
+			_mpz_disk_sem_post(done);
+	}
+
+	return 0;
+}
+
+// Returns 0 if the worker is running
+static int _mpz_disk_worker_start(_mpz_disk_worker* worker)
+{
+	int64_t state = _mpz_disk_atomic_add(&worker->started, 0);
+	if (state)
+		return state > 0 ? 0 : -1;
+
+	_mpz_disk_spin_lock(&_mpz_disk_workers_start_lock);
+
+	if (!_mpz_disk_atomic_add(&worker->started, 0)) {
+		worker->head = worker->tail = NULL;
+		_mpz_disk_mutex_init(&worker->lock);
+
+		int started = _mpz_disk_sem_init(&worker->queued) == 0;
+		if (started) {
+#ifdef _WIN32
+			HANDLE thread = CreateThread(NULL, 0, _mpz_disk_worker_entry, worker, 0, NULL);
+			if ((started = thread != NULL))
+				CloseHandle(thread);
+#elif defined(__unix__)
+			pthread_t thread;
+			if ((started = pthread_create(&thread, NULL, _mpz_disk_worker_entry, worker) == 0))
+				pthread_detach(thread);
+#endif
+			if (!started)
+				_mpz_disk_sem_destroy(&worker->queued);
+		}
+
+		if (!started)
+			_mpz_disk_mutex_destroy(&worker->lock);
+
+		_mpz_disk_atomic_add(&worker->started, started ? 1 : -1);
+	}
+
+	_mpz_disk_spin_unlock(&_mpz_disk_workers_start_lock);
+
+	return _mpz_disk_atomic_add(&worker->started, 0) > 0 ? 0 : -1;
+}
+
+// Same as _mpz_disk_run_threads(), but func(arg, i) runs on
+// workers[(first + i) % n_workers] for i > 0. func must not hand out work
+// to the same workers.
+static void _mpz_disk_workers_run(_mpz_disk_worker* workers, int n_workers, int first, int n_threads, _mpz_disk_thread_func func, void* arg)
+{
+	_mpz_disk_worker_request requests[MPZ_DISK_MAX_THREADS];
+	int queued[MPZ_DISK_MAX_THREADS] = { 0 };
+	volatile int64_t pending = 1;
+	_mpz_disk_sem done;
+
+	n_threads = max(min(n_threads, MPZ_DISK_MAX_THREADS), 1);
+
+	// Thread #0 is the calling thread
+	int use_workers = n_threads > 1 && _mpz_disk_sem_init(&done) == 0;
+
+	for (int i = 1; i < n_threads && use_workers; i++)
+	{
+		_mpz_disk_worker* worker = &workers[(first + i) % n_workers];
+		if (_mpz_disk_worker_start(worker) != 0)
+			continue;
+
+		_mpz_disk_worker_request* request = &requests[i];
+		request->func = func;
+		request->arg = arg;
+		request->thread_idx = i;
+		request->stats_op = _mpz_disk_stats_current();
+		request->pending = &pending;
+		request->done = &done;
+		request->next = NULL;
+		_mpz_disk_atomic_add(&pending, 1);
+
+		_mpz_disk_mutex_lock(&worker->lock);
+		if (worker->tail)
+			worker->tail->next = request;
+		else
+			worker->head = request;
+		worker->tail = request;
+		_mpz_disk_mutex_unlock(&worker->lock);
+
+		_mpz_disk_sem_post(&worker->queued);
+		queued[i] = 1;
+	}
+
+	func(arg, 0);
+
+	int64_t wait_start = _mpz_disk_stats_now();
+
+	// Do the work here of the workers that couldn't be started
+	for (int i = 1; i < n_threads; i++)
+	{
+		if (queued[i])
+			continue;
+
+		int64_t start = _mpz_disk_stats_now();
+		func(arg, i);
+		wait_start += _mpz_disk_stats_now() - start;
+	}
+
+	if (use_workers) {
+		if (_mpz_disk_atomic_add(&pending, -1) != 1)
+			_mpz_disk_sem_wait(&done);
+		_mpz_disk_sem_destroy(&done);
+	}
+
+	_mpz_disk_stats_wait(wait_start);
+}
+
+typedef struct _mpz_disk_chunked_struct _mpz_disk_chunked;
+
+struct _mpz_disk_handle_struct
+{
+	// One file per stripe directory, or a single file if not striped
+	_mpz_disk_fd fds[MPZ_DISK_MAX_STRIPE_DIRS];
+	int n_fds;
+	size_t stripe_limbs;
+	// Chunk index of a compressed integer, NULL if stored as plain limbs
+	_mpz_disk_chunked* chunked;
+	// Summary of the limbs (see _mpz_disk_get_summary())
+	int keep_summary, summary_lost;
+	unsigned char* summary;
+	size_t n_summary, summary_alloc;
+	char summary_filename[MPZ_DISK_FILENAME_LEN];
+	// Checksums of the limbs (see mpz_disk_set_checksums())
+	int keep_checksums;
+	uint64_t* checksums;
+	size_t n_checksums, checksums_alloc;
+	char checksum_filename[MPZ_DISK_FILENAME_LEN];
+	int mode;
+	// Size of the limbs in bytes (-1 = unknown) and whether the top limb is
+	// known to be non-zero, both kept up to date by our own writes
+	int64_t size;
+	int normalized;
+	// Guards the summary, the checksums, the size and normalized
+	_mpz_disk_mutex lock;
+	// Whether this is the handle a mpz_disk_t keeps open, and how many
+	// _mpz_disk_open() calls on it haven't been closed yet
+	int kept;
+	volatile int64_t refs;
+	mpz_disk_ptr op;
+	const mpz_disk_backend_t* backend;
+	// Key of the blocks of this integer in the block cache
+	uint64_t cache_id;
+	// Limbs of a small integer that has no files yet (see
+	// mpz_disk_set_memory_threshold()), guarded by memory_lock
+	int in_memory;
+	mp_limb_t* memory;
+	size_t memory_limbs, memory_alloc, max_memory_limbs;
+	_mpz_disk_mutex memory_lock;
+	// Read-only view of the limbs (see mpz_disk_map_ro()): the mapped file,
+	// or a copy if the limbs aren't in a single plain file
+	const mp_limb_t* map;
+	size_t map_bytes;
+	int map_refs, map_copy;
+	void* map_object;	// File mapping object on Windows
+};
+
+// Plain files backend (see mpz_disk_file_backend_init()). Its files are the
+// native handles, with the invalid handle as NULL.
+#ifdef _WIN32
+typedef HANDLE _mpz_disk_native_fd;
+#elif defined(__unix__)
+typedef int _mpz_disk_native_fd;
+#endif
+
+static _mpz_disk_native_fd _mpz_disk_native(void* file)
+{
+#ifdef _WIN32
+	return (HANDLE)file;
+#elif defined(__unix__)
+	return (int)((intptr_t)file - 1);
+#endif
+}
+
+static void* _mpz_disk_file_open(void* ctx, const char* filename, int mode)
+{
+#ifdef _WIN32
+	size_t name_size = strlen(filename) + 1;
+	wchar_t* wfilename = malloc(name_size * sizeof(wchar_t));
+	mbstowcs(wfilename, filename, name_size);
+
+	HANDLE f = CreateFile
+	(
+		wfilename,
+		mode == _MPZ_DISK_OPEN_READ ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		mode == _MPZ_DISK_OPEN_CREATE ? CREATE_ALWAYS : mode == _MPZ_DISK_OPEN_WRITE ? OPEN_ALWAYS : OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+	);
+
+	free(wfilename);
+
+	return f == INVALID_HANDLE_VALUE ? NULL : f;
+#elif defined(__unix__)
+	int flags = O_RDONLY;
+	if (mode == _MPZ_DISK_OPEN_WRITE)
+		flags = O_RDWR | O_CREAT;
+	else if (mode == _MPZ_DISK_OPEN_CREATE)
+		flags = O_RDWR | O_CREAT | O_TRUNC;
+
+	int f = open(filename, flags, 0644);
+
+	return f < 0 ? NULL : (void*)((intptr_t)f + 1);
+#endif
+}
+
+static void _mpz_disk_file_close(void* ctx, void* file)
+{
+#ifdef _WIN32
+	CloseHandle(_mpz_disk_native(file));
+#elif defined(__unix__)
+	close(_mpz_disk_native(file));
+#endif
+}
+
+static size_t _mpz_disk_file_pread(void* ctx, void* file, void* buf, size_t bytes, int64_t offset)
+{
+	_mpz_disk_native_fd fd = _mpz_disk_native(file);
+	size_t bytes_read = 0;
+
+	while (bytes_read < bytes)
+	{
+#ifdef _WIN32
+		// ReadFile() can't read more than 4 GB at once
+		DWORD n = (DWORD)min(bytes - bytes_read, (size_t)1 << 30), n_read = 0;
+
+		OVERLAPPED pos = { 0 };
+		pos.Offset = (DWORD)(offset + bytes_read);
+		pos.OffsetHigh = (DWORD)((uint64_t)(offset + bytes_read) >> 32);
+
+		if (!ReadFile(fd, (char*)buf + bytes_read, n, &n_read, &pos) || n_read == 0)
+			break;
+#elif defined(__unix__)
+		ssize_t n_read = pread(fd, (char*)buf + bytes_read, bytes - bytes_read, offset + bytes_read);
+		if (n_read <= 0)
+			break;
+#endif
+		bytes_read += n_read;
+	}
+
+	return bytes_read;
+}
+
+static int _mpz_disk_file_pwrite(void* ctx, void* file, const void* buf, size_t bytes, int64_t offset)
+{
+	_mpz_disk_native_fd fd = _mpz_disk_native(file);
+	size_t bytes_written = 0;
+
+	while (bytes_written < bytes)
+	{
+#ifdef _WIN32
+		DWORD n = (DWORD)min(bytes - bytes_written, (size_t)1 << 30), n_written = 0;
+
+		OVERLAPPED pos = { 0 };
+		pos.Offset = (DWORD)(offset + bytes_written);
+		pos.OffsetHigh = (DWORD)((uint64_t)(offset + bytes_written) >> 32);
+
+		if (!WriteFile(fd, (const char*)buf + bytes_written, n, &n_written, &pos) || n_written == 0)
+			break;
+#elif defined(__unix__)
+		ssize_t n_written = pwrite(fd, (const char*)buf + bytes_written, bytes - bytes_written, offset + bytes_written);
+		if (n_written <= 0)
+			break;
+#endif
+		bytes_written += n_written;
+	}
+
+	return bytes_written == bytes ? 0 : -1;
+}
+
+static int _mpz_disk_file_truncate(void* ctx, void* file, int64_t size)
+{
+#ifdef _WIN32
+	LARGE_INTEGER pos;
+	pos.QuadPart = size;
+
+	return SetFilePointerEx(_mpz_disk_native(file), pos, NULL, FILE_BEGIN) && SetEndOfFile(_mpz_disk_native(file)) ? 0 : -1;
+#elif defined(__unix__)
+	return ftruncate(_mpz_disk_native(file), size);
+#endif
+}
+
+static int64_t _mpz_disk_file_size(void* ctx, void* file)
+{
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	return GetFileSizeEx(_mpz_disk_native(file), &size) ? size.QuadPart : -1;
+#elif defined(__unix__)
+	struct stat st;
+	return fstat(_mpz_disk_native(file), &st) == 0 ? st.st_size : -1;
+#endif
+}
+
+static int _mpz_disk_file_sync(void* ctx, void* file)
+{
+#ifdef _WIN32
+	return FlushFileBuffers(_mpz_disk_native(file)) ? 0 : -1;
+#elif defined(__unix__)
+	return fsync(_mpz_disk_native(file));
+#endif
+}
+
+static int64_t _mpz_disk_file_next_data(void* ctx, void* file, int64_t offset)
+{
+	int64_t size = _mpz_disk_file_size(ctx, file);
+	if (size < 0 || offset >= size)
+		return offset;
+
+#ifdef _WIN32
+	// The first allocated range from offset on
+	FILE_ALLOCATED_RANGE_BUFFER query, range;
+	query.FileOffset.QuadPart = offset;
+	query.Length.QuadPart = size - offset;
+
+	DWORD bytes = 0;
+	if (!DeviceIoControl(_mpz_disk_native(file), FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), &range, sizeof(range), &bytes, NULL) &&
+		GetLastError() != ERROR_MORE_DATA)
+		return offset;
+
+	return bytes < sizeof(range) ? size : max(range.FileOffset.QuadPart, offset);
+#elif defined(__unix__) && defined(SEEK_DATA)
+	off_t data = lseek(_mpz_disk_native(file), offset, SEEK_DATA);
+	if (data >= 0)
+		return data;
+
+	// Only holes up to the end
+	return errno == ENXIO ? size : offset;
+#else
+	return offset;
+#endif
+}
+
+// Allocate the disk space of the first 'size' bytes, so that writes into
+// them don't have to grow the file
+static int _mpz_disk_file_preallocate(void* ctx, void* file, int64_t size)
+{
+#ifdef _WIN32
+	FILE_ALLOCATION_INFO info;
+	info.AllocationSize.QuadPart = size;
+
+	if (!SetFileInformationByHandle(_mpz_disk_native(file), FileAllocationInfo, &info, sizeof(info)))
+		return -1;
+
+	return 0;
+#elif defined(__unix__)
+	return size > 0 && posix_fallocate(_mpz_disk_native(file), 0, size) != 0 ? -1 : 0;
+#endif
+}
+
+// Let the ranges that are never written stay holes when the file grows
+static int _mpz_disk_file_set_sparse(void* ctx, void* file)
+{
+#ifdef _WIN32
+	DWORD bytes;
+	if (!DeviceIoControl(_mpz_disk_native(file), FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL))
+		return -1;
+
+	return 0;
+#elif defined(__unix__)
+	// Files are sparse anyway
+	return 0;
+#endif
+}
+
+static int _mpz_disk_file_remove(void* ctx, const char* filename)
+{
+	return remove(filename);
+}
+
+static const mpz_disk_backend_t _mpz_disk_file_backend =
+{
+	_mpz_disk_file_open, _mpz_disk_file_close, _mpz_disk_file_pread, _mpz_disk_file_pwrite,
+	_mpz_disk_file_truncate, _mpz_disk_file_size, _mpz_disk_file_sync, _mpz_disk_file_next_data,
+	_mpz_disk_file_preallocate, _mpz_disk_file_set_sparse, _mpz_disk_file_remove, NULL
+};
+
+int mpz_disk_file_backend_init(mpz_disk_backend_t* backend)
+{
+	*backend = _mpz_disk_file_backend;
+
+	return 0;
+}
+
+// RAM backend (see mpz_disk_ram_backend_init()): the files are growable
+// buffers in a list, each with a lock of its own. A removed file that is
+// still open lives on until it is closed.
+typedef struct _mpz_disk_ram_file_struct
+{
+	char* filename;
+	unsigned char* data;
+	int64_t size, alloc;
+	int refs, removed;	// Guarded by the lock of the backend
+	_mpz_disk_mutex lock;	// Guards data, size and alloc
+	struct _mpz_disk_ram_file_struct* next;
+} _mpz_disk_ram_file;
+
+typedef struct
+{
+	_mpz_disk_ram_file* files;
+	_mpz_disk_mutex lock;
+} _mpz_disk_ram;
+
+static void _mpz_disk_ram_file_free(_mpz_disk_ram_file* f)
+{
+	_mpz_disk_mutex_destroy(&f->lock);
+	free(f->data);
+	free(f->filename);
+	free(f);
+}
+
+// Unlink the file from the list, freeing it if it isn't open
+static void _mpz_disk_ram_unlink(_mpz_disk_ram_file** link)
+{
+	_mpz_disk_ram_file* f = *link;
+	*link = f->next;
+
+	if (f->refs == 0)
+		_mpz_disk_ram_file_free(f);
+	else
+		f->removed = 1;
+}
+
+static _mpz_disk_ram_file** _mpz_disk_ram_find(_mpz_disk_ram* ram, const char* filename)
+{
+	_mpz_disk_ram_file** link = &ram->files;
+	while (*link && strcmp((*link)->filename, filename) != 0)
+		link = &(*link)->next;
+
+	return link;
+}
+
+// Grow the file to at least 'size' bytes, the new ones zero. Takes f->lock.
+static int _mpz_disk_ram_grow(_mpz_disk_ram_file* f, int64_t size)
+{
+	if (size <= f->size)
+		return 0;
+
+	if (size > f->alloc) {
+		int64_t alloc = max(size, 2 * f->alloc);
+
+		unsigned char* data = realloc(f->data, (size_t)alloc);
+		if (!data)
+			return -1;
+
+		f->data = data;
+		f->alloc = alloc;
+	}
+
+	memset(f->data + f->size, 0, (size_t)(size - f->size));
+	f->size = size;
+
+	return 0;
+}
+
+static void* _mpz_disk_ram_open(void* ctx, const char* filename, int mode)
+{
+	_mpz_disk_ram* ram = ctx;
+
+	_mpz_disk_mutex_lock(&ram->lock);
+
+	_mpz_disk_ram_file** link = _mpz_disk_ram_find(ram, filename);
+	_mpz_disk_ram_file* f = *link;
+
+	if (!f && mode != _MPZ_DISK_OPEN_READ) {
+		f = calloc(1, sizeof(_mpz_disk_ram_file));
+		if (f && (f->filename = malloc(strlen(filename) + 1))) {
+			strcpy(f->filename, filename);
+			_mpz_disk_mutex_init(&f->lock);
+			*link = f;
+		}
+		else {
+			free(f);
+			f = NULL;
+		}
+	}
+
+	if (f) {
+		f->refs++;
+
+		if (mode == _MPZ_DISK_OPEN_CREATE) {
+			_mpz_disk_mutex_lock(&f->lock);
+			f->size = 0;
+			_mpz_disk_mutex_unlock(&f->lock);
+		}
+	}
+
+	_mpz_disk_mutex_unlock(&ram->lock);
+
+	return f;
+}
+
+static void _mpz_disk_ram_close(void* ctx, void* file)
+{
+	_mpz_disk_ram* ram = ctx;
+	_mpz_disk_ram_file* f = file;
+
+	_mpz_disk_mutex_lock(&ram->lock);
+
+	if (--f->refs == 0 && f->removed)
+		_mpz_disk_ram_file_free(f);
+
+	_mpz_disk_mutex_unlock(&ram->lock);
+}
+
+static size_t _mpz_disk_ram_pread(void* ctx, void* file, void* buf, size_t bytes, int64_t offset)
+{
+	_mpz_disk_ram_file* f = file;
+
+	_mpz_disk_mutex_lock(&f->lock);
+
+	size_t bytes_read = offset < f->size ? (size_t)min((int64_t)bytes, f->size - offset) : 0;
+	if (bytes_read)
+		memcpy(buf, f->data + offset, bytes_read);
+
+	_mpz_disk_mutex_unlock(&f->lock);
+
+	return bytes_read;
+}
+
+static int _mpz_disk_ram_pwrite(void* ctx, void* file, const void* buf, size_t bytes, int64_t offset)
+{
+	_mpz_disk_ram_file* f = file;
+
+	_mpz_disk_mutex_lock(&f->lock);
+
+	int ret = _mpz_disk_ram_grow(f, offset + (int64_t)bytes);
+	if (ret == 0 && bytes)
+		memcpy(f->data + offset, buf, bytes);
+
+	_mpz_disk_mutex_unlock(&f->lock);
+
+	return ret;
+}
+
+static int _mpz_disk_ram_truncate(void* ctx, void* file, int64_t size)
+{
+	_mpz_disk_ram_file* f = file;
+
+	_mpz_disk_mutex_lock(&f->lock);
+
+	int ret = 0;
+	if (size < f->size)
+		f->size = size;
+	else
+		ret = _mpz_disk_ram_grow(f, size);
+
+	_mpz_disk_mutex_unlock(&f->lock);
+
+	return ret;
+}
+
+static int64_t _mpz_disk_ram_size(void* ctx, void* file)
+{
+	_mpz_disk_ram_file* f = file;
+
+	_mpz_disk_mutex_lock(&f->lock);
+	int64_t size = f->size;
+	_mpz_disk_mutex_unlock(&f->lock);
+
+	return size;
+}
+
+// Nothing to wait for, and no holes
+static int _mpz_disk_ram_sync(void* ctx, void* file)
+{
+	return 0;
+}
+
+static int64_t _mpz_disk_ram_next_data(void* ctx, void* file, int64_t offset)
+{
+	return offset;
+}
+
+static int _mpz_disk_ram_preallocate(void* ctx, void* file, int64_t size)
+{
+	return 0;
+}
+
+static int _mpz_disk_ram_set_sparse(void* ctx, void* file)
+{
+	return 0;
+}
+
+static int _mpz_disk_ram_remove(void* ctx, const char* filename)
+{
+	_mpz_disk_ram* ram = ctx;
+
+	_mpz_disk_mutex_lock(&ram->lock);
+
+	_mpz_disk_ram_file** link = _mpz_disk_ram_find(ram, filename);
+	int ret = *link ? 0 : -1;
+	if (*link)
+		_mpz_disk_ram_unlink(link);
+
+	_mpz_disk_mutex_unlock(&ram->lock);
+
+	return ret;
+}
+
+int mpz_disk_ram_backend_init(mpz_disk_backend_t* backend)
+{
+	_mpz_disk_ram* ram = calloc(1, sizeof(_mpz_disk_ram));
+	if (!ram)
+		return -1;
+
+	_mpz_disk_mutex_init(&ram->lock);
+
+	backend->open = _mpz_disk_ram_open;
+	backend->close = _mpz_disk_ram_close;
+	backend->pread = _mpz_disk_ram_pread;
+	backend->pwrite = _mpz_disk_ram_pwrite;
+	backend->truncate = _mpz_disk_ram_truncate;
+	backend->size = _mpz_disk_ram_size;
+	backend->sync = _mpz_disk_ram_sync;
+	backend->next_data = _mpz_disk_ram_next_data;
+	backend->preallocate = _mpz_disk_ram_preallocate;
+	backend->set_sparse = _mpz_disk_ram_set_sparse;
+	backend->remove = _mpz_disk_ram_remove;
+	backend->ctx = ram;
+
+	return 0;
+}
+
+void mpz_disk_ram_backend_clear(mpz_disk_backend_t* backend)
+{
+	_mpz_disk_ram* ram = backend->ctx;
+
+	while (ram->files)
+	{
+		_mpz_disk_ram_file* f = ram->files;
+		ram->files = f->next;
+		_mpz_disk_ram_file_free(f);
+	}
+
+	_mpz_disk_mutex_destroy(&ram->lock);
+	free(ram);
+	backend->ctx = NULL;
+}
+
+// Throttled backend (see mpz_disk_throttled_backend_init()): the files of
+// the inner backend, with the reads, writes and syncs queued up on a
+// simulated device that serves one of them at a time
+typedef struct
+{
+	mpz_disk_backend_t inner;
+	int64_t latency_ns, bytes_per_second;
+	// When the device is done with the requests so far
+	int64_t busy_until;
+	_mpz_disk_mutex lock;
+} _mpz_disk_throttle;
+
+static void _mpz_disk_sleep_ns(int64_t ns)
+{
+#ifdef _WIN32
+	Sleep((DWORD)((ns + 999999) / 1000000));
+#elif defined(__unix__)
+	struct timespec duration = { (time_t)(ns / 1000000000), (long)(ns % 1000000000) };
+	nanosleep(&duration, NULL);
+#endif
+}
+
+// Wait for the device to serve a request of 'bytes' bytes
+static void _mpz_disk_throttle_wait(_mpz_disk_throttle* t, size_t bytes)
+{
+	int64_t ns = t->latency_ns;
+	if (t->bytes_per_second > 0)
+		ns += (int64_t)((double)bytes * 1e9 / t->bytes_per_second);
+
+	_mpz_disk_mutex_lock(&t->lock);
+
+	int64_t now = _mpz_disk_now_ns();
+	int64_t done = max(now, t->busy_until) + ns;
+	t->busy_until = done;
+
+	_mpz_disk_mutex_unlock(&t->lock);
+
+	if (done > now)
+		_mpz_disk_sleep_ns(done - now);
+}
+
+static void* _mpz_disk_throttle_open(void* ctx, const char* filename, int mode)
+{
+	_mpz_disk_throttle* t = ctx;
+	return t->inner.open(t->inner.ctx, filename, mode);
+}
+
+static void _mpz_disk_throttle_close(void* ctx, void* file)
+{
+	_mpz_disk_throttle* t = ctx;
+	t->inner.close(t->inner.ctx, file);
+}
+
+static size_t _mpz_disk_throttle_pread(void* ctx, void* file, void* buf, size_t bytes, int64_t offset)
+{
+	_mpz_disk_throttle* t = ctx;
+	_mpz_disk_throttle_wait(t, bytes);
+
+	return t->inner.pread(t->inner.ctx, file, buf, bytes, offset);
+}
+
+static int _mpz_disk_throttle_pwrite(void* ctx, void* file, const void* buf, size_t bytes, int64_t offset)
+{
+	_mpz_disk_throttle* t = ctx;
+	_mpz_disk_throttle_wait(t, bytes);
+
+	return t->inner.pwrite(t->inner.ctx, file, buf, bytes, offset);
+}
+
+static int _mpz_disk_throttle_truncate(void* ctx, void* file, int64_t size)
+{
+	_mpz_disk_throttle* t = ctx;
+	return t->inner.truncate(t->inner.ctx, file, size);
+}
+
+static int64_t _mpz_disk_throttle_size(void* ctx, void* file)
+{
+	_mpz_disk_throttle* t = ctx;
+	return t->inner.size(t->inner.ctx, file);
+}
+
+static int _mpz_disk_throttle_sync(void* ctx, void* file)
+{
+	_mpz_disk_throttle* t = ctx;
+	_mpz_disk_throttle_wait(t, 0);
+
+	return t->inner.sync(t->inner.ctx, file);
+}
+
+static int64_t _mpz_disk_throttle_next_data(void* ctx, void* file, int64_t offset)
+{
+	_mpz_disk_throttle* t = ctx;
+	return t->inner.next_data(t->inner.ctx, file, offset);
+}
+
+static int _mpz_disk_throttle_preallocate(void* ctx, void* file, int64_t size)
+{
+	_mpz_disk_throttle* t = ctx;
+	return t->inner.preallocate(t->inner.ctx, file, size);
+}
+
+static int _mpz_disk_throttle_set_sparse(void* ctx, void* file)
+{
+	_mpz_disk_throttle* t = ctx;
+	return t->inner.set_sparse(t->inner.ctx, file);
+}
+
+static int _mpz_disk_throttle_remove(void* ctx, const char* filename)
+{
+	_mpz_disk_throttle* t = ctx;
+	return t->inner.remove(t->inner.ctx, filename);
+}
+
+int mpz_disk_throttled_backend_init(mpz_disk_backend_t* backend, const mpz_disk_backend_t* inner, int64_t latency_ns, int64_t bytes_per_second)
+{
+	_mpz_disk_throttle* t = calloc(1, sizeof(_mpz_disk_throttle));
+	if (!t)
+		return -1;
+
+	t->inner = inner ? *inner : _mpz_disk_file_backend;
+	t->latency_ns = latency_ns;
+	t->bytes_per_second = bytes_per_second;
+	_mpz_disk_mutex_init(&t->lock);
+
+	backend->open = _mpz_disk_throttle_open;
+	backend->close = _mpz_disk_throttle_close;
+	backend->pread = _mpz_disk_throttle_pread;
+	backend->pwrite = _mpz_disk_throttle_pwrite;
+	backend->truncate = _mpz_disk_throttle_truncate;
+	backend->size = _mpz_disk_throttle_size;
+	backend->sync = _mpz_disk_throttle_sync;
+	backend->next_data = _mpz_disk_throttle_next_data;
+	backend->preallocate = _mpz_disk_throttle_preallocate;
+	backend->set_sparse = _mpz_disk_throttle_set_sparse;
+	backend->remove = _mpz_disk_throttle_remove;
+	backend->ctx = t;
+
+	return 0;
+}
+
+void mpz_disk_throttled_backend_clear(mpz_disk_backend_t* backend)
+{
+	_mpz_disk_throttle* t = backend->ctx;
+
+	_mpz_disk_mutex_destroy(&t->lock);
+	free(t);
+	backend->ctx = NULL;
+}
+
+// Pack backend (see mpz_disk_pack_backend_init()): the files are extents of
+// a single container file of the inner backend. Every file owns an extent of
+// 'alloc' bytes at 'offset', the first 'size' of which are its data. Freed
+// extents go on a list sorted by offset, merged with their free neighbours,
+// which new extents are taken from first fit before the container grows.
+#define _MPZ_DISK_PACK_GRANULE 512
+#define _MPZ_DISK_PACK_COPY_BYTES (1 << 20)
+
+typedef struct _mpz_disk_pack_file_struct
+{
+	char* filename;
+	int64_t offset, size, alloc;
+	// Guarded by the lock of the backend. A removed file that is still
+	// open keeps its extent until it is closed.
+	int refs, removed;
+	// Guards offset, size and alloc. Taken before the lock of the backend
+	// by anyone who needs both.
+	_mpz_disk_mutex lock;
+	struct _mpz_disk_pack_file_struct* next;
+} _mpz_disk_pack_file;
+
+typedef struct _mpz_disk_pack_extent_struct
+{
+	int64_t offset, bytes;
+	struct _mpz_disk_pack_extent_struct* next;
+} _mpz_disk_pack_extent;
+
+typedef struct
+{
+	mpz_disk_backend_t inner;
+	void* container;
+	char* filename;
+	// Hash table of the files by name
+	_mpz_disk_pack_file** buckets;
+	size_t n_buckets, n_files;
+	_mpz_disk_pack_extent* free_extents;
+	// End of the last extent in the container
+	int64_t end;
+	// Bumped whenever a file is added
+	int64_t generation;
+	// Guards the files, the free extents, end and generation
+	_mpz_disk_mutex lock;
+} _mpz_disk_pack;
+
+static int64_t _mpz_disk_pack_round(int64_t bytes)
+{
+	return (bytes + _MPZ_DISK_PACK_GRANULE - 1) / _MPZ_DISK_PACK_GRANULE * _MPZ_DISK_PACK_GRANULE;
+}
+
+static size_t _mpz_disk_pack_hash(const char* filename)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (; *filename; filename++)
+		hash = (hash ^ (unsigned char)*filename) * 1099511628211ULL;
+
+	return (size_t)hash;
+}
+
+// Link to the file that isn't removed, or to where it would be added
+static _mpz_disk_pack_file** _mpz_disk_pack_find(_mpz_disk_pack* pack, const char* filename)
+{
+	_mpz_disk_pack_file** link = &pack->buckets[_mpz_disk_pack_hash(filename) % pack->n_buckets];
+	while (*link && ((*link)->removed || strcmp((*link)->filename, filename) != 0))
+		link = &(*link)->next;
+
+	return link;
+}
+
+// Twice the buckets once there are more files than buckets. Failing to is
+// harmless, the chains only get longer.
+static void _mpz_disk_pack_rehash(_mpz_disk_pack* pack)
+{
+	if (pack->n_files <= pack->n_buckets)
+		return;
+
+	size_t n_buckets = 2 * pack->n_buckets;
+	_mpz_disk_pack_file** buckets = calloc(n_buckets, sizeof(_mpz_disk_pack_file*));
+	if (!buckets)
+		return;
+
+	for (size_t i = 0; i < pack->n_buckets; i++)
+	{
+		while (pack->buckets[i])
+		{
+			_mpz_disk_pack_file* f = pack->buckets[i];
+			pack->buckets[i] = f->next;
+
+			size_t bucket = _mpz_disk_pack_hash(f->filename) % n_buckets;
+			f->next = buckets[bucket];
+			buckets[bucket] = f;
+		}
+	}
+
+	free(pack->buckets);
+	pack->buckets = buckets;
+	pack->n_buckets = n_buckets;
+}
+
+// Take an extent of 'bytes' bytes from the free ones, or from the end of
+// the container. Takes pack->lock.
+static int64_t _mpz_disk_pack_alloc(_mpz_disk_pack* pack, int64_t bytes)
+{
+	for (_mpz_disk_pack_extent** link = &pack->free_extents; *link; link = &(*link)->next)
+	{
+		_mpz_disk_pack_extent* e = *link;
+		if (e->bytes < bytes)
+			continue;
+
+		int64_t offset = e->offset;
+		e->offset += bytes;
+		e->bytes -= bytes;
+
+		if (!e->bytes) {
+			*link = e->next;
+			free(e);
+		}
+
+		return offset;
+	}
+
+	int64_t offset = pack->end;
+	pack->end += bytes;
+
+	return offset;
+}
+
+// Take the 'bytes' bytes right after offset, if they are free. Takes
+// pack->lock.
+static int _mpz_disk_pack_extend(_mpz_disk_pack* pack, int64_t offset, int64_t bytes)
+{
+	if (offset == pack->end) {
+		pack->end += bytes;
+		return 1;
+	}
+
+	for (_mpz_disk_pack_extent** link = &pack->free_extents; *link && (*link)->offset <= offset; link = &(*link)->next)
+	{
+		_mpz_disk_pack_extent* e = *link;
+		if (e->offset != offset)
+			continue;
+
+		if (e->bytes < bytes)
+			return 0;
+
+		e->offset += bytes;
+		e->bytes -= bytes;
+
+		if (!e->bytes) {
+			*link = e->next;
+			free(e);
+		}
+
+		return 1;
+	}
+
+	return 0;
+}
+
+// Give an extent back. Takes pack->lock.
+static void _mpz_disk_pack_free(_mpz_disk_pack* pack, int64_t offset, int64_t bytes)
+{
+	if (!bytes)
+		return;
+
+	_mpz_disk_pack_extent* prev = NULL, * next = pack->free_extents;
+	while (next && next->offset < offset)
+	{
+		prev = next;
+		next = next->next;
+	}
+
+	if (prev && prev->offset + prev->bytes == offset) {
+		prev->bytes += bytes;
+
+		if (next && prev->offset + prev->bytes == next->offset) {
+			prev->bytes += next->bytes;
+			prev->next = next->next;
+			free(next);
+		}
+	}
+	else if (next && offset + bytes == next->offset) {
+		next->offset = offset;
+		next->bytes += bytes;
+	}
+	else {
+		// Without memory for it, the extent is lost until the next
+		// mpz_disk_pack_compact()
+		_mpz_disk_pack_extent* e = malloc(sizeof(_mpz_disk_pack_extent));
+		if (!e)
+			return;
+
+		e->offset = offset;
+		e->bytes = bytes;
+		e->next = next;
+
+		if (prev)
+			prev->next = e;
+		else
+			pack->free_extents = e;
+	}
+}
+
+// Copy 'bytes' bytes of the container from src to dst, front to back, so
+// that an extent may be moved down over itself
+static int _mpz_disk_pack_copy(_mpz_disk_pack* pack, int64_t dst, int64_t src, int64_t bytes)
+{
+	if (!bytes || dst == src)
+		return 0;
+
+	unsigned char* buf = malloc((size_t)min(bytes, _MPZ_DISK_PACK_COPY_BYTES));
+	if (!buf)
+		return -1;
+
+	int ret = 0;
+	for (int64_t done = 0; done < bytes && !ret; done += _MPZ_DISK_PACK_COPY_BYTES)
+	{
+		size_t n = (size_t)min(bytes - done, _MPZ_DISK_PACK_COPY_BYTES);
+
+		if (pack->inner.pread(pack->inner.ctx, pack->container, buf, n, src + done) != n)
+			ret = -1;
+		else
+			ret = pack->inner.pwrite(pack->inner.ctx, pack->container, buf, n, dst + done);
+	}
+
+	free(buf);
+
+	return ret;
+}
+
+// Extents are reused, so the bytes a file grows by are zeroed
+static int _mpz_disk_pack_zero(_mpz_disk_pack* pack, int64_t offset, int64_t bytes)
+{
+	if (!bytes)
+		return 0;
+
+	unsigned char* zero = calloc(1, (size_t)min(bytes, _MPZ_DISK_PACK_COPY_BYTES));
+	if (!zero)
+		return -1;
+
+	int ret = 0;
+	for (int64_t done = 0; done < bytes && !ret; done += _MPZ_DISK_PACK_COPY_BYTES)
+		ret = pack->inner.pwrite(pack->inner.ctx, pack->container, zero,
+			(size_t)min(bytes - done, _MPZ_DISK_PACK_COPY_BYTES), offset + done);
+
+	free(zero);
+
+	return ret;
+}
+
+// Make the extent of f at least 'bytes' bytes, in place if the space after
+// it is free and else by moving it. Takes f->lock.
+static int _mpz_disk_pack_reserve(_mpz_disk_pack* pack, _mpz_disk_pack_file* f, int64_t bytes)
+{
+	if (bytes <= f->alloc)
+		return 0;
+
+	// Doubling keeps the moves of a growing file down to a few
+	int64_t alloc = _mpz_disk_pack_round(max(bytes, 2 * f->alloc));
+
+	_mpz_disk_mutex_lock(&pack->lock);
+
+	int in_place = f->alloc && _mpz_disk_pack_extend(pack, f->offset + f->alloc, alloc - f->alloc);
+	int64_t offset = in_place ? f->offset : _mpz_disk_pack_alloc(pack, alloc);
+
+	_mpz_disk_mutex_unlock(&pack->lock);
+
+	if (!in_place) {
+		int ret = _mpz_disk_pack_copy(pack, offset, f->offset, f->size);
+
+		_mpz_disk_mutex_lock(&pack->lock);
+		if (ret == 0)
+			_mpz_disk_pack_free(pack, f->offset, f->alloc);
+		else
+			_mpz_disk_pack_free(pack, offset, alloc);
+		_mpz_disk_mutex_unlock(&pack->lock);
+
+		if (ret != 0)
+			return -1;
+
+		f->offset = offset;
+	}
+
+	f->alloc = alloc;
+
+	return 0;
+}
+
+// Unlink f from its bucket and give back its extent. Takes pack->lock.
+static void _mpz_disk_pack_drop(_mpz_disk_pack* pack, _mpz_disk_pack_file* f)
+{
+	_mpz_disk_pack_file** link = &pack->buckets[_mpz_disk_pack_hash(f->filename) % pack->n_buckets];
+	while (*link != f)
+		link = &(*link)->next;
+	*link = f->next;
+
+	pack->n_files--;
+	_mpz_disk_pack_free(pack, f->offset, f->alloc);
+
+	_mpz_disk_mutex_destroy(&f->lock);
+	free(f->filename);
+	free(f);
+}
+
+static void* _mpz_disk_pack_open(void* ctx, const char* filename, int mode)
+{
+	_mpz_disk_pack* pack = ctx;
+
+	_mpz_disk_mutex_lock(&pack->lock);
+
+	_mpz_disk_pack_file** link = _mpz_disk_pack_find(pack, filename);
+	_mpz_disk_pack_file* f = *link;
+
+	if (!f && mode != _MPZ_DISK_OPEN_READ) {
+		f = calloc(1, sizeof(_mpz_disk_pack_file));
+		if (f && (f->filename = malloc(strlen(filename) + 1))) {
+			strcpy(f->filename, filename);
+			_mpz_disk_mutex_init(&f->lock);
+			*link = f;
+
+			pack->n_files++;
+			pack->generation++;
+			_mpz_disk_pack_rehash(pack);
+		}
+		else {
+			free(f);
+			f = NULL;
+		}
+	}
+
+	if (f)
+		f->refs++;
+
+	_mpz_disk_mutex_unlock(&pack->lock);
+
+	// The extent is kept for the new data
+	if (f && mode == _MPZ_DISK_OPEN_CREATE) {
+		_mpz_disk_mutex_lock(&f->lock);
+		f->size = 0;
+		_mpz_disk_mutex_unlock(&f->lock);
+	}
+
+	return f;
+}
+
+static void _mpz_disk_pack_close(void* ctx, void* file)
+{
+	_mpz_disk_pack* pack = ctx;
+	_mpz_disk_pack_file* f = file;
+
+	_mpz_disk_mutex_lock(&pack->lock);
+
+	if (--f->refs == 0 && f->removed)
+		_mpz_disk_pack_drop(pack, f);
+
+	_mpz_disk_mutex_unlock(&pack->lock);
+}
+
+static size_t _mpz_disk_pack_pread(void* ctx, void* file, void* buf, size_t bytes, int64_t offset)
+{
+	_mpz_disk_pack* pack = ctx;
+	_mpz_disk_pack_file* f = file;
+
+	_mpz_disk_mutex_lock(&f->lock);
+
+	size_t bytes_read = offset < f->size ? (size_t)min((int64_t)bytes, f->size - offset) : 0;
+	if (bytes_read)
+		bytes_read = pack->inner.pread(pack->inner.ctx, pack->container, buf, bytes_read, f->offset + offset);
+
+	_mpz_disk_mutex_unlock(&f->lock);
+
+	return bytes_read;
+}
+
+static int _mpz_disk_pack_pwrite(void* ctx, void* file, const void* buf, size_t bytes, int64_t offset)
+{
+	_mpz_disk_pack* pack = ctx;
+	_mpz_disk_pack_file* f = file;
+
+	_mpz_disk_mutex_lock(&f->lock);
+
+	int64_t end = offset + (int64_t)bytes;
+	int ret = _mpz_disk_pack_reserve(pack, f, end);
+
+	// Whatever lies between the old end and the data reads as zero
+	if (ret == 0 && offset > f->size)
+		ret = _mpz_disk_pack_zero(pack, f->offset + f->size, offset - f->size);
+	if (ret == 0 && bytes)
+		ret = pack->inner.pwrite(pack->inner.ctx, pack->container, buf, bytes, f->offset + offset);
+	if (ret == 0 && end > f->size)
+		f->size = end;
+
+	_mpz_disk_mutex_unlock(&f->lock);
+
+	return ret;
+}
+
+static int _mpz_disk_pack_truncate(void* ctx, void* file, int64_t size)
+{
+	_mpz_disk_pack* pack = ctx;
+	_mpz_disk_pack_file* f = file;
+
+	_mpz_disk_mutex_lock(&f->lock);
+
+	int ret = 0;
+	if (size > f->size) {
+		ret = _mpz_disk_pack_reserve(pack, f, size);
+		if (ret == 0)
+			ret = _mpz_disk_pack_zero(pack, f->offset + f->size, size - f->size);
+	}
+
+	if (ret == 0)
+		f->size = size;
+
+	_mpz_disk_mutex_unlock(&f->lock);
+
+	return ret;
+}
+
+static int64_t _mpz_disk_pack_size(void* ctx, void* file)
+{
+	_mpz_disk_pack_file* f = file;
+
+	_mpz_disk_mutex_lock(&f->lock);
+	int64_t size = f->size;
+	_mpz_disk_mutex_unlock(&f->lock);
+
+	return size;
+}
+
+static int _mpz_disk_pack_sync(void* ctx, void* file)
+{
+	_mpz_disk_pack* pack = ctx;
+	return pack->inner.sync(pack->inner.ctx, pack->container);
+}
+
+// The extents have no holes
+static int64_t _mpz_disk_pack_next_data(void* ctx, void* file, int64_t offset)
+{
+	return offset;
+}
+
+static int _mpz_disk_pack_preallocate(void* ctx, void* file, int64_t size)
+{
+	_mpz_disk_pack* pack = ctx;
+	_mpz_disk_pack_file* f = file;
+
+	_mpz_disk_mutex_lock(&f->lock);
+	int ret = _mpz_disk_pack_reserve(pack, f, size);
+	_mpz_disk_mutex_unlock(&f->lock);
+
+	return ret;
+}
+
+static int _mpz_disk_pack_set_sparse(void* ctx, void* file)
+{
+	return 0;
+}
+
+static int _mpz_disk_pack_remove(void* ctx, const char* filename)
+{
+	_mpz_disk_pack* pack = ctx;
+
+	_mpz_disk_mutex_lock(&pack->lock);
+
+	_mpz_disk_pack_file* f = *_mpz_disk_pack_find(pack, filename);
+	if (f && f->refs == 0)
+		_mpz_disk_pack_drop(pack, f);
+	else if (f)
+		f->removed = 1;
+
+	_mpz_disk_mutex_unlock(&pack->lock);
+
+	return f ? 0 : -1;
+}
+
+int mpz_disk_pack_backend_init(mpz_disk_backend_t* backend, const mpz_disk_backend_t* inner, const char* filename)
+{
+	_mpz_disk_pack* pack = calloc(1, sizeof(_mpz_disk_pack));
+	if (!pack)
+		return -1;
+
+	pack->inner = inner ? *inner : _mpz_disk_file_backend;
+	pack->n_buckets = 1024;
+	pack->buckets = calloc(pack->n_buckets, sizeof(_mpz_disk_pack_file*));
+	pack->filename = malloc(strlen(filename) + 1);
+	pack->container = pack->buckets && pack->filename ? pack->inner.open(pack->inner.ctx, filename, _MPZ_DISK_OPEN_CREATE) : NULL;
+
+	if (!pack->container) {
+		free(pack->buckets);
+		free(pack->filename);
+		free(pack);
+		return -1;
+	}
+
+	strcpy(pack->filename, filename);
+	_mpz_disk_mutex_init(&pack->lock);
+
+	backend->open = _mpz_disk_pack_open;
+	backend->close = _mpz_disk_pack_close;
+	backend->pread = _mpz_disk_pack_pread;
+	backend->pwrite = _mpz_disk_pack_pwrite;
+	backend->truncate = _mpz_disk_pack_truncate;
+	backend->size = _mpz_disk_pack_size;
+	backend->sync = _mpz_disk_pack_sync;
+	backend->next_data = _mpz_disk_pack_next_data;
+	backend->preallocate = _mpz_disk_pack_preallocate;
+	backend->set_sparse = _mpz_disk_pack_set_sparse;
+	backend->remove = _mpz_disk_pack_remove;
+	backend->ctx = pack;
+
+	return 0;
+}
+
+void mpz_disk_pack_backend_clear(mpz_disk_backend_t* backend)
+{
+	_mpz_disk_pack* pack = backend->ctx;
+
+	for (size_t i = 0; i < pack->n_buckets; i++)
+	{
+		while (pack->buckets[i])
+		{
+			_mpz_disk_pack_file* f = pack->buckets[i];
+			pack->buckets[i] = f->next;
+
+			_mpz_disk_mutex_destroy(&f->lock);
+			free(f->filename);
+			free(f);
+		}
+	}
+
+	while (pack->free_extents)
+	{
+		_mpz_disk_pack_extent* e = pack->free_extents;
+		pack->free_extents = e->next;
+		free(e);
+	}
+
+	pack->inner.close(pack->inner.ctx, pack->container);
+	pack->inner.remove(pack->inner.ctx, pack->filename);
+
+	_mpz_disk_mutex_destroy(&pack->lock);
+	free(pack->buckets);
+	free(pack->filename);
+	free(pack);
+	backend->ctx = NULL;
+}
+
+static int _mpz_disk_pack_by_offset(const void* f1, const void* f2)
+{
+	int64_t offset1 = (*(_mpz_disk_pack_file* const*)f1)->offset;
+	int64_t offset2 = (*(_mpz_disk_pack_file* const*)f2)->offset;
+
+	return offset1 < offset2 ? -1 : offset1 > offset2;
+}
+
+static int _mpz_disk_pack_by_address(const void* f1, const void* f2)
+{
+	uintptr_t address1 = (uintptr_t)*(_mpz_disk_pack_file* const*)f1;
+	uintptr_t address2 = (uintptr_t)*(_mpz_disk_pack_file* const*)f2;
+
+	return address1 < address2 ? -1 : address1 > address2;
+}
+
+// Let go of the files listed by _mpz_disk_pack_lock_all(). Takes pack->lock.
+static void _mpz_disk_pack_unlock_all(_mpz_disk_pack* pack, _mpz_disk_pack_file** files, size_t n_files)
+{
+	for (size_t i = 0; i < n_files; i++)
+		_mpz_disk_mutex_unlock(&files[i]->lock);
+
+	for (size_t i = 0; i < n_files; i++)
+		if (--files[i]->refs == 0 && files[i]->removed)
+			_mpz_disk_pack_drop(pack, files[i]);
+}
+
+// List all files of pack, held open and with their locks taken, and take
+// pack->lock after them, so no extent moves until they are let go of. The
+// locks of the files are taken in the order of their addresses, and again
+// if a file was added meanwhile. NULL if the list can't be allocated.
+static _mpz_disk_pack_file** _mpz_disk_pack_lock_all(_mpz_disk_pack* pack, size_t* n_files)
+{
+	for (;;)
+	{
+		_mpz_disk_mutex_lock(&pack->lock);
+
+		_mpz_disk_pack_file** files = malloc(max(pack->n_files, 1) * sizeof(_mpz_disk_pack_file*));
+		if (!files) {
+			_mpz_disk_mutex_unlock(&pack->lock);
+			return NULL;
+		}
+
+		*n_files = 0;
+		for (size_t i = 0; i < pack->n_buckets; i++)
+		{
+			for (_mpz_disk_pack_file* f = pack->buckets[i]; f; f = f->next)
+			{
+				f->refs++;
+				files[(*n_files)++] = f;
+			}
+		}
+
+		int64_t generation = pack->generation;
+
+		_mpz_disk_mutex_unlock(&pack->lock);
+
+		qsort(files, *n_files, sizeof(_mpz_disk_pack_file*), _mpz_disk_pack_by_address);
+		for (size_t i = 0; i < *n_files; i++)
+			_mpz_disk_mutex_lock(&files[i]->lock);
+
+		_mpz_disk_mutex_lock(&pack->lock);
+
+		if (pack->generation == generation)
+			return files;
+
+		_mpz_disk_pack_unlock_all(pack, files, *n_files);
+		_mpz_disk_mutex_unlock(&pack->lock);
+		free(files);
+	}
+}
+
+int mpz_disk_pack_compact(mpz_disk_backend_t* backend)
+{
+	_mpz_disk_pack* pack = backend->ctx;
+
+	// Reads and writes of open files wait until the extents are moved
+	size_t n_files;
+	_mpz_disk_pack_file** files = _mpz_disk_pack_lock_all(pack, &n_files);
+	if (!files)
+		return -1;
+
+	// Moving the extents down in the order they are in never overwrites
+	// one that is still to be moved
+	qsort(files, n_files, sizeof(_mpz_disk_pack_file*), _mpz_disk_pack_by_offset);
+
+	int64_t end = 0;
+	int ret = 0;
+	for (size_t i = 0; i < n_files && !ret; i++)
+	{
+		_mpz_disk_pack_file* f = files[i];
+		if (!f->alloc)
+			continue;
+
+		ret = _mpz_disk_pack_copy(pack, end, f->offset, f->size);
+		if (ret == 0) {
+			f->offset = end;
+			f->alloc = _mpz_disk_pack_round(f->size);
+			end += f->alloc;
+		}
+	}
+
+	// The extents are still in order if a copy failed part of the way,
+	// with the ones that weren't moved where they were. The gaps between
+	// them are all that is free.
+	while (pack->free_extents)
+	{
+		_mpz_disk_pack_extent* e = pack->free_extents;
+		pack->free_extents = e->next;
+		free(e);
+	}
+
+	end = 0;
+	for (size_t i = 0; i < n_files; i++)
+	{
+		if (!files[i]->alloc)
+			continue;
+
+		_mpz_disk_pack_free(pack, end, files[i]->offset - end);
+		end = files[i]->offset + files[i]->alloc;
+	}
+
+	pack->end = end;
+	if (pack->inner.truncate(pack->inner.ctx, pack->container, end) != 0)
+		ret = -1;
+
+	_mpz_disk_pack_unlock_all(pack, files, n_files);
+	_mpz_disk_mutex_unlock(&pack->lock);
+	free(files);
+
+	return ret;
+}
+
+void mpz_disk_pack_usage(mpz_disk_backend_t* backend, int64_t* bytes, int64_t* free_bytes)
+{
+	_mpz_disk_pack* pack = backend->ctx;
+
+	_mpz_disk_mutex_lock(&pack->lock);
+
+	*bytes = pack->end;
+	*free_bytes = 0;
+	for (_mpz_disk_pack_extent* e = pack->free_extents; e; e = e->next)
+		*free_bytes += e->bytes;
+
+	_mpz_disk_mutex_unlock(&pack->lock);
+}
+
+int mpz_disk_set_backend(const mpz_disk_backend_t* backend)
+{
+	_mpz_disk_backend = backend;
+
+	return 0;
+}
+
+// The I/O of the operations goes through the functions below, to the
+// backend of each file
+static _mpz_disk_fd _mpz_disk_io_open(const mpz_disk_backend_t* backend, const char* filename, int mode)
+{
+	if (!backend)
+		backend = &_mpz_disk_file_backend;
+
+	_mpz_disk_fd fd = malloc(sizeof(_mpz_disk_file));
+	if (!fd)
+		return _MPZ_DISK_INVALID_FD;
+
+	int64_t start = _mpz_disk_stats_now();
+
+	fd->backend = backend;
+	fd->file = backend->open(backend->ctx, filename, mode);
+
+	_mpz_disk_stats_io(start, 1, 0, 0);
+
+	if (!fd->file) {
+		free(fd);
+		return _MPZ_DISK_INVALID_FD;
+	}
+
+	return fd;
+}
+
+static void _mpz_disk_io_close(_mpz_disk_fd fd)
+{
+	int64_t start = _mpz_disk_stats_now();
+
+	fd->backend->close(fd->backend->ctx, fd->file);
+	free(fd);
+
+	_mpz_disk_stats_io(start, 1, 0, 0);
+}
+
+// Returns the number of bytes read, which is less than 'bytes' at the end of the file
+static size_t _mpz_disk_io_pread(_mpz_disk_fd fd, void* buf, size_t bytes, int64_t offset)
+{
+	int64_t start = _mpz_disk_stats_now();
+
+	size_t bytes_read = fd->backend->pread(fd->backend->ctx, fd->file, buf, bytes, offset);
+
+	_mpz_disk_stats_io(start, 1, _MPZ_DISK_STAT_BYTES_READ, bytes_read);
+
+	return bytes_read;
+}
+
+static int _mpz_disk_io_pwrite(_mpz_disk_fd fd, const void* buf, size_t bytes, int64_t offset)
+{
+	int64_t start = _mpz_disk_stats_now();
+
+	int ret = fd->backend->pwrite(fd->backend->ctx, fd->file, buf, bytes, offset);
+
+	_mpz_disk_stats_io(start, 1, _MPZ_DISK_STAT_BYTES_WRITTEN, ret == 0 ? bytes : 0);
+
+	return ret;
+}
+
+static int64_t _mpz_disk_io_size(_mpz_disk_fd fd)
+{
+	int64_t start = _mpz_disk_stats_now();
+
+	int64_t ret = fd->backend->size(fd->backend->ctx, fd->file);
+
+	_mpz_disk_stats_io(start, 1, 0, 0);
+
+	return ret;
+}
+
+static int _mpz_disk_io_resize(_mpz_disk_fd fd, int64_t size)
+{
+	int64_t start = _mpz_disk_stats_now();
+
+	int ret = fd->backend->truncate(fd->backend->ctx, fd->file, size);
+
+	_mpz_disk_stats_io(start, 1, 0, 0);
+
+	return ret;
+}
+
+// Returns once what was written to fd is on the device
+static int _mpz_disk_io_sync(_mpz_disk_fd fd)
+{
+	int64_t start = _mpz_disk_stats_now();
+
+	int ret = fd->backend->sync(fd->backend->ctx, fd->file);
+
+	_mpz_disk_stats_io(start, 1, 0, 0);
+
+	return ret;
+}
+
+// Offset of the first byte at or after offset that isn't in a hole of the
+// file, or offset itself if the backend can't tell
+static int64_t _mpz_disk_io_next_data(_mpz_disk_fd fd, int64_t offset)
+{
+	int64_t start = _mpz_disk_stats_now();
+
+	int64_t ret = fd->backend->next_data(fd->backend->ctx, fd->file, offset);
+
+	_mpz_disk_stats_io(start, 1, 0, 0);
+
+	return ret;
+}
+
+static int _mpz_disk_io_preallocate(_mpz_disk_fd fd, int64_t size)
+{
+	return fd->backend->preallocate(fd->backend->ctx, fd->file, size);
+}
+
+static int _mpz_disk_io_set_sparse(_mpz_disk_fd fd)
+{
+	return fd->backend->set_sparse(fd->backend->ctx, fd->file);
+}
+
+// Read-ahead hint, only plain files take it
+static void _mpz_disk_io_will_need(_mpz_disk_fd fd, int64_t offset, int64_t bytes)
+{
+#ifdef _WIN32
+	// Windows has no read-ahead hint for a file range
+#elif defined(__unix__)
+	if (fd->backend->open == _mpz_disk_file_open)
+		posix_fadvise(_mpz_disk_native(fd->file), (off_t)offset, (off_t)bytes, POSIX_FADV_WILLNEED);
+#endif
+}
+
+static int _mpz_disk_io_remove(const mpz_disk_backend_t* backend, const char* filename)
+{
+	if (!backend)
+		backend = &_mpz_disk_file_backend;
+
+	return backend->remove(backend->ctx, filename);
+}
+
+// Chunk codec: a byte-oriented LZ77 with a separate token for runs of
+// zero bytes, which are what shifted values and products of small factors
+// are mostly made of. The stream is a sequence of
+//   <literal count> <literals> <match length> <match distance>
+// with the numbers stored as 7-bit varints. Distance 0 stands for a run of
+// zeros. The last sequence may end right after its literals.
+#define _MPZ_DISK_LZ_MIN_MATCH 4
+#define _MPZ_DISK_LZ_MIN_ZERO_RUN 8
+#define _MPZ_DISK_LZ_HASH_BITS 14
+#define _MPZ_DISK_LZ_MAX_DIST (1 << 16)
+
+static unsigned char* _mpz_disk_put_varint(unsigned char* p, unsigned char* end, size_t value)
+{
+	for (; p < end; value >>= 7)
+	{
+		if (value < 0x80) {
+			*p++ = (unsigned char)value;
+			return p;
+		}
+
+		*p++ = (unsigned char)(value | 0x80);
+	}
+
+	return NULL;
+}
+
+static const unsigned char* _mpz_disk_get_varint(const unsigned char* p, const unsigned char* end, size_t* value)
+{
+	*value = 0;
+
+	for (int shift = 0; p < end && shift < 64; shift += 7)
+	{
+		*value |= (size_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80))
+			return p;
+	}
+
+	return NULL;
+}
+
+static unsigned char* _mpz_disk_lz_emit(unsigned char* p, unsigned char* end,
+	const unsigned char* literals, size_t n_literals, size_t match_len, size_t match_dist)
+{
+	p = _mpz_disk_put_varint(p, end, n_literals);
+	if (!p || (size_t)(end - p) < n_literals)
+		return NULL;
+
+	memcpy(p, literals, n_literals);
+	p += n_literals;
+
+	if (match_len == 0)
+		return p;
+
+	p = _mpz_disk_put_varint(p, end, match_len);
+	return p ? _mpz_disk_put_varint(p, end, match_dist) : NULL;
+}
+
+size_t _mpz_disk_compress(unsigned char* dst, const unsigned char* src, size_t bytes)
+{
+	// Last position + 1 of each 4-byte hash, 0 = none
+	uint32_t table[1 << _MPZ_DISK_LZ_HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	// Compressing is only worth it if the output is smaller than the input
+	unsigned char* p = dst, * end = dst + bytes;
+	size_t pos = 0, anchor = 0;
+
+	while (pos + _MPZ_DISK_LZ_MIN_MATCH <= bytes)
+	{
+		if (src[pos] == 0) {
+			size_t run = 1;
+			while (pos + run < bytes && src[pos + run] == 0)
+				run++;
+
+			if (run >= _MPZ_DISK_LZ_MIN_ZERO_RUN) {
+				if (!(p = _mpz_disk_lz_emit(p, end, src + anchor, pos - anchor, run, 0)))
+					return 0;
+
+				pos += run;
+				anchor = pos;
+				continue;
+			}
+		}
+
+		uint32_t word;
+		memcpy(&word, src + pos, sizeof(word));
+		uint32_t hash = (word * 2654435761u) >> (32 - _MPZ_DISK_LZ_HASH_BITS);
+
+		size_t candidate = table[hash];
+		table[hash] = (uint32_t)pos + 1;
+
+		if (candidate != 0 && pos - (candidate - 1) <= _MPZ_DISK_LZ_MAX_DIST &&
+			memcmp(src + candidate - 1, src + pos, _MPZ_DISK_LZ_MIN_MATCH) == 0)
+		{
+			candidate--;
+
+			size_t len = _MPZ_DISK_LZ_MIN_MATCH;
+			while (pos + len < bytes && src[candidate + len] == src[pos + len])
+				len++;
+
+			if (!(p = _mpz_disk_lz_emit(p, end, src + anchor, pos - anchor, len, pos - candidate)))
+				return 0;
+
+			pos += len;
+			anchor = pos;
+			continue;
+		}
+
+		// Skip faster through data that doesn't compress
+		pos += 1 + ((pos - anchor) >> 6);
+	}
+
+	if (anchor < bytes)
+		if (!(p = _mpz_disk_lz_emit(p, end, src + anchor, bytes - anchor, 0, 0)))
+			return 0;
+
+	return p < end ? p - dst : 0;
+}
+
+int _mpz_disk_decompress(unsigned char* dst, size_t bytes, const unsigned char* src, size_t src_bytes)
+{
+	const unsigned char* p = src, * end = src + src_bytes;
+	size_t pos = 0;
+
+	while (pos < bytes)
+	{
+		size_t n_literals, match_len, match_dist;
+
+		if (!(p = _mpz_disk_get_varint(p, end, &n_literals)) ||
+			n_literals > bytes - pos || n_literals > (size_t)(end - p))
+			return -1;
+
+		memcpy(dst + pos, p, n_literals);
+		p += n_literals;
+		pos += n_literals;
+
+		if (pos == bytes)
+			break;
+
+		if (!(p = _mpz_disk_get_varint(p, end, &match_len)) ||
+			!(p = _mpz_disk_get_varint(p, end, &match_dist)) ||
+			match_len > bytes - pos || match_dist > pos)
+			return -1;
+
+		if (match_dist == 0)
+			memset(dst + pos, 0, match_len);
+		else if (match_dist >= match_len)
+			memcpy(dst + pos, dst + pos - match_dist, match_len);
+		else
+			for (size_t i = 0; i < match_len; i++)
+				dst[pos + i] = dst[pos - match_dist + i];
+
+		pos += match_len;
+	}
+
+	return 0;
+}
+
+// Compressed integers (see mpz_disk_set_compression()) are split into
+// chunks of chunk_limbs limbs that are compressed on their own, so any limb
+// can be reached by decompressing a single chunk. The chunks are kept in the
+// limb file in no particular order, the index file maps chunk numbers to
+// their place in it.
+#define _MPZ_DISK_CHUNK_ZERO 0	// All zero, nothing stored
+#define _MPZ_DISK_CHUNK_RAW 1	// Stored as is
+#define _MPZ_DISK_CHUNK_LZ 2	// Compressed with _mpz_disk_compress()
+
+// Number of partially written chunks kept in memory until they are complete
+#define _MPZ_DISK_PENDING_CHUNKS 4
+
+typedef struct
+{
+	uint64_t offset;	// Position in the limb file
+	uint32_t size;		// Bytes stored at 'offset'
+	uint32_t capacity;	// Bytes reserved at 'offset', a rewrite that fits is done in place
+	uint32_t type;
+	uint32_t reserved;
+} _mpz_disk_chunk_entry;
+
+typedef struct
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t chunk_limbs;
+	uint64_t limbs;
+	uint64_t data_end;
+	uint64_t n_chunks;
+} _mpz_disk_chunk_header;
+
+typedef struct
+{
+	mp_limb_t* limbs;
+	size_t chunk;
+	size_t lo, hi;	// Part written so far, as long as the writes are contiguous
+	int used;
+	uint64_t last_use;
+} _mpz_disk_pending_chunk;
+
+struct _mpz_disk_chunked_struct
+{
+	char index_filename[MPZ_DISK_FILENAME_LEN];
+	int mode;
+	const mpz_disk_backend_t* backend;
+	size_t chunk_limbs;
+	size_t limbs;
+	volatile int64_t data_end;
+	_mpz_disk_chunk_entry* chunks;
+	size_t n_chunks, chunks_alloc;
+	_mpz_disk_pending_chunk pending[_MPZ_DISK_PENDING_CHUNKS];
+	uint64_t use_counter;
+	unsigned char* buf;	// Compressed data of the chunks handled by the calling thread
+	_mpz_disk_mutex lock;
+};
+
+// Make sure chunks [0, n_chunks) have index entries, new ones are all zero
+static int _mpz_disk_chunked_reserve(_mpz_disk_chunked* cf, size_t n_chunks)
+{
+	if (n_chunks > cf->chunks_alloc) {
+		size_t alloc = max(n_chunks, 2 * cf->chunks_alloc);
+
+		_mpz_disk_chunk_entry* chunks = realloc(cf->chunks, alloc * sizeof(_mpz_disk_chunk_entry));
+		if (!chunks)
+			return -1;
+
+		cf->chunks = chunks;
+		cf->chunks_alloc = alloc;
+	}
+
+	if (n_chunks > cf->n_chunks) {
+		memset(cf->chunks + cf->n_chunks, 0, (n_chunks - cf->n_chunks) * sizeof(_mpz_disk_chunk_entry));
+		cf->n_chunks = n_chunks;
+	}
+
+	return 0;
+}
+
+// Decompress the chunk of index entry 'entry' (NULL = past the end) into
+// dst, 'buf' must hold a chunk. The entry may be a copy taken under the
+// lock, the limb file is read without it.
+static int _mpz_disk_chunk_load(_mpz_disk_chunked* cf, _mpz_disk_fd fd, const _mpz_disk_chunk_entry* entry, mp_limb_t* dst, unsigned char* buf)
+{
+	size_t bytes = cf->chunk_limbs * sizeof(mp_limb_t);
+
+	if (!entry || entry->type == _MPZ_DISK_CHUNK_ZERO) {
+		memset(dst, 0, bytes);
+		return 0;
+	}
+
+	if (entry->size > bytes)
+		return -1;
+
+	if (entry->type == _MPZ_DISK_CHUNK_RAW)
+		return _mpz_disk_io_pread(fd, dst, bytes, entry->offset) == bytes ? 0 : -1;
+
+	if (_mpz_disk_io_pread(fd, buf, entry->size, entry->offset) != entry->size)
+		return -1;
+
+	return _mpz_disk_decompress((unsigned char*)dst, bytes, buf, entry->size);
+}
+
+// Compress a chunk from src, 'buf' must hold a chunk. Returns its type,
+// and in *data and *size what is to be stored, which needs no lock.
+static uint32_t _mpz_disk_chunk_compress(_mpz_disk_chunked* cf, const mp_limb_t* src, unsigned char* buf, const void** data, size_t* size)
+{
+	size_t bytes = cf->chunk_limbs * sizeof(mp_limb_t);
+
+	size_t i;
+	for (i = 0; i < cf->chunk_limbs; i++)
+		if (src[i] != 0)
+			break;
+
+	*data = NULL;
+	*size = 0;
+	if (i == cf->chunk_limbs)
+		return _MPZ_DISK_CHUNK_ZERO;
+
+	*data = buf;
+	*size = _mpz_disk_compress(buf, (const unsigned char*)src, bytes);
+	if (*size == 0) {
+		*data = src;
+		*size = bytes;
+		return _MPZ_DISK_CHUNK_RAW;
+	}
+
+	return _MPZ_DISK_CHUNK_LZ;
+}
+
+// Update the index entry of chunk #chunk for 'size' bytes of 'type', with
+// the lock held. Returns where in the limb file they go. Zero chunks keep
+// their space, in case they are rewritten later.
+static uint64_t _mpz_disk_chunk_place(_mpz_disk_chunked* cf, size_t chunk, uint32_t type, size_t size)
+{
+	_mpz_disk_chunk_entry* entry = &cf->chunks[chunk];
+
+	if (size > entry->capacity) {
+		entry->offset = _mpz_disk_atomic_add(&cf->data_end, size);
+		entry->capacity = (uint32_t)size;
+	}
+
+	entry->size = (uint32_t)size;
+	entry->type = type;
+
+	return entry->offset;
+}
+
+// Compress chunk #chunk from src and write it out with the lock held,
+// 'buf' must hold a chunk
+static int _mpz_disk_chunk_store(_mpz_disk_chunked* cf, _mpz_disk_fd fd, size_t chunk, const mp_limb_t* src, unsigned char* buf)
+{
+	const void* data;
+	size_t size;
+	uint32_t type = _mpz_disk_chunk_compress(cf, src, buf, &data, &size);
+	uint64_t offset = _mpz_disk_chunk_place(cf, chunk, type, size);
+
+	if (type == _MPZ_DISK_CHUNK_ZERO)
+		return 0;
+
+	return _mpz_disk_io_pwrite(fd, data, size, offset) != 0 ? -1 : 0;
+}
+
+// cf->buf is only held while the integer is in use
+static int _mpz_disk_chunked_scratch(_mpz_disk_chunked* cf)
+{
+	if (!cf->buf)
+		cf->buf = _mpz_disk_buffer_alloc(cf->chunk_limbs * sizeof(mp_limb_t));
+
+	return cf->buf ? 0 : -1;
+}
+
+static int _mpz_disk_pending_flush(_mpz_disk_handle* handle, _mpz_disk_pending_chunk* slot)
+{
+	_mpz_disk_chunked* cf = handle->chunked;
+
+	if (_mpz_disk_chunked_scratch(cf) != 0)
+		return -1;
+
+	slot->used = 0;
+
+	return _mpz_disk_chunk_store(cf, handle->fds[0], slot->chunk, slot->limbs, cf->buf);
+}
+
+static _mpz_disk_pending_chunk* _mpz_disk_pending_find(_mpz_disk_chunked* cf, size_t chunk)
+{
+	for (int i = 0; i < _MPZ_DISK_PENDING_CHUNKS; i++)
+		if (cf->pending[i].used && cf->pending[i].chunk == chunk)
+			return &cf->pending[i];
+
+	return NULL;
+}
+
+// Pending copy of chunk #chunk, the least recently used one is written
+// out to make room if needed
+static _mpz_disk_pending_chunk* _mpz_disk_pending_get(_mpz_disk_handle* handle, size_t chunk)
+{
+	_mpz_disk_chunked* cf = handle->chunked;
+	_mpz_disk_pending_chunk* slot = _mpz_disk_pending_find(cf, chunk);
+
+	if (!slot) {
+		slot = &cf->pending[0];
+		for (int i = 0; i < _MPZ_DISK_PENDING_CHUNKS && slot->used; i++)
+			if (!cf->pending[i].used || cf->pending[i].last_use < slot->last_use)
+				slot = &cf->pending[i];
+
+		if (slot->used && _mpz_disk_pending_flush(handle, slot) != 0)
+			return NULL;
+
+		if (!slot->limbs && !(slot->limbs = _mpz_disk_buffer_alloc(cf->chunk_limbs * sizeof(mp_limb_t))))
+			return NULL;
+
+		const _mpz_disk_chunk_entry* entry = chunk < cf->n_chunks ? &cf->chunks[chunk] : NULL;
+		if (_mpz_disk_chunked_scratch(cf) != 0 || _mpz_disk_chunk_load(cf, handle->fds[0], entry, slot->limbs, cf->buf) != 0)
+			return NULL;
+
+		slot->chunk = chunk;
+		slot->lo = slot->hi = 0;
+		slot->used = 1;
+	}
+
+	slot->last_use = ++cf->use_counter;
+
+	return slot;
+}
+
+static _mpz_disk_chunked* _mpz_disk_chunked_open(mpz_disk_ptr op, int mode)
+{
+	_mpz_disk_chunked* cf = calloc(1, sizeof(_mpz_disk_chunked));
+	if (!cf)
+		return NULL;
+
+	_mpz_disk_get_index_filename(cf->index_filename, op);
+	cf->mode = mode;
+	cf->chunk_limbs = op->chunk_limbs;
+	cf->backend = op->backend;
+
+	int ok = 1;
+
+	// A missing index is an empty integer
+	_mpz_disk_fd index_fd = mode == _MPZ_DISK_OPEN_CREATE ? _MPZ_DISK_INVALID_FD : _mpz_disk_io_open(op->backend, cf->index_filename, _MPZ_DISK_OPEN_READ);
+
+	if (index_fd != _MPZ_DISK_INVALID_FD) {
+		_mpz_disk_chunk_header header;
+
+		ok = _mpz_disk_io_pread(index_fd, &header, sizeof(header), 0) == sizeof(header) &&
+			memcmp(header.magic, "MPZC", 4) == 0 && header.chunk_limbs == cf->chunk_limbs &&
+			_mpz_disk_chunked_reserve(cf, header.n_chunks) == 0 &&
+			_mpz_disk_io_pread(index_fd, cf->chunks, header.n_chunks * sizeof(_mpz_disk_chunk_entry), sizeof(header)) ==
+				header.n_chunks * sizeof(_mpz_disk_chunk_entry);
+
+		cf->limbs = header.limbs;
+		cf->data_end = header.data_end;
+	}
+
+	if (index_fd != _MPZ_DISK_INVALID_FD)
+		_mpz_disk_io_close(index_fd);
+
+	if (!ok) {
+		free(cf->chunks);
+		free(cf);
+		return NULL;
+	}
+
+	_mpz_disk_mutex_init(&cf->lock);
+
+	return cf;
+}
+
+// Write out the partly written chunks and give back the buffers
+static void _mpz_disk_chunked_flush(_mpz_disk_handle* handle)
+{
+	_mpz_disk_chunked* cf = handle->chunked;
+
+	_mpz_disk_mutex_lock(&cf->lock);
+
+	for (int i = 0; i < _MPZ_DISK_PENDING_CHUNKS; i++)
+	{
+		if (cf->pending[i].used)
+			_mpz_disk_pending_flush(handle, &cf->pending[i]);
+
+		_mpz_disk_buffer_free(cf->pending[i].limbs);
+		cf->pending[i].limbs = NULL;
+	}
+
+	_mpz_disk_buffer_free(cf->buf);
+	cf->buf = NULL;
+
+	_mpz_disk_mutex_unlock(&cf->lock);
+}
+
+// Write out the chunk index, and wait for it to reach the device if 'sync'
+static int _mpz_disk_chunked_write_index(_mpz_disk_chunked* cf, int sync)
+{
+	_mpz_disk_mutex_lock(&cf->lock);
+
+	_mpz_disk_chunk_header header = { { 'M', 'P', 'Z', 'C' }, 1, cf->chunk_limbs, cf->limbs, cf->data_end, cf->n_chunks };
+
+	int ret = -1;
+	_mpz_disk_fd index_fd = _mpz_disk_io_open(cf->backend, cf->index_filename, _MPZ_DISK_OPEN_CREATE);
+	if (index_fd != _MPZ_DISK_INVALID_FD) {
+		if (_mpz_disk_io_pwrite(index_fd, &header, sizeof(header), 0) == 0 &&
+			_mpz_disk_io_pwrite(index_fd, cf->chunks, cf->n_chunks * sizeof(_mpz_disk_chunk_entry), sizeof(header)) == 0 &&
+			(!sync || _mpz_disk_io_sync(index_fd) == 0))
+			ret = 0;
+
+		_mpz_disk_io_close(index_fd);
+	}
+
+	_mpz_disk_mutex_unlock(&cf->lock);
+
+	return ret;
+}
+
+static void _mpz_disk_chunked_close(_mpz_disk_handle* handle)
+{
+	_mpz_disk_chunked* cf = handle->chunked;
+
+	_mpz_disk_chunked_flush(handle);
+
+	if (cf->mode != _MPZ_DISK_OPEN_READ)
+		_mpz_disk_chunked_write_index(cf, 0);
+
+	_mpz_disk_mutex_destroy(&cf->lock);
+
+	free(cf->chunks);
+	free(cf);
+}
+
+// Compresses (or decompresses) chunks [first_chunk, end_chunk) of a
+// transfer, with the chunks spread over the calling thread and the
+// persistent chunk workers. They only take the lock to place a compressed
+// chunk in the index; reads go by a copy of the index entries taken with
+// the pending chunks, which are left out.
+#define _MPZ_DISK_CHUNK_PENDING 0xffffffff
+
+static _mpz_disk_worker _mpz_disk_chunk_workers[MPZ_DISK_MAX_THREADS];
+
+typedef struct
+{
+	_mpz_disk_handle* handle;
+	mp_limb_t* buf;
+	size_t limbs, offset;
+	size_t first_chunk, end_chunk;
+	_mpz_disk_chunk_entry* entries;	// Of chunks [first_chunk, end_chunk) when reading
+	int n_threads;
+	int write;
+	int error;
+} _mpz_disk_chunk_job;
+
+static void _mpz_disk_chunk_thread(void* arg, int thread_idx)
+{
+	_mpz_disk_chunk_job* job = arg;
+	_mpz_disk_chunked* cf = job->handle->chunked;
+	size_t chunk_limbs = cf->chunk_limbs;
+
+	mp_limb_t* chunk_buf = _mpz_disk_buffer_alloc(chunk_limbs * sizeof(mp_limb_t));
+	unsigned char* buf = _mpz_disk_buffer_alloc(chunk_limbs * sizeof(mp_limb_t));
+
+	if (!chunk_buf || !buf) {
+		job->error = 1;
+		_mpz_disk_buffer_free(chunk_buf);
+		_mpz_disk_buffer_free(buf);
+		return;
+	}
+
+	for (size_t chunk = job->first_chunk + thread_idx; chunk < job->end_chunk; chunk += job->n_threads)
+	{
+		size_t begin = max(chunk * chunk_limbs, job->offset);
+		size_t end = min((chunk + 1) * chunk_limbs, job->offset + job->limbs);
+		mp_limb_t* part = job->buf + (begin - job->offset);
+
+		if (job->write) {
+			const void* data;
+			size_t size;
+			uint32_t type = _mpz_disk_chunk_compress(cf, part, buf, &data, &size);
+
+			_mpz_disk_mutex_lock(&cf->lock);
+			uint64_t pos = _mpz_disk_chunk_place(cf, chunk, type, size);
+			_mpz_disk_mutex_unlock(&cf->lock);
+
+			if (type != _MPZ_DISK_CHUNK_ZERO && _mpz_disk_io_pwrite(job->handle->fds[0], data, size, pos) != 0)
+				job->error = 1;
+		}
+		else {
+			const _mpz_disk_chunk_entry* entry = &job->entries[chunk - job->first_chunk];
+			if (entry->type == _MPZ_DISK_CHUNK_PENDING)
+				continue;
+
+			// Whole chunks are decompressed in place
+			mp_limb_t* dst = end - begin == chunk_limbs ? part : chunk_buf;
+
+			if (_mpz_disk_chunk_load(cf, job->handle->fds[0], entry, dst, buf) != 0)
+				job->error = 1;
+			else if (dst != part)
+				memcpy(part, dst + (begin - chunk * chunk_limbs), (end - begin) * sizeof(mp_limb_t));
+		}
+	}
+
+	_mpz_disk_buffer_free(chunk_buf);
+	_mpz_disk_buffer_free(buf);
+}
+
+static int _mpz_disk_chunked_io(_mpz_disk_handle* handle, mp_limb_t* buf, size_t limbs, size_t offset, int write)
+{
+	_mpz_disk_chunked* cf = handle->chunked;
+	size_t chunk_limbs = cf->chunk_limbs;
+	int ret = 0;
+
+	_mpz_disk_chunk_job job;
+
+	job.handle = handle;
+	job.buf = buf;
+	job.limbs = limbs;
+	job.offset = offset;
+	job.first_chunk = offset / chunk_limbs;
+	job.end_chunk = (offset + limbs - 1) / chunk_limbs + 1;
+	job.entries = NULL;
+	job.write = write;
+	job.error = 0;
+
+	if (!write && !(job.entries = malloc((job.end_chunk - job.first_chunk) * sizeof(_mpz_disk_chunk_entry))))
+		return -1;
+
+	_mpz_disk_mutex_lock(&cf->lock);
+
+	if (write) {
+		if (_mpz_disk_chunked_reserve(cf, job.end_chunk) != 0) {
+			_mpz_disk_mutex_unlock(&cf->lock);
+			return -1;
+		}
+
+		// Chunks only partly covered by this write are collected in memory
+		// until the rest of them is written too
+		for (size_t chunk = job.first_chunk; chunk < job.end_chunk; chunk++)
+		{
+			size_t begin = max(chunk * chunk_limbs, offset) - chunk * chunk_limbs;
+			size_t end = min((chunk + 1) * chunk_limbs, offset + limbs) - chunk * chunk_limbs;
+
+			if (end - begin == chunk_limbs) {
+				_mpz_disk_pending_chunk* slot = _mpz_disk_pending_find(cf, chunk);
+				if (slot)
+					slot->used = 0;
+				continue;
+			}
+
+			_mpz_disk_pending_chunk* slot = _mpz_disk_pending_get(handle, chunk);
+			if (!slot) {
+				ret = -1;
+				continue;
+			}
+
+			memcpy(slot->limbs + begin, buf + (chunk * chunk_limbs + begin - offset), (end - begin) * sizeof(mp_limb_t));
+
+			if (slot->lo == slot->hi)
+				slot->lo = begin, slot->hi = end;
+			else if (begin <= slot->hi && end >= slot->lo)
+				slot->lo = min(slot->lo, begin), slot->hi = max(slot->hi, end);
+
+			if (slot->lo == 0 && slot->hi == chunk_limbs && _mpz_disk_pending_flush(handle, slot) != 0)
+				ret = -1;
+		}
+
+		cf->limbs = max(cf->limbs, offset + limbs);
+
+		// The threads get the whole chunks
+		job.first_chunk = (offset + chunk_limbs - 1) / chunk_limbs;
+		job.end_chunk = (offset + limbs) / chunk_limbs;
+	}
+	else {
+		// Chunks still in memory are served from there
+		for (size_t chunk = job.first_chunk; chunk < job.end_chunk; chunk++)
+		{
+			_mpz_disk_chunk_entry* entry = &job.entries[chunk - job.first_chunk];
+			_mpz_disk_pending_chunk* slot = _mpz_disk_pending_find(cf, chunk);
+
+			if (!slot) {
+				if (chunk < cf->n_chunks)
+					*entry = cf->chunks[chunk];
+				else
+					memset(entry, 0, sizeof(_mpz_disk_chunk_entry));
+				continue;
+			}
+
+			size_t begin = max(chunk * chunk_limbs, offset);
+			size_t end = min((chunk + 1) * chunk_limbs, offset + limbs);
+
+			memcpy(buf + (begin - offset), slot->limbs + (begin - chunk * chunk_limbs), (end - begin) * sizeof(mp_limb_t));
+			entry->type = _MPZ_DISK_CHUNK_PENDING;
+		}
+	}
+
+	_mpz_disk_mutex_unlock(&cf->lock);
+
+	if (job.first_chunk < job.end_chunk) {
+		job.n_threads = (int)min((size_t)_mpz_disk_op_threads(), job.end_chunk - job.first_chunk);
+		_mpz_disk_workers_run(_mpz_disk_chunk_workers, MPZ_DISK_MAX_THREADS, 0, job.n_threads, _mpz_disk_chunk_thread, &job);
+	}
+
+	free(job.entries);
+
+	return job.error ? -1 : ret;
+}
+
+static int _mpz_disk_chunked_resize(_mpz_disk_handle* handle, size_t limbs)
+{
+	_mpz_disk_chunked* cf = handle->chunked;
+	size_t chunk_limbs = cf->chunk_limbs;
+	size_t n_chunks = (limbs + chunk_limbs - 1) / chunk_limbs;
+	int ret = 0;
+
+	_mpz_disk_mutex_lock(&cf->lock);
+
+	if (limbs < cf->limbs) {
+		for (int i = 0; i < _MPZ_DISK_PENDING_CHUNKS; i++)
+			if (cf->pending[i].used && cf->pending[i].chunk >= n_chunks)
+				cf->pending[i].used = 0;
+
+		// Limbs cut off the last chunk have to read as zero if it grows again
+		if (limbs % chunk_limbs) {
+			_mpz_disk_pending_chunk* slot = _mpz_disk_pending_get(handle, limbs / chunk_limbs);
+
+			if (!slot)
+				ret = -1;
+			else {
+				memset(slot->limbs + limbs % chunk_limbs, 0, (chunk_limbs - limbs % chunk_limbs) * sizeof(mp_limb_t));
+				if (_mpz_disk_pending_flush(handle, slot) != 0)
+					ret = -1;
+			}
+		}
+
+		// Give back the space of the dropped chunks at the end of the file
+		cf->n_chunks = min(cf->n_chunks, n_chunks);
+		cf->data_end = 0;
+		for (size_t i = 0; i < cf->n_chunks; i++)
+			cf->data_end = max(cf->data_end, (int64_t)(cf->chunks[i].offset + cf->chunks[i].capacity));
+
+		if (_mpz_disk_io_resize(handle->fds[0], cf->data_end) != 0)
+			ret = -1;
+	}
+
+	cf->limbs = limbs;
+
+	_mpz_disk_mutex_unlock(&cf->lock);
+
+	return ret;
+}
+
+static void _mpz_disk_chunked_prefetch(_mpz_disk_handle* handle, size_t offset, size_t limbs)
+{
+#ifdef _WIN32
+	// Nothing to do: Windows has no read-ahead hint for a file range
+#elif defined(__unix__)
+	_mpz_disk_chunked* cf = handle->chunked;
+
+	_mpz_disk_mutex_lock(&cf->lock);
+
+	for (size_t chunk = offset / cf->chunk_limbs; chunk * cf->chunk_limbs < offset + limbs && chunk < cf->n_chunks; chunk++)
+		if (cf->chunks[chunk].type != _MPZ_DISK_CHUNK_ZERO)
+			_mpz_disk_io_will_need(handle->fds[0], cf->chunks[chunk].offset, cf->chunks[chunk].size);
+
+	_mpz_disk_mutex_unlock(&cf->lock);
+#endif
+}
+
+// The summary records for every MPZ_DISK_SUMMARY_LIMBS limbs whether they
+// are all zero, all ones or mixed, with limbs past the end of the integer
+// counting as zero. It is kept up to date by every write, so that carries
+// and borrows can cross uniform parts of an integer without reading them.
+static int _mpz_disk_summary_classify(const mp_limb_t* limbs, size_t n)
+{
+	if (limbs[0] != 0 && limbs[0] != ~(mp_limb_t)0)
+		return _MPZ_DISK_SUMMARY_MIXED;
+
+	for (size_t i = 1; i < n; i++)
+		if (limbs[i] != limbs[0])
+			return _MPZ_DISK_SUMMARY_MIXED;
+
+	return limbs[0] ? _MPZ_DISK_SUMMARY_ONES : _MPZ_DISK_SUMMARY_ZERO;
+}
+
+// Make sure the first n entries exist, new ones are set to 'fill'
+static int _mpz_disk_summary_reserve(_mpz_disk_handle* handle, size_t n, unsigned char fill)
+{
+	if (n > handle->summary_alloc) {
+		size_t alloc = max(n, 2 * handle->summary_alloc);
+
+		unsigned char* summary = realloc(handle->summary, alloc);
+		if (!summary)
+			return -1;
+
+		handle->summary = summary;
+		handle->summary_alloc = alloc;
+	}
+
+	if (n > handle->n_summary) {
+		memset(handle->summary + handle->n_summary, fill, n - handle->n_summary);
+		handle->n_summary = n;
+	}
+
+	return 0;
+}
+
+static void _mpz_disk_summary_open(_mpz_disk_handle* handle, mpz_disk_ptr op, int mode)
+{
+	handle->keep_summary = op->keep_summary;
+	handle->summary_lost = 0;
+	handle->summary = NULL;
+	handle->n_summary = handle->summary_alloc = 0;
+	handle->mode = mode;
+
+	if (!handle->keep_summary)
+		return;
+
+	_mpz_disk_get_summary_filename(handle->summary_filename, op);
+
+	if (mode == _MPZ_DISK_OPEN_CREATE)
+		return;
+
+	_mpz_disk_fd fd = _mpz_disk_io_open(handle->backend, handle->summary_filename, _MPZ_DISK_OPEN_READ);
+	if (fd != _MPZ_DISK_INVALID_FD) {
+		int64_t size = _mpz_disk_io_size(fd);
+
+		if (size <= 0 || _mpz_disk_summary_reserve(handle, (size_t)size, _MPZ_DISK_SUMMARY_MIXED) != 0 ||
+			_mpz_disk_io_pread(fd, handle->summary, (size_t)size, 0) != (size_t)size)
+			handle->n_summary = 0;
+
+		_mpz_disk_io_close(fd);
+	}
+
+	// Parts of the integer the summary doesn't cover (e.g. if it was
+	// written without one) are unknown, past the end everything is zero
+	size_t limbs = (size_t)((_mpz_disk_handle_size(handle) + sizeof(mp_limb_t) - 1) / sizeof(mp_limb_t));
+	size_t n = (limbs + MPZ_DISK_SUMMARY_LIMBS - 1) / MPZ_DISK_SUMMARY_LIMBS;
+
+	size_t covered = handle->n_summary = min(handle->n_summary, n);
+	if (_mpz_disk_summary_reserve(handle, n, _MPZ_DISK_SUMMARY_MIXED) != 0) {
+		handle->summary_lost = 1;
+		return;
+	}
+
+	// Although the holes of a plain file are zero
+	if (covered < n && handle->n_fds == 1 && !handle->chunked) {
+		int64_t size = _mpz_disk_handle_size(handle), data = 0;
+
+		for (size_t i = covered; i < n; i++)
+		{
+			int64_t begin = (int64_t)i * MPZ_DISK_SUMMARY_LIMBS * sizeof(mp_limb_t);
+			int64_t end = min(begin + (int64_t)(MPZ_DISK_SUMMARY_LIMBS * sizeof(mp_limb_t)), size);
+
+			if (data < begin)
+				data = _mpz_disk_io_next_data(handle->fds[0], begin);
+			if (data >= end)
+				handle->summary[i] = _MPZ_DISK_SUMMARY_ZERO;
+		}
+	}
+}
+
+static void _mpz_disk_summary_close(_mpz_disk_handle* handle)
+{
+	if (!handle->keep_summary)
+		return;
+
+	if (handle->summary_lost)
+		_mpz_disk_io_remove(handle->backend, handle->summary_filename);
+	else if (handle->mode != _MPZ_DISK_OPEN_READ) {
+		_mpz_disk_fd fd = _mpz_disk_io_open(handle->backend, handle->summary_filename, _MPZ_DISK_OPEN_CREATE);
+
+		if (fd != _MPZ_DISK_INVALID_FD) {
+			_mpz_disk_io_pwrite(fd, handle->summary, handle->n_summary, 0);
+			_mpz_disk_io_close(fd);
+		}
+	}
+
+	free(handle->summary);
+}
+
+static void _mpz_disk_summary_write(_mpz_disk_handle* handle, const mp_limb_t* buf, size_t limbs, size_t offset)
+{
+	if (!handle->keep_summary || limbs == 0)
+		return;
+
+	size_t first = offset / MPZ_DISK_SUMMARY_LIMBS;
+	size_t end = (offset + limbs - 1) / MPZ_DISK_SUMMARY_LIMBS + 1;
+
+	_mpz_disk_mutex_lock(&handle->lock);
+
+	// Without a summary every part is mixed
+	if (handle->summary_lost || _mpz_disk_summary_reserve(handle, end, _MPZ_DISK_SUMMARY_ZERO) != 0) {
+		handle->summary_lost = 1;
+		_mpz_disk_mutex_unlock(&handle->lock);
+		return;
+	}
+
+	for (size_t i = first; i < end; i++)
+	{
+		size_t begin = max(i * MPZ_DISK_SUMMARY_LIMBS, offset);
+		size_t part_end = min((i + 1) * MPZ_DISK_SUMMARY_LIMBS, offset + limbs);
+		int state = _mpz_disk_summary_classify(buf + (begin - offset), part_end - begin);
+
+		// A partial write only keeps the entry if it's of the same kind
+		if (part_end - begin == MPZ_DISK_SUMMARY_LIMBS || handle->summary[i] == state)
+			handle->summary[i] = state;
+		else
+			handle->summary[i] = _MPZ_DISK_SUMMARY_MIXED;
+	}
+
+	_mpz_disk_mutex_unlock(&handle->lock);
+}
+
+static void _mpz_disk_summary_resize(_mpz_disk_handle* handle, size_t limbs)
+{
+	if (!handle->keep_summary)
+		return;
+
+	size_t n = (limbs + MPZ_DISK_SUMMARY_LIMBS - 1) / MPZ_DISK_SUMMARY_LIMBS;
+
+	_mpz_disk_mutex_lock(&handle->lock);
+
+	// Nothing is unknown about an empty integer
+	if (n == 0)
+		handle->summary_lost = 0;
+
+	// The limbs cut off the last entry are zero from now on
+	if (n <= handle->n_summary) {
+		handle->n_summary = n;
+
+		if (n > 0 && limbs % MPZ_DISK_SUMMARY_LIMBS && handle->summary[n - 1] == _MPZ_DISK_SUMMARY_ONES)
+			handle->summary[n - 1] = _MPZ_DISK_SUMMARY_MIXED;
+	}
+
+	_mpz_disk_mutex_unlock(&handle->lock);
+}
+
+int _mpz_disk_get_summary(_mpz_disk_handle* handle, size_t offset, size_t limbs)
+{
+	if (!handle->keep_summary || handle->summary_lost)
+		return _MPZ_DISK_SUMMARY_MIXED;
+
+	if (limbs == 0)
+		return _MPZ_DISK_SUMMARY_ZERO;
+
+	size_t first = offset / MPZ_DISK_SUMMARY_LIMBS;
+	size_t end = (offset + limbs - 1) / MPZ_DISK_SUMMARY_LIMBS + 1;
+
+	_mpz_disk_mutex_lock(&handle->lock);
+
+	int state = first < handle->n_summary ? handle->summary[first] : _MPZ_DISK_SUMMARY_ZERO;
+	for (size_t i = first + 1; i < end && state != _MPZ_DISK_SUMMARY_MIXED; i++)
+		if ((i < handle->n_summary ? handle->summary[i] : _MPZ_DISK_SUMMARY_ZERO) != state)
+			state = _MPZ_DISK_SUMMARY_MIXED;
+
+	_mpz_disk_mutex_unlock(&handle->lock);
+
+	return state;
+}
+
+// CRC32C (Castagnoli) with the crc32 instruction of SSE4.2 where the CPU
+// has it, and a table otherwise
+static uint32_t _mpz_disk_crc32c_table[256];
+static int _mpz_disk_crc32c_sse42 = 0;
+static volatile long _mpz_disk_crc32c_ready = 0, _mpz_disk_crc32c_lock = 0;
+
+static void _mpz_disk_crc32c_init()
+{
+	_mpz_disk_spin_lock(&_mpz_disk_crc32c_lock);
+
+	if (!_mpz_disk_crc32c_ready) {
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++)
+				crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+			_mpz_disk_crc32c_table[i] = crc;
+		}
+
+#if defined(_M_X64) || defined(__x86_64__)
+#ifdef _WIN32
+		int info[4];
+		__cpuid(info, 1);
+		_mpz_disk_crc32c_sse42 = (info[2] >> 20) & 1;
+#elif defined(__unix__)
+		_mpz_disk_crc32c_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+#endif
+
+		_mpz_disk_crc32c_ready = 1;
+	}
+
+	_mpz_disk_spin_unlock(&_mpz_disk_crc32c_lock);
+}
+
+#if defined(_M_X64) || defined(__x86_64__)
+#ifndef _WIN32
+__attribute__((target("sse4.2")))
+#endif
+static uint32_t _mpz_disk_crc32c_hw(uint32_t crc, const unsigned char* data, size_t bytes)
+{
+	uint64_t crc64 = crc;
+	for (; bytes >= 8; bytes -= 8, data += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+
+	crc = (uint32_t)crc64;
+	for (; bytes > 0; bytes--, data++)
+		crc = _mm_crc32_u8(crc, *data);
+
+	return crc;
+}
+#endif
+
+uint32_t _mpz_disk_crc32c(uint32_t crc, const void* data, size_t bytes)
+{
+	if (!_mpz_disk_crc32c_ready)
+		_mpz_disk_crc32c_init();
+
+	const unsigned char* p = data;
+	crc = ~crc;
+
+#if defined(_M_X64) || defined(__x86_64__)
+	if (_mpz_disk_crc32c_sse42)
+		return ~_mpz_disk_crc32c_hw(crc, p, bytes);
+#endif
+
+	for (; bytes > 0; bytes--, p++)
+		crc = (crc >> 8) ^ _mpz_disk_crc32c_table[(crc ^ *p) & 0xff];
+
+	return ~crc;
+}
+
+// The checksums are a CRC32C for every entry of the summary, of all of its
+// MPZ_DISK_SUMMARY_LIMBS limbs with limbs past the end of the integer
+// counting as zero (so that zero-extending the integer keeps them right).
+// An entry's checksum is only known once a write has covered the entry up
+// to its end, or up to the end of the integer, until then it isn't checked.
+#define _MPZ_DISK_CHECKSUM_KNOWN ((uint64_t)1 << 32)
+
+// Checksum of an entry that is all zero, which entries past the end are
+static uint64_t _mpz_disk_zero_checksum = 0;
+
+static volatile int64_t _mpz_disk_checksum_errors = 0;
+
+static size_t _mpz_disk_read_files(_mpz_disk_handle* handle, mp_limb_t* buf, size_t limbs, size_t offset);
+
+// Checksum of an entry that starts with the 'limbs' limbs of buf and is zero after them
+static uint64_t _mpz_disk_checksum_entry(const mp_limb_t* buf, size_t limbs)
+{
+	static const mp_limb_t zeros[512] = { 0 };
+
+	uint32_t crc = _mpz_disk_crc32c(0, buf, limbs * sizeof(mp_limb_t));
+	for (size_t i = limbs; i < MPZ_DISK_SUMMARY_LIMBS; i += 512)
+		crc = _mpz_disk_crc32c(crc, zeros, min(512, MPZ_DISK_SUMMARY_LIMBS - i) * sizeof(mp_limb_t));
+
+	return _MPZ_DISK_CHECKSUM_KNOWN | crc;
+}
+
+int mpz_disk_set_checksums(int enabled)
+{
+	_mpz_disk_crc32c_init();
+	_mpz_disk_zero_checksum = _mpz_disk_checksum_entry(NULL, 0);
+
+	_mpz_disk_checksums = enabled != 0;
+
+	return 0;
+}
+
+int64_t mpz_disk_get_checksum_errors()
+{
+	return _mpz_disk_atomic_add(&_mpz_disk_checksum_errors, 0);
+}
+
+// Make sure the first n entries exist, new ones are set to 'fill'
+static int _mpz_disk_checksum_reserve(_mpz_disk_handle* handle, size_t n, uint64_t fill)
+{
+	if (n > handle->checksums_alloc) {
+		size_t alloc = max(n, 2 * handle->checksums_alloc);
+
+		uint64_t* checksums = realloc(handle->checksums, alloc * sizeof(uint64_t));
+		if (!checksums)
+			return -1;
+
+		handle->checksums = checksums;
+		handle->checksums_alloc = alloc;
+	}
+
+	for (; handle->n_checksums < n; handle->n_checksums++)
+		handle->checksums[handle->n_checksums] = fill;
+
+	return 0;
+}
+
+// Stop keeping checksums (e.g. when there's no memory for them), for good
+static void _mpz_disk_checksum_drop(_mpz_disk_handle* handle)
+{
+	free(handle->checksums);
+	handle->checksums = NULL;
+	handle->n_checksums = handle->checksums_alloc = 0;
+	handle->keep_checksums = 0;
+
+	_mpz_disk_io_remove(handle->backend, handle->checksum_filename);
+}
+
+static void _mpz_disk_checksum_open(_mpz_disk_handle* handle, mpz_disk_ptr op, int mode)
+{
+	handle->keep_checksums = op->keep_checksums;
+	handle->checksums = NULL;
+	handle->n_checksums = handle->checksums_alloc = 0;
+
+	if (!handle->keep_checksums)
+		return;
+
+	_mpz_disk_get_checksum_filename(handle->checksum_filename, op);
+
+	if (mode == _MPZ_DISK_OPEN_CREATE)
+		return;
+
+	_mpz_disk_fd fd = _mpz_disk_io_open(handle->backend, handle->checksum_filename, _MPZ_DISK_OPEN_READ);
+	if (fd != _MPZ_DISK_INVALID_FD) {
+		int64_t size = _mpz_disk_io_size(fd);
+		size_t n = size > 0 ? (size_t)size / sizeof(uint64_t) : 0;
+
+		if (n == 0 || _mpz_disk_checksum_reserve(handle, n, 0) != 0 ||
+			_mpz_disk_io_pread(fd, handle->checksums, n * sizeof(uint64_t), 0) != n * sizeof(uint64_t))
+			handle->n_checksums = 0;
+
+		_mpz_disk_io_close(fd);
+	}
+
+	// Parts of the integer without checksums (e.g. written while they were
+	// off) aren't checked
+	size_t limbs = (size_t)((_mpz_disk_handle_size(handle) + sizeof(mp_limb_t) - 1) / sizeof(mp_limb_t));
+	size_t n = (limbs + MPZ_DISK_SUMMARY_LIMBS - 1) / MPZ_DISK_SUMMARY_LIMBS;
+
+	handle->n_checksums = min(handle->n_checksums, n);
+	if (_mpz_disk_checksum_reserve(handle, n, 0) != 0)
+		_mpz_disk_checksum_drop(handle);
+}
+
+static void _mpz_disk_checksum_close(_mpz_disk_handle* handle)
+{
+	if (!handle->keep_checksums)
+		return;
+
+	if (handle->mode != _MPZ_DISK_OPEN_READ) {
+		_mpz_disk_fd fd = _mpz_disk_io_open(handle->backend, handle->checksum_filename, _MPZ_DISK_OPEN_CREATE);
+
+		if (fd != _MPZ_DISK_INVALID_FD) {
+			_mpz_disk_io_pwrite(fd, handle->checksums, handle->n_checksums * sizeof(uint64_t), 0);
+			_mpz_disk_io_close(fd);
+		}
+	}
+
+	free(handle->checksums);
+}
+
+static void _mpz_disk_checksum_write(_mpz_disk_handle* handle, const mp_limb_t* buf, size_t limbs, size_t offset)
+{
+	if (!handle->keep_checksums || limbs == 0)
+		return;
+
+	_mpz_disk_mutex_lock(&handle->lock);
+	int64_t size = handle->size;
+	_mpz_disk_mutex_unlock(&handle->lock);
+
+	size_t first = offset / MPZ_DISK_SUMMARY_LIMBS;
+	size_t end = (offset + limbs - 1) / MPZ_DISK_SUMMARY_LIMBS + 1;
+
+	for (size_t i = first; i < end; i++)
+	{
+		size_t entry = i * MPZ_DISK_SUMMARY_LIMBS;
+		size_t begin = max(entry, offset);
+		size_t part_end = min(entry + MPZ_DISK_SUMMARY_LIMBS, offset + limbs);
+
+		// The CRC is worked out outside the lock, so that the threads
+		// writing an integer don't wait for each other
+		uint64_t checksum = 0;
+		if (begin == entry && (part_end == entry + MPZ_DISK_SUMMARY_LIMBS ||
+			(size >= 0 && (int64_t)(part_end * sizeof(mp_limb_t)) >= size)))
+			checksum = _mpz_disk_checksum_entry(buf + (begin - offset), part_end - begin);
+
+		// Entries skipped over are past the end, i.e. zero
+		_mpz_disk_mutex_lock(&handle->lock);
+
+		if (handle->keep_checksums) {
+			if (_mpz_disk_checksum_reserve(handle, i + 1, _mpz_disk_zero_checksum) == 0)
+				handle->checksums[i] = checksum;
+			else
+				_mpz_disk_checksum_drop(handle);
+		}
+
+		_mpz_disk_mutex_unlock(&handle->lock);
+	}
+}
+
+// Check the entries that limbs [offset, offset + limbs) in buf cover up to
+// their end (or the end of the integer) against their checksums. Returns
+// the number of entries that don't match.
+static int64_t _mpz_disk_checksum_check(_mpz_disk_handle* handle, const mp_limb_t* buf, size_t limbs, size_t offset)
+{
+	if (!handle->keep_checksums)
+		return 0;
+
+	_mpz_disk_mutex_lock(&handle->lock);
+	int64_t size = handle->size;
+	_mpz_disk_mutex_unlock(&handle->lock);
+
+	if (size < 0)
+		return 0;
+
+	size_t end = min(offset + limbs, (size_t)size / sizeof(mp_limb_t));
+
+	int64_t mismatches = 0;
+	for (size_t entry = (offset + MPZ_DISK_SUMMARY_LIMBS - 1) / MPZ_DISK_SUMMARY_LIMBS * MPZ_DISK_SUMMARY_LIMBS;
+		entry < end; entry += MPZ_DISK_SUMMARY_LIMBS)
+	{
+		size_t entry_end = min(entry + MPZ_DISK_SUMMARY_LIMBS, (size_t)size / sizeof(mp_limb_t));
+		if (entry_end > end)
+			break;
+
+		size_t i = entry / MPZ_DISK_SUMMARY_LIMBS;
+
+		_mpz_disk_mutex_lock(&handle->lock);
+		uint64_t expected = !handle->keep_checksums ? 0 :
+			i < handle->n_checksums ? handle->checksums[i] : _mpz_disk_zero_checksum;
+		_mpz_disk_mutex_unlock(&handle->lock);
+
+		if ((expected & _MPZ_DISK_CHECKSUM_KNOWN) && _mpz_disk_checksum_entry(buf + (entry - offset), entry_end - entry) != expected)
+			mismatches++;
+	}
+
+	if (mismatches)
+		_mpz_disk_atomic_add(&_mpz_disk_checksum_errors, mismatches);
+
+	return mismatches;
+}
+
+// Called before the files are cut (or extended) from old_size bytes to
+// 'limbs' limbs
+static void _mpz_disk_checksum_resize(_mpz_disk_handle* handle, size_t limbs, int64_t old_size)
+{
+	if (!handle->keep_checksums)
+		return;
+
+	size_t n = (limbs + MPZ_DISK_SUMMARY_LIMBS - 1) / MPZ_DISK_SUMMARY_LIMBS;
+	size_t kept = limbs % MPZ_DISK_SUMMARY_LIMBS;
+	size_t old_limbs = old_size >= 0 ? (size_t)old_size / sizeof(mp_limb_t) : SIZE_MAX;
+
+	_mpz_disk_mutex_lock(&handle->lock);
+
+	int cut = n <= handle->n_checksums && kept && old_limbs > limbs && (handle->checksums[n - 1] & _MPZ_DISK_CHECKSUM_KNOWN);
+	uint64_t old_checksum = cut ? handle->checksums[n - 1] : 0;
+
+	if (n <= handle->n_checksums) {
+		handle->n_checksums = n;
+
+		if (cut)
+			handle->checksums[n - 1] = 0;
+	}
+
+	_mpz_disk_mutex_unlock(&handle->lock);
+
+	// Extending only adds zeroes, which the checksums count in already, but
+	// cutting the last entry short needs a new checksum. The entry is checked
+	// before it is cut, so that a damaged one doesn't get a valid checksum.
+	if (!cut || old_size < 0)
+		return;
+
+	size_t entry = (n - 1) * MPZ_DISK_SUMMARY_LIMBS;
+	size_t entry_limbs = min(old_limbs - entry, MPZ_DISK_SUMMARY_LIMBS);
+	mp_limb_t* buf = _mpz_disk_buffer_alloc(entry_limbs * sizeof(mp_limb_t));
+
+	if (buf && _mpz_disk_read_files(handle, buf, entry_limbs, entry) == entry_limbs * sizeof(mp_limb_t)) {
+		if (_mpz_disk_checksum_entry(buf, entry_limbs) == old_checksum) {
+			_mpz_disk_mutex_lock(&handle->lock);
+			if (handle->keep_checksums && n <= handle->n_checksums)
+				handle->checksums[n - 1] = _mpz_disk_checksum_entry(buf, kept);
+			_mpz_disk_mutex_unlock(&handle->lock);
+		}
+		else
+			_mpz_disk_atomic_add(&_mpz_disk_checksum_errors, 1);
+	}
+
+	_mpz_disk_buffer_free(buf);
+}
+
+// Block cache shared by all integers and threads. It keeps recently read
+// blocks of MPZ_DISK_CACHE_BLOCK_LIMBS limbs of the integers on disk, so
+// that an operand read again by the next operation comes from memory.
+// Blocks are keyed by the cache_id of the handle (i.e. the integer) and
+// their number, writes and resizes drop the blocks they touch. The cache
+// takes memory a block at a time as blocks are read, until it reaches its
+// size; then the block to replace is picked by the CLOCK algorithm.
+typedef struct
+{
+	uint64_t id;	// 0 = free
+	size_t block;
+	size_t limbs;	// Limbs of the block held, from its start
+	int referenced;
+	int pins;	// Copies in or out of limbs running without the lock
+	int next;	// Next entry of the same hash bucket, -1 = none
+	mp_limb_t* limbs_ptr;
+} _mpz_disk_cache_entry;
+
+// Blocks taken at a time before the automatic size is looked at again
+#define _MPZ_DISK_CACHE_GROW_BLOCKS 64
+
+// The lock only covers the entries and buckets, the blocks are copied
+// without it while their entries are pinned
+static _mpz_disk_mutex _mpz_disk_cache_lock;
+static volatile long _mpz_disk_cache_lock_init = 0;
+static volatile int64_t _mpz_disk_cache_lock_ready = 0;
+static size_t _mpz_disk_cache_max_bytes = MPZ_DISK_CACHE_AUTO;
+static _mpz_disk_cache_entry* _mpz_disk_cache_entries = NULL;
+static int* _mpz_disk_cache_buckets = NULL;
+static size_t _mpz_disk_cache_n_entries = 0, _mpz_disk_cache_alloc_entries = 0, _mpz_disk_cache_n_buckets = 0, _mpz_disk_cache_hand = 0;
+static size_t _mpz_disk_cache_max_entries = 0;
+static volatile int64_t _mpz_disk_cache_hits = 0, _mpz_disk_cache_misses = 0;
+static volatile int64_t _mpz_disk_cache_ids = 0;
+
+static void _mpz_disk_cache_acquire()
+{
+	// The cache has no init function, its lock is set up on first use and
+	// published through the atomic helpers
+	if (!_mpz_disk_atomic_add(&_mpz_disk_cache_lock_ready, 0)) {
+		_mpz_disk_spin_lock(&_mpz_disk_cache_lock_init);
+		if (!_mpz_disk_atomic_add(&_mpz_disk_cache_lock_ready, 0)) {
+			_mpz_disk_mutex_init(&_mpz_disk_cache_lock);
+			_mpz_disk_atomic_add(&_mpz_disk_cache_lock_ready, 1);
+		}
+		_mpz_disk_spin_unlock(&_mpz_disk_cache_lock_init);
+	}
+
+	_mpz_disk_mutex_lock(&_mpz_disk_cache_lock);
+}
+
+static void _mpz_disk_cache_release()
+{
+	_mpz_disk_mutex_unlock(&_mpz_disk_cache_lock);
+}
+
+static int* _mpz_disk_cache_bucket(uint64_t id, size_t block)
+{
+	uint64_t hash = id * 0x9E3779B97F4A7C15ull + block * 0xC2B2AE3D27D4EB4Full;
+	hash ^= hash >> 29;
+
+	return &_mpz_disk_cache_buckets[hash & (_mpz_disk_cache_n_buckets - 1)];
+}
+
+static int _mpz_disk_cache_find(uint64_t id, size_t block)
+{
+	if (!_mpz_disk_cache_n_buckets)
+		return -1;
+
+	int i = *_mpz_disk_cache_bucket(id, block);
+
+	while (i >= 0 && (_mpz_disk_cache_entries[i].id != id || _mpz_disk_cache_entries[i].block != block))
+		i = _mpz_disk_cache_entries[i].next;
+
+	return i;
+}
+
+// Take an entry out of its bucket. Its block is only reused once it isn't
+// pinned any more.
+static void _mpz_disk_cache_remove(int i)
+{
+	_mpz_disk_cache_entry* entry = &_mpz_disk_cache_entries[i];
+
+	int* link = _mpz_disk_cache_bucket(entry->id, entry->block);
+	while (*link != i)
+		link = &_mpz_disk_cache_entries[*link].next;
+	*link = entry->next;
+
+	entry->id = 0;
+}
+
+// Add a free entry with a block of its own, with the lock held. Returns -1
+// if the cache is at its size. The automatic size is a quarter of the
+// memory an operation may use, counting the blocks the cache holds already.
+static int _mpz_disk_cache_grow()
+{
+	const size_t block_bytes = MPZ_DISK_CACHE_BLOCK_LIMBS * sizeof(mp_limb_t);
+	size_t n = _mpz_disk_cache_n_entries;
+
+	if (n % _MPZ_DISK_CACHE_GROW_BLOCKS == 0 && n >= _mpz_disk_cache_max_entries) {
+		_mpz_disk_cache_max_entries = _mpz_disk_cache_max_bytes == MPZ_DISK_CACHE_AUTO ?
+			(_mpz_disk_op_mem() + n * block_bytes) / 4 / block_bytes : _mpz_disk_cache_max_bytes / block_bytes;
+
+		// Not looked at again until it is reached
+		_mpz_disk_cache_max_entries = min(_mpz_disk_cache_max_entries, n + _MPZ_DISK_CACHE_GROW_BLOCKS);
+	}
+
+	if (n >= _mpz_disk_cache_max_entries)
+		return -1;
+
+	if (n == _mpz_disk_cache_alloc_entries) {
+		size_t alloc = max(2 * n, _MPZ_DISK_CACHE_GROW_BLOCKS);
+		_mpz_disk_cache_entry* entries = realloc(_mpz_disk_cache_entries, alloc * sizeof(_mpz_disk_cache_entry));
+		if (!entries)
+			return -1;
+		_mpz_disk_cache_entries = entries;
+		_mpz_disk_cache_alloc_entries = alloc;
+
+		// Twice as many buckets as entries
+		int* buckets = malloc(2 * alloc * sizeof(int));
+		if (!buckets)
+			return -1;
+		free(_mpz_disk_cache_buckets);
+		_mpz_disk_cache_buckets = buckets;
+		_mpz_disk_cache_n_buckets = 2 * alloc;
+		memset(buckets, -1, 2 * alloc * sizeof(int));
+
+		for (size_t i = 0; i < n; i++)
+		{
+			if (!entries[i].id)
+				continue;
+
+			int* bucket = _mpz_disk_cache_bucket(entries[i].id, entries[i].block);
+			entries[i].next = *bucket;
+			*bucket = (int)i;
+		}
+	}
+
+	mp_limb_t* limbs = malloc(block_bytes);
+	if (!limbs) {
+		_mpz_disk_cache_max_entries = n;
+		return -1;
+	}
+
+	memset(&_mpz_disk_cache_entries[n], 0, sizeof(_mpz_disk_cache_entry));
+	_mpz_disk_cache_entries[n].next = -1;
+	_mpz_disk_cache_entries[n].limbs_ptr = limbs;
+	_mpz_disk_cache_n_entries++;
+
+	return (int)n;
+}
+
+// Entry to replace once the cache is full, with the lock held. Returns -1
+// if all of them are pinned.
+static int _mpz_disk_cache_evict()
+{
+	size_t n = _mpz_disk_cache_n_entries;
+
+	// Give blocks that were used since the hand last passed them another
+	// round, at most two rounds in all
+	for (size_t step = 0; step < 2 * n; step++)
+	{
+		size_t i = _mpz_disk_cache_hand;
+		_mpz_disk_cache_entry* entry = &_mpz_disk_cache_entries[i];
+		_mpz_disk_cache_hand = (_mpz_disk_cache_hand + 1) % n;
+
+		if (entry->pins)
+			continue;
+
+		if (entry->id && entry->referenced) {
+			entry->referenced = 0;
+			continue;
+		}
+
+		if (entry->id)
+			_mpz_disk_cache_remove((int)i);
+
+		return (int)i;
+	}
+
+	return -1;
+}
+
+// Copy limbs [begin, end) of a block out of the cache, if it has them
+static int _mpz_disk_cache_get(_mpz_disk_handle* handle, size_t block, mp_limb_t* dst, size_t begin, size_t end)
+{
+	if (_mpz_disk_cache_max_bytes == 0)
+		return 0;
+
+	const mp_limb_t* src = NULL;
+	int i;
+
+	_mpz_disk_cache_acquire();
+
+	i = _mpz_disk_cache_find(handle->cache_id, block);
+	if (i >= 0 && _mpz_disk_cache_entries[i].limbs >= end) {
+		_mpz_disk_cache_entries[i].referenced = 1;
+		_mpz_disk_cache_entries[i].pins++;
+		src = _mpz_disk_cache_entries[i].limbs_ptr;
+	}
+
+	_mpz_disk_cache_release();
+
+	if (src) {
+		memcpy(dst, src + begin, (end - begin) * sizeof(mp_limb_t));
+
+		_mpz_disk_cache_acquire();
+		_mpz_disk_cache_entries[i].pins--;
+		_mpz_disk_cache_release();
+	}
+
+	_mpz_disk_atomic_add(src ? &_mpz_disk_cache_hits : &_mpz_disk_cache_misses, 1);
+
+	return src != NULL;
+}
+
+// Keep the first 'limbs' limbs of a block
+static void _mpz_disk_cache_put(_mpz_disk_handle* handle, size_t block, const mp_limb_t* src, size_t limbs)
+{
+	if (_mpz_disk_cache_max_bytes == 0)
+		return;
+
+	mp_limb_t* dst = NULL;
+
+	_mpz_disk_cache_acquire();
+
+	int i = _mpz_disk_cache_find(handle->cache_id, block);
+
+	if (i < 0 || _mpz_disk_cache_entries[i].limbs < limbs) {
+		// A shorter copy of the block is replaced by a new entry, as it
+		// may be being copied out
+		if (i >= 0)
+			_mpz_disk_cache_remove(i);
+
+		i = _mpz_disk_cache_grow();
+		if (i < 0)
+			i = _mpz_disk_cache_evict();
+
+		if (i >= 0) {
+			_mpz_disk_cache_entry* entry = &_mpz_disk_cache_entries[i];
+			int* bucket = _mpz_disk_cache_bucket(handle->cache_id, block);
+
+			// Found by the readers once it is filled
+			entry->id = handle->cache_id;
+			entry->block = block;
+			entry->limbs = 0;
+			entry->referenced = 0;
+			entry->pins = 1;
+			entry->next = *bucket;
+			*bucket = i;
+
+			dst = entry->limbs_ptr;
+		}
+	}
+
+	_mpz_disk_cache_release();
+
+	if (!dst)
+		return;
+
+	memcpy(dst, src, limbs * sizeof(mp_limb_t));
+
+	_mpz_disk_cache_acquire();
+
+	// Unless it was dropped meanwhile
+	_mpz_disk_cache_entry* entry = &_mpz_disk_cache_entries[i];
+	if (entry->id == handle->cache_id && entry->block == block)
+		entry->limbs = limbs;
+	entry->pins--;
+
+	_mpz_disk_cache_release();
+}
+
+// Drop blocks [first_block, end_block) of an integer
+static void _mpz_disk_cache_drop(_mpz_disk_handle* handle, size_t first_block, size_t end_block)
+{
+	if (!handle->kept || first_block >= end_block || _mpz_disk_cache_max_bytes == 0)
+		return;
+
+	_mpz_disk_cache_acquire();
+
+	// Look the blocks up one by one, or go through the whole cache if
+	// that's quicker
+	if (end_block - first_block <= _mpz_disk_cache_n_entries) {
+		for (size_t block = first_block; block < end_block; block++)
+		{
+			int i = _mpz_disk_cache_find(handle->cache_id, block);
+			if (i >= 0)
+				_mpz_disk_cache_remove(i);
+		}
+	}
+	else {
+		for (size_t i = 0; i < _mpz_disk_cache_n_entries; i++)
+			if (_mpz_disk_cache_entries[i].id == handle->cache_id &&
+				_mpz_disk_cache_entries[i].block >= first_block && _mpz_disk_cache_entries[i].block < end_block)
+				_mpz_disk_cache_remove((int)i);
+	}
+
+	_mpz_disk_cache_release();
+}
+
+int mpz_disk_set_cache_size(size_t max_bytes)
+{
+	_mpz_disk_cache_acquire();
+
+	for (size_t i = 0; i < _mpz_disk_cache_n_entries; i++)
+		free(_mpz_disk_cache_entries[i].limbs_ptr);
+	free(_mpz_disk_cache_entries);
+	free(_mpz_disk_cache_buckets);
+	_mpz_disk_cache_entries = NULL;
+	_mpz_disk_cache_buckets = NULL;
+	_mpz_disk_cache_n_entries = _mpz_disk_cache_alloc_entries = _mpz_disk_cache_n_buckets = 0;
+	_mpz_disk_cache_max_entries = 0;
+	_mpz_disk_cache_hand = 0;
+
+	_mpz_disk_cache_max_bytes = max_bytes;
+
+	_mpz_disk_cache_release();
+
+	return 0;
+}
+
+void mpz_disk_get_cache_stats(int64_t* hits, int64_t* misses)
+{
+	*hits = _mpz_disk_cache_hits;
+	*misses = _mpz_disk_cache_misses;
+}
+
+// Open the files of op into handle
+static int _mpz_disk_open_files(_mpz_disk_handle* handle, mpz_disk_ptr op, int mode)
+{
+	handle->n_fds = max(op->stripe_dirs, 1);
+	handle->backend = op->backend;
+	handle->stripe_limbs = op->stripe_dirs ? op->stripe_limbs : 0;
+	handle->chunked = NULL;
+
+	for (int i = 0; i < handle->n_fds; i++)
+	{
+		char filename[MPZ_DISK_MAX_PATH + MPZ_DISK_FILENAME_LEN];
+		_mpz_disk_get_stripe_filename(filename, op, i);
+
+		handle->fds[i] = _mpz_disk_io_open(handle->backend, filename, mode);
+
+		if (handle->fds[i] == _MPZ_DISK_INVALID_FD) {
+			while (i-- > 0)
+				_mpz_disk_io_close(handle->fds[i]);
+			handle->n_fds = 0;
+
+			return -1;
+		}
+	}
+
+	if (op->chunk_limbs && !(handle->chunked = _mpz_disk_chunked_open(op, mode))) {
+		_mpz_disk_io_close(handle->fds[0]);
+		handle->n_fds = 0;
+
+		return -1;
+	}
+
+	_mpz_disk_summary_open(handle, op, mode);
+	_mpz_disk_checksum_open(handle, op, mode);
+
+	return 0;
+}
+
+static void _mpz_disk_close_files(_mpz_disk_handle* handle)
+{
+	_mpz_disk_summary_close(handle);
+	_mpz_disk_checksum_close(handle);
+
+	if (handle->chunked)
+		_mpz_disk_chunked_close(handle);
+	handle->chunked = NULL;
+
+	for (int i = 0; i < handle->n_fds; i++)
+		_mpz_disk_io_close(handle->fds[i]);
+	handle->n_fds = 0;
+}
+
+// Whether the limbs are held in memory. If so, this returns with
+// handle->memory_lock held, so that they stay there until it's released.
+static int _mpz_disk_lock_memory(_mpz_disk_handle* handle)
+{
+	if (!handle->max_memory_limbs)
+		return 0;
+
+	_mpz_disk_mutex_lock(&handle->memory_lock);
+
+	if (handle->in_memory)
+		return 1;
+
+	_mpz_disk_mutex_unlock(&handle->memory_lock);
+
+	return 0;
+}
+
+static void _mpz_disk_unmap_view(_mpz_disk_handle* handle);
+
+_mpz_disk_handle* _mpz_disk_open(mpz_disk_ptr op, int mode)
+{
+	// Integers keep their files open between operations
+	if (op->handle) {
+		if (mode == _MPZ_DISK_OPEN_CREATE && _mpz_disk_resize(op->handle, 0) != 0)
+			return NULL;
+
+		_mpz_disk_atomic_add(&op->handle->refs, 1);
+
+		return op->handle;
+	}
+
+	_mpz_disk_handle* handle = malloc(sizeof(_mpz_disk_handle));
+	if (!handle)
+		return NULL;
+
+	handle->op = op;
+	handle->backend = op->backend;
+	handle->kept = 0;
+	handle->refs = 1;
+	handle->cache_id = (uint64_t)_mpz_disk_atomic_add(&_mpz_disk_cache_ids, 1) + 1;
+	handle->memory = NULL;
+	handle->memory_limbs = handle->memory_alloc = 0;
+	handle->max_memory_limbs = 0;
+	handle->in_memory = 0;
+	handle->map = NULL;
+	handle->map_refs = 0;
+
+	// Opening the files already looks up their size
+	_mpz_disk_mutex_init(&handle->lock);
+	handle->size = -1;
+
+	if (mode == _MPZ_DISK_OPEN_MEMORY) {
+		// No files until the limbs outgrow op->max_memory_limbs
+		handle->n_fds = 0;
+		handle->stripe_limbs = 0;
+		handle->chunked = NULL;
+		handle->keep_summary = 0;
+		handle->keep_checksums = 0;
+		handle->mode = _MPZ_DISK_OPEN_CREATE;
+		handle->max_memory_limbs = op->max_memory_limbs;
+		handle->in_memory = 1;
+
+		_mpz_disk_mutex_init(&handle->memory_lock);
+	}
+	else if (_mpz_disk_open_files(handle, op, mode) != 0) {
+		_mpz_disk_mutex_destroy(&handle->lock);
+		free(handle);
+		return NULL;
+	}
+
+	// The size is only looked up here, from then on it follows our writes
+	handle->size = mode == _MPZ_DISK_OPEN_READ || mode == _MPZ_DISK_OPEN_WRITE ? _mpz_disk_handle_size(handle) : 0;
+	handle->normalized = handle->size == 0;
+
+	return handle;
+}
+
+void _mpz_disk_close(_mpz_disk_handle* handle)
+{
+	if (!handle)
+		return;
+
+	// Kept handles stay open, but once no operation is using them their
+	// partly written chunks are written out (and the buffers given back)
+	if (handle->kept) {
+		if (_mpz_disk_atomic_add(&handle->refs, -1) == 1 && handle->chunked)
+			_mpz_disk_chunked_flush(handle);
+
+		return;
+	}
+
+	_mpz_disk_unmap_view(handle);
+	_mpz_disk_close_files(handle);
+
+	if (handle->max_memory_limbs)
+		_mpz_disk_mutex_destroy(&handle->memory_lock);
+	free(handle->memory);
+
+	_mpz_disk_mutex_destroy(&handle->lock);
+
+	free(handle);
+}
+
+void _mpz_disk_keep_open(mpz_disk_ptr op, _mpz_disk_handle* handle)
+{
+	handle->kept = 1;
+	handle->op = op;
+	op->handle = handle;
+}
+
+void _mpz_disk_release(mpz_disk_ptr op)
+{
+	_mpz_disk_handle* handle = op->handle;
+	if (!handle)
+		return;
+
+	op->handle = NULL;
+
+	// Nothing has to be written back, the files are about to be removed
+	handle->kept = 0;
+	handle->mode = _MPZ_DISK_OPEN_READ;
+	if (handle->chunked)
+		handle->chunked->mode = _MPZ_DISK_OPEN_READ;
+
+	_mpz_disk_close(handle);
+}
+
+int _mpz_disk_in_memory(mpz_disk_ptr op)
+{
+	if (!op->handle || !_mpz_disk_lock_memory(op->handle))
+		return 0;
+
+	_mpz_disk_mutex_unlock(&op->handle->memory_lock);
+
+	return 1;
+}
+
+static void _mpz_disk_unmap_view(_mpz_disk_handle* handle)
+{
+	if (!handle->map)
+		return;
+
+	if (handle->map_copy)
+		_mpz_disk_buffer_free((void*)handle->map);
+	else {
+#ifdef _WIN32
+		UnmapViewOfFile(handle->map);
+		CloseHandle(handle->map_object);
+#elif defined(__unix__)
+		munmap((void*)handle->map, handle->map_bytes);
+#endif
+	}
+
+	handle->map = NULL;
+	handle->map_refs = 0;
+}
+
+const mp_limb_t* _mpz_disk_map(_mpz_disk_handle* handle, size_t limbs)
+{
+	// Stands in for the limbs of zero
+	static const mp_limb_t zero_limb = 0;
+
+	if (limbs == 0)
+		return &zero_limb;
+
+	_mpz_disk_mutex_lock(&handle->lock);
+
+	if (handle->map) {
+		handle->map_refs++;
+		_mpz_disk_mutex_unlock(&handle->lock);
+
+		return handle->map;
+	}
+
+	const mp_limb_t* map = NULL;
+	size_t bytes = limbs * sizeof(mp_limb_t);
+	int in_memory = _mpz_disk_lock_memory(handle);
+	if (in_memory)
+		_mpz_disk_mutex_unlock(&handle->memory_lock);
+
+	// Only the limbs of a single plain file are where they can be mapped
+	handle->map_copy = in_memory || handle->chunked || handle->stripe_limbs != 0 ||
+		handle->fds[0]->backend->open != _mpz_disk_file_open;
+
+	if (!handle->map_copy) {
+#ifdef _WIN32
+		handle->map_object = CreateFileMapping(_mpz_disk_native(handle->fds[0]->file), NULL, PAGE_READONLY, (DWORD)((uint64_t)bytes >> 32), (DWORD)bytes, NULL);
+		if (handle->map_object) {
+			map = MapViewOfFile(handle->map_object, FILE_MAP_READ, 0, 0, bytes);
+			if (!map)
+				CloseHandle(handle->map_object);
+		}
+#elif defined(__unix__)
+		void* mapped = mmap(NULL, bytes, PROT_READ, MAP_SHARED, _mpz_disk_native(handle->fds[0]->file), 0);
+		map = mapped == MAP_FAILED ? NULL : mapped;
+#endif
+	}
+	else {
+		// Read outside handle->lock, which the reads take themselves
+		_mpz_disk_mutex_unlock(&handle->lock);
+		mp_limb_t* copy = _mpz_disk_buffer_alloc(bytes);
+		if (copy && _mpz_disk_read_limbs(handle, copy, limbs, 0, limbs) != 0) {
+			_mpz_disk_buffer_free(copy);
+			copy = NULL;
+		}
+		_mpz_disk_mutex_lock(&handle->lock);
+
+		map = copy;
+
+		// Mapped by another thread in the meantime
+		if (handle->map) {
+			_mpz_disk_buffer_free(copy);
+			handle->map_refs++;
+			map = handle->map;
+			_mpz_disk_mutex_unlock(&handle->lock);
+
+			return map;
+		}
+	}
+
+	if (map) {
+		handle->map = map;
+		handle->map_bytes = bytes;
+		handle->map_refs = 1;
+	}
+
+	_mpz_disk_mutex_unlock(&handle->lock);
+
+	return map;
+}
+
+void _mpz_disk_unmap(_mpz_disk_handle* handle, const mp_limb_t* map)
+{
+	_mpz_disk_mutex_lock(&handle->lock);
+
+	// Nothing is mapped for zero
+	if (map == handle->map && --handle->map_refs == 0)
+		_mpz_disk_unmap_view(handle);
+
+	_mpz_disk_mutex_unlock(&handle->lock);
+}
+
+int _mpz_disk_sync(_mpz_disk_handle* handle)
+{
+	// Nothing to lose but the process
+	if (_mpz_disk_lock_memory(handle)) {
+		_mpz_disk_mutex_unlock(&handle->memory_lock);
+		return 0;
+	}
+
+	// The pending chunks and the index have to be on disk as well
+	if (handle->chunked) {
+		_mpz_disk_chunked_flush(handle);
+
+		if (_mpz_disk_chunked_write_index(handle->chunked, 1) != 0)
+			return -1;
+	}
+
+	for (int i = 0; i < handle->n_fds; i++)
+		if (_mpz_disk_io_sync(handle->fds[i]) != 0)
+			return -1;
+
+	return 0;
+}
+
+int _mpz_disk_write_journal(mpz_disk_ptr rop, _mpz_disk_handle* fp, const void* journal, size_t bytes)
+{
+	// The journal must never get ahead of the limbs it describes
+	if (_mpz_disk_sync(fp) != 0)
+		return -1;
+
+	char journal_filename[MPZ_DISK_FILENAME_LEN];
+	_mpz_disk_get_journal_filename(journal_filename, rop);
+
+	_mpz_disk_fd fd = _mpz_disk_io_open(rop->backend, journal_filename, _MPZ_DISK_OPEN_WRITE);
+	if (fd == _MPZ_DISK_INVALID_FD)
+		return -1;
+
+	// Small enough to be written in a single sector
+	int ret = _mpz_disk_io_pwrite(fd, journal, bytes, 0) == 0 && _mpz_disk_io_sync(fd) == 0 ? 0 : -1;
+	_mpz_disk_io_close(fd);
+
+	return ret;
+}
+
+int _mpz_disk_read_journal(mpz_disk_ptr rop, void* journal, size_t bytes)
+{
+	char journal_filename[MPZ_DISK_FILENAME_LEN];
+	_mpz_disk_get_journal_filename(journal_filename, rop);
+
+	_mpz_disk_fd fd = _mpz_disk_io_open(rop->backend, journal_filename, _MPZ_DISK_OPEN_READ);
+	if (fd == _MPZ_DISK_INVALID_FD)
+		return -1;
+
+	int ret = _mpz_disk_io_pread(fd, journal, bytes, 0) == bytes ? 0 : -1;
+	_mpz_disk_io_close(fd);
+
+	return ret;
+}
+
+// Moves limbs [offset, offset + limbs) of a striped integer to or from buf,
+// with one thread per stripe directory (i.e. per device): the calling
+// thread for the first one, and the worker of the directory for the others
+static _mpz_disk_worker _mpz_disk_stripe_workers[MPZ_DISK_MAX_STRIPE_DIRS];
+
+typedef struct
+{
+	_mpz_disk_handle* handle;
+	mp_limb_t* buf;
+	size_t limbs, offset;
+	size_t first_stripe;
+	int write;
+	int error;
+} _mpz_disk_stripe_job;
+
+static void _mpz_disk_stripe_thread(void* arg, int thread_idx)
+{
+	_mpz_disk_stripe_job* job = arg;
+
+	size_t stripe_limbs = job->handle->stripe_limbs;
+	size_t n_dirs = job->handle->n_fds;
+	size_t end = job->offset + job->limbs;
+
+	// All stripes handled by this thread are in the same directory
+	for (size_t stripe = job->first_stripe + thread_idx; stripe * stripe_limbs < end; stripe += n_dirs)
+	{
+		size_t begin = max(stripe * stripe_limbs, job->offset);
+		size_t limbs = min((stripe + 1) * stripe_limbs, end) - begin;
+
+		// Position of the limbs inside the stripe file
+		int64_t pos = (int64_t)((stripe / n_dirs) * stripe_limbs + begin - stripe * stripe_limbs) * sizeof(mp_limb_t);
+		_mpz_disk_fd fd = job->handle->fds[stripe % n_dirs];
+
+		if (job->write) {
+			if (_mpz_disk_io_pwrite(fd, job->buf + (begin - job->offset), limbs * sizeof(mp_limb_t), pos) != 0)
+				job->error = 1;
+		}
+		else if (_mpz_disk_io_pread(fd, job->buf + (begin - job->offset), limbs * sizeof(mp_limb_t), pos) != limbs * sizeof(mp_limb_t))
+			job->error = 1;
+	}
+}
+
+static int _mpz_disk_stripe_io(_mpz_disk_handle* handle, mp_limb_t* buf, size_t limbs, size_t offset, int write)
+{
+	_mpz_disk_stripe_job job;
+
+	job.handle = handle;
+	job.buf = buf;
+	job.limbs = limbs;
+	job.offset = offset;
+	job.first_stripe = offset / handle->stripe_limbs;
+	job.write = write;
+	job.error = 0;
+
+	// Thread i does the stripes in directory (first_stripe + i) % n_fds, on
+	// the worker of that directory
+	size_t n_stripes = (offset + limbs - 1) / handle->stripe_limbs - job.first_stripe + 1;
+	_mpz_disk_workers_run(_mpz_disk_stripe_workers, handle->n_fds, (int)(job.first_stripe % handle->n_fds),
+		(int)min(n_stripes, (size_t)handle->n_fds), _mpz_disk_stripe_thread, &job);
+
+	return job.error ? -1 : 0;
+}
+
+// Returns the number of bytes read
+static size_t _mpz_disk_read_files(_mpz_disk_handle* handle, mp_limb_t* buf, size_t limbs, size_t offset)
+{
+	if (handle->chunked)
+		return _mpz_disk_chunked_io(handle, buf, limbs, offset, 0) == 0 ? limbs * sizeof(mp_limb_t) : 0;
+
+	if (handle->stripe_limbs == 0)
+		return _mpz_disk_io_pread(handle->fds[0], buf, limbs * sizeof(mp_limb_t), (int64_t)offset * sizeof(mp_limb_t));
+
+	return _mpz_disk_stripe_io(handle, buf, limbs, offset, 0) == 0 ? limbs * sizeof(mp_limb_t) : 0;
+}
+
+// _mpz_disk_read_files() through the block cache: cached blocks are copied
+// from there, each run of blocks in between is read in one go and cached
+static size_t _mpz_disk_read_cached(_mpz_disk_handle* handle, mp_limb_t* buf, size_t limbs, size_t offset)
+{
+	const size_t block_limbs = MPZ_DISK_CACHE_BLOCK_LIMBS;
+	size_t end = offset + limbs;
+	size_t pos = offset;
+
+	while (pos < end)
+	{
+		size_t block = pos / block_limbs;
+		size_t block_end = min((block + 1) * block_limbs, end);
+
+		if (_mpz_disk_cache_get(handle, block, buf + (pos - offset), pos - block * block_limbs, block_end - block * block_limbs)) {
+			pos = block_end;
+			continue;
+		}
+
+		size_t run_end = block_end;
+		while (run_end < end && !_mpz_disk_cache_get(handle, run_end / block_limbs, buf + (run_end - offset),
+			0, min(run_end + block_limbs, end) - run_end))
+			run_end = min(run_end + block_limbs, end);
+
+		size_t bytes = _mpz_disk_read_files(handle, buf + (pos - offset), run_end - pos, pos);
+		size_t read_end = pos + bytes / sizeof(mp_limb_t);
+
+		// Blocks read from their start on
+		for (size_t b = (pos + block_limbs - 1) / block_limbs; b * block_limbs < read_end; b++)
+			_mpz_disk_cache_put(handle, b, buf + (b * block_limbs - offset), min(block_limbs, read_end - b * block_limbs));
+
+		if (read_end < run_end)
+			return (pos - offset) * sizeof(mp_limb_t) + bytes;
+
+		// The block that ended the run was copied already
+		pos = run_end < end ? min(run_end + block_limbs, end) : end;
+	}
+
+	return limbs * sizeof(mp_limb_t);
+}
+
+int _mpz_disk_read_limbs(_mpz_disk_handle* handle, mp_limb_t* buf, size_t limbs, size_t offset, size_t file_limbs)
+{
+	size_t limbs_to_read = offset < file_limbs ? min(limbs, file_limbs - offset) : 0;
+	size_t bytes_read = 0;
+	int ret = 0;
+
+	if (_mpz_disk_lock_memory(handle)) {
+		limbs_to_read = offset < handle->memory_limbs ? min(limbs_to_read, handle->memory_limbs - offset) : 0;
+		if (limbs_to_read > 0)
+			memcpy(buf, handle->memory + offset, limbs_to_read * sizeof(mp_limb_t));
+		bytes_read = limbs_to_read * sizeof(mp_limb_t);
+
+		_mpz_disk_mutex_unlock(&handle->memory_lock);
+
+		limbs_to_read = 0;
+	}
+
+	// Uniform parts don't have to be read at all
+	int summary = _mpz_disk_get_summary(handle, offset, limbs_to_read);
+
+	if (limbs_to_read > 0 && summary != _MPZ_DISK_SUMMARY_MIXED) {
+		memset(buf, summary == _MPZ_DISK_SUMMARY_ONES ? 0xff : 0, limbs_to_read * sizeof(mp_limb_t));
+		bytes_read = limbs_to_read * sizeof(mp_limb_t);
+	}
+	else if (limbs_to_read > 0) {
+		if (handle->kept)
+			bytes_read = _mpz_disk_read_cached(handle, buf, limbs_to_read, offset);
+		else
+			bytes_read = _mpz_disk_read_files(handle, buf, limbs_to_read, offset);
+
+		if (bytes_read < limbs_to_read * sizeof(mp_limb_t))
+			ret = MPZ_DISK_ERROR_READ;
+		else if (_mpz_disk_checksum_check(handle, buf, bytes_read / sizeof(mp_limb_t), offset))
+			ret = MPZ_DISK_ERROR_CHECKSUM;
+	}
+
+	memset((char*)buf + bytes_read, 0, limbs * sizeof(mp_limb_t) - bytes_read);
+
+	return ret;
+}
+
+// Splits mpz_disk_verify() over the threads, one contiguous range of whole
+// buffers per thread
+typedef struct
+{
+	_mpz_disk_handle* fp;
+	size_t limbs, limbs_per_thread, limbs_in_buffer;
+	volatile int64_t mismatches;
+	int error;
+} _mpz_disk_verify_job;
+
+static void _mpz_disk_verify_thread(void* arg, int thread_idx)
+{
+	_mpz_disk_verify_job* job = arg;
+
+	size_t begin = thread_idx * job->limbs_per_thread;
+	size_t end = min(begin + job->limbs_per_thread, job->limbs);
+
+	mp_limb_t* buf = _mpz_disk_buffer_alloc(job->limbs_in_buffer * sizeof(mp_limb_t));
+	if (!buf) {
+		job->error = 1;
+		return;
+	}
+
+	// Straight from the files, a cached copy would say nothing about them
+	for (size_t offset = begin; offset < end; offset += job->limbs_in_buffer)
+	{
+		size_t limbs = min(job->limbs_in_buffer, end - offset);
+
+		if (_mpz_disk_read_files(job->fp, buf, limbs, offset) != limbs * sizeof(mp_limb_t)) {
+			job->error = 1;
+			break;
+		}
 
-#elif defined(__unix__)	/* *nix */
-#include <unistd.h>
+		int64_t mismatches = _mpz_disk_checksum_check(job->fp, buf, limbs, offset);
+		if (mismatches)
+			_mpz_disk_atomic_add(&job->mismatches, mismatches);
+	}
 
-#error "Not all POSIX functions have been implemented yet"
-#endif
+	_mpz_disk_buffer_free(buf);
+}
 
+static int _mpz_disk_verify(mpz_disk_ptr op)
+{
+	_mpz_disk_handle* fp = _mpz_disk_open(op, _MPZ_DISK_OPEN_READ);
+	if (!fp)
+		return -1;
 
-int mpz_disk_init(mpz_disk_ptr disk_integer) {
-	// Generate a random filename (from https://codereview.stackexchange.com/questions/29198/random-string-generator-in-c)
-    const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	// Limbs held in memory have no checksums
+	if (_mpz_disk_lock_memory(fp)) {
+		_mpz_disk_mutex_unlock(&fp->memory_lock);
+		_mpz_disk_close(fp);
+		return 0;
+	}
 
-	int n = 0;
-    for (n = 0; n < MPZ_DISK_FILENAME_LEN - 5; n++) {
-		int key = rand() % (int)(sizeof charset - 1);
-		disk_integer->filename[n] = charset[key];
+	int64_t size = _mpz_disk_handle_size(fp);
+	if (size < 0) {
+		_mpz_disk_close(fp);
+		return -1;
 	}
 
-	// End with .tmp extension
-	strcpy(&disk_integer->filename[n], ".tmp");
+	_mpz_disk_verify_job job;
+	job.fp = fp;
+	job.limbs = (size_t)size / sizeof(mp_limb_t);
+	job.mismatches = 0;
+	job.error = 0;
 
-	mp_limb_t zero = 0;
+	// Buffers of whole entries, as only those can be checked
+	int n_threads = _mpz_disk_op_threads();
+	job.limbs_in_buffer = _mpz_disk_summary_align(max(_mpz_disk_op_mem() / 3 / sizeof(mp_limb_t) / n_threads, MPZ_DISK_SUMMARY_LIMBS));
+	job.limbs_per_thread = (job.limbs + n_threads - 1) / n_threads;
+	job.limbs_per_thread += (job.limbs_in_buffer - job.limbs_per_thread % job.limbs_in_buffer) % job.limbs_in_buffer;
+	n_threads = (int)((job.limbs + job.limbs_per_thread - 1) / job.limbs_per_thread);
 
-	FILE* mp_file = fopen(disk_integer->filename, "wb");
-	if (!mp_file)
+	if (n_threads > 0)
+		_mpz_disk_run_threads(n_threads, _mpz_disk_verify_thread, &job);
+
+	_mpz_disk_close(fp);
+
+	if (job.error)
 		return -1;
 
-	fwrite(&zero, sizeof(mp_limb_t), 1, mp_file);
-	
-	fclose(mp_file);
+	return job.mismatches ? MPZ_DISK_ERROR_CHECKSUM : 0;
+}
 
-	return 0;
+int mpz_disk_verify(mpz_disk_ptr op)
+{
+	_mpz_disk_stats_scope stats = _mpz_disk_stats_begin(MPZ_DISK_STATS_VERIFY);
+	int ret = _mpz_disk_verify(op);
+	_mpz_disk_stats_end(stats);
+
+	return ret;
 }
 
-int mpz_disk_clear(mpz_disk_ptr disk_integer)
+static int _mpz_disk_write_files(_mpz_disk_handle* handle, const mp_limb_t* buf, size_t limbs, size_t offset)
 {
-	return remove(disk_integer->filename);
+	_mpz_disk_summary_write(handle, buf, limbs, offset);
+	_mpz_disk_checksum_write(handle, buf, limbs, offset);
+
+	int ret;
+	if (handle->chunked)
+		ret = _mpz_disk_chunked_io(handle, (mp_limb_t*)buf, limbs, offset, 1);
+	else if (handle->stripe_limbs == 0)
+		ret = _mpz_disk_io_pwrite(handle->fds[0], buf, limbs * sizeof(mp_limb_t), (int64_t)offset * sizeof(mp_limb_t));
+	else
+		ret = _mpz_disk_stripe_io(handle, (mp_limb_t*)buf, limbs, offset, 1);
+
+	// Cached copies of the blocks are out of date now
+	_mpz_disk_cache_drop(handle, offset / MPZ_DISK_CACHE_BLOCK_LIMBS, (offset + limbs - 1) / MPZ_DISK_CACHE_BLOCK_LIMBS + 1);
+
+	return ret;
 }
 
-int mpz_disk_add(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_t op2)
+// Move limbs held in memory to the files, with handle->memory_lock held
+static int _mpz_disk_spill(_mpz_disk_handle* handle)
 {
-	FILE* rop_file = fopen(rop->filename, "wb");
-	FILE* op1_file = fopen(op1->filename, "rb");
-	FILE* op2_file = fopen(op2->filename, "rb");
+	mpz_disk_ptr op = handle->op;
 
-	if (!rop_file || !op1_file || !op2_file)
-	{
-		fclose(rop_file);
-		fclose(op1_file);
-		fclose(op2_file);
+	if (_mpz_disk_open_files(handle, op, _MPZ_DISK_OPEN_CREATE) != 0)
+		return -1;
 
-		return MPZ_DISK_ADD_ERROR_FILE_OPEN_FAIL;
+	// The sign of an integer in memory is only kept in op->sign
+	if ((handle->memory_limbs && _mpz_disk_write_files(handle, handle->memory, handle->memory_limbs, 0) != 0) ||
+		_mpz_disk_write_sign_file(op, op->sign == MPZ_DISK_SIGN_NEGATIVE ? MPZ_DISK_SIGN_NEGATIVE : MPZ_DISK_SIGN_POSITIVE) != 0) {
+		_mpz_disk_close_files(handle);
+		return -1;
 	}
-	// Addition roughly works in the following way:
-	// 1. Read blocks of size "block_size" bytes from op1
-	//    and op2
-	// 2. Add the two blocks (and the carry from previous
-	//    additions) and record the result and carry
-	// 3. Write the result to rop and record the carry
 
-	size_t available_mem = MPZ_DISK_AVAILABLE_MEM_FUNCTION();
+	free(handle->memory);
+	handle->memory = NULL;
+	handle->memory_limbs = handle->memory_alloc = 0;
+	handle->in_memory = 0;
 
-	// We need memory for three blocks and then some
-	size_t block_size = available_mem / 3;
-	size_t limbs_in_block = block_size / sizeof(mp_limb_t);
-	block_size = limbs_in_block * sizeof(mp_limb_t);
+	return 0;
+}
 
-	// Total number of blocks in op1 and op2
-	// number of blocks = ceil( bytes in op1 / block size )
+// Make room for 'limbs' limbs in memory. If there are too many of them (or
+// the memory runs out) the limbs go to the files instead and 1 is returned.
+static int _mpz_disk_reserve_memory(_mpz_disk_handle* handle, size_t limbs)
+{
+	if (limbs > handle->max_memory_limbs)
+		return _mpz_disk_spill(handle) == 0 ? 1 : -1;
 
-	size_t op1_filesize = _mpz_disk_get_file_size(op1->filename),
-		   op2_filesize = _mpz_disk_get_file_size(op2->filename);
-	size_t n_op1_blocks = op1_filesize / block_size;
-	size_t n_op2_blocks = op2_filesize / block_size;
-	// Round up
-	if (op1_filesize > n_op1_blocks * block_size) n_op1_blocks++;
-	if (op2_filesize > n_op2_blocks * block_size) n_op2_blocks++;
+	if (limbs > handle->memory_alloc) {
+		size_t alloc = min(max(limbs, 2 * handle->memory_alloc), handle->max_memory_limbs);
 
-	// Minimum number of blocks in output (rop)
-	size_t n_blocks = max(n_op1_blocks, n_op2_blocks);
+		mp_limb_t* memory = realloc(handle->memory, alloc * sizeof(mp_limb_t));
+		if (!memory)
+			return _mpz_disk_spill(handle) == 0 ? 1 : -1;
 
-	// If both the numbers fit inside a single block,
-	// reduce block size to save memory
-	if (n_blocks == 1) {
-		block_size = max(_mpz_disk_get_file_size(op1->filename),
-						 _mpz_disk_get_file_size(op2->filename));
-		limbs_in_block = block_size / sizeof(mp_limb_t);
+		handle->memory = memory;
+		handle->memory_alloc = alloc;
 	}
-	
-	// Try to allocate memory for the blocks
-	mp_limb_t* rop_block, * op1_block, * op2_block;
 
-	rop_block = malloc(limbs_in_block * sizeof(mp_limb_t));
-	op1_block = malloc(limbs_in_block * sizeof(mp_limb_t));
-	op2_block = malloc(limbs_in_block * sizeof(mp_limb_t));
+	// Limbs past the end read as zero once they are inside
+	if (limbs > handle->memory_limbs)
+		memset(handle->memory + handle->memory_limbs, 0, (limbs - handle->memory_limbs) * sizeof(mp_limb_t));
 
-	// TODO Decrease blocks size progressively if any of the
-	// memory allocation fails
-	if (!rop_block || !op1_block || !op2_block) {
-		fclose(rop_file);
-		fclose(op1_file);
-		fclose(op2_file);
+	return 0;
+}
 
-		free(rop_block);
-		free(op1_block);
-		free(op2_block);
+int _mpz_disk_write_limbs(_mpz_disk_handle* handle, const mp_limb_t* buf, size_t limbs, size_t offset)
+{
+	if (limbs == 0)
+		return 0;
 
-		return MPZ_DISK_ADD_ERROR_MEM_ALLOC_FAIL;
-	}
+	int ret;
+	if (_mpz_disk_lock_memory(handle)) {
+		ret = _mpz_disk_reserve_memory(handle, max(handle->memory_limbs, offset + limbs));
 
-	mp_limb_t carry = 0;
-	for (int n = 1; n <= n_blocks; n++)
-	{
-		mp_limb_t carry_now = 0;
+		if (ret == 0) {
+			memcpy(handle->memory + offset, buf, limbs * sizeof(mp_limb_t));
+			handle->memory_limbs = max(handle->memory_limbs, offset + limbs);
+		}
+		else if (ret == 1)
+			ret = _mpz_disk_write_files(handle, buf, limbs, offset);
 
-		// Pad the input block with zero if the current block
-		// number is the last block
-		if (n == n_op1_blocks)
-			memset(op1_block, 0, limbs_in_block * sizeof(mp_limb_t));
-		if (n == n_op2_blocks)
-			memset(op2_block, 0, limbs_in_block * sizeof(mp_limb_t));
-
-		fread(op1_block, sizeof(mp_limb_t), limbs_in_block, op1_file);
-		fread(op2_block, sizeof(mp_limb_t), limbs_in_block, op2_file);
-
-		// Directly copy the block if the other block is zero
-		if (n > n_op1_blocks)
-			memcpy(rop_block, op2_block, limbs_in_block * sizeof(mp_limb_t));
-		else if (n > n_op2_blocks)
-			memcpy(rop_block, op1_block, limbs_in_block * sizeof(mp_limb_t));
-		else // Add the blocks
-			carry_now = MPZ_DISK_ADD_FUNCTION(rop_block, op1_block, op2_block, limbs_in_block);
-
-		// Process carry as well
-		if (carry)
-			carry_now += MPZ_DISK_ADD_CARRY_FUNCTION(rop_block, rop_block, limbs_in_block, carry);
-
-		// Write rop_block to rop
-		fwrite(rop_block, sizeof(mp_limb_t), limbs_in_block, rop_file);
-
-		assert(carry_now <= 1);	// Carry can either by 0 or 1
-		
-		carry = carry_now;
+		_mpz_disk_mutex_unlock(&handle->memory_lock);
 	}
+	else
+		ret = _mpz_disk_write_files(handle, buf, limbs, offset);
 
-	fclose(op1_file);
-	fclose(op2_file);
-	// Don't close rop_file just yet
-	free(op1_block);
-	free(op2_block);
-	free(rop_block);
-	
-	// Finally, write out the carry
-	if (carry != 0) {
-		fwrite(&carry, sizeof(mp_limb_t), 1, rop_file);
-		fclose(rop_file);
-	}
-	else {
-		fclose(rop_file);
+	// The write reaching furthest decides the size and the top limb,
+	// whatever order the threads get here in
+	int64_t end = (int64_t)(offset + limbs) * sizeof(mp_limb_t);
 
-		// Truncate unneccassary zereos in the output file
-		if (_mpz_disk_truncate_leading_zeroes(rop->filename) != 0)
-			return MPZ_DISK_ERROR_UNKNOWN;
+	_mpz_disk_mutex_lock(&handle->lock);
+
+	if (ret != 0 || handle->size < 0) {
+		handle->size = -1;
+		handle->normalized = 0;
 	}
-	return 0;
+	else if (end >= handle->size) {
+		handle->size = end;
+		handle->normalized = buf[limbs - 1] != 0;
+	}
+
+	_mpz_disk_mutex_unlock(&handle->lock);
+
+	return ret;
 }
-int mpz_disk_sub(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_t op2)
-{
-	FILE* rop_file = fopen(rop->filename, "wb");
-	FILE* op1_file = fopen(op1->filename, "rb");
-	FILE* op2_file = fopen(op2->filename, "rb");
 
-	if (!rop_file || !op1_file || !op2_file)
-	{
-		fclose(rop_file);
-		fclose(op1_file);
-		fclose(op2_file);
+void _mpz_disk_prefetch_limbs(_mpz_disk_handle* handle, size_t offset, size_t limbs)
+{
+	if (_mpz_disk_lock_memory(handle)) {
+		_mpz_disk_mutex_unlock(&handle->memory_lock);
+		return;
+	}
 
-		return MPZ_DISK_ADD_ERROR_FILE_OPEN_FAIL;
+	if (handle->chunked) {
+		_mpz_disk_chunked_prefetch(handle, offset, limbs);
+		return;
 	}
-	// Addition roughly works in the following way:
-	// 1. Read blocks of size "block_size" bytes from op1
-	//    and op2
-	// 2. Add the two blocks (and the carry from previous
-	//    additions) and record the result and carry
-	// 3. Write the result to rop and record the carry
 
-	size_t available_mem = MPZ_DISK_AVAILABLE_MEM_FUNCTION();
+#ifdef _WIN32
+	// Nothing to do: Windows has no read-ahead hint for a file range
+#elif defined(__unix__)
+	size_t stripe_limbs = handle->stripe_limbs ? handle->stripe_limbs : limbs;
 
-	// We need memory for three blocks and then some
-	size_t block_size = available_mem / 3;
-	size_t limbs_in_block = block_size / sizeof(mp_limb_t);
-	block_size = limbs_in_block * sizeof(mp_limb_t);
+	for (size_t begin = offset; begin < offset + limbs; begin = (begin / stripe_limbs + 1) * stripe_limbs)
+	{
+		size_t stripe = begin / stripe_limbs;
+		size_t n = min((stripe + 1) * stripe_limbs, offset + limbs) - begin;
+		size_t pos = handle->stripe_limbs ? (stripe / handle->n_fds) * stripe_limbs + begin - stripe * stripe_limbs : begin;
 
-	// Total number of blocks in op1 and op2
-	// number of blocks = ceil( bytes in op1 / block size )
+		_mpz_disk_io_will_need(handle->fds[stripe % handle->n_fds], (int64_t)pos * sizeof(mp_limb_t),
+			(int64_t)n * sizeof(mp_limb_t));
+	}
+#endif
+}
 
-	size_t op1_filesize = _mpz_disk_get_file_size(op1->filename),
-		   op2_filesize = _mpz_disk_get_file_size(op2->filename);
-	size_t n_op1_blocks = op1_filesize / block_size;
-	size_t n_op2_blocks = op2_filesize / block_size;
-	// Round up
-	if (op1_filesize > n_op1_blocks * block_size) n_op1_blocks++;
-	if (op2_filesize > n_op2_blocks * block_size) n_op2_blocks++;
+int64_t _mpz_disk_handle_size(_mpz_disk_handle* handle)
+{
+	_mpz_disk_mutex_lock(&handle->lock);
+	int64_t size = handle->size;
+	_mpz_disk_mutex_unlock(&handle->lock);
 
-	// Minimum number of blocks in output (rop)
-	size_t n_blocks = max(n_op1_blocks, n_op2_blocks);
+	// Only looked up if a write failed (or while opening)
+	if (size >= 0)
+		return size;
 
-	// If both the numbers fit inside a single block,
-	// reduce block size to save memory
-	if (n_blocks == 1) {
-		block_size = max(_mpz_disk_get_file_size(op1->filename),
-						 _mpz_disk_get_file_size(op2->filename));
-		limbs_in_block = block_size / sizeof(mp_limb_t);
+	if (_mpz_disk_lock_memory(handle)) {
+		size = (int64_t)handle->memory_limbs * sizeof(mp_limb_t);
+		_mpz_disk_mutex_unlock(&handle->memory_lock);
+
+		return size;
 	}
-	
-	// Try to allocate memory for the blocks
-	mp_limb_t* rop_block, * op1_block, * op2_block;
 
-	rop_block = malloc(limbs_in_block * sizeof(mp_limb_t));
-	op1_block = malloc(limbs_in_block * sizeof(mp_limb_t));
-	op2_block = malloc(limbs_in_block * sizeof(mp_limb_t));
+	if (handle->chunked)
+		return (int64_t)handle->chunked->limbs * sizeof(mp_limb_t);
 
-	// TODO Decrease blocks size progressively if any of the
-	// memory allocation fails
-	if (!rop_block || !op1_block || !op2_block) {
-		fclose(rop_file);
-		fclose(op1_file);
-		fclose(op2_file);
+	size = 0;
 
-		free(rop_block);
-		free(op1_block);
-		free(op2_block);
+	for (int i = 0; i < handle->n_fds; i++)
+	{
+		int64_t stripe_size = _mpz_disk_io_size(handle->fds[i]);
+		if (stripe_size < 0)
+			return -1;
 
-		return MPZ_DISK_ADD_ERROR_MEM_ALLOC_FAIL;
+		size += stripe_size;
 	}
 
-	mp_limb_t carry = 0;
-	for (int n = 1; n <= n_blocks; n++)
-	{
-		mp_limb_t carry_now = 0;
-
-		// Pad the input block with zero if the current block
-		// number is the last block
-		if (n == n_op1_blocks)
-			memset(op1_block, 0, limbs_in_block * sizeof(mp_limb_t));
-		if (n == n_op2_blocks)
-			memset(op2_block, 0, limbs_in_block * sizeof(mp_limb_t));
+	return size;
+}
 
-		fread(op1_block, sizeof(mp_limb_t), limbs_in_block, op1_file);
-		fread(op2_block, sizeof(mp_limb_t), limbs_in_block, op2_file);
+static int _mpz_disk_resize_files(_mpz_disk_handle* handle, size_t limbs)
+{
+	if (handle->chunked)
+		return _mpz_disk_chunked_resize(handle, limbs);
 
-		// Directly copy the block if the other block is zero
-		if (n > n_op1_blocks)
-			memcpy(rop_block, op2_block, limbs_in_block * sizeof(mp_limb_t));
-		else if (n > n_op2_blocks)
-			memcpy(rop_block, op1_block, limbs_in_block * sizeof(mp_limb_t));
-		else // Add the blocks
-			carry_now = MPZ_DISK_SUB_FUNCTION(rop_block, op1_block, op2_block, limbs_in_block);
+	if (handle->stripe_limbs == 0)
+		return _mpz_disk_io_resize(handle->fds[0], (int64_t)limbs * sizeof(mp_limb_t));
 
-		// Process carry as well
-		if (carry)
-			carry_now += MPZ_DISK_SUB_CARRY_FUNCTION(rop_block, rop_block, limbs_in_block, carry);
+	// Every directory gets its share of the full stripes, the directory
+	// after the last full stripe also gets the partial one
+	size_t full_stripes = limbs / handle->stripe_limbs;
+	size_t partial_limbs = limbs % handle->stripe_limbs;
 
-		// Write rop_block to rop
-		fwrite(rop_block, sizeof(mp_limb_t), limbs_in_block, rop_file);
+	for (int i = 0; i < handle->n_fds; i++)
+	{
+		size_t stripes = full_stripes / handle->n_fds + (i < (int)(full_stripes % handle->n_fds));
+		size_t stripe_file_limbs = stripes * handle->stripe_limbs;
 
-		assert(carry_now <= 1);	// Carry can either by 0 or 1
+		if (i == (int)(full_stripes % handle->n_fds))
+			stripe_file_limbs += partial_limbs;
 
-		carry = carry_now;
+		if (_mpz_disk_io_resize(handle->fds[i], (int64_t)stripe_file_limbs * sizeof(mp_limb_t)) != 0)
+			return -1;
 	}
 
-	fclose(op1_file);
-	fclose(op2_file);
-	fclose(rop_file);
-	free(op1_block);
-	free(op2_block);
-	free(rop_block);
-	
-	// Finally, write out the carry
-	if (carry != 0) {
-		assert(0);
-	}
-	else {
-		int ret = _mpz_disk_truncate_leading_zeroes(rop->filename);
-		if (ret != 0)
-			return MPZ_DISK_ERROR_UNKNOWN;
-	}
 	return 0;
 }
 
-int mpz_disk_cmpabs(mpz_disk_ptr op1, mpz_disk_ptr op2)
+int _mpz_disk_resize(_mpz_disk_handle* handle, size_t limbs)
 {
-	// If sizes are unequal, directly compare the sizes
-	if (mpz_disk_size(op1) != mpz_disk_size(op2))
-		return mpz_disk_size(op1) > mpz_disk_size(op2) ? 1 : -1;
+	int ret = 1;
+	if (_mpz_disk_lock_memory(handle)) {
+		ret = _mpz_disk_reserve_memory(handle, limbs);
 
-	FILE* op1_file = fopen(op1->filename, "rb");
-	FILE* op2_file = fopen(op2->filename, "rb");
+		if (ret == 0)
+			handle->memory_limbs = limbs;
 
-	// Number of limbs in both op1 and op2 are equal
-	size_t nlimbs = mpz_disk_size(op1);
+		_mpz_disk_mutex_unlock(&handle->memory_lock);
+	}
 
-	mp_limb_t op1_buf[_MPZ_DISK_DEFAULT_SEEK_COUNT] = { 0 };
-	mp_limb_t op2_buf[_MPZ_DISK_DEFAULT_SEEK_COUNT] = { 0 };
+	// Too large to stay in memory (or on disk already)
+	if (ret == 1) {
+		_mpz_disk_mutex_lock(&handle->lock);
+		int64_t old_size = handle->size;
+		_mpz_disk_mutex_unlock(&handle->lock);
 
-	fseek(op1_file, 0, SEEK_END);
-	fseek(op2_file, 0, SEEK_END);
-	
-	for (size_t limbs_compared = 0; limbs_compared < nlimbs; limbs_compared += _MPZ_DISK_DEFAULT_SEEK_COUNT)
-	{
-		// Seek back and read
-		if (nlimbs - limbs_compared > _MPZ_DISK_DEFAULT_SEEK_COUNT) {
-			fseek(op1_file, -_MPZ_DISK_DEFAULT_SEEK_COUNT * sizeof(mp_limb_t), SEEK_CUR);
-			fseek(op2_file, -_MPZ_DISK_DEFAULT_SEEK_COUNT * sizeof(mp_limb_t), SEEK_CUR);
-		}
-		else {
-			fseek(op1_file, 0, SEEK_SET);
-			fseek(op2_file, 0, SEEK_SET);
-		}
+		_mpz_disk_summary_resize(handle, limbs);
+		_mpz_disk_checksum_resize(handle, limbs, old_size);
+		ret = _mpz_disk_resize_files(handle, limbs);
 
-		// Read
-		fread(op1_buf, sizeof(mp_limb_t), _MPZ_DISK_DEFAULT_SEEK_COUNT, op1_file);
-		fread(op2_buf, sizeof(mp_limb_t), _MPZ_DISK_DEFAULT_SEEK_COUNT, op2_file);
+		// Drop the cached blocks that were cut off (all of them if the old size is unknown)
+		size_t block_bytes = MPZ_DISK_CACHE_BLOCK_LIMBS * sizeof(mp_limb_t);
+		_mpz_disk_cache_drop(handle, limbs / MPZ_DISK_CACHE_BLOCK_LIMBS,
+			old_size < 0 ? SIZE_MAX : (size_t)((old_size + block_bytes - 1) / block_bytes));
+	}
 
-		// Compare
-		int cmp = mpn_cmp(op1_buf, op2_buf, _MPZ_DISK_DEFAULT_SEEK_COUNT);
+	int64_t size = (int64_t)limbs * sizeof(mp_limb_t);
 
-		if (cmp != 0) {
-			fclose(op1_file);
-			fclose(op2_file);
+	// Only an unchanged size keeps a non-zero top limb for sure
+	_mpz_disk_mutex_lock(&handle->lock);
 
-			return cmp;
-		}
-	}
+	handle->normalized = ret == 0 && (limbs == 0 || (handle->normalized && size == handle->size));
+	handle->size = ret == 0 ? size : -1;
 
-	fclose(op1_file);
-	fclose(op2_file);
+	_mpz_disk_mutex_unlock(&handle->lock);
 
-	// Equal
-	return 0;
+	return ret;
 }
 
-int mpz_disk_set_mpz(mpz_disk_ptr rop, mpz_srcptr op)
+int _mpz_disk_prepare_files(_mpz_disk_handle* handle, size_t limbs, int sparse)
 {
-	FILE* mp_file = fopen(rop->filename, "wb+");
-	if (!mp_file)
-		return -1;
+	int in_memory = _mpz_disk_lock_memory(handle);
+	if (in_memory)
+		_mpz_disk_mutex_unlock(&handle->memory_lock);
 
-	//char mp_sign_filename[MPZ_DISK_FILENAME_LEN + 5];
-	//_mpz_disk_get_sign_filename(mp_sign_filename, rop);
+	// Holes are only left where a file grows after it is made sparse
+	if (sparse && !in_memory && !handle->chunked)
+		for (int i = 0; i < handle->n_fds; i++)
+			_mpz_disk_io_set_sparse(handle->fds[i]);
 
-	//FILE* mp_sign_file = fopen(mp_sign_filename, "wb+");
+	if (_mpz_disk_resize(handle, limbs) != 0)
+		return -1;
 
-	//char mp_sign = op->_mp_size < 0 ? MPZ_DISK_SIGN_NEGATIVE : MPZ_DISK_SIGN_POSITIVE;
-	//fwrite(&mp_sign, 1, 1, mp_sign_file);
-	//fclose(mp_sign_file);
+	// Small enough to stay in memory. Compressed integers have no place for
+	// the limbs before they are written.
+	if (_mpz_disk_lock_memory(handle)) {
+		_mpz_disk_mutex_unlock(&handle->memory_lock);
+		return 0;
+	}
+	if (handle->chunked)
+		return 0;
 
-	fwrite(op->_mp_d, sizeof(mp_limb_t), abs(op->_mp_size), mp_file);
-	fclose(mp_file);
+	// The allocation is only a hint, the writes allocate what is missing
+	for (int i = 0; i < handle->n_fds; i++)
+	{
+		if (sparse)
+			_mpz_disk_io_set_sparse(handle->fds[i]);
+		else
+			_mpz_disk_io_preallocate(handle->fds[i], _mpz_disk_io_size(handle->fds[i]));
+	}
 
 	return 0;
 }
 
-int mpz_disk_get_mpz(mpz_ptr mpz, mpz_disk_ptr op)
+int _mpz_disk_normalize(mpz_disk_ptr rop)
 {
-	size_t size = _mpz_disk_get_file_size(op->filename);
-	
-	size_t limbs = size / sizeof(mp_limb_t);
-	if (size > limbs * sizeof(mp_limb_t))
-		limbs++;
-
-	// Round up
-	size = limbs * sizeof(mp_limb_t);
+	_mpz_disk_handle* fp = _mpz_disk_open(rop, _MPZ_DISK_OPEN_WRITE);
+	if (!fp)
+		return -1;
 
-	mpz_clear(mpz);
-	mpz_init2(mpz, limbs * sizeof(mp_limb_t) * 8);
+	// Nothing to do if our last writes left a non-zero top limb
+	_mpz_disk_mutex_lock(&fp->lock);
+	int normalized = fp->normalized;
+	_mpz_disk_mutex_unlock(&fp->lock);
 
-	char* buf = calloc(limbs, sizeof(mp_limb_t));
+	if (normalized) {
+		_mpz_disk_close(fp);
+		return 0;
+	}
 
-	if (buf == NULL)
-		return -1;
+	int64_t start = _mpz_disk_stats_now();
+	mp_limb_t buf[_MPZ_DISK_DEFAULT_SEEK_COUNT];
 
-	FILE* fp = fopen(op->filename, "rb");
+	size_t limbs = mpz_disk_size(rop);
 
-	if (!fp) {
-		fclose(fp);
-		return -1;
-	}
+	// Walk back from the top until a non-zero limb is found (or the whole
+	// file turns out to be zero)
+	size_t top = limbs;
+	while (top > 0)
+	{
+		size_t n = min(top, _MPZ_DISK_DEFAULT_SEEK_COUNT);
+		int ret = _mpz_disk_read_limbs(fp, buf, n, top - n, limbs);
+		if (ret) {
+			_mpz_disk_close(fp);
+			return ret;
+		}
 
-	fread(buf, 1, size, fp);
-	fclose(fp);
+		int top_limb_idx;
+		for (top_limb_idx = n - 1; top_limb_idx >= 0; top_limb_idx--)
+			if (buf[top_limb_idx] != 0)
+				break;
 
-	memcpy(mpz->_mp_d, buf, size);
-	mpz->_mp_size = limbs;
+		top -= n - top_limb_idx - 1;
+		if (top_limb_idx != -1)
+			break;
+	}
 
-	free(buf);
+	int ret = _mpz_disk_resize(fp, top);
 
-	return 0;
-}
+	// The limb below the cut is the non-zero one found above
+	if (ret == 0) {
+		_mpz_disk_mutex_lock(&fp->lock);
+		fp->normalized = 1;
+		_mpz_disk_mutex_unlock(&fp->lock);
+	}
 
-size_t mpz_disk_size(mpz_disk_ptr mpd)
-{
-	size_t nlimbs = _mpz_disk_get_file_size(mpd->filename) / sizeof(mp_limb_t);
-	if (nlimbs * sizeof(mp_limb_t) < _mpz_disk_get_file_size(mpd->filename))
-		nlimbs += 1;
+	_mpz_disk_close(fp);
 
-	return nlimbs;
-}
+	_mpz_disk_stats_time(_MPZ_DISK_STAT_NORMALIZE_NS, start);
 
-void _mpz_disk_get_sign_filename(char* dest, mpz_disk_ptr rop)
-{
-	memcpy(dest, rop->filename, MPZ_DISK_FILENAME_LEN);
-	strcpy(&dest[MPZ_DISK_FILENAME_LEN], ".sgn");
+	return ret;
 }
 
 size_t _mpz_disk_get_available_mem()
@@ -430,6 +7730,13 @@ size_t _mpz_disk_get_available_mem()
 	GlobalMemoryStatusEx(&status);
 	return status.ullAvailPhys;
 #elif defined(__unix__)
+	long pages = sysconf(_SC_AVPHYS_PAGES);
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	if (pages < 0 || page_size < 0)
+		return 0;
+
+	return (size_t)pages * (size_t)page_size;
 #endif
 }
 
@@ -464,6 +7771,12 @@ int64_t _mpz_disk_get_file_size(char* filename)
 	else
 		return -1;
 #elif defined(__unix__)
+	struct stat st;
+
+	if (stat(filename, &st) != 0)
+		return -1;
+
+	return (int64_t)st.st_size;
 #endif
 }
 
@@ -509,72 +7822,29 @@ int _mpz_disk_truncate_file(char* filename, size_t bytes_to_truncate)
 		return -1;
 	}
 #elif defined(__unix__)
+	struct stat st;
+
+	if (stat(filename, &st) != 0 || (uint64_t)st.st_size < bytes_to_truncate)
+		return -1;
+
+	return truncate(filename, st.st_size - (off_t)bytes_to_truncate) == 0 ? 0 : -1;
 #endif
 }
 
 int _mpz_disk_truncate_leading_zeroes(char* filename)
 {
-	size_t bytes_to_truncate = 0;
-
-	FILE* fp = fopen(filename, "rb");
-
-	// If it's a small file, just map the file to memory and proceed
-	if (_mpz_disk_get_file_size(filename) < _MPZ_DISK_DEFAULT_SEEK_COUNT * sizeof(mp_limb_t)) {
-		mpz_disk_t mp;
-		strcpy(mp->filename, filename);
-
-		size_t limbs = mpz_disk_size(mp);	// FIXME This is a quick hack
-		mp_limb_t* buf = malloc(limbs * sizeof(mp_limb_t));
-
-		if (buf == NULL) {
-			fclose(fp);
-			return -1;
-		}
-
-		fread(buf, sizeof(mp_limb_t), limbs, fp);
-		fclose(fp);
-
-		int top_limb_idx;
-		for (top_limb_idx = limbs - 1; top_limb_idx >= 0; top_limb_idx--)
-			if (buf[top_limb_idx] != 0)
-				break;
-
-		free(buf);
-
-		int ret = _mpz_disk_truncate_file(filename, (limbs - top_limb_idx - 1) * sizeof(mp_limb_t));
-
-		if (ret != 0)
-			return -1;
-		return 0;
-	}
-
-
-	mp_limb_t buf[_MPZ_DISK_DEFAULT_SEEK_COUNT];
-
-	fseek(fp, 0, SEEK_END);
-
-	int top_limb_idx;
-	do
-	{
-		fseek(fp, -_MPZ_DISK_DEFAULT_SEEK_COUNT * sizeof(mp_limb_t), SEEK_CUR);	// Seek back
-		fread(buf, sizeof(mp_limb_t), _MPZ_DISK_DEFAULT_SEEK_COUNT, fp);
-		fseek(fp, -_MPZ_DISK_DEFAULT_SEEK_COUNT * sizeof(mp_limb_t), SEEK_CUR);	// Seek back
-
-		for (top_limb_idx = _MPZ_DISK_DEFAULT_SEEK_COUNT - 1; top_limb_idx >= 0; top_limb_idx--)
-			if (buf[top_limb_idx] != 0)
-				break;
-
-		bytes_to_truncate += (_MPZ_DISK_DEFAULT_SEEK_COUNT - top_limb_idx - 1) * sizeof(mp_limb_t);
-	} while (top_limb_idx == -1);
+	// A plain, unstriped mpz_disk_t stored in 'filename'
+	mpz_disk_t mp;
+	strcpy(mp->filename, filename);
+	mp->stripe_dirs = 0;
+	mp->stripe_limbs = 0;
+	mp->chunk_limbs = 0;
+	mp->keep_summary = 0;
+	mp->keep_checksums = 0;
+	mp->backend = NULL;
+	mp->handle = NULL;
+	mp->sign = -1;
+	mp->max_memory_limbs = 0;
 
-	fclose(fp);
-
-	int ret = _mpz_disk_truncate_file(filename, bytes_to_truncate);
-
-	if (ret != 0)
-		return -1;
-
-	return 0;
+	return _mpz_disk_normalize(mp);
 }
-
-
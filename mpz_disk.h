@@ -5,6 +5,10 @@
 #include <mpir.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define MPZ_DISK_FILENAME_LEN 25
 #define MPZ_DISK_ADD_FUNCTION mpn_add_n
 #define MPZ_DISK_ADD_CARRY_FUNCTION mpn_add_1
@@ -13,11 +17,35 @@
 #define MPZ_DISK_AVAILABLE_MEM_FUNCTION _mpz_disk_get_available_mem
 
 #define _MPZ_DISK_DEFAULT_SEEK_COUNT 1024
+#define _MPZ_DISK_HUGE_PAGE_BYTES (2 << 20)
+
+// Upper limit on the number of threads of the parallel routines
+#define MPZ_DISK_MAX_THREADS 64
+// Upper limit on the number of directories integers can be striped across
+#define MPZ_DISK_MAX_STRIPE_DIRS 16
+#define MPZ_DISK_MAX_PATH 260
+// Default chunk size of compressed integers
+#define MPZ_DISK_DEFAULT_CHUNK_BYTES (1 << 20)
+// Integers up to this many bytes are held in memory (see mpz_disk_set_memory_threshold())
+#define MPZ_DISK_DEFAULT_MEMORY_THRESHOLD (64 << 10)
+// Cap on idle pooled buffers that follows MPZ_DISK_AVAILABLE_MEM_FUNCTION()
+#define MPZ_DISK_POOL_AUTO ((size_t)-1)
+// Cache size that follows MPZ_DISK_AVAILABLE_MEM_FUNCTION() (see mpz_disk_set_cache_size())
+#define MPZ_DISK_CACHE_AUTO ((size_t)-1)
+// Number of limbs per block of the block cache
+#define MPZ_DISK_CACHE_BLOCK_LIMBS 8192
+// Number of limbs per entry of the summary of an integer (see _mpz_disk_get_summary())
+#define MPZ_DISK_SUMMARY_LIMBS 65536
 
 
 // Error codes
 #define MPZ_DISK_ADD_ERROR_FILE_OPEN_FAIL -1
 #define MPZ_DISK_ADD_ERROR_MEM_ALLOC_FAIL -2
+#define MPZ_DISK_ERROR_NO_CHECKPOINT -3
+#define MPZ_DISK_ERROR_CHECKSUM -4
+#define MPZ_DISK_ERROR_CANCELLED -5
+#define MPZ_DISK_ERROR_NEGATIVE -6
+#define MPZ_DISK_ERROR_READ -7
 #define MPZ_DISK_ERROR_UNKNOWN -314159
 
 #define MPZ_DISK_SIGN_POSITIVE 0
@@ -28,13 +56,82 @@
 // Returns a predefined number as available memory (useful for testing purposes)
 size_t _mpz_disk_simulate_available_mem();
 #define MPZ_DISK_AVAILABLE_MEM_FUNCTION _mpz_disk_simulate_available_mem
+// Small enough for the simulated memory to span several entries
+#undef MPZ_DISK_SUMMARY_LIMBS
+#define MPZ_DISK_SUMMARY_LIMBS 8
+// Small enough for the tests to cover integers in memory and on disk
+#undef MPZ_DISK_DEFAULT_MEMORY_THRESHOLD
+#define MPZ_DISK_DEFAULT_MEMORY_THRESHOLD 256
+#undef MPZ_DISK_CACHE_BLOCK_LIMBS
+#define MPZ_DISK_CACHE_BLOCK_LIMBS 8
+// Whether an operation should stop after its first 'blocks_done' blocks, as
+// if the process had crashed
+int _mpz_disk_simulate_crash(size_t blocks_done);
+#endif
+
+#ifdef MPZ_DISK_BENCHMARK
+#undef MPZ_DISK_AVAILABLE_MEM_FUNCTION
+// Returns the memory the benchmark lets the operations use, which sets
+// their block size (see bench.c)
+size_t _mpz_disk_bench_available_mem();
+#define MPZ_DISK_AVAILABLE_MEM_FUNCTION _mpz_disk_bench_available_mem
 #endif
 
+// Storage the files of integers are kept in (see mpz_disk_set_backend()).
+// Every function is passed ctx, and a file as returned by open().
+typedef struct
+{
+	// Open a file with mode _MPZ_DISK_OPEN_READ, _MPZ_DISK_OPEN_WRITE or
+	// _MPZ_DISK_OPEN_CREATE, NULL if it can't be
+	void* (*open)(void* ctx, const char* filename, int mode);
+	void (*close)(void* ctx, void* file);
+	// Returns the number of bytes read, less than 'bytes' at the end of the file
+	size_t (*pread)(void* ctx, void* file, void* buf, size_t bytes, int64_t offset);
+	// Returns 0 once all of the bytes are written, growing the file if needed
+	int (*pwrite)(void* ctx, void* file, const void* buf, size_t bytes, int64_t offset);
+	// Shrink or zero-extend the file to 'size' bytes
+	int (*truncate)(void* ctx, void* file, int64_t size);
+	int64_t (*size)(void* ctx, void* file);
+	// Returns once what was written to file is on the device
+	int (*sync)(void* ctx, void* file);
+	// Offset of the first byte at or after offset that isn't in a hole (the
+	// size if there is none), or just offset if holes aren't known
+	int64_t (*next_data)(void* ctx, void* file, int64_t offset);
+	// Hints that may do nothing: allocate the first 'size' bytes up front,
+	// and let the ranges that are never written stay holes
+	int (*preallocate)(void* ctx, void* file, int64_t size);
+	int (*set_sparse)(void* ctx, void* file);
+	// Returns 0 if the file existed. It may still be open, in which case it
+	// lives on until it is closed.
+	int (*remove)(void* ctx, const char* filename);
+	void* ctx;
+} mpz_disk_backend_t;
+
+// Open limb file(s) of a mpz_disk_t, one per stripe directory
+typedef struct _mpz_disk_handle_struct _mpz_disk_handle;
+
 typedef struct
 {
 	char filename[MPZ_DISK_FILENAME_LEN];
-	// FILE* mp_file;
-	// TODO Do we need a FILE ptr here?
+	// Number of directories the limbs are striped across (0 = not striped)
+	// and the number of limbs in each stripe
+	int stripe_dirs;
+	size_t stripe_limbs;
+	// Number of limbs per chunk if stored compressed (0 = not compressed)
+	size_t chunk_limbs;
+	// Keep a summary of the limbs next to them
+	int keep_summary;
+	// Keep checksums of the limbs next to them (see mpz_disk_set_checksums())
+	int keep_checksums;
+	// Storage its files are in (NULL = plain files)
+	const mpz_disk_backend_t* backend;
+	// Limb file(s) kept open from mpz_disk_init() to mpz_disk_clear(), along
+	// with the size and normalization of the limbs (NULL = opened every time)
+	_mpz_disk_handle* handle;
+	// Cached sign, -1 if it has to be read from the sign file
+	int sign;
+	// Number of limbs it may grow to before it gets files (0 = always on disk)
+	size_t max_memory_limbs;
 } _mpz_disk_struct;
 
 typedef _mpz_disk_struct  mpz_disk_t[1];
@@ -46,30 +143,357 @@ int mpz_disk_init(mpz_disk_ptr disk_integer);
 int mpz_disk_clear(mpz_disk_ptr disk_integer);
 
 // Set value of rop from op, i.e. initialize value of a mpz_disk_t from a mpz_t
+// Large values are written by all threads at once, into files sized up front
 int mpz_disk_set_mpz(mpz_disk_ptr rop, mpz_srcptr op);
 int mpz_disk_set_str_file(mpz_disk_ptr rop, char* filename);
 
+// Reads op straight into the limbs of mpz (reusing them if there are
+// enough), by all threads at once for large integers
 int mpz_disk_get_mpz(mpz_ptr mpz, mpz_disk_ptr op);
 size_t mpz_disk_size(mpz_disk_ptr mpd);
 
+// Make view a read-only mpz_t over the limbs of op, for any function that
+// only reads its operands. A plain file is mapped into memory rather than
+// read, so only the pages that are used are loaded. view must not be
+// initialized or cleared, and op must not change until mpz_disk_unmap().
+int mpz_disk_map_ro(mpz_ptr view, mpz_disk_ptr op);
+int mpz_disk_unmap(mpz_ptr view, mpz_disk_ptr op);
+
+// Equivalents of mpz_out_raw() and mpz_inp_raw(), in the same format, that
+// stream the limbs in a single pass instead of going through a mpz_t.
+// Return the number of bytes written/read, 0 on error.
+size_t mpz_disk_out_raw(FILE* stream, mpz_disk_ptr op);
+size_t mpz_disk_inp_raw(mpz_disk_ptr rop, FILE* stream);
+
+// Operands larger than a block are added/subtracted by all threads at
+// once (see mpz_disk_set_num_threads())
 int mpz_disk_add(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_t op2);
 int mpz_disk_sub(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_t op2);
+// rop = |ops[0]| +/- |ops[1]| +/- ... +/- |ops[n - 1]|, subtracting the
+// terms with subtract[i] set (subtract[0] must be 0), in a single pass that
+// reads every term once and writes rop once. rop may not be one of the
+// terms. Returns MPZ_DISK_ERROR_NEGATIVE, with rop reading as zero, if the
+// result would be negative.
+int mpz_disk_addsub_n(mpz_disk_ptr rop, mpz_disk_ptr const* ops, const int* subtract, int n);
+// rop = op, sign included (rop may be op)
+int mpz_disk_set(mpz_disk_ptr rop, mpz_disk_ptr op);
+
+// mpz_disk_add() and mpz_disk_sub() note their progress in a journal next
+// to rop every 'bytes' bytes of rop (0, the default, turns it off), once
+// rop is on the device up to that point. Checkpointed operations run on a
+// single thread.
+int mpz_disk_set_checkpoint(size_t bytes);
+// Carry on with an interrupted mpz_disk_add()/mpz_disk_sub() into rop from
+// its last checkpoint. op1 and op2 have to be the very same operands.
+// Returns MPZ_DISK_ERROR_NO_CHECKPOINT if there is nothing to carry on with.
+int mpz_disk_resume(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2);
+
+// Told how many of the bytes_total bytes of an operation are done so far.
+// Returning non-zero cancels the operation.
+typedef int (*mpz_disk_progress_func)(int64_t bytes_done, int64_t bytes_total, void* arg);
+// Have mpz_disk_add(), mpz_disk_sub(), mpz_disk_addsub_n(),
+// mpz_disk_resume() and mpz_disk_cmpabs[_ex]() call func(..., arg) whenever
+// another 'bytes' bytes (0 = every block) are done, and once more when
+// they are all done. func = NULL, the default, turns it off. It may be
+// called from any of the threads of the operation, but by one at a time.
+// A cancelled operation gives back its buffers, closes its files and returns
+// MPZ_DISK_ERROR_CANCELLED. rop then reads as zero, unless it was
+// checkpointed (see mpz_disk_set_checkpoint()) and can be carried on with
+// mpz_disk_resume(). A cancelled comparison has no rop: mpz_disk_cmpabs()
+// returns 0 and only mpz_disk_cmpabs_ex() returns MPZ_DISK_ERROR_CANCELLED.
+int mpz_disk_set_progress(mpz_disk_progress_func func, void* arg, size_t bytes);
 void mpz_disk_mul(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_t op2);
 
 //void mpz_disk_add_mpz(mpz_disk_t, mpz_t, mpz_disk_t);
 //void mpz_disk_sub_mpz(mpz_disk_t, mpz_t, mpz_disk_t);
 //void mpz_disk_mul_mpz(mpz_disk_t, mpz_t, mpz_disk_t);
 
+// Compares |op1| and |op2|. Equal-length operands are compared from the
+// top down by all threads at once. Returns 1, 0 or -1; 0 too if the
+// comparison failed or was cancelled, which only mpz_disk_cmpabs_ex()
+// tells apart.
 int mpz_disk_cmpabs(mpz_disk_ptr op1, mpz_disk_ptr op2);
+// Same as mpz_disk_cmpabs(), but stores the comparison in *result and
+// returns 0, or an error code (e.g. MPZ_DISK_ERROR_READ or
+// MPZ_DISK_ERROR_CHECKSUM) if op1 or op2 couldn't be read, or
+// MPZ_DISK_ERROR_CANCELLED. *result is then 0.
+int mpz_disk_cmpabs_ex(mpz_disk_ptr op1, mpz_disk_ptr op2, int* result);
+
+// Bitwise logic with the same two's complement semantics as mpz_and(),
+// mpz_ior(), mpz_xor() and mpz_com(). rop may be the same as op1 or op2.
+int mpz_disk_and(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2);
+int mpz_disk_ior(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2);
+int mpz_disk_xor(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_ptr op2);
+int mpz_disk_com(mpz_disk_ptr rop, mpz_disk_ptr op);
+
+// Parallel equivalents of mpz_popcount(), mpz_hamdist(), mpz_scan0() and
+// mpz_scan1(). Like them, ~(mp_bitcnt_t)0 is returned when the result is
+// infinite (and also when a file can't be read or doesn't match its
+// checksums).
+mp_bitcnt_t mpz_disk_popcount(mpz_disk_ptr op);
+mp_bitcnt_t mpz_disk_hamdist(mpz_disk_ptr op1, mpz_disk_ptr op2);
+mp_bitcnt_t mpz_disk_scan0(mpz_disk_ptr op, mp_bitcnt_t starting_bit);
+mp_bitcnt_t mpz_disk_scan1(mpz_disk_ptr op, mp_bitcnt_t starting_bit);
+
+// Number of threads used by the parallel routines (0 = one per CPU, the default)
+void mpz_disk_set_num_threads(int num_threads);
+int mpz_disk_get_num_threads();
+
+// Pool of workers that run independent operations (e.g. the leaves of a
+// product tree) at once. The operations it runs at once share the
+// available memory and the threads above equally, rather than each taking
+// what it would have to itself.
+typedef struct _mpz_disk_task_struct* mpz_disk_task;
+typedef int (*mpz_disk_task_func)(void* arg);
+// Start n_workers workers (0 = one per CPU), -1 if they are already running
+int mpz_disk_pool_start(int n_workers);
+// Run what is still queued and stop the workers. No tasks may be
+// submitted meanwhile.
+void mpz_disk_pool_stop();
+// Queue func(arg) for the next idle worker (without workers it is run
+// right away). Returns NULL if the task can't be allocated.
+mpz_disk_task mpz_disk_submit(mpz_disk_task_func func, void* arg);
+// Like mpz_disk_submit(), but func(arg) is only queued once the n_deps tasks
+// in deps have finished (NULL entries are skipped). If one of them failed,
+// the task fails with its result without running. The deps may be waited
+// for or detached as soon as this returns.
+mpz_disk_task mpz_disk_submit_after(mpz_disk_task_func func, void* arg, int n_deps, const mpz_disk_task* deps);
+// Wait for a task to finish and free it, returns what func returned. Tasks
+// may wait for tasks they submitted.
+int mpz_disk_wait(mpz_disk_task task);
+// 1 if the task has finished (mpz_disk_wait() then returns right away)
+int mpz_disk_poll(mpz_disk_task task);
+// Call func(result, arg) on the thread that finishes the task, or right
+// away if it has finished. -1 if func can't be registered.
+typedef void (*mpz_disk_done_func)(int result, void* arg);
+int mpz_disk_on_complete(mpz_disk_task task, mpz_disk_done_func func, void* arg);
+// Let go of a task without waiting for it, it is freed once it has run
+void mpz_disk_detach(mpz_disk_task task);
+
+// Non-blocking rop = op1 +/- op2, run on the pool (which they start if it
+// isn't running) once the n_deps tasks in deps have finished, e.g. the ones
+// computing op1 and op2. The operands must be left alone until the task has
+// finished. Returns NULL if the task can't be allocated.
+mpz_disk_task mpz_disk_add_async(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_t op2, int n_deps, const mpz_disk_task* deps);
+mpz_disk_task mpz_disk_sub_async(mpz_disk_ptr rop, mpz_disk_ptr op1, mpz_disk_t op2, int n_deps, const mpz_disk_task* deps);
+
+// Stripe integers initialized from now on across n_dirs directories (e.g.
+// one per disk) in round-robin stripes of stripe_bytes bytes. Each directory
+// gets an I/O thread of its own. n_dirs = 0 turns striping off. The
+// directories must exist and may only be changed while no striped
+// integers are alive.
+int mpz_disk_set_stripe_dirs(const char** dirs, int n_dirs, size_t stripe_bytes);
+
+// Store integers initialized from now on compressed, in chunks of chunk_bytes
+// bytes (0 = MPZ_DISK_DEFAULT_CHUNK_BYTES) that are compressed and
+// decompressed by all threads at once. Worth it for values with long runs of
+// zeros or repeats, such as shifted values. Compressed integers aren't striped.
+int mpz_disk_set_compression(int enabled, size_t chunk_bytes);
+
+// Integers initialized from now on are held in memory, without any files,
+// until they grow past 'bytes' bytes (default MPZ_DISK_DEFAULT_MEMORY_THRESHOLD,
+// 0 = always on disk). Operations take any mix of them and integers on disk.
+int mpz_disk_set_memory_threshold(size_t bytes);
+
+// mpz_disk_set_mpz() leaves the ranges of zero limbs of the value as holes
+// in the files instead of writing them, on file systems with sparse files
+int mpz_disk_set_sparse(int enabled);
+
+// Keep the files of integers initialized from now on in backend (NULL, the
+// default, is plain files). The backend must outlive them.
+int mpz_disk_set_backend(const mpz_disk_backend_t* backend);
+// Plain files, as the integers have without a backend
+int mpz_disk_file_backend_init(mpz_disk_backend_t* backend);
+// Files in memory, e.g. for fast tests. Clearing it frees all of them.
+int mpz_disk_ram_backend_init(mpz_disk_backend_t* backend);
+void mpz_disk_ram_backend_clear(mpz_disk_backend_t* backend);
+// The files of inner (NULL = plain files) on a simulated slow disk, e.g. for
+// benchmarks: every read, write and sync waits latency_ns plus its bytes at
+// bytes_per_second (0 = no limit) behind the ones before it
+int mpz_disk_throttled_backend_init(mpz_disk_backend_t* backend, const mpz_disk_backend_t* inner,
+	int64_t latency_ns, int64_t bytes_per_second);
+void mpz_disk_throttled_backend_clear(mpz_disk_backend_t* backend);
+// All files as extents of the single container file 'filename' of inner
+// (NULL = plain files), e.g. for product trees with millions of leaves that
+// would otherwise each get files of their own. Space given back by cleared
+// integers is reused for new ones. Clearing it removes the container.
+int mpz_disk_pack_backend_init(mpz_disk_backend_t* backend, const mpz_disk_backend_t* inner, const char* filename);
+void mpz_disk_pack_backend_clear(mpz_disk_backend_t* backend);
+// Move the files of a pack backend down over the free space between them
+// and shrink the container to fit. Operations on its integers may run
+// meanwhile, their reads and writes wait for it.
+int mpz_disk_pack_compact(mpz_disk_backend_t* backend);
+// Size of the container of a pack backend, and how much of it is free
+void mpz_disk_pack_usage(mpz_disk_backend_t* backend, int64_t* bytes, int64_t* free_bytes);
+
+// The block buffers of all operations come from a pool of page-aligned
+// buffers. Up to max_bytes of them (MPZ_DISK_POOL_AUTO, the default, keeps
+// up to half of the available memory, shared by the running tasks like the
+// blocks of the operations) are kept between operations for reuse.
+// With huge_pages they are backed by huge pages where the OS allows it.
+int mpz_disk_set_buffer_pool(size_t max_bytes, int huge_pages);
+// Give all idle pooled buffers back to the OS
+void mpz_disk_release_buffers();
+
+// Blocks of integers on disk that are read are kept in a cache shared by
+// all operations, so that operands used again are read from memory. It
+// takes memory as blocks are read, up to max_bytes bytes
+// (MPZ_DISK_CACHE_AUTO, the default, is a quarter of the available memory,
+// shared by the running tasks like the blocks of the operations; 0 turns it
+// off). Must not be called while operations are running.
+int mpz_disk_set_cache_size(size_t max_bytes);
+// Number of blocks found in the cache and not found since the start
+void mpz_disk_get_cache_stats(int64_t* hits, int64_t* misses);
+
+// Integers initialized from now on keep a CRC32C of every
+// MPZ_DISK_SUMMARY_LIMBS limbs next to them, made as the limbs are written
+// and checked whenever they are read back whole. Operations that read limbs
+// which don't match return MPZ_DISK_ERROR_CHECKSUM (mpz_disk_out_raw()
+// returns 0, and the counting ones ~(mp_bitcnt_t)0).
+int mpz_disk_set_checksums(int enabled);
+// Check all the limbs of op against their checksums, by all threads at
+// once. Returns MPZ_DISK_ERROR_CHECKSUM if any of them don't match.
+int mpz_disk_verify(mpz_disk_ptr op);
+// Number of reads since the start that didn't match their checksum
+int64_t mpz_disk_get_checksum_errors();
+
+// Operations the statistics are kept for (see mpz_disk_get_stats())
+#define MPZ_DISK_STATS_ADD 0	// mpz_disk_add(), mpz_disk_addsub_n(), and mpz_disk_resume() of an addition
+#define MPZ_DISK_STATS_SUB 1
+#define MPZ_DISK_STATS_CMPABS 2
+#define MPZ_DISK_STATS_LOGIC 3	// mpz_disk_and(), mpz_disk_ior(), mpz_disk_xor() and mpz_disk_com()
+#define MPZ_DISK_STATS_COUNT 4	// mpz_disk_popcount(), mpz_disk_hamdist(), mpz_disk_scan0() and mpz_disk_scan1()
+#define MPZ_DISK_STATS_SET_MPZ 5
+#define MPZ_DISK_STATS_GET_MPZ 6
+#define MPZ_DISK_STATS_RAW 7	// mpz_disk_out_raw() and mpz_disk_inp_raw()
+#define MPZ_DISK_STATS_VERIFY 8
+#define MPZ_DISK_STATS_OTHER 9	// Everything done outside of the above, e.g. by mpz_disk_clear()
+#define MPZ_DISK_STATS_ALL 10	// Totals of all operations
+
+typedef struct
+{
+	int64_t calls;
+	// Wall clock time of the calls
+	int64_t ns;
+	int64_t bytes_read, bytes_written, syscalls;
+	// Time all of the threads of the calls together spent in system calls
+	// for I/O and in between them, so it can exceed ns
+	int64_t io_ns, compute_ns;
+	// Part of io_ns + compute_ns spent cutting the leading zero limbs off results
+	int64_t normalize_ns;
+	// Bytes of block buffers handed out by the buffer pool, and the most of
+	// them that were in use at once while the operation ran
+	int64_t buffer_bytes, peak_buffer_bytes;
+} mpz_disk_stats_t;
+
+// Statistics of op (MPZ_DISK_STATS_ADD, ... or MPZ_DISK_STATS_ALL) since
+// the start or the last mpz_disk_reset_stats(). They are only kept when
+// built with MPZ_DISK_STATS defined, otherwise the hooks compile to
+// nothing and this zeroes *stats and returns -1. Worker threads charge
+// their work to the operation that started them, and operations called
+// from within another operation are charged to the outer one.
+int mpz_disk_get_stats(mpz_disk_stats_t* stats, int op);
+// Must not be called while operations are running
+void mpz_disk_reset_stats();
+// Write the statistics of all operations to stream as a JSON object
+int mpz_disk_dump_stats(FILE* stream);
 
 size_t _mpz_disk_get_available_mem(); // FIXME Rename
 // Get size of file in bytes
 int64_t _mpz_disk_get_file_size(char* filename);
 void _mpz_disk_get_sign_filename(char* dest, mpz_disk_ptr rop);
+// Name of the chunk index of a compressed mpz_disk_t
+void _mpz_disk_get_index_filename(char* dest, mpz_disk_ptr op);
+void _mpz_disk_get_summary_filename(char* dest, mpz_disk_ptr op);
+void _mpz_disk_get_checksum_filename(char* dest, mpz_disk_ptr op);
+// Name of the journal of the operation writing op (see mpz_disk_set_checkpoint())
+void _mpz_disk_get_journal_filename(char* dest, mpz_disk_ptr op);
+// Sign of a mpz_disk_t (MPZ_DISK_SIGN_POSITIVE or MPZ_DISK_SIGN_NEGATIVE)
+int _mpz_disk_get_sign(mpz_disk_ptr op);
+int _mpz_disk_set_sign(mpz_disk_ptr rop, int sign);
+// Create (negative) or remove (positive) the sign file, whatever rop->sign says
+int _mpz_disk_write_sign_file(mpz_disk_ptr rop, int sign);
 // Truncate the last 'bytes_to_truncate' bytes_to_truncate of a file
 int _mpz_disk_truncate_file(char* filename, size_t bytes_to_truncate);
 // Truncate leading limbs from a mpz_disk_t
 int _mpz_disk_truncate_leading_zeroes(char* filename);
 
+typedef void (*_mpz_disk_thread_func)(void* arg, int thread_idx);
+// Run func(arg, 0), ..., func(arg, n_threads - 1) in parallel and wait for them
+int _mpz_disk_run_threads(int n_threads, _mpz_disk_thread_func func, void* arg);
+// Atomically set *target to min(*target, value)
+void _mpz_disk_atomic_min(volatile int64_t* target, int64_t value);
+// Atomically set *target to max(*target, value)
+void _mpz_disk_atomic_max(volatile int64_t* target, int64_t value);
+// Atomically add value to *target, returns the old value
+int64_t _mpz_disk_atomic_add(volatile int64_t* target, int64_t value);
+// Atomically set *target to value if it is expected, returns whether it was
+int _mpz_disk_atomic_cas(volatile int64_t* target, int64_t expected, int64_t value);
+
+// Page-aligned buffer from the pool, to be given back with _mpz_disk_buffer_free()
+void* _mpz_disk_buffer_alloc(size_t bytes);
+void _mpz_disk_buffer_free(void* ptr);
+
+// Compress 'bytes' bytes from src to dst. Returns the compressed size, or 0
+// if it wouldn't be smaller than 'bytes' (dst must hold 'bytes' bytes).
+size_t _mpz_disk_compress(unsigned char* dst, const unsigned char* src, size_t bytes);
+// Decompress src into the 'bytes' bytes of dst, returns -1 if src is corrupt
+int _mpz_disk_decompress(unsigned char* dst, size_t bytes, const unsigned char* src, size_t src_bytes);
+
+// Open the limb file(s) of op, or hand out the handle op keeps open
+#define _MPZ_DISK_OPEN_READ 0
+#define _MPZ_DISK_OPEN_WRITE 1	// Read and write, created if missing
+#define _MPZ_DISK_OPEN_CREATE 2	// Read and write, truncated to zero length
+#define _MPZ_DISK_OPEN_MEMORY 3	// Empty and in memory, files are created once it outgrows op->max_memory_limbs
+_mpz_disk_handle* _mpz_disk_open(mpz_disk_ptr op, int mode);
+void _mpz_disk_close(_mpz_disk_handle* fp);
+// Keep fp open as op's handle until _mpz_disk_release(op), which closes it
+// without writing back what is only needed to reopen the files
+void _mpz_disk_keep_open(mpz_disk_ptr op, _mpz_disk_handle* fp);
+void _mpz_disk_release(mpz_disk_ptr op);
+// Whether op is held in memory (it has no files yet)
+int _mpz_disk_in_memory(mpz_disk_ptr op);
+// Read-only view of the first 'limbs' limbs, shared by all callers until
+// each of them gives it back with _mpz_disk_unmap()
+const mp_limb_t* _mpz_disk_map(_mpz_disk_handle* fp, size_t limbs);
+void _mpz_disk_unmap(_mpz_disk_handle* fp, const mp_limb_t* map);
+// Name of the limb file of op in stripe directory 'stripe_dir'
+void _mpz_disk_get_stripe_filename(char* dest, mpz_disk_ptr op, int stripe_dir);
+// Size of the limbs in bytes (summed over all stripes)
+int64_t _mpz_disk_handle_size(_mpz_disk_handle* fp);
+// Cut (or zero-extend) the limbs to 'limbs' limbs
+int _mpz_disk_resize(_mpz_disk_handle* fp, size_t limbs);
+// Resize to 'limbs' limbs ahead of writing them, with the disk space
+// allocated up front, or as sparse files if the zero ranges won't be written
+int _mpz_disk_prepare_files(_mpz_disk_handle* fp, size_t limbs, int sparse);
+// Drop the leading zero limbs of op
+int _mpz_disk_normalize(mpz_disk_ptr op);
+// Whether limbs [offset, offset + limbs) are known to be all zero, all ones,
+// or neither, from the summary alone (limbs past the end count as zero)
+#define _MPZ_DISK_SUMMARY_ZERO 0
+#define _MPZ_DISK_SUMMARY_ONES 1
+#define _MPZ_DISK_SUMMARY_MIXED 2
+int _mpz_disk_get_summary(_mpz_disk_handle* fp, size_t offset, size_t limbs);
+// CRC32C of 'bytes' bytes carrying on from crc (0 to start with)
+uint32_t _mpz_disk_crc32c(uint32_t crc, const void* data, size_t bytes);
+// Read 'limbs' limbs starting at limb 'offset' of a file of 'file_limbs' limbs,
+// limbs past the end of the file read as zero. Returns MPZ_DISK_ERROR_READ if
+// fewer limbs than that could be read, MPZ_DISK_ERROR_CHECKSUM if the limbs
+// read don't match their checksums, else 0.
+int _mpz_disk_read_limbs(_mpz_disk_handle* fp, mp_limb_t* buf, size_t limbs, size_t offset, size_t file_limbs);
+// Hint that limbs [offset, offset + limbs) of a file will be read soon
+void _mpz_disk_prefetch_limbs(_mpz_disk_handle* fp, size_t offset, size_t limbs);
+// Write 'limbs' limbs at limb 'offset' of a file
+int _mpz_disk_write_limbs(_mpz_disk_handle* fp, const mp_limb_t* buf, size_t limbs, size_t offset);
+// Wait for everything written so far to reach the device
+int _mpz_disk_sync(_mpz_disk_handle* fp);
+// Replace the journal of rop, once the limbs written through fp are on the
+// device, and read it back
+int _mpz_disk_write_journal(mpz_disk_ptr rop, _mpz_disk_handle* fp, const void* journal, size_t bytes);
+int _mpz_disk_read_journal(mpz_disk_ptr rop, void* journal, size_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
@@ -0,0 +1,262 @@
+#ifndef _INC_MPZ_DISKXX_H
+#define _INC_MPZ_DISKXX_H
+
+#include <stdexcept>
+#include <utility>
+#include "mpz_disk.h"
+
+// C++ interface to mpz_disk, in the spirit of mpirxx.h. A mpz_disk_class
+// owns the files of its integer and removes them when it goes out of
+// scope. Moving one hands its files over, nothing is copied.
+//
+// Sums and differences are expression templates: r = a + b - c only notes
+// the terms, and the assignment runs them through mpz_disk_addsub_n() in a
+// single pass, so no temporary integers are written. As with mpz_disk_add()
+// and mpz_disk_sub(), the terms are taken as absolute values and the result
+// may not be negative.
+
+// Thrown when an operation fails, with the error code it returned
+class mpz_disk_error : public std::runtime_error
+{
+public:
+	explicit mpz_disk_error(int code) : std::runtime_error("mpz_disk operation failed"), code_(code) {}
+
+	int code() const { return code_; }
+
+private:
+	int code_;
+};
+
+// Terms ops[0] +/- ops[1] +/- ... of a sum that isn't evaluated yet. The
+// terms are only referred to, so it has to be assigned within the full
+// expression it is made in.
+template <int N>
+struct mpz_disk_expr
+{
+	mpz_disk_ptr ops[N];
+	int subtract[N];
+};
+
+template <int N, int M>
+inline mpz_disk_expr<N + M> _mpz_disk_expr_join(const mpz_disk_expr<N>& e1, const mpz_disk_expr<M>& e2, int subtract)
+{
+	mpz_disk_expr<N + M> e;
+
+	for (int i = 0; i < N; i++) {
+		e.ops[i] = e1.ops[i];
+		e.subtract[i] = e1.subtract[i];
+	}
+
+	// Subtracting a sum subtracts each of its terms
+	for (int i = 0; i < M; i++) {
+		e.ops[N + i] = e2.ops[i];
+		e.subtract[N + i] = e2.subtract[i] ^ subtract;
+	}
+
+	return e;
+}
+
+class mpz_disk_class
+{
+public:
+	mpz_disk_class() : mp_(new _mpz_disk_struct)
+	{
+		if (mpz_disk_init(mp_) != 0) {
+			delete mp_;
+			throw mpz_disk_error(MPZ_DISK_ADD_ERROR_FILE_OPEN_FAIL);
+		}
+	}
+
+	explicit mpz_disk_class(mpz_srcptr op) : mpz_disk_class()
+	{
+		set_mpz(op);
+	}
+
+	// Copies are written out in full, sign included
+	mpz_disk_class(const mpz_disk_class& op) : mpz_disk_class()
+	{
+		check(mpz_disk_set(mp_, op.mp_));
+	}
+
+	template <int N>
+	mpz_disk_class(const mpz_disk_expr<N>& e) : mpz_disk_class()
+	{
+		assign(e);
+	}
+
+	// The moved-from integer may only be assigned to or destroyed
+	mpz_disk_class(mpz_disk_class&& op) noexcept : mp_(op.mp_)
+	{
+		op.mp_ = nullptr;
+	}
+
+	~mpz_disk_class()
+	{
+		if (mp_) {
+			mpz_disk_clear(mp_);
+			delete mp_;
+		}
+	}
+
+	// The old value goes with op
+	mpz_disk_class& operator=(mpz_disk_class&& op) noexcept
+	{
+		swap(op);
+		return *this;
+	}
+
+	mpz_disk_class& operator=(const mpz_disk_class& op)
+	{
+		// A moved-from integer has no files to copy into
+		if (!mp_) {
+			mpz_disk_class r(op);
+			swap(r);
+		}
+		else
+			check(mpz_disk_set(mp_, op.mp_));
+
+		return *this;
+	}
+
+	template <int N>
+	mpz_disk_class& operator=(const mpz_disk_expr<N>& e)
+	{
+		// rop can't be one of the terms, as it is written while they are
+		// read, so such sums go to a new integer first
+		int alias = !mp_;
+		for (int i = 0; i < N; i++)
+			alias = alias || e.ops[i] == mp_;
+
+		if (alias) {
+			mpz_disk_class r(e);
+			swap(r);
+		}
+		else
+			assign(e);
+
+		return *this;
+	}
+
+	mpz_disk_class& operator+=(const mpz_disk_class& op)
+	{
+		return *this = _mpz_disk_expr_join(term(), op.term(), 0);
+	}
+
+	mpz_disk_class& operator-=(const mpz_disk_class& op)
+	{
+		return *this = _mpz_disk_expr_join(term(), op.term(), 1);
+	}
+
+	template <int N>
+	mpz_disk_class& operator+=(const mpz_disk_expr<N>& e)
+	{
+		return *this = _mpz_disk_expr_join(term(), e, 0);
+	}
+
+	template <int N>
+	mpz_disk_class& operator-=(const mpz_disk_expr<N>& e)
+	{
+		return *this = _mpz_disk_expr_join(term(), e, 1);
+	}
+
+	void set_mpz(mpz_srcptr op)
+	{
+		check(mpz_disk_set_mpz(mp_, op));
+	}
+
+	void get_mpz(mpz_ptr rop) const
+	{
+		check(mpz_disk_get_mpz(rop, mp_));
+	}
+
+	size_t size() const
+	{
+		return mpz_disk_size(mp_);
+	}
+
+	void swap(mpz_disk_class& op) noexcept
+	{
+		std::swap(mp_, op.mp_);
+	}
+
+	// For calling the C functions on it
+	mpz_disk_ptr get_mpz_disk_t() const
+	{
+		return mp_;
+	}
+
+	// The integer as a sum of one term
+	mpz_disk_expr<1> term() const
+	{
+		mpz_disk_expr<1> e = { { mp_ }, { 0 } };
+		return e;
+	}
+
+private:
+	static void check(int ret)
+	{
+		if (ret != 0)
+			throw mpz_disk_error(ret);
+	}
+
+	template <int N>
+	void assign(const mpz_disk_expr<N>& e)
+	{
+		check(mpz_disk_addsub_n(mp_, e.ops, e.subtract, N));
+	}
+
+	mpz_disk_ptr mp_;
+};
+
+inline void swap(mpz_disk_class& op1, mpz_disk_class& op2) noexcept
+{
+	op1.swap(op2);
+}
+
+inline mpz_disk_expr<2> operator+(const mpz_disk_class& op1, const mpz_disk_class& op2)
+{
+	return _mpz_disk_expr_join(op1.term(), op2.term(), 0);
+}
+
+inline mpz_disk_expr<2> operator-(const mpz_disk_class& op1, const mpz_disk_class& op2)
+{
+	return _mpz_disk_expr_join(op1.term(), op2.term(), 1);
+}
+
+template <int N>
+inline mpz_disk_expr<N + 1> operator+(const mpz_disk_expr<N>& e, const mpz_disk_class& op)
+{
+	return _mpz_disk_expr_join(e, op.term(), 0);
+}
+
+template <int N>
+inline mpz_disk_expr<N + 1> operator-(const mpz_disk_expr<N>& e, const mpz_disk_class& op)
+{
+	return _mpz_disk_expr_join(e, op.term(), 1);
+}
+
+template <int M>
+inline mpz_disk_expr<M + 1> operator+(const mpz_disk_class& op, const mpz_disk_expr<M>& e)
+{
+	return _mpz_disk_expr_join(op.term(), e, 0);
+}
+
+template <int M>
+inline mpz_disk_expr<M + 1> operator-(const mpz_disk_class& op, const mpz_disk_expr<M>& e)
+{
+	return _mpz_disk_expr_join(op.term(), e, 1);
+}
+
+template <int N, int M>
+inline mpz_disk_expr<N + M> operator+(const mpz_disk_expr<N>& e1, const mpz_disk_expr<M>& e2)
+{
+	return _mpz_disk_expr_join(e1, e2, 0);
+}
+
+template <int N, int M>
+inline mpz_disk_expr<N + M> operator-(const mpz_disk_expr<N>& e1, const mpz_disk_expr<M>& e2)
+{
+	return _mpz_disk_expr_join(e1, e2, 1);
+}
+
+#endif
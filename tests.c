@@ -3,6 +3,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <direct.h>
+static void _mpz_disk_make_dir(const char* dir) { _mkdir(dir); }
+static void _mpz_disk_remove_dir(const char* dir) { _rmdir(dir); }
+#elif defined(__unix__)
+#include <sys/stat.h>
+#include <unistd.h>
+// The stdlib.h of MSVC has these for C
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+static void _mpz_disk_make_dir(const char* dir) { mkdir(dir, 0755); }
+static void _mpz_disk_remove_dir(const char* dir) { rmdir(dir); }
+#endif
 
 int test_mpz_disk_get_file_size()
 {
@@ -342,6 +361,98 @@ int test_mpz_disk_sub() {
 	return 0;
 }
 
+int test_mpz_disk_addsub_parallel()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing parallel mpz_disk_add(), mpz_disk_sub()...");
+
+	mpz_disk_set_num_threads(4);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_rop, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_rop;
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_rop);
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_rop);
+
+		// Add 2^x - 1 and a small number, so that the carry ripples
+		// through all segments. Subtracting gives long borrow chains.
+		mpz_set_ui(rand_op1, 0);
+		mpz_setbit(rand_op1, (rand() << 14) / RAND_MAX);
+		if (i & 1)
+			mpz_sub_ui(rand_op1, rand_op1, 1);
+		mpz_urandomb(rand_op2, mp_randstate, 1 + (rand() << 14) / RAND_MAX);
+		if (i & 2)
+			mpz_set_ui(rand_op2, rand() + 1);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		if (i & 4) {
+			mpz_add     (rand_rop, rand_op1, rand_op2);
+			mpz_disk_add(disk_rop, disk_op1, disk_op2);
+		}
+		else if (mpz_cmp(rand_op1, rand_op2) > 0) {
+			mpz_sub     (rand_rop, rand_op1, rand_op2);
+			mpz_disk_sub(disk_rop, disk_op1, disk_op2);
+		}
+		else {
+			mpz_sub     (rand_rop, rand_op2, rand_op1);
+			mpz_disk_sub(disk_rop, disk_op2, disk_op1);
+		}
+
+		mpz_disk_get_mpz(rop, disk_rop);
+
+		if (mpz_cmp(rop, rand_rop) != 0) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result while %s numbers\n", (i & 4) ? "adding" : "subtracting");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			gmp_printf("rop: %Zx\n", rand_rop);
+			gmp_printf("got: %Zx\n", rop);
+			// --
+
+			mpz_clear(rop);
+			mpz_clear(rand_rop);
+			mpz_clear(rand_op1);
+			mpz_clear(rand_op2);
+			mpz_disk_clear(disk_rop);
+			mpz_disk_clear(disk_op1);
+			mpz_disk_clear(disk_op2);
+			mpz_disk_set_num_threads(0);
+
+			return -1;
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_disk_clear(disk_rop);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+	}
+
+	mpz_disk_set_num_threads(0);
+
+	printf(" OK [%d cases tested]\n", TestCases);
+	return 0;
+}
+
 int test_mpz_disk_cmpabs()
 {
 	const int TestCases = 100;
@@ -388,6 +499,9 @@ int test_mpz_disk_cmpabs()
 
 		mpz_disk_set_mpz(disk_op2, rand_op2);
 
+		// Compare with 1 to 4 threads
+		mpz_disk_set_num_threads(1 + i % 4);
+
 		cmp_exp = mpz_cmpabs(rand_op1, rand_op2);
 		cmp_got = mpz_disk_cmpabs(disk_op1, disk_op2);
 
@@ -397,6 +511,7 @@ int test_mpz_disk_cmpabs()
 
 			mpz_clear(rand_op1); mpz_clear(rand_op2);
 			mpz_disk_clear(disk_op1); mpz_disk_clear(disk_op2);
+			mpz_disk_set_num_threads(0);
 
 			return -1;
 		}
@@ -406,25 +521,2949 @@ int test_mpz_disk_cmpabs()
 		mpz_disk_clear(disk_op1); mpz_disk_clear(disk_op2);
 	}
 
+	mpz_disk_set_num_threads(0);
+
 	printf(" OK [%d cases tested]\n", TestCases);
 	return 0;
 }
 
-int main()
+int test_mpz_disk_logic()
 {
-	int passed = 1;
-	//passed = passed && !test_mpz_disk_get_file_size();
-	//passed = passed && !test_mpz_disk_truncate_file();
-	//passed = passed && !test_mpz_disk_truncate_leading_zereos();
-	//passed = passed && !test_mpz_disk_get_mpz();
-	//passed = passed && !test_mpz_disk_add();
-	//passed = passed && !test_mpz_disk_sub();
-	passed = passed && !test_mpz_disk_cmpabs();
+	const int TestCases = 100;
 
-	if (!passed)
-		return -1;
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_and(), mpz_disk_ior(), mpz_disk_xor()...");
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_rop, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_rop;
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_rop);
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_rop);
+
+		mpz_urandomb(rand_op1, mp_randstate, 1 + (rand() << 14) / RAND_MAX);
+		mpz_urandomb(rand_op2, mp_randstate, 1 + (rand() << 14) / RAND_MAX);
+
+		// Cover all sign combinations
+		if (i & 1) mpz_neg(rand_op1, rand_op1);
+		if (i & 2) mpz_neg(rand_op2, rand_op2);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		int logic_op = (i >> 2) % 3;
+		switch (logic_op)
+		{
+		case 0:
+			mpz_and(rand_rop, rand_op1, rand_op2);
+			mpz_disk_and(disk_rop, disk_op1, disk_op2);
+			break;
+		case 1:
+			mpz_ior(rand_rop, rand_op1, rand_op2);
+			mpz_disk_ior(disk_rop, disk_op1, disk_op2);
+			break;
+		case 2:
+			mpz_xor(rand_rop, rand_op1, rand_op2);
+			mpz_disk_xor(disk_rop, disk_op1, disk_op2);
+			break;
+		}
+
+		mpz_disk_get_mpz(rop, disk_rop);
+
+		// Same operation again, this time overwriting op1
+		mpz_t rop_aliased;
+		mpz_init(rop_aliased);
+		switch (logic_op)
+		{
+		case 0: mpz_disk_and(disk_op1, disk_op1, disk_op2); break;
+		case 1: mpz_disk_ior(disk_op1, disk_op1, disk_op2); break;
+		case 2: mpz_disk_xor(disk_op1, disk_op1, disk_op2); break;
+		}
+		mpz_disk_get_mpz(rop_aliased, disk_op1);
+
+		if (mpz_cmp(rop, rand_rop) != 0 || mpz_cmp(rop_aliased, rand_rop) != 0) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result of bitwise operation %d\n", logic_op);
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			gmp_printf("rop: %Zx\n", rand_rop);
+			gmp_printf("got: %Zx\n", rop);
+			gmp_printf("got (aliased): %Zx\n", rop_aliased);
+			// --
+
+			mpz_clear(rop);
+			mpz_clear(rop_aliased);
+			mpz_clear(rand_rop);
+			mpz_clear(rand_op1);
+			mpz_clear(rand_op2);
+			mpz_disk_clear(disk_rop);
+			mpz_disk_clear(disk_op1);
+			mpz_disk_clear(disk_op2);
+
+			return -1;
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rop_aliased);
+		mpz_clear(rand_rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_disk_clear(disk_rop);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+	}
+
+	printf(" OK [%d cases tested]\n", TestCases);
+	return 0;
+}
+
+int test_mpz_disk_com()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_com()...");
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op, rand_rop, rop;
+		mpz_disk_t disk_op, disk_rop;
+
+		mpz_init(rop);
+		mpz_init(rand_op);
+		mpz_init(rand_rop);
+		mpz_disk_init(disk_op);
+		mpz_disk_init(disk_rop);
+
+		switch (i % 4)
+		{
+		case 0:
+			// Random number
+			mpz_urandomb(rand_op, mp_randstate, 1 + (rand() << 14) / RAND_MAX);
+			break;
+		case 1:
+			// Negative random number
+			mpz_urandomb(rand_op, mp_randstate, 1 + (rand() << 14) / RAND_MAX);
+			mpz_neg(rand_op, rand_op);
+			break;
+		case 2:
+			// 2^x - 1, complement carries into a new limb
+			mpz_set_ui(rand_op, 0);
+			mpz_setbit(rand_op, (rand() << 10) / RAND_MAX);
+			mpz_sub_ui(rand_op, rand_op, 1);
+			break;
+		case 3:
+			// -2^x
+			mpz_set_ui(rand_op, 0);
+			mpz_setbit(rand_op, (rand() << 10) / RAND_MAX);
+			mpz_neg(rand_op, rand_op);
+			break;
+		}
+
+		mpz_disk_set_mpz(disk_op, rand_op);
+
+		mpz_com     (rand_rop, rand_op);
+		mpz_disk_com(disk_rop, disk_op);
+
+		mpz_disk_get_mpz(rop, disk_rop);
+
+		if (mpz_cmp(rop, rand_rop) != 0) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result of complement\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op:  %Zx\n", rand_op);
+			gmp_printf("rop: %Zx\n", rand_rop);
+			gmp_printf("got: %Zx\n", rop);
+			// --
+
+			mpz_clear(rop);
+			mpz_clear(rand_rop);
+			mpz_clear(rand_op);
+			mpz_disk_clear(disk_rop);
+			mpz_disk_clear(disk_op);
+
+			return -1;
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_rop);
+		mpz_clear(rand_op);
+		mpz_disk_clear(disk_rop);
+		mpz_disk_clear(disk_op);
+	}
+
+	printf(" OK [%d cases tested]\n", TestCases);
 	return 0;
 }
+
+int test_mpz_disk_popcount()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_popcount(), mpz_disk_hamdist()...");
+
+	mpz_disk_set_num_threads(4);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2;
+		mpz_disk_t disk_op1, disk_op2;
+
+		mpz_init(rand_op1); mpz_init(rand_op2);
+		mpz_disk_init(disk_op1); mpz_disk_init(disk_op2);
+
+		mpz_urandomb(rand_op1, mp_randstate, 1 + (rand() << 14) / RAND_MAX);
+		mpz_urandomb(rand_op2, mp_randstate, 1 + (rand() << 14) / RAND_MAX);
+
+		// Cover all sign combinations, and numbers with low zero limbs
+		if (i & 1) mpz_neg(rand_op1, rand_op1);
+		if (i & 2) mpz_neg(rand_op2, rand_op2);
+		if (i & 4) mpz_mul_2exp(rand_op1, rand_op1, (rand() << 10) / RAND_MAX);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		if (mpz_popcount(rand_op1) != mpz_disk_popcount(disk_op1) ||
+			mpz_hamdist(rand_op1, rand_op2) != mpz_disk_hamdist(disk_op1, disk_op2)) {
+			printf(" FAILED\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			// --
+
+			mpz_clear(rand_op1); mpz_clear(rand_op2);
+			mpz_disk_clear(disk_op1); mpz_disk_clear(disk_op2);
+			mpz_disk_set_num_threads(0);
+
+			return -1;
+		}
+
+		mpz_clear(rand_op1); mpz_clear(rand_op2);
+		mpz_disk_clear(disk_op1); mpz_disk_clear(disk_op2);
+	}
+
+	mpz_disk_set_num_threads(0);
+
+	printf(" OK [%d cases tested]\n", TestCases);
+	return 0;
+}
+
+int test_mpz_disk_scan()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_scan0(), mpz_disk_scan1()...");
+
+	mpz_disk_set_num_threads(4);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op;
+		mpz_disk_t disk_op;
+
+		mpz_init(rand_op);
+		mpz_disk_init(disk_op);
+
+		// Sparse numbers, so that scan1 has to skip over lots of limbs
+		mpz_set_ui(rand_op, 0);
+		int bits = (rand() % 4);
+		while (bits-- > 0)
+			mpz_setbit(rand_op, (rand() << 14) / RAND_MAX);
+
+		// Dense numbers, so that scan0 has to skip over lots of limbs
+		if (i & 2)
+			mpz_com(rand_op, rand_op);
+		if (i & 1)
+			mpz_neg(rand_op, rand_op);
+
+		mpz_disk_set_mpz(disk_op, rand_op);
+
+		mp_bitcnt_t starting_bit = (rand() << 14) / RAND_MAX;
+
+		if (mpz_scan0(rand_op, starting_bit) != mpz_disk_scan0(disk_op, starting_bit) ||
+			mpz_scan1(rand_op, starting_bit) != mpz_disk_scan1(disk_op, starting_bit)) {
+			printf(" FAILED\n");
+
+			// --
+			printf("CASE #%d (starting bit %d)\n", i, (int)starting_bit);
+			gmp_printf("op: %Zx\n", rand_op);
+			// --
+
+			mpz_clear(rand_op);
+			mpz_disk_clear(disk_op);
+			mpz_disk_set_num_threads(0);
+
+			return -1;
+		}
+
+		mpz_clear(rand_op);
+		mpz_disk_clear(disk_op);
+	}
+
+	mpz_disk_set_num_threads(0);
+
+	printf(" OK [%d cases tested]\n", TestCases);
+	return 0;
+}
+
+int test_mpz_disk_stripe()
+{
+	const int TestCases = 100;
+	const char* stripe_dirs[] = { "stripe0", "stripe1", "stripe2" };
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing striped mpz_disk_t...");
+
+	int i;
+	for (i = 0; i < 3; ++i)
+		_mpz_disk_make_dir(stripe_dirs[i]);
+
+	mpz_disk_set_num_threads(4);
+
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_rop, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_rop;
+
+		// 1 to 3 directories, stripes of 1 to 16 limbs
+		mpz_disk_set_stripe_dirs(stripe_dirs, 1 + i % 3, (1 + rand() % 16) * sizeof(mp_limb_t));
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_rop);
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_rop);
+
+		mpz_urandomb(rand_op1, mp_randstate, 1 + (rand() << 14) / RAND_MAX);
+		mpz_urandomb(rand_op2, mp_randstate, 1 + (rand() << 14) / RAND_MAX);
+		if (i & 1)
+			mpz_set(rand_op2, rand_op1);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		int failed = 0;
+
+		mpz_disk_get_mpz(rop, disk_op1);
+		failed = failed || mpz_cmp(rop, rand_op1) != 0;
+
+		int cmp = mpz_cmpabs(rand_op1, rand_op2);
+		failed = failed || ((cmp > 0) - (cmp < 0)) != mpz_disk_cmpabs(disk_op1, disk_op2);
+
+		mpz_add     (rand_rop, rand_op1, rand_op2);
+		mpz_disk_add(disk_rop, disk_op1, disk_op2);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		// rop aliased with an operand
+		mpz_and     (rand_rop, rand_rop, rand_op1);
+		mpz_disk_and(disk_rop, disk_rop, disk_op1);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		if (mpz_cmp(rand_op1, rand_op2) >= 0) {
+			mpz_sub     (rand_rop, rand_op1, rand_op2);
+			mpz_disk_sub(disk_rop, disk_op1, disk_op2);
+		}
+		else {
+			mpz_sub     (rand_rop, rand_op2, rand_op1);
+			mpz_disk_sub(disk_rop, disk_op2, disk_op1);
+		}
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		failed = failed || mpz_popcount(rand_op1) != mpz_disk_popcount(disk_op1);
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result with %d stripe directories\n", 1 + i % 3);
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			// --
+
+			mpz_clear(rop);
+			mpz_clear(rand_rop);
+			mpz_clear(rand_op1);
+			mpz_clear(rand_op2);
+			mpz_disk_clear(disk_rop);
+			mpz_disk_clear(disk_op1);
+			mpz_disk_clear(disk_op2);
+			mpz_disk_set_stripe_dirs(NULL, 0, 0);
+			mpz_disk_set_num_threads(0);
+
+			return -1;
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_disk_clear(disk_rop);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+	}
+
+	mpz_disk_set_stripe_dirs(NULL, 0, 0);
+	mpz_disk_set_num_threads(0);
+
+	for (i = 0; i < 3; ++i)
+		_mpz_disk_remove_dir(stripe_dirs[i]);
+
+	printf(" OK [%d cases tested]\n", TestCases);
+	return 0;
+}
+
+int test_mpz_disk_compress()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing compressed mpz_disk_t...");
+
+	// The codec on its own, with zero runs, repeats and noise
+	unsigned char src[4096], comp[4096], dst[4096];
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		size_t bytes = 1 + rand() % sizeof(src);
+		size_t pos = 0;
+
+		while (pos < bytes)
+		{
+			size_t n = min(bytes - pos, (size_t)(1 + rand() % 64));
+
+			switch (rand() % 3) {
+			case 0: memset(src + pos, 0, n); break;
+			case 1: memset(src + pos, rand(), n); break;
+			default:
+				for (size_t j = 0; j < n; j++)
+					src[pos + j] = (unsigned char)rand();
+			}
+
+			pos += n;
+		}
+
+		size_t comp_bytes = _mpz_disk_compress(comp, src, bytes);
+
+		if (comp_bytes >= bytes ||
+			(comp_bytes != 0 && (_mpz_disk_decompress(dst, bytes, comp, comp_bytes) != 0 || memcmp(src, dst, bytes) != 0))) {
+			printf(" FAILED\n");
+			printf("[ERR] Codec round trip failed\n");
+			printf("CASE #%d\n", i);
+			return -1;
+		}
+	}
+
+	mpz_disk_set_num_threads(4);
+
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_rop, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_rop;
+
+		// Chunks of 1 to 64 limbs
+		mpz_disk_set_compression(1, (1 + rand() % 64) * sizeof(mp_limb_t));
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_rop);
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_rop);
+
+		// Shifted values, 2^x - 1 and products of small factors
+		mpz_urandomb(rand_op1, mp_randstate, 1 + (rand() << 10) / RAND_MAX);
+		mpz_mul_2exp(rand_op1, rand_op1, (rand() << 14) / RAND_MAX);
+		mpz_set_ui(rand_op2, 1);
+		if (i & 1)
+			mpz_mul_2exp(rand_op2, rand_op2, (rand() << 14) / RAND_MAX);
+		else
+			while (mpz_sizeinbase(rand_op2, 2) < (size_t)(rand() << 14) / RAND_MAX)
+				mpz_mul_ui(rand_op2, rand_op2, 1 + rand() % 16);
+		mpz_sub_ui(rand_op2, rand_op2, 1);
+		if (i & 2)
+			mpz_neg(rand_op2, rand_op2);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		int failed = 0;
+
+		mpz_disk_get_mpz(rop, disk_op2);
+		failed = failed || mpz_cmp(rop, rand_op2) != 0;
+
+		int cmp = mpz_cmpabs(rand_op1, rand_op2);
+		failed = failed || ((cmp > 0) - (cmp < 0)) != mpz_disk_cmpabs(disk_op1, disk_op2);
+
+		mpz_abs(rand_op2, rand_op2);
+		mpz_add     (rand_rop, rand_op1, rand_op2);
+		mpz_disk_add(disk_rop, disk_op1, disk_op2);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		if (cmp >= 0) {
+			mpz_sub     (rand_rop, rand_op1, rand_op2);
+			mpz_disk_sub(disk_rop, disk_op1, disk_op2);
+		}
+		else {
+			mpz_sub     (rand_rop, rand_op2, rand_op1);
+			mpz_disk_sub(disk_rop, disk_op2, disk_op1);
+		}
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		// rop aliased with an operand
+		mpz_xor     (rand_rop, rand_rop, rand_op1);
+		mpz_disk_xor(disk_rop, disk_rop, disk_op1);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		failed = failed || mpz_popcount(rand_op1) != mpz_disk_popcount(disk_op1);
+
+		// A shifted value should take a fraction of its size on disk
+		failed = failed || (mpz_disk_size(disk_op1) > 100 &&
+			_mpz_disk_get_file_size(disk_op1->filename) > (int64_t)(mpz_disk_size(disk_op1) * sizeof(mp_limb_t) / 2));
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result with compressed integers\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			// --
+
+			mpz_clear(rop);
+			mpz_clear(rand_rop);
+			mpz_clear(rand_op1);
+			mpz_clear(rand_op2);
+			mpz_disk_clear(disk_rop);
+			mpz_disk_clear(disk_op1);
+			mpz_disk_clear(disk_op2);
+			mpz_disk_set_compression(0, 0);
+			mpz_disk_set_num_threads(0);
+
+			return -1;
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_disk_clear(disk_rop);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+	}
+
+	mpz_disk_set_compression(0, 0);
+	mpz_disk_set_num_threads(0);
+
+	printf(" OK [%d cases tested]\n", TestCases);
+	return 0;
+}
+
+int test_mpz_disk_summary()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing summaries of mpz_disk_t...");
+
+	// Only integers on disk keep a summary
+	mpz_disk_set_memory_threshold(0);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_rop, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_rop;
+
+		mpz_disk_set_num_threads(1 + i % 4);
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_rop);
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_rop);
+
+		// Long runs of ones and zeros with a few random limbs in between,
+		// so that carries and borrows cross whole summary entries
+		mp_bitcnt_t ones = (rand() << 14) / RAND_MAX;
+		mpz_set_ui(rand_op1, 1);
+		mpz_mul_2exp(rand_op1, rand_op1, ones);
+		mpz_sub_ui(rand_op1, rand_op1, 1);
+		if (i & 1) {
+			mpz_urandomb(rand_rop, mp_randstate, 1 + rand() % 256);
+			mpz_mul_2exp(rand_rop, rand_rop, ones + (rand() << 12) / RAND_MAX);
+			mpz_add(rand_op1, rand_op1, rand_rop);
+		}
+		mpz_urandomb(rand_op2, mp_randstate, 1 + rand() % 256);
+		if (i & 2)
+			mpz_mul_2exp(rand_op2, rand_op2, (rand() << 14) / RAND_MAX);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		int failed = 0;
+
+		// The run of ones has to show up in the summary
+		_mpz_disk_handle* fp = _mpz_disk_open(disk_op1, _MPZ_DISK_OPEN_READ);
+		failed = failed || (ones >= 2 * MPZ_DISK_SUMMARY_LIMBS * GMP_NUMB_BITS &&
+			_mpz_disk_get_summary(fp, 0, MPZ_DISK_SUMMARY_LIMBS) != _MPZ_DISK_SUMMARY_ONES);
+		_mpz_disk_close(fp);
+
+		mpz_add     (rand_rop, rand_op1, rand_op2);
+		mpz_disk_add(disk_rop, disk_op1, disk_op2);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		if (mpz_cmp(rand_op1, rand_op2) >= 0) {
+			mpz_sub     (rand_rop, rand_op1, rand_op2);
+			mpz_disk_sub(disk_rop, disk_op1, disk_op2);
+		}
+		else {
+			mpz_sub     (rand_rop, rand_op2, rand_op1);
+			mpz_disk_sub(disk_rop, disk_op2, disk_op1);
+		}
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		// 2^x - small, the borrow runs through the zeros
+		mpz_set_ui(rand_op1, 1);
+		mpz_mul_2exp(rand_op1, rand_op1, mpz_sizeinbase(rand_op2, 2) + (rand() << 14) / RAND_MAX);
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+
+		mpz_sub     (rand_rop, rand_op1, rand_op2);
+		mpz_disk_sub(disk_rop, disk_op1, disk_op2);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result with uniform limbs\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			// --
+
+			mpz_clear(rop);
+			mpz_clear(rand_rop);
+			mpz_clear(rand_op1);
+			mpz_clear(rand_op2);
+			mpz_disk_clear(disk_rop);
+			mpz_disk_clear(disk_op1);
+			mpz_disk_clear(disk_op2);
+			mpz_disk_set_num_threads(0);
+			mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+			return -1;
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_disk_clear(disk_rop);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+	}
+
+	mpz_disk_set_num_threads(0);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+	printf(" OK [%d cases tested]\n", TestCases);
+	return 0;
+}
+
+int test_mpz_disk_buffer_pool()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing buffer pool...");
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_rop, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_rop;
+
+		// Pool small enough to be trimmed now and then, with and without huge pages
+		mpz_disk_set_buffer_pool((1 + rand() % 4) << 12, i & 1);
+		mpz_disk_set_num_threads(1 + i % 4);
+
+		int failed = 0;
+
+		// Buffers are page-aligned, writable and reused once given back
+		size_t bytes = 1 + (rand() << 2);
+		unsigned char* buf = _mpz_disk_buffer_alloc(bytes);
+		unsigned char* buf2 = _mpz_disk_buffer_alloc(bytes);
+		failed = failed || !buf || !buf2 || buf == buf2 || (size_t)buf % 4096 != 0;
+		if (!failed) {
+			memset(buf, 0xa5, bytes);
+			memset(buf2, 0x5a, bytes);
+			failed = buf[bytes - 1] != 0xa5;
+		}
+		_mpz_disk_buffer_free(buf2);
+		if (bytes <= 4096 && !(i & 1))
+			failed = failed || _mpz_disk_buffer_alloc(bytes) != buf2;
+		else
+			buf2 = NULL;
+		_mpz_disk_buffer_free(buf);
+		_mpz_disk_buffer_free(buf2);
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_rop);
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_rop);
+
+		mpz_urandomb(rand_op1, mp_randstate, (rand() << 14) / RAND_MAX);
+		mpz_urandomb(rand_op2, mp_randstate, (rand() << 14) / RAND_MAX);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		mpz_add     (rand_rop, rand_op1, rand_op2);
+		mpz_disk_add(disk_rop, disk_op1, disk_op2);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		mpz_xor     (rand_rop, rand_op1, rand_op2);
+		mpz_disk_xor(disk_rop, disk_op1, disk_op2);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		failed = failed || mpz_disk_popcount(disk_op1) != mpz_popcount(rand_op1);
+
+		if (i % 10 == 9)
+			mpz_disk_release_buffers();
+
+		mpz_clear(rop);
+		mpz_clear(rand_rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_disk_clear(disk_rop);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result with pooled buffers\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			// --
+
+			mpz_disk_set_num_threads(0);
+			mpz_disk_set_buffer_pool(MPZ_DISK_POOL_AUTO, 0);
+
+			return -1;
+		}
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_num_threads(0);
+	mpz_disk_set_buffer_pool(MPZ_DISK_POOL_AUTO, 0);
+	mpz_disk_release_buffers();
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+int test_mpz_disk_handle()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing cached handles of mpz_disk_t...");
+
+	mpz_t rand_op1, rand_op2, rand_rop, rop;
+	mpz_disk_t disk_op1, disk_op2, disk_rop;
+
+	mpz_init(rop);
+	mpz_init(rand_op1);
+	mpz_init(rand_op2);
+	mpz_init(rand_rop);
+
+	// op1 is compressed, all of them are on disk from the start
+	mpz_disk_set_memory_threshold(0);
+	mpz_disk_set_compression(1, 64);
+	mpz_disk_init(disk_op1);
+	mpz_disk_set_compression(0, 0);
+	mpz_disk_init(disk_op2);
+	mpz_disk_init(disk_rop);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+	// The same integers are used over and over, so that all the cached
+	// sizes, signs and top limbs have to follow the writes
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_disk_set_num_threads(1 + i % 4);
+
+		mpz_urandomb(rand_op1, mp_randstate, (rand() << 14) / RAND_MAX);
+		mpz_urandomb(rand_op2, mp_randstate, (rand() << 14) / RAND_MAX);
+		if (i & 1)
+			mpz_neg(rand_op1, rand_op1);
+		if (i & 2)
+			mpz_neg(rand_op2, rand_op2);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		int failed = 0;
+
+		// Opening an integer hands out the handle it keeps
+		_mpz_disk_handle* fp = _mpz_disk_open(disk_op1, _MPZ_DISK_OPEN_READ);
+		failed = failed || !fp || fp != disk_op1->handle;
+		_mpz_disk_close(fp);
+
+		failed = failed || mpz_disk_size(disk_op2) != mpz_size(rand_op2) ||
+			_mpz_disk_get_file_size(disk_op2->filename) != (int64_t)(mpz_size(rand_op2) * sizeof(mp_limb_t));
+
+		mpz_abs(rand_op1, rand_op1);
+		mpz_abs(rand_op2, rand_op2);
+
+		switch (i % 3)
+		{
+		case 0:
+			mpz_add     (rand_rop, rand_op1, rand_op2);
+			mpz_disk_add(disk_rop, disk_op1, disk_op2);
+			break;
+		case 1:
+			if (mpz_cmp(rand_op1, rand_op2) >= 0) {
+				mpz_sub     (rand_rop, rand_op1, rand_op2);
+				mpz_disk_sub(disk_rop, disk_op1, disk_op2);
+			}
+			else {
+				mpz_sub     (rand_rop, rand_op2, rand_op1);
+				mpz_disk_sub(disk_rop, disk_op2, disk_op1);
+			}
+			break;
+		case 2:
+			// The signs read back have to be the ones set above
+			mpz_disk_get_mpz(rop, disk_op1);
+			mpz_disk_get_mpz(rand_rop, disk_op2);
+			mpz_xor     (rand_rop, rop, rand_rop);
+			mpz_disk_xor(disk_rop, disk_op1, disk_op2);
+			break;
+		}
+
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0 || mpz_disk_size(disk_rop) != mpz_size(rand_rop);
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Cached size or sign out of date\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			// --
+
+			break;
+		}
+	}
+
+	mpz_clear(rop);
+	mpz_clear(rand_rop);
+	mpz_clear(rand_op1);
+	mpz_clear(rand_op2);
+	mpz_disk_clear(disk_rop);
+	mpz_disk_clear(disk_op1);
+	mpz_disk_clear(disk_op2);
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_num_threads(0);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+int test_mpz_disk_memory()
+{
+	const int TestCases = 100;
+	const size_t Threshold = 64;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_t in memory...");
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_rop, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_rop;
+
+		mpz_disk_set_num_threads(1 + i % 4);
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_rop);
+
+		// op1 is on disk every other case, compressed every fourth
+		mpz_disk_set_memory_threshold(i & 1 ? 0 : Threshold);
+		mpz_disk_init(disk_op1);
+		mpz_disk_set_memory_threshold(Threshold);
+		mpz_disk_set_compression(i % 4 == 2, 64);
+		mpz_disk_init(disk_op2);
+		mpz_disk_set_compression(0, 0);
+		mpz_disk_init(disk_rop);
+
+		int failed = !_mpz_disk_in_memory(disk_op2) || _mpz_disk_get_file_size(disk_op2->filename) >= 0;
+
+		mpz_urandomb(rand_op1, mp_randstate, (rand() << 11) / RAND_MAX);
+		mpz_urandomb(rand_op2, mp_randstate, (rand() << 11) / RAND_MAX);
+		if (i & 2)
+			mpz_neg(rand_op2, rand_op2);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		// Files (and the sign file) only once the value outgrows the threshold
+		int in_memory = mpz_size(rand_op2) * sizeof(mp_limb_t) <= Threshold;
+
+		char sign_filename[MPZ_DISK_FILENAME_LEN];
+		_mpz_disk_get_sign_filename(sign_filename, disk_op2);
+		FILE* sign_file = fopen(sign_filename, "rb");
+		if (sign_file)
+			fclose(sign_file);
+
+		failed = failed || _mpz_disk_in_memory(disk_op2) != in_memory ||
+			(_mpz_disk_get_file_size(disk_op2->filename) >= 0) == in_memory ||
+			(sign_file != NULL) != (!in_memory && mpz_sgn(rand_op2) < 0);
+
+		mpz_disk_get_mpz(rop, disk_op2);
+		failed = failed || mpz_cmp(rop, rand_op2) != 0;
+
+		mpz_abs(rand_op2, rand_op2);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		mpz_add     (rand_rop, rand_op1, rand_op2);
+		mpz_disk_add(disk_rop, disk_op1, disk_op2);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		if (mpz_cmp(rand_op1, rand_op2) >= 0) {
+			mpz_sub     (rand_rop, rand_op1, rand_op2);
+			mpz_disk_sub(disk_rop, disk_op1, disk_op2);
+		}
+		else {
+			mpz_sub     (rand_rop, rand_op2, rand_op1);
+			mpz_disk_sub(disk_rop, disk_op2, disk_op1);
+		}
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		mpz_xor     (rand_rop, rand_op1, rand_op2);
+		mpz_disk_xor(disk_rop, disk_op1, disk_op2);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		int cmp = mpz_disk_cmpabs(disk_op1, disk_op2), rand_cmp = mpz_cmpabs(rand_op1, rand_op2);
+		failed = failed || (cmp > 0) - (cmp < 0) != (rand_cmp > 0) - (rand_cmp < 0);
+		failed = failed || mpz_disk_hamdist(disk_op1, disk_op2) != mpz_hamdist(rand_op1, rand_op2);
+
+		// Grow an integer in memory step by step until it has to go to disk
+		mpz_disk_set_mpz(disk_rop, rand_op2);
+		mpz_set(rand_rop, rand_op2);
+		while (mpz_size(rand_rop) * sizeof(mp_limb_t) <= 2 * Threshold)
+		{
+			mpz_add     (rand_op1, rand_rop, rand_rop);
+			mpz_disk_add(disk_op1, disk_rop, disk_rop);
+			mpz_add_ui(rand_rop, rand_op1, 1);
+			mpz_set_ui(rand_op2, 1);
+			mpz_disk_set_mpz(disk_op2, rand_op2);
+			mpz_disk_add(disk_rop, disk_op1, disk_op2);
+		}
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0 || _mpz_disk_in_memory(disk_rop);
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result with integers in memory\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_disk_clear(disk_rop);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_num_threads(0);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+typedef struct
+{
+	mpz_disk_ptr op;
+	mpz_srcptr value;
+	volatile int64_t failed;
+} _test_cache_readers_state;
+
+// Each thread reads the whole integer a few times, so that their blocks
+// are put, copied out and replaced in the cache at once
+static void _test_cache_reader_thread(void* arg, int thread_idx)
+{
+	_test_cache_readers_state* state = arg;
+
+	mpz_t rop;
+	mpz_init(rop);
+
+	for (int i = 0; i < 4; i++)
+	{
+		mpz_disk_get_mpz(rop, state->op);
+		if (mpz_cmp(rop, state->value) != 0)
+			_mpz_disk_atomic_add(&state->failed, 1);
+	}
+
+	mpz_clear(rop);
+}
+
+int test_mpz_disk_cache()
+{
+	const int TestCases = 100;
+	// Off, the default, a few blocks, all blocks
+	const size_t CacheSizes[] = { 0, MPZ_DISK_CACHE_AUTO, 3 * MPZ_DISK_CACHE_BLOCK_LIMBS * sizeof(mp_limb_t), 1 << 20 };
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing block cache...");
+
+	mpz_disk_set_memory_threshold(0);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_rop, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_rop;
+
+		size_t cache_size = CacheSizes[i % 4];
+		mpz_disk_set_cache_size(cache_size);
+		mpz_disk_set_num_threads(1 + i % 3);
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_rop);
+
+		mpz_disk_set_compression(i % 8 == 5, 64);
+		mpz_disk_init(disk_op1);
+		mpz_disk_set_compression(0, 0);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_rop);
+
+		mpz_urandomb(rand_op1, mp_randstate, (rand() << 12) / RAND_MAX);
+		mpz_urandomb(rand_op2, mp_randstate, (rand() << 12) / RAND_MAX);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		// Reading op1 again should be served from the cache when it fits
+		int64_t hits, misses, old_hits, old_misses;
+		mpz_disk_get_mpz(rop, disk_op1);
+		mpz_disk_get_cache_stats(&old_hits, &old_misses);
+		mpz_disk_get_mpz(rop, disk_op1);
+		mpz_disk_get_cache_stats(&hits, &misses);
+
+		int failed = mpz_cmp(rop, rand_op1) != 0;
+		if (cache_size == 0)
+			failed = failed || hits != old_hits || misses != old_misses;
+		else if (cache_size == 1 << 20 && mpz_size(rand_op1))
+			failed = failed || hits <= old_hits || misses != old_misses;
+
+		_test_cache_readers_state readers = { disk_op1, rand_op1, 0 };
+		_mpz_disk_run_threads(4, _test_cache_reader_thread, &readers);
+		failed = failed || readers.failed;
+
+		// Results written over cached operands
+		mpz_add     (rand_rop, rand_op1, rand_op2);
+		mpz_disk_add(disk_rop, disk_op1, disk_op2);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		mpz_add     (rand_op1, rand_rop, rand_op2);
+		mpz_disk_add(disk_op1, disk_rop, disk_op2);
+		mpz_disk_get_mpz(rop, disk_op1);
+		failed = failed || mpz_cmp(rop, rand_op1) != 0;
+
+		mpz_sub     (rand_op2, rand_op1, rand_rop);
+		mpz_disk_sub(disk_op2, disk_op1, disk_rop);
+		mpz_disk_get_mpz(rop, disk_op2);
+		failed = failed || mpz_cmp(rop, rand_op2) != 0;
+
+		// In place, blocks are read and written back one at a time
+		mpz_and     (rand_op2, rand_op2, rand_op1);
+		mpz_disk_and(disk_op2, disk_op2, disk_op1);
+		mpz_disk_get_mpz(rop, disk_op2);
+		failed = failed || mpz_cmp(rop, rand_op2) != 0;
+
+		mpz_xor     (rand_rop, rand_op1, rand_rop);
+		mpz_disk_xor(disk_rop, disk_op1, disk_rop);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		// Shrinking and growing again must not bring back stale blocks
+		mpz_disk_set_mpz(disk_rop, rand_op2);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_op2) != 0;
+		mpz_disk_set_mpz(disk_rop, rand_op1);
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_op1) != 0;
+
+		failed = failed || mpz_disk_hamdist(disk_op1, disk_rop) != 0;
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result with block cache\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_disk_clear(disk_rop);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_num_threads(0);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+	mpz_disk_set_cache_size(MPZ_DISK_CACHE_AUTO);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+int test_mpz_disk_get_mpz_parallel()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing parallel mpz_disk_get_mpz()...");
+
+	mpz_disk_set_memory_threshold(0);
+
+	// rop is reused across the cases, so it is read into with whatever it
+	// was left with (too small, large enough, negative, zero)
+	mpz_t rand_op, rop;
+	mpz_init(rand_op);
+	mpz_init(rop);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_disk_t disk_op;
+
+		mpz_disk_set_num_threads(1 + i % 4);
+		mpz_disk_set_compression(i % 8 == 3, 64);
+		mpz_disk_init(disk_op);
+		mpz_disk_set_compression(0, 0);
+
+		mpz_urandomb(rand_op, mp_randstate, i % 10 == 0 ? 0 : (rand() << 14) / RAND_MAX);
+		if (i & 2)
+			mpz_neg(rand_op, rand_op);
+
+		mpz_disk_set_mpz(disk_op, rand_op);
+
+		// The limbs of rop are written in place when they are enough
+		int reused = mpz_size(rand_op) > 0 && mpz_size(rand_op) <= (size_t)rop->_mp_alloc;
+		mp_limb_t* old_limbs = rop->_mp_d;
+
+		int failed = mpz_disk_get_mpz(rop, disk_op) != 0 || mpz_cmp(rop, rand_op) != 0 ||
+			(reused && rop->_mp_d != old_limbs);
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result with parallel reads\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op: %Zx\n", rand_op);
+			// --
+		}
+
+		mpz_disk_clear(disk_op);
+
+		if (failed)
+			break;
+	}
+
+	mpz_clear(rand_op);
+	mpz_clear(rop);
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_num_threads(0);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+int test_mpz_disk_set_mpz_parallel()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing parallel mpz_disk_set_mpz()...");
+
+	mpz_disk_set_memory_threshold(0);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op, rand_high, rop;
+		mpz_disk_t disk_op;
+
+		mpz_init(rop);
+		mpz_init(rand_op);
+		mpz_init(rand_high);
+
+		mpz_disk_set_num_threads(1 + i % 4);
+		mpz_disk_set_sparse(i & 1);
+		mpz_disk_set_compression(i % 8 == 6, 64);
+		mpz_disk_init(disk_op);
+		mpz_disk_set_compression(0, 0);
+
+		// Long runs of zero limbs between the low and the high part
+		mpz_urandomb(rand_op, mp_randstate, (rand() << 12) / RAND_MAX);
+		mpz_urandomb(rand_high, mp_randstate, (rand() << 10) / RAND_MAX);
+		mpz_mul_2exp(rand_high, rand_high, (rand() << 14) / RAND_MAX);
+		mpz_add(rand_op, rand_op, rand_high);
+		if (i & 2)
+			mpz_neg(rand_op, rand_op);
+
+		// Written over a larger value, so the old limbs must not show through
+		mpz_mul_2exp(rand_high, rand_op, 1 << 12);
+		mpz_disk_set_mpz(disk_op, rand_high);
+
+		int failed = mpz_disk_set_mpz(disk_op, rand_op) != 0;
+
+		mpz_disk_get_mpz(rop, disk_op);
+		failed = failed || mpz_cmp(rop, rand_op) != 0 || mpz_disk_size(disk_op) != mpz_size(rand_op);
+
+		if (i % 8 != 6)
+			failed = failed || _mpz_disk_get_file_size(disk_op->filename) != (int64_t)(mpz_size(rand_op) * sizeof(mp_limb_t));
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result with parallel writes\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op: %Zx\n", rand_op);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_op);
+		mpz_clear(rand_high);
+		mpz_disk_clear(disk_op);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_num_threads(0);
+	mpz_disk_set_sparse(0);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+int test_mpz_disk_map_ro()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_map_ro()...");
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op, rand_rop, rop, view1, view2;
+		mpz_disk_t disk_op;
+
+		mpz_init(rop);
+		mpz_init(rand_op);
+		mpz_init(rand_rop);
+
+		// Mapped from a plain file, copied when in memory or compressed
+		mpz_disk_set_memory_threshold(i % 3 == 0 ? MPZ_DISK_DEFAULT_MEMORY_THRESHOLD : 0);
+		mpz_disk_set_compression(i % 3 == 1 && (i & 4), 64);
+		mpz_disk_init(disk_op);
+		mpz_disk_set_compression(0, 0);
+
+		mpz_urandomb(rand_op, mp_randstate, i % 10 == 0 ? 0 : (rand() << 14) / RAND_MAX);
+		if (i & 2)
+			mpz_neg(rand_op, rand_op);
+
+		mpz_disk_set_mpz(disk_op, rand_op);
+
+		int failed = mpz_disk_map_ro(view1, disk_op) != 0 || mpz_cmp(view1, rand_op) != 0;
+
+		// The views are shared, and work as operands of mpz functions
+		failed = failed || mpz_disk_map_ro(view2, disk_op) != 0 || mpz_cmp(view2, view1) != 0;
+
+		mpz_mul(rand_rop, rand_op, rand_op);
+		mpz_mul(rop, view1, view2);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		mpz_disk_unmap(view2, disk_op);
+		failed = failed || mpz_cmp(view1, rand_op) != 0;
+		mpz_disk_unmap(view1, disk_op);
+
+		// Mapped again after op has changed
+		mpz_add_ui(rand_op, rand_op, 1);
+		mpz_mul_2exp(rand_op, rand_op, 100);
+		mpz_disk_set_mpz(disk_op, rand_op);
+
+		failed = failed || mpz_disk_map_ro(view1, disk_op) != 0 || mpz_cmp(view1, rand_op) != 0;
+		mpz_disk_unmap(view1, disk_op);
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect mapped view\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op: %Zx\n", rand_op);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_op);
+		mpz_clear(rand_rop);
+		mpz_disk_clear(disk_op);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+int test_mpz_disk_raw()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_out_raw(), mpz_disk_inp_raw()...");
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op, rop;
+		mpz_disk_t disk_op, disk_rop;
+
+		mpz_init(rop);
+		mpz_init(rand_op);
+
+		mpz_disk_set_memory_threshold(i % 3 == 0 ? MPZ_DISK_DEFAULT_MEMORY_THRESHOLD : 0);
+		mpz_disk_set_compression(i % 3 == 1, 64);
+		mpz_disk_init(disk_op);
+		mpz_disk_init(disk_rop);
+		mpz_disk_set_compression(0, 0);
+
+		// Most are larger than the (simulated) available memory
+		mpz_urandomb(rand_op, mp_randstate, i % 10 == 0 ? 0 : (rand() << 14) / RAND_MAX);
+		if (i & 2)
+			mpz_neg(rand_op, rand_op);
+
+		FILE* gmp_raw = tmpfile();
+		FILE* disk_raw = tmpfile();
+
+		// Written by GMP/MPIR, read back by mpz_disk and the other way round
+		size_t gmp_bytes = mpz_out_raw(gmp_raw, rand_op);
+		rewind(gmp_raw);
+		int failed = mpz_disk_inp_raw(disk_op, gmp_raw) != gmp_bytes;
+
+		mpz_disk_get_mpz(rop, disk_op);
+		failed = failed || mpz_cmp(rop, rand_op) != 0;
+
+		failed = failed || mpz_disk_out_raw(disk_raw, disk_op) != gmp_bytes;
+		rewind(disk_raw);
+		failed = failed || mpz_inp_raw(rop, disk_raw) != gmp_bytes || mpz_cmp(rop, rand_op) != 0;
+
+		// Both files are the same
+		rewind(gmp_raw);
+		rewind(disk_raw);
+		int c1, c2;
+		do {
+			c1 = fgetc(gmp_raw);
+			c2 = fgetc(disk_raw);
+		} while (c1 == c2 && c1 != EOF);
+		failed = failed || c1 != c2;
+
+		// Read over a larger value
+		mpz_mul_2exp(rop, rand_op, 1 << 12);
+		mpz_disk_set_mpz(disk_rop, rop);
+		rewind(disk_raw);
+		failed = failed || mpz_disk_inp_raw(disk_rop, disk_raw) != gmp_bytes;
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_op) != 0;
+
+		fclose(gmp_raw);
+		fclose(disk_raw);
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect raw import/export\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op: %Zx\n", rand_op);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_op);
+		mpz_disk_clear(disk_op);
+		mpz_disk_clear(disk_rop);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+// Block after which operations stop as if they crashed, 0 = never
+static size_t _mpz_disk_crash_block = 0;
+
+int test_mpz_disk_checkpoint()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_set_checkpoint(), mpz_disk_resume()...");
+
+	mpz_disk_set_memory_threshold(0);
+	mpz_disk_set_num_threads(4);
+
+	int i, resumed = 0;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_rop, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_rop;
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_rop);
+
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_set_compression(i % 4 == 3, 64);
+		mpz_disk_init(disk_rop);
+		mpz_disk_set_compression(0, 0);
+
+		// Every block or every few blocks of the simulated memory
+		mpz_disk_set_checkpoint(i & 1 ? 1 : 1000);
+
+		mpz_urandomb(rand_op1, mp_randstate, (rand() << 14) / RAND_MAX);
+		mpz_urandomb(rand_op2, mp_randstate, (rand() << 14) / RAND_MAX);
+		if (mpz_cmp(rand_op1, rand_op2) < 0)
+			mpz_swap(rand_op1, rand_op2);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		int subtract = i & 2;
+		if (subtract)
+			mpz_sub(rand_rop, rand_op1, rand_op2);
+		else
+			mpz_add(rand_rop, rand_op1, rand_op2);
+
+		// Crash somewhere, then carry on from the last checkpoint (if the
+		// crash came after one), or start over
+		_mpz_disk_crash_block = 1 + rand() % 8;
+		int ret = subtract ? mpz_disk_sub(disk_rop, disk_op1, disk_op2) : mpz_disk_add(disk_rop, disk_op1, disk_op2);
+		_mpz_disk_crash_block = 0;
+
+		int failed = 0;
+		if (ret != 0) {
+			ret = mpz_disk_resume(disk_rop, disk_op1, disk_op2);
+			if (ret == MPZ_DISK_ERROR_NO_CHECKPOINT)
+				ret = subtract ? mpz_disk_sub(disk_rop, disk_op1, disk_op2) : mpz_disk_add(disk_rop, disk_op1, disk_op2);
+			else
+				resumed++;
+
+			failed = ret != 0;
+		}
+
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		// The journal goes once the operation is done
+		char journal_filename[MPZ_DISK_FILENAME_LEN];
+		_mpz_disk_get_journal_filename(journal_filename, disk_rop);
+		FILE* journal = fopen(journal_filename, "rb");
+		if (journal)
+			fclose(journal);
+		failed = failed || journal != NULL || mpz_disk_resume(disk_rop, disk_op1, disk_op2) != MPZ_DISK_ERROR_NO_CHECKPOINT;
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result after resuming\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_disk_clear(disk_rop);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_checkpoint(0);
+	mpz_disk_set_num_threads(0);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+	// Some of the crashes have to come after a checkpoint
+	if (i < TestCases || resumed == 0) {
+		if (i == TestCases)
+			printf(" FAILED\n[ERR] Never resumed\n");
+		return -1;
+	}
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+int test_mpz_disk_checksums()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_set_checksums(), mpz_disk_verify()...");
+
+	// Reads have to come from the files to be checked
+	mpz_disk_set_checksums(1);
+	mpz_disk_set_memory_threshold(0);
+	mpz_disk_set_cache_size(0);
+	mpz_disk_set_num_threads(4);
+
+	// The check value of CRC32C
+	int i = _mpz_disk_crc32c(0, "123456789", 9) == 0xe3069283 ? 0 : TestCases;
+	if (i)
+		printf(" FAILED\n[ERR] Incorrect CRC32C\n");
+
+	for (; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_sum, rand_xor, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_sum, disk_xor;
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_sum);
+		mpz_init(rand_xor);
+
+		int compressed = i % 4 == 3;
+		mpz_disk_set_compression(compressed, 64);
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_sum);
+		mpz_disk_init(disk_xor);
+		mpz_disk_set_compression(0, 0);
+
+		// Whole limbs, so that doubling op1 carries out half the time,
+		// which is a write of a single limb
+		mpz_urandomb(rand_op1, mp_randstate, 64 * (1 + rand() % 256));
+		mpz_urandomb(rand_op2, mp_randstate, (rand() << 14) / RAND_MAX);
+		if (mpz_cmp(rand_op1, rand_op2) < 0)
+			mpz_swap(rand_op1, rand_op2);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		// Differences often have leading zeroes that get cut off
+		if (i & 1) {
+			mpz_sub(rand_sum, rand_op1, rand_op2);
+			mpz_disk_sub(disk_sum, disk_op1, disk_op2);
+		}
+		else {
+			mpz_add(rand_sum, rand_op1, i & 2 ? rand_op1 : rand_op2);
+			mpz_disk_add(disk_sum, disk_op1, i & 2 ? disk_op1 : disk_op2);
+		}
+
+		mpz_xor(rand_xor, rand_op1, rand_op2);
+		mpz_disk_xor(disk_xor, disk_op1, disk_op2);
+
+		int64_t errors = mpz_disk_get_checksum_errors();
+
+		mpz_disk_get_mpz(rop, disk_sum);
+		int failed = mpz_cmp(rop, rand_sum) != 0;
+		mpz_disk_get_mpz(rop, disk_xor);
+		failed = failed || mpz_cmp(rop, rand_xor) != 0;
+
+		// Nothing is wrong yet
+		failed = failed || mpz_disk_verify(disk_op1) != 0 || mpz_disk_verify(disk_op2) != 0 ||
+			mpz_disk_verify(disk_sum) != 0 || mpz_disk_verify(disk_xor) != 0 ||
+			mpz_disk_get_checksum_errors() != errors;
+
+		// Damage a byte of the limb file of op1, which the check, reading
+		// op1 and the operations on it have to notice
+		if (!compressed) {
+			FILE* limb_file = fopen(disk_op1->filename, "r+b");
+			long pos = rand() % (long)(mpz_disk_size(disk_op1) * sizeof(mp_limb_t));
+
+			fseek(limb_file, pos, SEEK_SET);
+			int c = fgetc(limb_file);
+			fseek(limb_file, pos, SEEK_SET);
+			fputc(c ^ (1 << rand() % 8), limb_file);
+			fclose(limb_file);
+
+			failed = failed || mpz_disk_verify(disk_op1) != MPZ_DISK_ERROR_CHECKSUM;
+
+			failed = failed || mpz_disk_get_mpz(rop, disk_op1) != MPZ_DISK_ERROR_CHECKSUM;
+			failed = failed || mpz_disk_get_checksum_errors() <= errors;
+
+			failed = failed || mpz_disk_add(disk_sum, disk_op1, disk_op2) != MPZ_DISK_ERROR_CHECKSUM;
+			failed = failed || mpz_disk_xor(disk_xor, disk_op1, disk_op2) != MPZ_DISK_ERROR_CHECKSUM;
+
+			// Compared with itself, every limb of op1 is read
+			int cmp = 1;
+			failed = failed || mpz_disk_cmpabs_ex(disk_op1, disk_op1, &cmp) != MPZ_DISK_ERROR_CHECKSUM || cmp != 0;
+		}
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect checksums\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_clear(rand_sum);
+		mpz_clear(rand_xor);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+		mpz_disk_clear(disk_sum);
+		mpz_disk_clear(disk_xor);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_checksums(0);
+	mpz_disk_set_cache_size(MPZ_DISK_CACHE_AUTO);
+	mpz_disk_set_num_threads(0);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+int test_mpz_disk_stats()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_get_stats(), mpz_disk_dump_stats()...");
+
+	// Reads have to come from the files to be counted
+	mpz_disk_set_memory_threshold(0);
+	mpz_disk_set_cache_size(0);
+	mpz_disk_set_num_threads(4);
+
+	int i = 0;
+	mpz_disk_stats_t stats;
+
+#ifndef MPZ_DISK_STATS
+	// Not kept at all
+	if (mpz_disk_get_stats(&stats, MPZ_DISK_STATS_ALL) != -1 || stats.calls != 0 || mpz_disk_dump_stats(stdout) != -1) {
+		printf(" FAILED\n[ERR] Statistics kept without MPZ_DISK_STATS\n");
+		i = -1;
+	}
+	else
+		i = TestCases;
+#endif
+
+	for (; i >= 0 && i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_sum, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_sum;
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_sum);
+
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_sum);
+
+		mpz_urandomb(rand_op1, mp_randstate, 64 * (1 + rand() % 256));
+		mpz_urandomb(rand_op2, mp_randstate, 64 * (1 + rand() % 256));
+		mpz_add(rand_sum, rand_op1, rand_op2);
+
+		mpz_disk_reset_stats();
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+		mpz_disk_add(disk_sum, disk_op1, disk_op2);
+		mpz_disk_get_mpz(rop, disk_sum);
+
+		size_t op1_bytes = mpz_disk_size(disk_op1) * sizeof(mp_limb_t);
+		size_t op2_bytes = mpz_disk_size(disk_op2) * sizeof(mp_limb_t);
+		size_t sum_bytes = mpz_disk_size(disk_sum) * sizeof(mp_limb_t);
+
+		int failed = mpz_cmp(rop, rand_sum) != 0;
+
+		mpz_disk_get_stats(&stats, MPZ_DISK_STATS_SET_MPZ);
+		failed = failed || stats.calls != 2 || stats.bytes_written < op1_bytes + op2_bytes || stats.bytes_read != 0;
+
+		mpz_disk_get_stats(&stats, MPZ_DISK_STATS_ADD);
+		failed = failed || stats.calls != 1 || stats.bytes_read < op1_bytes + op2_bytes ||
+			stats.bytes_written < sum_bytes || stats.syscalls < 3 ||
+			stats.buffer_bytes == 0 || stats.peak_buffer_bytes == 0 ||
+			stats.io_ns + stats.compute_ns <= 0 || stats.ns <= 0;
+
+		mpz_disk_get_stats(&stats, MPZ_DISK_STATS_GET_MPZ);
+		failed = failed || stats.calls != 1 || stats.bytes_read < sum_bytes || stats.bytes_written != 0;
+
+		mpz_disk_get_stats(&stats, MPZ_DISK_STATS_SUB);
+		failed = failed || stats.calls != 0 || stats.bytes_read != 0 || stats.syscalls != 0;
+
+		// The totals are the sums over the operations
+		mpz_disk_stats_t all, sum = { 0 };
+		mpz_disk_get_stats(&all, MPZ_DISK_STATS_ALL);
+		for (int op = 0; op < MPZ_DISK_STATS_ALL; op++)
+		{
+			mpz_disk_get_stats(&stats, op);
+			sum.calls += stats.calls;
+			sum.bytes_read += stats.bytes_read;
+			sum.bytes_written += stats.bytes_written;
+			sum.syscalls += stats.syscalls;
+			sum.buffer_bytes += stats.buffer_bytes;
+			sum.peak_buffer_bytes = max(sum.peak_buffer_bytes, stats.peak_buffer_bytes);
+		}
+
+		failed = failed || all.calls != 4 || all.bytes_read != sum.bytes_read || all.bytes_written != sum.bytes_written ||
+			all.syscalls != sum.syscalls || all.buffer_bytes != sum.buffer_bytes ||
+			all.peak_buffer_bytes != sum.peak_buffer_bytes;
+
+		// A JSON object with an entry per operation
+		FILE* stream = tmpfile();
+		int dumped = mpz_disk_dump_stats(stream) == 0;
+
+		char json[4096] = { 0 };
+		rewind(stream);
+		fread(json, 1, sizeof(json) - 1, stream);
+		fclose(stream);
+
+		failed = failed || !dumped || json[0] != '{' || !strstr(json, "\"add\": { \"calls\": 1,") ||
+			!strstr(json, "\"set_mpz\": { \"calls\": 2,") || !strstr(json, "\"all\": { \"calls\": 4,");
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect statistics\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			printf("%s", json);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_clear(rand_sum);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+		mpz_disk_clear(disk_sum);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_cache_size(MPZ_DISK_CACHE_AUTO);
+	mpz_disk_set_num_threads(0);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+typedef struct
+{
+	int calls, cancel_at, out_of_order;
+	int64_t bytes_done, bytes_total;
+} _test_progress;
+
+static int _test_progress_func(int64_t bytes_done, int64_t bytes_total, void* arg)
+{
+	_test_progress* progress = arg;
+
+	if (bytes_done < progress->bytes_done || bytes_done > bytes_total ||
+		(progress->calls && bytes_total != progress->bytes_total))
+		progress->out_of_order = 1;
+
+	progress->bytes_done = bytes_done;
+	progress->bytes_total = bytes_total;
+
+	return ++progress->calls == progress->cancel_at;
+}
+
+int test_mpz_disk_progress()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_set_progress()...");
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_sum, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_sum;
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_sum);
+
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_sum);
+
+		mpz_urandomb(rand_op1, mp_randstate, 64 * (1 + rand() % 1024));
+		mpz_urandomb(rand_op2, mp_randstate, 64 * (1 + rand() % 1024));
+		if (i & 1)
+			mpz_set(rand_op2, rand_op1);
+		if (mpz_cmp(rand_op1, rand_op2) < 0)
+			mpz_swap(rand_op1, rand_op2);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		// Serially with checkpoints, or by all threads
+		int checkpoint = i % 4 < 2;
+		mpz_disk_set_num_threads(checkpoint ? 1 : 4);
+		mpz_disk_set_checkpoint(checkpoint ? 1000 : 0);
+
+		_test_progress progress = { 0 };
+		mpz_disk_set_progress(_test_progress_func, &progress, rand() % 2 ? 0 : 2000);
+
+		int64_t bytes_total = (int64_t)mpz_disk_size(disk_op1) * sizeof(mp_limb_t);
+		int failed = 0;
+
+		// Runs to the end, reported along the way
+		if (i & 2) {
+			mpz_sub(rand_sum, rand_op1, rand_op2);
+			failed = mpz_disk_sub(disk_sum, disk_op1, disk_op2) != 0;
+		}
+		else {
+			mpz_add(rand_sum, rand_op1, rand_op2);
+			failed = mpz_disk_add(disk_sum, disk_op1, disk_op2) != 0;
+		}
+
+		mpz_disk_get_mpz(rop, disk_sum);
+		failed = failed || mpz_cmp(rop, rand_sum) != 0 || progress.out_of_order ||
+			progress.calls < 1 || progress.bytes_done != bytes_total || progress.bytes_total != bytes_total;
+
+		// Operands of different sizes are compared without reading them
+		int cmp = mpz_cmpabs(rand_op1, rand_op2);
+		progress.calls = 0;
+		progress.bytes_done = 0;
+		failed = failed || mpz_disk_cmpabs(disk_op1, disk_op2) != (cmp > 0) - (cmp < 0) ||
+			progress.out_of_order || (progress.calls && progress.bytes_done != bytes_total);
+
+		// Cancelled at some report, if there is more than the last one
+		int reports = progress.calls;
+		if (reports > 1) {
+			memset(&progress, 0, sizeof(progress));
+			progress.cancel_at = 1 + rand() % (reports - 1);
+
+			// Not a comparison, so only the status tells
+			int result = 1;
+			failed = failed || mpz_disk_cmpabs_ex(disk_op1, disk_op2, &result) != MPZ_DISK_ERROR_CANCELLED ||
+				result != 0 || progress.calls != progress.cancel_at;
+
+			memset(&progress, 0, sizeof(progress));
+			progress.cancel_at = 1 + rand() % (reports - 1);
+			failed = failed || mpz_disk_cmpabs(disk_op1, disk_op2) != 0;
+		}
+
+		memset(&progress, 0, sizeof(progress));
+		progress.cancel_at = 1;
+
+		int ret = i & 2 ? mpz_disk_sub(disk_sum, disk_op1, disk_op2) : mpz_disk_add(disk_sum, disk_op1, disk_op2);
+
+		// Cancelled unless the first report was the last one. Then rop is
+		// zero, or carried on from its last checkpoint.
+		if (progress.bytes_done < bytes_total) {
+			failed = failed || ret != MPZ_DISK_ERROR_CANCELLED || progress.calls != 1;
+
+			mpz_disk_set_progress(NULL, NULL, 0);
+			ret = mpz_disk_resume(disk_sum, disk_op1, disk_op2);
+
+			mpz_disk_get_mpz(rop, disk_sum);
+			if (ret == 0)
+				failed = failed || !checkpoint || mpz_cmp(rop, rand_sum) != 0;
+			else
+				failed = failed || ret != MPZ_DISK_ERROR_NO_CHECKPOINT || mpz_sgn(rop) != 0;
+		}
+		else {
+			mpz_disk_get_mpz(rop, disk_sum);
+			failed = failed || ret != 0 || mpz_cmp(rop, rand_sum) != 0;
+		}
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect progress\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			// --
+		}
+
+		mpz_disk_set_progress(NULL, NULL, 0);
+
+		mpz_clear(rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_clear(rand_sum);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_op2);
+		mpz_disk_clear(disk_sum);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_checkpoint(0);
+	mpz_disk_set_num_threads(0);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+int test_mpz_disk_backend()
+{
+	const int TestCases = 100;
+	// Never created, the RAM backend takes any filename
+	const char* stripe_dirs[] = { "ram0", "ram1" };
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_set_backend()...");
+
+	mpz_disk_backend_t ram, throttled;
+	mpz_disk_ram_backend_init(&ram);
+	mpz_disk_throttled_backend_init(&throttled, &ram, 1000, 1000000000);
+
+	mpz_disk_set_memory_threshold(0);
+	mpz_disk_set_num_threads(4);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_rop, rop;
+		mpz_disk_t disk_op1, disk_op2, disk_rop;
+
+		mpz_init(rop);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+		mpz_init(rand_rop);
+
+		// Plain, striped or compressed, in RAM or on a slow disk in RAM
+		mpz_disk_set_backend(i & 1 ? &throttled : &ram);
+		if (i % 3 == 1)
+			mpz_disk_set_stripe_dirs(stripe_dirs, 2, (1 + rand() % 16) * sizeof(mp_limb_t));
+		mpz_disk_set_compression(i % 3 == 2, 64);
+		mpz_disk_set_checkpoint(i & 2 ? 1000 : 0);
+
+		mpz_disk_init(disk_op1);
+		mpz_disk_init(disk_op2);
+		mpz_disk_init(disk_rop);
+
+		mpz_urandomb(rand_op1, mp_randstate, (rand() << 14) / RAND_MAX);
+		mpz_urandomb(rand_op2, mp_randstate, (rand() << 14) / RAND_MAX);
+		if (mpz_cmp(rand_op1, rand_op2) < 0)
+			mpz_swap(rand_op1, rand_op2);
+
+		mpz_disk_set_mpz(disk_op1, rand_op1);
+		mpz_disk_set_mpz(disk_op2, rand_op2);
+
+		mpz_add(rand_rop, rand_op1, rand_op2);
+		int failed = mpz_disk_add(disk_rop, disk_op1, disk_op2) != 0;
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		mpz_sub(rand_rop, rand_op1, rand_op2);
+		failed = failed || mpz_disk_sub(disk_rop, disk_op1, disk_op2) != 0;
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		mpz_xor(rand_rop, rand_op1, rand_op2);
+		failed = failed || mpz_disk_xor(disk_rop, disk_op1, disk_op2) != 0;
+		mpz_disk_get_mpz(rop, disk_rop);
+		failed = failed || mpz_cmp(rop, rand_rop) != 0;
+
+		int cmp = mpz_cmpabs(rand_op1, rand_op2);
+		failed = failed || mpz_disk_cmpabs(disk_op1, disk_op2) != (cmp > 0) - (cmp < 0);
+
+		// With a sign file
+		if (i & 4) {
+			mpz_neg(rand_op1, rand_op1);
+			mpz_disk_set_mpz(disk_op1, rand_op1);
+			mpz_disk_get_mpz(rop, disk_op1);
+			failed = failed || mpz_cmp(rop, rand_op1) != 0;
+		}
+
+		// Nothing on disk, everything in the backend until cleared
+		char sign_filename[MPZ_DISK_FILENAME_LEN];
+		_mpz_disk_get_sign_filename(sign_filename, disk_op1);
+
+		void* file = ram.open(ram.ctx, sign_filename, _MPZ_DISK_OPEN_READ);
+		failed = failed || (file != NULL) != (mpz_sgn(rand_op1) < 0) ||
+			_mpz_disk_get_file_size(disk_op1->filename) >= 0 || _mpz_disk_get_file_size(sign_filename) >= 0;
+		if (file)
+			ram.close(ram.ctx, file);
+
+		mpz_disk_set_stripe_dirs(NULL, 0, 0);
+		mpz_disk_set_compression(0, 0);
+		mpz_disk_set_checkpoint(0);
+
+		char filename[MPZ_DISK_FILENAME_LEN];
+		strcpy(filename, disk_op2->filename);
+
+		mpz_disk_clear(disk_op2);
+		file = i % 3 == 1 ? NULL : ram.open(ram.ctx, filename, _MPZ_DISK_OPEN_READ);
+		failed = failed || file != NULL;
+		if (file)
+			ram.close(ram.ctx, file);
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result on backend\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+		mpz_clear(rand_rop);
+		mpz_disk_clear(disk_op1);
+		mpz_disk_clear(disk_rop);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_backend(NULL);
+	mpz_disk_set_num_threads(0);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+	mpz_disk_throttled_backend_clear(&throttled);
+	mpz_disk_ram_backend_clear(&ram);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+// Sum of the leaves [first, first + n), by a task for each node of the tree
+// that waits for the tasks of its children, like a product tree
+typedef struct
+{
+	mpz_disk_ptr leaves;
+	int first, n;
+	mpz_disk_t sum;
+} _test_pool_node;
+
+static int _test_pool_sum(void* arg)
+{
+	_test_pool_node* node = arg;
+
+	if (node->n == 1) {
+		mpz_disk_t zero;
+		mpz_disk_init(zero);
+		int ret = mpz_disk_add(node->sum, node->leaves + node->first, zero);
+		mpz_disk_clear(zero);
+
+		return ret;
+	}
+
+	_test_pool_node left = { node->leaves, node->first, node->n / 2 };
+	_test_pool_node right = { node->leaves, node->first + node->n / 2, node->n - node->n / 2 };
+	mpz_disk_init(left.sum);
+	mpz_disk_init(right.sum);
+
+	mpz_disk_task left_task = mpz_disk_submit(_test_pool_sum, &left);
+	mpz_disk_task right_task = mpz_disk_submit(_test_pool_sum, &right);
+	int ret = !left_task || !right_task;
+	if (left_task)
+		ret = mpz_disk_wait(left_task) || ret;
+	if (right_task)
+		ret = mpz_disk_wait(right_task) || ret;
+
+	ret = ret || mpz_disk_add(node->sum, left.sum, right.sum);
+
+	mpz_disk_clear(left.sum);
+	mpz_disk_clear(right.sum);
+
+	return ret;
+}
+
+static int _test_pool_count(void* arg)
+{
+	_mpz_disk_atomic_add(arg, 1);
+
+	return 1;
+}
+
+int test_mpz_disk_pool()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_pool_start(), mpz_disk_submit(), mpz_disk_wait()...");
+
+	mpz_disk_set_num_threads(4);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_sum, rand_leaf, rop;
+		mpz_disk_t leaves[16];
+
+		mpz_init(rop);
+		mpz_init(rand_sum);
+		mpz_init(rand_leaf);
+
+		// 1 to 4 workers, or none
+		int failed = i % 5 != 0 && mpz_disk_pool_start(1 + i % 4) != 0;
+
+		int n = 1 + rand() % 16;
+		for (int j = 0; j < n; j++)
+		{
+			mpz_urandomb(rand_leaf, mp_randstate, (rand() << 14) / RAND_MAX);
+			mpz_add(rand_sum, rand_sum, rand_leaf);
+
+			mpz_disk_init(leaves[j]);
+			mpz_disk_set_mpz(leaves[j], rand_leaf);
+		}
+
+		_test_pool_node root = { leaves[0], 0, n };
+		mpz_disk_init(root.sum);
+
+		mpz_disk_task task = mpz_disk_submit(_test_pool_sum, &root);
+
+		// More tasks than the queue holds at once, some of them run by
+		// this thread
+		volatile int64_t count = 0;
+		int n_tasks = 100 + rand() % 2000, results = 0;
+		mpz_disk_task* tasks = malloc(n_tasks * sizeof(mpz_disk_task));
+		for (int j = 0; j < n_tasks; j++)
+			tasks[j] = mpz_disk_submit(_test_pool_count, (void*)&count);
+		for (int j = 0; j < n_tasks; j++)
+			results += tasks[j] ? mpz_disk_wait(tasks[j]) : 0;
+		free(tasks);
+
+		failed = failed || !task || mpz_disk_wait(task) != 0 || results != n_tasks || count != n_tasks;
+
+		mpz_disk_pool_stop();
+
+		mpz_disk_get_mpz(rop, root.sum);
+		failed = failed || mpz_cmp(rop, rand_sum) != 0;
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result of the tasks\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("sum: %Zx\n", rand_sum);
+			gmp_printf("rop: %Zx\n", rop);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_sum);
+		mpz_clear(rand_leaf);
+		mpz_disk_clear(root.sum);
+		for (int j = 0; j < n; j++)
+			mpz_disk_clear(leaves[j]);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_num_threads(0);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+typedef struct
+{
+	volatile int64_t started, ready, waiting;
+	mpz_disk_task volatile dep;
+} _test_pool_late_state;
+
+static int _test_pool_late_result(void* arg)
+{
+	return 3;
+}
+
+// Runs on the only worker, and waits for a task whose dependency is queued
+// once the worker has nothing left to run
+static int _test_pool_late_waiter(void* arg)
+{
+	_test_pool_late_state* state = arg;
+
+	_mpz_disk_atomic_add(&state->started, 1);
+	while (!_mpz_disk_atomic_add(&state->ready, 0))
+		;
+
+	_mpz_disk_atomic_add(&state->waiting, 1);
+
+	return mpz_disk_wait(state->dep) == 3 ? 0 : -1;
+}
+
+// Run by the submitting thread when the queue is full, it lets the worker
+// run out of tasks before it finishes and queues the dependent task
+static int _test_pool_late_gate(void* arg)
+{
+	_test_pool_late_state* state = arg;
+
+	_mpz_disk_atomic_add(&state->ready, 1);
+	while (!_mpz_disk_atomic_add(&state->waiting, 0))
+		;
+
+	clock_t start = clock();
+	while (clock() - start < CLOCKS_PER_SEC / 200)
+		;
+
+	return 0;
+}
+
+int test_mpz_disk_pool_late()
+{
+	const int TestCases = 100;
+
+	printf("Testing mpz_disk_wait() on a worker for a task queued later...");
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		volatile int64_t count = 0;
+		_test_pool_late_state state = { 0, 0, 0, NULL };
+
+		int failed = mpz_disk_pool_start(1) != 0;
+
+		mpz_disk_task waiter = mpz_disk_submit(_test_pool_late_waiter, &state);
+		while (waiter && !_mpz_disk_atomic_add(&state.started, 0))
+			;
+
+		// The gate is queued first, so it is the one this thread takes off
+		// the queue when the fillers overflow it
+		mpz_disk_task gate = mpz_disk_submit(_test_pool_late_gate, &state);
+		state.dep = mpz_disk_submit_after(_test_pool_late_result, NULL, 1, &gate);
+		mpz_disk_detach(gate);
+
+		// Enough to fill the queue once, but not again after the gate
+		int n_tasks = 1024 + rand() % 512, results = 0;
+		mpz_disk_task* tasks = malloc(n_tasks * sizeof(mpz_disk_task));
+		for (int j = 0; j < n_tasks; j++)
+			tasks[j] = mpz_disk_submit(_test_pool_count, (void*)&count);
+		for (int j = 0; j < n_tasks; j++)
+			results += tasks[j] ? mpz_disk_wait(tasks[j]) : 0;
+		free(tasks);
+
+		failed = failed || !waiter || mpz_disk_wait(waiter) != 0 || results != n_tasks || count != n_tasks;
+
+		mpz_disk_pool_stop();
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result of the tasks\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			printf("tasks: %d\n", n_tasks);
+			printf("count: %d\n", (int)count);
+			// --
+			break;
+		}
+	}
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+static int _test_async_fail(void* arg)
+{
+	return -7;
+}
+
+static void _test_async_done(int result, void* arg)
+{
+	if (result == 0)
+		_mpz_disk_atomic_add(arg, 1);
+}
+
+int test_mpz_disk_async()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_add_async(), mpz_disk_sub_async(), mpz_disk_on_complete()...");
+
+	mpz_disk_set_num_threads(4);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_sum, rand_diff, rand_leaf, rop, rop_diff;
+		mpz_disk_t leaves[16], sums[16], diff;
+
+		mpz_init(rop);
+		mpz_init(rop_diff);
+		mpz_init(rand_sum);
+		mpz_init(rand_diff);
+		mpz_init(rand_leaf);
+
+		// 1 to 4 workers, or as many as the operations start
+		if (i % 5 != 0)
+			mpz_disk_pool_start(1 + i % 4);
+
+		int n = 2 + rand() % 15;
+		mpz_disk_ptr level[16];
+		mpz_disk_task tasks[16];
+		for (int j = 0; j < n; j++)
+		{
+			mpz_urandomb(rand_leaf, mp_randstate, (rand() << 14) / RAND_MAX);
+			mpz_add(rand_sum, rand_sum, rand_leaf);
+
+			mpz_disk_init(leaves[j]);
+			mpz_disk_set_mpz(leaves[j], rand_leaf);
+			mpz_disk_init(sums[j]);
+
+			level[j] = leaves[j];
+			tasks[j] = NULL;
+		}
+		mpz_disk_get_mpz(rand_leaf, leaves[0]);
+		mpz_sub(rand_diff, rand_sum, rand_leaf);
+
+		// Sum the leaves pairwise, each sum starting once the two below it
+		// are ready
+		volatile int64_t done = 0;
+		int failed = 0, n_sums = 0;
+		for (int m = n; m > 1; m = (m + 1) / 2)
+		{
+			for (int j = 0; j < m / 2; j++)
+			{
+				mpz_disk_ptr sum = sums[n_sums++];
+				mpz_disk_task deps[2] = { tasks[2 * j], tasks[2 * j + 1] };
+				mpz_disk_task task = mpz_disk_add_async(sum, level[2 * j], level[2 * j + 1], 2, deps);
+
+				failed = failed || !task || mpz_disk_on_complete(task, _test_async_done, (void*)&done) != 0;
+				for (int k = 0; k < 2; k++)
+					if (deps[k])
+						mpz_disk_detach(deps[k]);
+
+				level[j] = sum;
+				tasks[j] = task;
+			}
+
+			if (m % 2) {
+				level[m / 2] = level[m - 1];
+				tasks[m / 2] = tasks[m - 1];
+			}
+		}
+
+		mpz_disk_init(diff);
+		mpz_disk_task diff_task = mpz_disk_sub_async(diff, level[0], leaves[0], 1, tasks);
+
+		// A task after a failed one fails the same way without running
+		volatile int64_t count = 0;
+		mpz_disk_task fail_task = mpz_disk_submit(_test_async_fail, NULL);
+		mpz_disk_task skip_task = mpz_disk_submit_after(_test_pool_count, (void*)&count, 1, &fail_task);
+
+		failed = failed || !diff_task || !fail_task || !skip_task;
+		if (!failed) {
+			while (!mpz_disk_poll(diff_task))
+				;
+
+			failed = mpz_disk_wait(tasks[0]) != 0 || mpz_disk_wait(diff_task) != 0;
+			failed = mpz_disk_wait(skip_task) != -7 || mpz_disk_wait(fail_task) != -7 || failed;
+		}
+
+		// The callbacks have all run once the workers are stopped
+		mpz_disk_pool_stop();
+		failed = failed || count != 0 || done != n_sums;
+
+		mpz_disk_get_mpz(rop, level[0]);
+		mpz_disk_get_mpz(rop_diff, diff);
+		failed = failed || mpz_cmp(rop, rand_sum) != 0 || mpz_cmp(rop_diff, rand_diff) != 0;
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result of the asynchronous operations\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("sum: %Zx\n", rand_sum);
+			gmp_printf("rop: %Zx\n", rop);
+			gmp_printf("diff: %Zx\n", rand_diff);
+			gmp_printf("rop_diff: %Zx\n", rop_diff);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rop_diff);
+		mpz_clear(rand_sum);
+		mpz_clear(rand_diff);
+		mpz_clear(rand_leaf);
+		mpz_disk_clear(diff);
+		for (int j = 0; j < n; j++) {
+			mpz_disk_clear(leaves[j]);
+			mpz_disk_clear(sums[j]);
+		}
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_num_threads(0);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+int test_mpz_disk_addsub_n()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_addsub_n()...");
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_sum, rand_op, rop;
+		mpz_disk_t ops[8], disk_rop;
+		mpz_disk_ptr op_ptrs[8];
+		int subtract[8];
+
+		mpz_init(rop);
+		mpz_init(rand_sum);
+		mpz_init(rand_op);
+
+		// The first term is the largest more often than not, but some of
+		// the sums come out negative
+		int n = 1 + rand() % 8;
+		for (int j = 0; j < n; j++)
+		{
+			mpz_urandomb(rand_op, mp_randstate, (rand() << 14) / RAND_MAX / (j ? 2 : 1));
+			subtract[j] = j && rand() % 2;
+
+			if (subtract[j])
+				mpz_sub(rand_sum, rand_sum, rand_op);
+			else
+				mpz_add(rand_sum, rand_sum, rand_op);
+
+			mpz_disk_init(ops[j]);
+			mpz_disk_set_mpz(ops[j], rand_op);
+			op_ptrs[j] = ops[j];
+		}
+
+		mpz_disk_init(disk_rop);
+		int ret = mpz_disk_addsub_n(disk_rop, op_ptrs, subtract, n);
+
+		mpz_disk_get_mpz(rop, disk_rop);
+
+		int failed;
+		if (mpz_sgn(rand_sum) < 0)
+			failed = ret != MPZ_DISK_ERROR_NEGATIVE || mpz_sgn(rop) != 0;
+		else
+			failed = ret != 0 || mpz_cmp(rop, rand_sum) != 0;
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result of mpz_disk_addsub_n(), returned %d\n", ret);
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("sum: %Zx\n", rand_sum);
+			gmp_printf("rop: %Zx\n", rop);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_sum);
+		mpz_clear(rand_op);
+		mpz_disk_clear(disk_rop);
+		for (int j = 0; j < n; j++)
+			mpz_disk_clear(ops[j]);
+
+		if (failed)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+typedef struct
+{
+	mpz_disk_backend_t* pack;
+	mpz_disk_ptr op1, op2;
+	mpz_srcptr sum;
+	volatile int64_t done;
+	int failed;
+	int compact_ret;
+} _test_pack_compact_state;
+
+// Thread 0 writes sums that grow their extents and clears them again,
+// thread 1 compacts the container until they are done. Each sum has
+// the space of a cleared integer below it, which compacting moves it into.
+static void _test_pack_compact_thread(void* arg, int thread_idx)
+{
+	_test_pack_compact_state* state = arg;
+
+	if (thread_idx == 0) {
+		mpz_t rop;
+		mpz_init(rop);
+
+		for (int i = 0; i < 16 && !state->failed; i++)
+		{
+			mpz_disk_t disk_rop, gap;
+			mpz_disk_init(gap);
+			mpz_disk_set_mpz(gap, state->sum);
+			mpz_disk_init(disk_rop);
+			mpz_disk_clear(gap);
+
+			state->failed = mpz_disk_add(disk_rop, state->op1, state->op2) != 0;
+			mpz_disk_get_mpz(rop, disk_rop);
+			state->failed = state->failed || mpz_cmp(rop, state->sum) != 0;
+
+			mpz_disk_clear(disk_rop);
+		}
+
+		mpz_clear(rop);
+		_mpz_disk_atomic_add(&state->done, 1);
+		return;
+	}
+
+	do
+		state->compact_ret = state->compact_ret || mpz_disk_pack_compact(state->pack) != 0;
+	while (!_mpz_disk_atomic_add(&state->done, 0));
+}
+
+int test_mpz_disk_pack()
+{
+	const int TestCases = 100;
+	const int Slots = 8;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_pack_backend_init(), mpz_disk_pack_compact()...");
+
+	mpz_disk_backend_t pack;
+	int failed = mpz_disk_pack_backend_init(&pack, NULL, "pack.tmp") != 0;
+	if (failed) {
+		printf(" FAILED\n");
+		printf("[ERR] Couldn't create the container\n");
+		return -1;
+	}
+
+	mpz_disk_set_backend(&pack);
+	mpz_disk_set_memory_threshold(0);
+	mpz_disk_set_sparse(1);
+	mpz_disk_set_num_threads(4);
+
+	// Integers that live on over several cases, so that the extents of
+	// the ones cleared are reused in between
+	mpz_t rand_slots[8], rand_rop, rop;
+	mpz_disk_t slots[8], disk_rop;
+	int live[8] = { 0 };
+
+	mpz_init(rop);
+	mpz_init(rand_rop);
+	for (int j = 0; j < Slots; j++)
+		mpz_init(rand_slots[j]);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_disk_set_compression(i % 3 == 2, 64);
+
+		int j = rand() % Slots;
+		if (live[j]) {
+			mpz_disk_get_mpz(rop, slots[j]);
+			failed = mpz_cmp(rop, rand_slots[j]) != 0;
+			mpz_disk_clear(slots[j]);
+		}
+
+		// Some with zero limbs in the middle, which are left as holes that
+		// must read as zero in extents reused from other integers
+		mpz_urandomb(rand_slots[j], mp_randstate, (rand() << 14) / RAND_MAX);
+		if (i & 1) {
+			mpz_urandomb(rand_rop, mp_randstate, 64);
+			mpz_mul_2exp(rand_slots[j], rand_slots[j], (rand() << 14) / RAND_MAX);
+			mpz_add(rand_slots[j], rand_slots[j], rand_rop);
+		}
+
+		mpz_disk_init(slots[j]);
+		mpz_disk_set_mpz(slots[j], rand_slots[j]);
+		live[j] = 1;
+
+		// A sum that grows its file (and moves its extent) as it is written
+		int k = rand() % Slots, l = rand() % Slots;
+		if (!failed && live[k] && live[l]) {
+			mpz_add(rand_rop, rand_slots[k], rand_slots[l]);
+
+			// Others while the container is compacted under them
+			if (i % 2) {
+				_test_pack_compact_state state = { &pack, slots[k], slots[l], rand_rop, 0, 0, 0 };
+				_mpz_disk_run_threads(2, _test_pack_compact_thread, &state);
+				failed = state.failed || state.compact_ret;
+			}
+
+			mpz_disk_init(disk_rop);
+			failed = failed || mpz_disk_add(disk_rop, slots[k], slots[l]) != 0;
+			mpz_disk_get_mpz(rop, disk_rop);
+			failed = failed || mpz_cmp(rop, rand_rop) != 0;
+			mpz_disk_clear(disk_rop);
+		}
+
+		// Nothing but the container on disk
+		failed = failed || _mpz_disk_get_file_size(slots[j]->filename) >= 0 || _mpz_disk_get_file_size("pack.tmp") < 0;
+
+		// Compacting leaves no free space, and moves no values
+		if (!failed && i % 10 == 9) {
+			int64_t bytes, free_bytes;
+			failed = mpz_disk_pack_compact(&pack) != 0;
+			mpz_disk_pack_usage(&pack, &bytes, &free_bytes);
+			failed = failed || free_bytes != 0 || _mpz_disk_get_file_size("pack.tmp") != bytes;
+
+			for (k = 0; k < Slots && !failed; k++)
+			{
+				if (!live[k])
+					continue;
+
+				mpz_disk_get_mpz(rop, slots[k]);
+				failed = mpz_cmp(rop, rand_slots[k]) != 0;
+			}
+		}
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] Incorrect result in pack\n");
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("rop: %Zx\n", rop);
+			// --
+
+			break;
+		}
+	}
+
+	for (int j = 0; j < Slots; j++)
+	{
+		if (live[j])
+			mpz_disk_clear(slots[j]);
+		mpz_clear(rand_slots[j]);
+	}
+	mpz_clear(rop);
+	mpz_clear(rand_rop);
+
+	// With all of them cleared, the container shrinks to nothing
+	int64_t bytes, free_bytes;
+	if (!failed) {
+		failed = mpz_disk_pack_compact(&pack) != 0;
+		mpz_disk_pack_usage(&pack, &bytes, &free_bytes);
+		failed = failed || bytes != 0 || free_bytes != 0;
+
+		if (failed) {
+			printf(" FAILED\n");
+			printf("[ERR] %lld bytes left in pack after all integers were cleared\n", (long long)bytes);
+		}
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_backend(NULL);
+	mpz_disk_set_compression(0, 0);
+	mpz_disk_set_sparse(0);
+	mpz_disk_set_num_threads(0);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+	mpz_disk_pack_backend_clear(&pack);
+
+	failed = failed || _mpz_disk_get_file_size("pack.tmp") >= 0;
+
+	if (failed)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+
+// In testsxx.cpp, as it is C++
+int test_mpz_disk_class();
+
+int main()
+{
+	int passed = 1;
+	//passed = passed && !test_mpz_disk_get_file_size();
+	//passed = passed && !test_mpz_disk_truncate_file();
+	//passed = passed && !test_mpz_disk_truncate_leading_zereos();
+	//passed = passed && !test_mpz_disk_get_mpz();
+	//passed = passed && !test_mpz_disk_add();
+	//passed = passed && !test_mpz_disk_sub();
+	passed = passed && !test_mpz_disk_addsub_parallel();
+	passed = passed && !test_mpz_disk_cmpabs();
+	passed = passed && !test_mpz_disk_logic();
+	passed = passed && !test_mpz_disk_com();
+	passed = passed && !test_mpz_disk_popcount();
+	passed = passed && !test_mpz_disk_scan();
+	passed = passed && !test_mpz_disk_stripe();
+	passed = passed && !test_mpz_disk_compress();
+	passed = passed && !test_mpz_disk_summary();
+	passed = passed && !test_mpz_disk_buffer_pool();
+	passed = passed && !test_mpz_disk_handle();
+	passed = passed && !test_mpz_disk_memory();
+	passed = passed && !test_mpz_disk_cache();
+	passed = passed && !test_mpz_disk_get_mpz_parallel();
+	passed = passed && !test_mpz_disk_set_mpz_parallel();
+	passed = passed && !test_mpz_disk_map_ro();
+	passed = passed && !test_mpz_disk_raw();
+	passed = passed && !test_mpz_disk_checkpoint();
+	passed = passed && !test_mpz_disk_checksums();
+	passed = passed && !test_mpz_disk_stats();
+	passed = passed && !test_mpz_disk_progress();
+	passed = passed && !test_mpz_disk_backend();
+	passed = passed && !test_mpz_disk_pool();
+	passed = passed && !test_mpz_disk_pool_late();
+	passed = passed && !test_mpz_disk_async();
+	passed = passed && !test_mpz_disk_addsub_n();
+	passed = passed && !test_mpz_disk_pack();
+	passed = passed && !test_mpz_disk_class();
+
+	if (!passed)
+		return -1;
+	return 0;
+}
+int _mpz_disk_simulate_crash(size_t blocks_done)
+{
+	return _mpz_disk_crash_block && blocks_done >= _mpz_disk_crash_block;
+}
+
 size_t _mpz_disk_simulate_available_mem()
 {
 	return 1000;
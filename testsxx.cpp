@@ -0,0 +1,149 @@
+#ifdef MPZ_DISK_TESTING
+#include "mpz_diskxx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" int test_mpz_disk_class()
+{
+	const int TestCases = 100;
+
+	gmp_randstate_t mp_randstate;
+	gmp_randinit_default(mp_randstate);
+
+	printf("Testing mpz_disk_class...");
+
+	// So every integer has a file to be removed
+	mpz_disk_set_memory_threshold(0);
+
+	int i;
+	for (i = 0; i < TestCases; ++i)
+	{
+		mpz_t rand_op1, rand_op2, rand_sum, rop;
+
+		mpz_init(rop);
+		mpz_init(rand_sum);
+		mpz_init(rand_op1);
+		mpz_init(rand_op2);
+
+		// op1 > op2, so op2 - op1 is negative
+		mpz_urandomb(rand_op2, mp_randstate, (rand() << 14) / RAND_MAX);
+		mpz_urandomb(rand_op1, mp_randstate, (rand() << 14) / RAND_MAX);
+		mpz_add(rand_op1, rand_op1, rand_op2);
+		mpz_add_ui(rand_op1, rand_op1, 1);
+		mpz_add(rand_sum, rand_op1, rand_op2);
+
+		const char* err = NULL;
+		char filename[MPZ_DISK_FILENAME_LEN];
+
+		try {
+			{
+				mpz_disk_class op(rand_op1);
+				strcpy(filename, op.get_mpz_disk_t()->filename);
+
+				if (_mpz_disk_get_file_size(filename) < 0)
+					err = "No file was written";
+			}
+
+			if (!err && _mpz_disk_get_file_size(filename) >= 0)
+				err = "The file wasn't removed with the integer";
+
+			mpz_disk_class op1(rand_op1), op2(rand_op2);
+
+			// The moved-to integers hold the value, the moved-from ones are
+			// assigned to again
+			mpz_disk_class moved(std::move(op1));
+			moved.get_mpz(rop);
+			if (!err && mpz_cmp(rop, rand_op1) != 0)
+				err = "Incorrect value after the move constructor";
+
+			op1 = std::move(moved);
+			op1.get_mpz(rop);
+			if (!err && mpz_cmp(rop, rand_op1) != 0)
+				err = "Incorrect value after the move assignment";
+
+			moved = op1 + op2;
+			moved.get_mpz(rop);
+			if (!err && mpz_cmp(rop, rand_sum) != 0)
+				err = "Incorrect result of a moved-from integer assigned a sum";
+
+			// rop is one of the terms
+			op1 = op1 + op2;
+			op1.get_mpz(rop);
+			if (!err && mpz_cmp(rop, rand_sum) != 0)
+				err = "Incorrect result of op1 = op1 + op2";
+
+			op1 -= op2;
+			op1.get_mpz(rop);
+			if (!err && mpz_cmp(rop, rand_op1) != 0)
+				err = "Incorrect result of op1 -= op2";
+
+			op1 += op2;
+			op1.get_mpz(rop);
+			if (!err && mpz_cmp(rop, rand_sum) != 0)
+				err = "Incorrect result of op1 += op2";
+
+			// Copies keep the sign, both into a new integer and over an old one
+			mpz_neg(rand_op1, rand_op1);
+			mpz_disk_class neg(rand_op1);
+
+			mpz_disk_class copy(neg);
+			copy.get_mpz(rop);
+			if (!err && mpz_cmp(rop, rand_op1) != 0)
+				err = "Incorrect value after the copy constructor";
+
+			copy = op2;
+			copy = neg;
+			copy.get_mpz(rop);
+			if (!err && mpz_cmp(rop, rand_op1) != 0)
+				err = "Incorrect value after the copy assignment";
+
+			mpz_neg(rand_op1, rand_op1);
+
+			try {
+				mpz_disk_class negative(op2 - op1);
+				if (!err)
+					err = "No mpz_disk_error for a negative result";
+			}
+			catch (const mpz_disk_error& e) {
+				if (!err && e.code() != MPZ_DISK_ERROR_NEGATIVE)
+					err = "Wrong error code for a negative result";
+			}
+		}
+		catch (const mpz_disk_error&) {
+			if (!err)
+				err = "Unexpected mpz_disk_error";
+		}
+
+		if (err) {
+			printf(" FAILED\n");
+			printf("[ERR] %s\n", err);
+
+			// --
+			printf("CASE #%d\n", i);
+			gmp_printf("op1: %Zx\n", rand_op1);
+			gmp_printf("op2: %Zx\n", rand_op2);
+			gmp_printf("rop: %Zx\n", rop);
+			// --
+		}
+
+		mpz_clear(rop);
+		mpz_clear(rand_sum);
+		mpz_clear(rand_op1);
+		mpz_clear(rand_op2);
+
+		if (err)
+			break;
+	}
+
+	gmp_randclear(mp_randstate);
+	mpz_disk_set_memory_threshold(MPZ_DISK_DEFAULT_MEMORY_THRESHOLD);
+
+	if (i < TestCases)
+		return -1;
+
+	printf(" OK [%d cases tested]\n", TestCases);
+
+	return 0;
+}
+#endif